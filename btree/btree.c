@@ -36,13 +36,56 @@ btreeOpen(GDatabase *db, offset_t offset)
 	return (BTree *)block->detail;
 }
 
+BTree *
+btreeOpenSnapshot(GdbSnapshot *snapshot, offset_t offset)
+{
+	GdbTreeImage image;
+	BTree *live, *tree;
+
+	if (snapshot == NULL)
+		return NULL;
+
+	live = btreeOpen(snapshot->db, offset);
+
+	if (live == NULL)
+		return NULL;
+
+	/*
+	 * The view shares the tree's header block, and with it, the nodes
+	 * read through it. Only the header fields are its own.
+	 */
+	gdbGetTreeImage(snapshot, live, &image);
+
+	MEM_CHECK(tree = (BTree *)malloc(sizeof(BTree)));
+	memset(tree, 0, sizeof(BTree));
+
+	tree->block    = live->block;
+	tree->order    = live->order;
+	tree->minLeaf  = live->minLeaf;
+	tree->minInt   = live->minInt;
+	tree->root     = image.root;
+	tree->leftLeaf = image.leftLeaf;
+	tree->size     = image.size;
+	tree->snapshot = snapshot;
+
+	return tree;
+}
+
 void
 btreeClose(BTree *tree)
 {
+	GdbSnapshot *snapshot;
+
 	if (tree == NULL)
 		return;
 
+	/* The tree itself goes with the block, but a snapshot's view doesn't. */
+	snapshot = tree->snapshot;
+
 	gdbDestroyBlock(tree->block);
+
+	if (snapshot != NULL)
+		free(tree);
 }
 
 BTree *
@@ -78,7 +121,5 @@ btreeGetSize(BTree *tree)
 	if (tree == NULL)
 		return 0;
 
-	tree->size = btreeGetTreeSize(tree);
-
-	return tree->size;
+	return btreeGetTreeSize(tree);
 }
@@ -0,0 +1,739 @@
+/**
+ * @file btree_bench.c B+Tree and database benchmark program.
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#include "db_internal.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_PADDING 200
+
+/*
+ * Hashtable keys of the packages in the data file. These only need to be
+ * distinct from one another.
+ */
+#define BENCH_TAG_NAME   1
+#define BENCH_TAG_FILES  2
+
+typedef struct
+{
+	unsigned long packageCount;  /* Number of packages.              */
+	unsigned long fileCount;     /* Files per package.               */
+	unsigned long depCount;      /* Dependencies per package.        */
+	unsigned long padding;       /* Extra characters in file names.  */
+	unsigned short pageSize;     /* Page size of the files.          */
+	unsigned long cacheSize;     /* Cache budget, or 0 for default.  */
+	unsigned int seed;           /* Random seed.                     */
+	const char *prefix;          /* Prefix of the benchmark files.   */
+
+} BenchOptions;
+
+typedef struct
+{
+	const char *name;            /* Name of the phase.               */
+	double *latencies;           /* Latency of each operation.       */
+	unsigned long count;         /* Number of operations timed.      */
+	unsigned long size;          /* Room in latencies.               */
+	double total;                /* Total time, in seconds.          */
+
+} BenchPhase;
+
+static BenchOptions options;
+static char padding[BENCH_MAX_PADDING + 1];
+
+static double
+__now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+__usage(const char *program)
+{
+	printf("Usage: %s [options]\n"
+		   "  -n count   Number of packages (default 1000)\n"
+		   "  -f count   Files per package (default 10)\n"
+		   "  -d count   Dependencies per package (default 4)\n"
+		   "  -k length  Extra characters in each file name (default 0)\n"
+		   "  -p size    Page size: 4096, 16384, or 0 for the 0.2 format "
+		   "(default 4096)\n"
+		   "  -c bytes   Block cache budget (default: library default)\n"
+		   "  -s seed    Random seed (default 1)\n"
+		   "  -o prefix  Prefix of the database files (default bench)\n",
+		   program);
+
+	exit(1);
+}
+
+static void
+__parseOptions(int argc, char **argv)
+{
+	int c;
+
+	options.packageCount = 1000;
+	options.fileCount    = 10;
+	options.depCount     = 4;
+	options.padding      = 0;
+	options.pageSize     = DB_PAGE_SIZE_SMALL;
+	options.cacheSize    = 0;
+	options.seed         = 1;
+	options.prefix       = "bench";
+
+	while ((c = getopt(argc, argv, "n:f:d:k:p:c:s:o:")) != -1)
+	{
+		switch (c)
+		{
+			case 'n': options.packageCount = strtoul(optarg, NULL, 10); break;
+			case 'f': options.fileCount    = strtoul(optarg, NULL, 10); break;
+			case 'd': options.depCount     = strtoul(optarg, NULL, 10); break;
+			case 'k': options.padding      = strtoul(optarg, NULL, 10); break;
+			case 'p': options.pageSize     = atoi(optarg);              break;
+			case 'c': options.cacheSize    = strtoul(optarg, NULL, 10); break;
+			case 's': options.seed         = atoi(optarg);              break;
+			case 'o': options.prefix       = optarg;                    break;
+			default:  __usage(argv[0]);
+		}
+	}
+
+	if (options.packageCount == 0 || options.padding > BENCH_MAX_PADDING ||
+		(options.pageSize != 0 && options.pageSize != DB_PAGE_SIZE_SMALL &&
+		 options.pageSize != DB_PAGE_SIZE_LARGE))
+	{
+		__usage(argv[0]);
+	}
+
+	memset(padding, 'x', options.padding);
+	padding[options.padding] = '\0';
+
+	srand(options.seed);
+}
+
+/*
+ * Names of things in the corpus. Every package has the same number of
+ * files, and depends on randomly picked libraries of other packages.
+ */
+static void
+__packageName(char *buffer, size_t size, unsigned long package)
+{
+	snprintf(buffer, size, "pkg%06lu", package);
+}
+
+static void
+__fileName(char *buffer, size_t size, unsigned long package,
+		   unsigned long file)
+{
+	snprintf(buffer, size, "/usr/share/pkg%06lu/%sfile%04lu",
+			 package, padding, file);
+}
+
+static void
+__libraryName(char *buffer, size_t size, unsigned long package)
+{
+	snprintf(buffer, size, "libpkg%06lu.so", package);
+}
+
+static void
+__dbFilename(char *filename, size_t size, const char *suffix)
+{
+	snprintf(filename, size, "%s%s", options.prefix, suffix);
+}
+
+static unsigned long
+__random(unsigned long max)
+{
+	return (unsigned long)(((double)rand() / ((double)RAND_MAX + 1)) * max);
+}
+
+/*
+ * Shuffles 0..count-1, so each key is visited once in a random order.
+ */
+static unsigned long *
+__shuffle(unsigned long count)
+{
+	unsigned long *order, i, j, tmp;
+
+	MEM_CHECK(order = (unsigned long *)malloc(count * sizeof(unsigned long)));
+
+	for (i = 0; i < count; i++)
+		order[i] = i;
+
+	for (i = count; i > 1; i--)
+	{
+		j = __random(i);
+
+		tmp          = order[i - 1];
+		order[i - 1] = order[j];
+		order[j]     = tmp;
+	}
+
+	return order;
+}
+
+static void
+__startPhase(BenchPhase *phase, const char *name, unsigned long size,
+			 GDatabase **dbs, int dbCount)
+{
+	int i;
+
+	phase->name  = name;
+	phase->count = 0;
+	phase->size  = size;
+	phase->total = 0;
+
+	MEM_CHECK(phase->latencies = (double *)malloc((size ? size : 1) *
+												  sizeof(double)));
+
+	for (i = 0; i < dbCount; i++)
+		gdbResetStats(dbs[i]);
+}
+
+static void
+__timeOp(BenchPhase *phase, double start)
+{
+	double elapsed = __now() - start;
+
+	if (phase->count < phase->size)
+		phase->latencies[phase->count++] = elapsed;
+
+	phase->total += elapsed;
+}
+
+static int
+__compareLatencies(const void *a, const void *b)
+{
+	double la = *(const double *)a, lb = *(const double *)b;
+
+	return (la < lb ? -1 : (la > lb ? 1 : 0));
+}
+
+static double
+__percentile(BenchPhase *phase, unsigned int percent)
+{
+	unsigned long index;
+
+	if (phase->count == 0)
+		return 0;
+
+	index = (phase->count * percent + 99) / 100;
+
+	return phase->latencies[(index == 0 ? 0 : index - 1)];
+}
+
+static void
+__printHeader(void)
+{
+	printf("%-16s %9s %11s %9s %9s %9s %9s %9s %11s %9s %9s\n",
+		   "phase", "ops", "ops/s", "p50 us", "p90 us", "p99 us", "max us",
+		   "blk read", "bytes read", "hits", "blk wrtn");
+}
+
+static void
+__endPhase(BenchPhase *phase, GDatabase **dbs, int dbCount)
+{
+	GdbStats stats, total;
+	int i;
+
+	memset(&total, 0, sizeof(GdbStats));
+
+	for (i = 0; i < dbCount; i++)
+	{
+		gdbGetStats(dbs[i], &stats);
+
+		total.blocksRead    += stats.blocksRead;
+		total.bytesRead     += stats.bytesRead;
+		total.blocksWritten += stats.blocksWritten;
+		total.cacheHits     += stats.cacheHits;
+	}
+
+	qsort(phase->latencies, phase->count, sizeof(double), __compareLatencies);
+
+	printf("%-16s %9lu %11.0f %9.2f %9.2f %9.2f %9.2f %9lu %11lu %9lu %9lu\n",
+		   phase->name, phase->count,
+		   (phase->total > 0 ? phase->count / phase->total : 0),
+		   __percentile(phase, 50) * 1e6, __percentile(phase, 90) * 1e6,
+		   __percentile(phase, 99) * 1e6, __percentile(phase, 100) * 1e6,
+		   total.blocksRead, total.bytesRead, total.cacheHits,
+		   total.blocksWritten);
+
+	free(phase->latencies);
+}
+
+static GDatabase *
+__openDb(const char *suffix, GdbType type, PmAccessMode mode)
+{
+	GDatabase *db;
+	char filename[1024];
+
+	__dbFilename(filename, sizeof(filename), suffix);
+
+	db = gdbOpen(filename, type, mode);
+
+	if (db == NULL)
+	{
+		printf("Unable to open %s\n", filename);
+		exit(1);
+	}
+
+	if (options.cacheSize != 0)
+		gdbSetCacheSize(db, options.cacheSize);
+
+	return db;
+}
+
+static GDatabase *
+__createDb(const char *suffix, GdbType type)
+{
+	GDatabase *db;
+	char filename[1024];
+
+	__dbFilename(filename, sizeof(filename), suffix);
+
+	unlink(filename);
+
+	db = gdbCreatePaged(filename, type, options.pageSize);
+
+	if (db == NULL)
+	{
+		printf("Unable to create %s\n", filename);
+		exit(1);
+	}
+
+	if (options.cacheSize != 0)
+		gdbSetCacheSize(db, options.cacheSize);
+
+	return db;
+}
+
+/*
+ * Builds the corpus: a data file with a hashtable per package, and an
+ * index file with every file name in the main tree, and a tree of the
+ * packages that depend on each library, like the GNUpdate package
+ * database does.
+ */
+static void
+__buildCorpus(offset_t *packages, offset_t *depTreeOffset)
+{
+	GDatabase *dbs[2], *data, *index;
+	GdbHashTable *table;
+	BTree *depTree, *tree;
+	BenchPhase phase;
+	char name[64], key[BENCH_MAX_PADDING + 64];
+	unsigned long i, j, *order;
+	double start;
+
+	data  = dbs[0] = __createDb(".db",  GDB_DATA_FILE);
+	index = dbs[1] = __createDb(".idx", GDB_INDEX_FILE);
+
+	__startPhase(&phase, "write packages", options.packageCount, dbs, 2);
+
+	for (i = 0; i < options.packageCount; i++)
+	{
+		__packageName(name, sizeof(name), i);
+
+		start = __now();
+
+		table = htCreate(data);
+		htAddString(table, BENCH_TAG_NAME, name);
+		htAddLong(table, BENCH_TAG_FILES, options.fileCount);
+		gdbWriteBlock(table->block);
+
+		packages[i] = table->block->offset;
+
+		gdbDestroyBlock(table->block);
+
+		__timeOp(&phase, start);
+	}
+
+	__endPhase(&phase, dbs, 2);
+
+	/* Insert the files of the packages in a random order. */
+	order = __shuffle(options.packageCount);
+
+	__startPhase(&phase, "insert", options.packageCount * options.fileCount,
+				 dbs, 2);
+
+	for (i = 0; i < options.packageCount; i++)
+	{
+		for (j = 0; j < options.fileCount; j++)
+		{
+			__fileName(key, sizeof(key), order[i], j);
+
+			start = __now();
+
+			if (btreeInsert(index->mainTree, key, packages[order[i]],
+							0) != GDB_SUCCESS)
+			{
+				printf("Unable to insert %s\n", key);
+				exit(1);
+			}
+
+			__timeOp(&phase, start);
+		}
+	}
+
+	__endPhase(&phase, dbs, 2);
+
+	free(order);
+
+	depTree        = btreeCreate(index, 0);
+	*depTreeOffset = depTree->block->offset;
+
+	__startPhase(&phase, "insert deps",
+				 options.packageCount * options.depCount, dbs, 2);
+
+	for (i = 0; i < options.packageCount; i++)
+	{
+		__packageName(name, sizeof(name), i);
+
+		for (j = 0; j < options.depCount; j++)
+		{
+			__libraryName(key, sizeof(key), __random(options.packageCount));
+
+			start = __now();
+
+			if (gdbAddTree(index, depTree, key, &tree) != GDB_SUCCESS)
+			{
+				printf("Unable to add the tree for %s\n", key);
+				exit(1);
+			}
+
+			/* A package may depend on the same library twice. */
+			gdbAddIndexEntry(index, tree, name, packages[i]);
+
+			btreeClose(tree);
+
+			__timeOp(&phase, start);
+		}
+	}
+
+	__endPhase(&phase, dbs, 2);
+
+	btreeClose(depTree);
+
+	__startPhase(&phase, "sync", 1, dbs, 2);
+
+	start = __now();
+
+	gdbSync(data);
+	gdbSync(index);
+
+	__timeOp(&phase, start);
+
+	__endPhase(&phase, dbs, 2);
+
+	gdbClose(data);
+	gdbClose(index);
+}
+
+static void
+__benchSearch(GDatabase *index, const offset_t *packages)
+{
+	BenchPhase phase;
+	char key[BENCH_MAX_PADDING + 64];
+	unsigned long i, count, package, file;
+	offset_t offset;
+	double start;
+
+	count = options.packageCount * options.fileCount;
+
+	__startPhase(&phase, "search hit", count, &index, 1);
+
+	for (i = 0; i < count; i++)
+	{
+		package = __random(options.packageCount);
+		file    = __random(options.fileCount);
+
+		__fileName(key, sizeof(key), package, file);
+
+		start  = __now();
+		offset = btreeSearch(index->mainTree, key);
+
+		__timeOp(&phase, start);
+
+		if (offset != packages[package])
+		{
+			printf("Searching for %s returned %ld\n", key, (long)offset);
+			exit(1);
+		}
+	}
+
+	__endPhase(&phase, &index, 1);
+
+	__startPhase(&phase, "search miss", count, &index, 1);
+
+	for (i = 0; i < count; i++)
+	{
+		/* Past the last file of a package that does exist. */
+		__fileName(key, sizeof(key), __random(options.packageCount),
+				   options.fileCount + __random(options.fileCount + 1));
+
+		start  = __now();
+		offset = btreeSearch(index->mainTree, key);
+
+		__timeOp(&phase, start);
+
+		if (offset != 0)
+		{
+			printf("Searching for %s returned %ld\n", key, (long)offset);
+			exit(1);
+		}
+	}
+
+	__endPhase(&phase, &index, 1);
+}
+
+static void
+__benchTraversal(GDatabase *index, offset_t depTreeOffset)
+{
+	BTreeTraversal *trav;
+	BTree *depTree, *tree;
+	BenchPhase phase;
+	char prefix[64];
+	unsigned long i, count;
+	offset_t offset;
+	double start;
+
+	count = options.packageCount * options.fileCount;
+
+	/* Time each step of a full traversal. */
+	__startPhase(&phase, "traverse", count, &index, 1);
+
+	trav = btreeInitTraversal(index->mainTree);
+
+	start  = __now();
+	offset = btreeGetFirstOffset(trav);
+
+	while (offset != (offset_t)-1)
+	{
+		__timeOp(&phase, start);
+
+		start  = __now();
+		offset = btreeGetNextOffset(trav);
+	}
+
+	btreeDestroyTraversal(trav);
+
+	__endPhase(&phase, &index, 1);
+
+	if (phase.count != count)
+	{
+		printf("Traversed %lu of %lu keys\n", phase.count, count);
+		exit(1);
+	}
+
+	/* Time whole prefix traversals, like a search for a package's files. */
+	__startPhase(&phase, "prefix traverse", options.packageCount, &index, 1);
+
+	for (i = 0; i < options.packageCount; i++)
+	{
+		snprintf(prefix, sizeof(prefix), "/usr/share/pkg%06lu/",
+				 __random(options.packageCount));
+
+		start = __now();
+
+		trav = btreeInitPrefixTraversal(index->mainTree, prefix);
+
+		for (offset = btreeGetFirstOffset(trav);
+			 offset != (offset_t)-1;
+			 offset = btreeGetNextOffset(trav))
+			;
+
+		btreeDestroyTraversal(trav);
+
+		__timeOp(&phase, start);
+	}
+
+	__endPhase(&phase, &index, 1);
+
+	/* Find the packages depending on a library, like a dependency check. */
+	depTree = btreeOpen(index, depTreeOffset);
+
+	__startPhase(&phase, "dep lookup", options.packageCount, &index, 1);
+
+	for (i = 0; i < options.packageCount; i++)
+	{
+		__libraryName(prefix, sizeof(prefix), __random(options.packageCount));
+
+		start = __now();
+
+		offset = btreeSearch(depTree, prefix);
+
+		if (offset != 0)
+		{
+			tree = btreeOpen(index, offset);
+			trav = btreeInitTraversal(tree);
+
+			for (offset = btreeGetFirstOffset(trav);
+				 offset != (offset_t)-1;
+				 offset = btreeGetNextOffset(trav))
+				;
+
+			btreeDestroyTraversal(trav);
+			btreeClose(tree);
+		}
+
+		__timeOp(&phase, start);
+	}
+
+	__endPhase(&phase, &index, 1);
+
+	btreeClose(depTree);
+}
+
+static void
+__benchReadBlock(GDatabase *data, const offset_t *packages,
+				 const char *name)
+{
+	BenchPhase phase;
+	GdbBlock *block;
+	unsigned long i, *order;
+	double start;
+
+	order = __shuffle(options.packageCount);
+
+	__startPhase(&phase, name, options.packageCount, &data, 1);
+
+	for (i = 0; i < options.packageCount; i++)
+	{
+		start = __now();
+
+		block = gdbReadBlock(data, packages[order[i]], GDB_BLOCK_HASHTABLE,
+							 NULL);
+
+		__timeOp(&phase, start);
+
+		if (block == NULL)
+		{
+			printf("Unable to read the package at %ld\n",
+				   (long)packages[order[i]]);
+			exit(1);
+		}
+
+		gdbDestroyBlock(block);
+	}
+
+	__endPhase(&phase, &data, 1);
+
+	free(order);
+}
+
+static void
+__benchDelete(void)
+{
+	GDatabase *index;
+	BenchPhase phase;
+	char key[BENCH_MAX_PADDING + 64];
+	unsigned long i, count, *order;
+	double start;
+
+	index = __openDb(".idx", GDB_INDEX_FILE, PM_MODE_READ_WRITE);
+
+	count = options.packageCount * options.fileCount;
+	order = __shuffle(count);
+
+	__startPhase(&phase, "delete", count, &index, 1);
+
+	for (i = 0; i < count; i++)
+	{
+		__fileName(key, sizeof(key), order[i] / options.fileCount,
+				   order[i] % options.fileCount);
+
+		start = __now();
+
+		if (!btreeDelete(index->mainTree, key))
+		{
+			printf("Unable to delete %s\n", key);
+			exit(1);
+		}
+
+		__timeOp(&phase, start);
+	}
+
+	__endPhase(&phase, &index, 1);
+
+	free(order);
+
+	if (!btreeIsEmpty(index->mainTree))
+	{
+		printf("%lu keys left after deleting them all\n",
+			   btreeGetSize(index->mainTree));
+		exit(1);
+	}
+
+	gdbClose(index);
+}
+
+int
+main(int argc, char **argv)
+{
+	GDatabase *data, *index;
+	offset_t *packages, depTreeOffset;
+
+	__parseOptions(argc, argv);
+
+	printf("%lu packages, %lu files and %lu dependencies each, "
+		   "%lu byte file names, page size %u\n\n",
+		   options.packageCount, options.fileCount, options.depCount,
+		   (unsigned long)strlen("/usr/share/pkg000000/file0000") +
+		   options.padding, options.pageSize);
+
+	MEM_CHECK(packages = (offset_t *)malloc(options.packageCount *
+											sizeof(offset_t)));
+
+	__printHeader();
+
+	__buildCorpus(packages, &depTreeOffset);
+
+	/* Read the files back as a package query would. */
+	data  = __openDb(".db",  GDB_DATA_FILE,  PM_MODE_READ_ONLY);
+	index = __openDb(".idx", GDB_INDEX_FILE, PM_MODE_READ_ONLY);
+
+	/* A header that was written wrong shows up here, not as odd timings. */
+	if (btreeGetSize(index->mainTree) !=
+		options.packageCount * options.fileCount)
+	{
+		printf("The index has %lu keys after reopening, not %lu\n",
+			   btreeGetSize(index->mainTree),
+			   options.packageCount * options.fileCount);
+		exit(1);
+	}
+
+	__benchReadBlock(data, packages, "read cold");
+	__benchReadBlock(data, packages, "read warm");
+
+	if (options.fileCount > 0)
+		__benchSearch(index, packages);
+
+	__benchTraversal(index, depTreeOffset);
+
+	gdbClose(data);
+	gdbClose(index);
+
+	if (options.fileCount > 0)
+		__benchDelete();
+
+	free(packages);
+
+	return 0;
+}
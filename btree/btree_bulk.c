@@ -0,0 +1,359 @@
+/**
+ * @file btree_bulk.c Bulk loading functions
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#include "db_internal.h"
+
+/*
+ * The deepest tree that can be built. Every level holds at least
+ * twice as many keys as the one above it, so this is plenty.
+ */
+#define BTREE_BULK_MAX_DEPTH 32
+
+/*
+ * The keys and offsets waiting to go into nodes on one level of the
+ * tree. For leaves, the offsets are values. Above that, they're the
+ * children, and each key is the largest key under its child.
+ */
+typedef struct
+{
+	char     **keys;     /* Pending keys.                         */
+	offset_t  *offsets;  /* Pending offsets.                      */
+	int        count;    /* Number of pending entries.            */
+	int        perNode;  /* Entries to put in each full node.     */
+	int        minNode;  /* Fewest entries a node may have.       */
+	int        maxNode;  /* Most entries a node may have.         */
+	int        written;  /* Number of nodes written on the level. */
+
+} BTreeBulkLevel;
+
+typedef struct
+{
+	BTree          *tree;
+	BTreeBulkLevel  levels[BTREE_BULK_MAX_DEPTH];
+	int             depth;      /* Number of levels in use.          */
+	BTreeNode      *nextLeaf;   /* Next leaf, with its offset set.   */
+	offset_t        leftLeaf;   /* Offset of the first leaf.         */
+
+} BTreeBulkState;
+
+/*
+ * Gives a new node its disk offset before it's written, so the leaf
+ * before it can point to it.
+ */
+static void
+__reserveNode(BTreeNode *node)
+{
+	GdbBlock *block = node->block;
+
+	block->chain      = gdbReserveBlockChain(block->db, 1, block->type);
+	block->chainCount = 1;
+	block->offset     = block->chain[0];
+}
+
+static void
+__initLevel(BTreeBulkState *state, int level)
+{
+	BTreeBulkLevel *l = &state->levels[level];
+	BTree *tree = state->tree;
+	int size;
+
+	if (level >= BTREE_BULK_MAX_DEPTH)
+	{
+		pmError(PM_ERROR_FATAL,
+				_("GNUpdate DB: B+Tree bulk load is too deep in %s, "
+				  "line %d\n"),
+				__FILE__, __LINE__);
+		abort();
+	}
+
+	if (level == 0)
+	{
+		l->maxNode = tree->order - 1;
+		l->minNode = tree->minLeaf;
+		l->perNode = state->levels[0].perNode;
+	}
+	else
+	{
+		l->maxNode = tree->order;
+		l->minNode = tree->minInt + 1;
+		l->perNode = state->levels[1].perNode;
+	}
+
+	if (l->perNode < l->minNode)
+		l->perNode = l->minNode;
+
+	if (l->perNode > l->maxNode)
+		l->perNode = l->maxNode;
+
+	/* A full node's worth, plus enough to keep the next from underflowing. */
+	size = l->perNode + l->minNode;
+
+	MEM_CHECK(l->keys    = (char **)malloc(size * sizeof(char *)));
+	MEM_CHECK(l->offsets = (offset_t *)malloc(size * sizeof(offset_t)));
+
+	l->count   = 0;
+	l->written = 0;
+
+	state->depth = level + 1;
+}
+
+static void __addEntry(BTreeBulkState *state, int level, char *key,
+					   offset_t offset);
+
+/*
+ * Writes a node holding the first count entries on a level, and passes
+ * it up to the next level.
+ */
+static void
+__writeNode(BTreeBulkState *state, int level, int count, char hasNext)
+{
+	BTreeBulkLevel *l = &state->levels[level];
+	BTree *tree = state->tree;
+	BTreeNode *node;
+	offset_t offset;
+	int i, keyCount;
+
+	if (level == 0)
+	{
+		if (state->nextLeaf == NULL)
+		{
+			state->nextLeaf = btreeNewNode(tree);
+			__reserveNode(state->nextLeaf);
+		}
+
+		node = state->nextLeaf;
+		state->nextLeaf = NULL;
+
+		BTREE_SET_LEAF(node);
+
+		keyCount = count;
+
+		if (state->leftLeaf == 0)
+			state->leftLeaf = node->block->offset;
+
+		if (hasNext)
+		{
+			state->nextLeaf = btreeNewNode(tree);
+			__reserveNode(state->nextLeaf);
+
+			node->children[keyCount] = state->nextLeaf->block->offset;
+		}
+	}
+	else
+	{
+		node = btreeNewNode(tree);
+
+		/* The last child's key belongs to the parent. */
+		keyCount = count - 1;
+
+		node->children[keyCount] = l->offsets[keyCount];
+	}
+
+	for (i = 0; i < keyCount; i++)
+	{
+		btreeInsertKey(node, i, l->keys[i]);
+		node->children[i] = l->offsets[i];
+	}
+
+	offset = btreeWriteNode(node);
+	btreeDestroyNode(node);
+
+	for (i = 0; i < count - 1; i++)
+		free(l->keys[i]);
+
+	/* The largest key in the node goes up with it. */
+	if (level + 1 >= state->depth)
+		__initLevel(state, level + 1);
+
+	__addEntry(state, level + 1, l->keys[count - 1], offset);
+
+	l->count -= count;
+
+	memmove(l->keys, l->keys + count, l->count * sizeof(char *));
+	memmove(l->offsets, l->offsets + count, l->count * sizeof(offset_t));
+
+	l->written++;
+}
+
+static void
+__addEntry(BTreeBulkState *state, int level, char *key, offset_t offset)
+{
+	BTreeBulkLevel *l = &state->levels[level];
+
+	l->keys[l->count]    = key;
+	l->offsets[l->count] = offset;
+	l->count++;
+
+	/*
+	 * Hold back a few entries after a full node, so the last node on
+	 * the level never ends up with too few.
+	 */
+	if (l->count == l->perNode + l->minNode)
+		__writeNode(state, level, l->perNode, 1);
+}
+
+/*
+ * Writes out what's left on each level once all the keys are in, and
+ * returns the offset of the root.
+ */
+static offset_t
+__finish(BTreeBulkState *state)
+{
+	BTreeBulkLevel *l;
+	int level, half;
+
+	for (level = 0; level < state->depth; level++)
+	{
+		l = &state->levels[level];
+
+		/* A lone child at the top is the root. */
+		if (level > 0 && l->written == 0 && l->count == 1)
+		{
+			free(l->keys[0]);
+			l->count = 0;
+
+			return l->offsets[0];
+		}
+
+		if (l->count <= l->maxNode)
+		{
+			__writeNode(state, level, l->count, 0);
+		}
+		else
+		{
+			half = l->count / 2;
+
+			__writeNode(state, level, half, 1);
+			__writeNode(state, level, l->count, 0);
+		}
+	}
+
+	/* Not reached. Writing the top level always adds another. */
+	return 0;
+}
+
+static void
+__destroyState(BTreeBulkState *state)
+{
+	int level, i;
+
+	for (level = 0; level < state->depth; level++)
+	{
+		for (i = 0; i < state->levels[level].count; i++)
+			free(state->levels[level].keys[i]);
+
+		free(state->levels[level].keys);
+		free(state->levels[level].offsets);
+	}
+
+	if (state->nextLeaf != NULL)
+	{
+		gdbFreeBlock(state->tree->block->db, state->nextLeaf->block->offset,
+					 state->nextLeaf->block->type);
+
+		GDB_CLEAR_DIRTY(state->nextLeaf->block);
+		btreeDestroyNode(state->nextLeaf);
+	}
+}
+
+GdbStatus
+btreeBulkLoad(BTree *tree, BTreeLoadFunc next, void *data,
+			  unsigned char fillFactor)
+{
+	BTreeBulkState state;
+	const char *key;
+	char *lastKey = NULL;
+	offset_t offset, root;
+	unsigned long count = 0;
+	GdbStatus status = GDB_SUCCESS;
+
+	if (tree == NULL || next == NULL || tree->snapshot != NULL ||
+		tree->block->db->mode == PM_MODE_READ_ONLY)
+	{
+		return GDB_ERROR;
+	}
+
+	if (fillFactor == 0 || fillFactor > 100)
+		fillFactor = 100;
+
+	btreeLockWriter(tree);
+
+	if (btreeGetRootNode(tree) != 0)
+	{
+		btreeUnlockWriter(tree);
+
+		return GDB_ERROR;
+	}
+
+	memset(&state, 0, sizeof(BTreeBulkState));
+
+	state.tree = tree;
+
+	state.levels[0].perNode = ((tree->order - 1) * fillFactor + 99) / 100;
+	state.levels[1].perNode = (tree->order * fillFactor + 99) / 100;
+
+	__initLevel(&state, 0);
+
+	while (next(data, &key, &offset))
+	{
+		if (lastKey != NULL)
+		{
+			int cmp = strcmp(key, lastKey);
+
+			/* Keep the first of any duplicates, as btreeInsert() does. */
+			if (cmp == 0)
+				continue;
+
+			if (cmp < 0)
+			{
+				pmError(PM_ERROR_WARNING,
+						_("GNUpdate DB: B+Tree bulk load keys are out of "
+						  "order at '%s'\n"),
+						key);
+
+				status = GDB_ERROR;
+				break;
+			}
+		}
+
+		lastKey = strdup(key);
+
+		__addEntry(&state, 0, lastKey, offset);
+
+		gdbBloomAdd(tree, key);
+
+		count++;
+	}
+
+	if (status == GDB_SUCCESS && count > 0)
+	{
+		root = __finish(&state);
+
+		btreeSetLeftLeaf(tree, state.leftLeaf);
+		btreeSetTreeSize(tree, count);
+		btreeSetRootNode(tree, root);
+	}
+
+	__destroyState(&state);
+
+	btreeUnlockWriter(tree);
+
+	return status;
+}
@@ -20,41 +20,52 @@
  */
 #include "db_internal.h"
 
+/*
+ * Inserts a child offset, moving the ones after it along.
+ */
+static void
+__insertChild(BTree *tree, BTreeNode *node, int index, offset_t offset)
+{
+	memmove(&node->children[index + 1], &node->children[index],
+			(tree->order - index) * sizeof(offset_t));
+
+	node->children[index] = offset;
+}
+
+/*
+ * Removes a child offset, moving the ones after it back.
+ */
+static void
+__removeChild(BTree *tree, BTreeNode *node, int index)
+{
+	memmove(&node->children[index], &node->children[index + 1],
+			(tree->order - index) * sizeof(offset_t));
+
+	node->children[tree->order] = 0;
+}
+
 static char
-__removeKey(BTree *tree, BTreeNode *rootNode, const char *key,
+__removeKey(BTree *tree, BTreeNode **rootNode, const char *key,
 			offset_t *filePos)
 {
-	int i;
+	char found;
+	int  i;
 	
-	for (i = 0;
-		 i < rootNode->keyCount && strcmp(rootNode->keys[i], key) < 0;
-		 i++)
-		;
+	i = btreeFindKey(*rootNode, key, &found);
 
-	if (BTREE_IS_LEAF(rootNode) && i < rootNode->keyCount &&
-		strcmp(rootNode->keys[i], key) == 0)
+	if (BTREE_IS_LEAF(*rootNode) && found)
 	{
-		*filePos = rootNode->children[i];
+		btreeShadowNode(tree, rootNode);
 
-		free(rootNode->keys[i]);
+		*filePos = (*rootNode)->children[i];
 
-		for (; i < rootNode->keyCount - 1; i++)
-		{
-			rootNode->keys[i]     = rootNode->keys[i + 1];
-			rootNode->keySizes[i] = rootNode->keySizes[i + 1];
-			rootNode->children[i] = rootNode->children[i + 1];
-		}
+		/* The next leaf pointer moves back along with the rest. */
+		btreeRemoveKey(*rootNode, i);
+		__removeChild(tree, *rootNode, i);
 
-		rootNode->keys[i]         = NULL;
-		rootNode->keySizes[i]     = 0;
-		rootNode->children[i]     = rootNode->children[i + 1];
-		rootNode->children[i + 1] = 0;
+		GDB_SET_DIRTY((*rootNode)->block);
 
-		rootNode->keyCount--;
-
-		GDB_SET_DIRTY(rootNode->block);
-
-		btreeWriteNode(rootNode);
+		btreeWriteNode(*rootNode);
 
 		return 1;
 	}
@@ -62,288 +73,307 @@ __removeKey(BTree *tree, BTreeNode *rootNode, const char *key,
 	return 0;
 }
 
+/*
+ * Points a parent at a child that has moved, or the tree at a new root.
+ */
 static void
-__removeKey2(BTree *tree, BTreeNode *rootNode, int index)
+__relink(BTree *tree, BTreeNode **prevNode, int index, offset_t offset)
 {
-	int i;
-
-	free(rootNode->keys[index]);
-	
-	for (i = index; i < rootNode->keyCount - 1; i++)
+	if (prevNode == NULL)
 	{
-		rootNode->keys[i]     = rootNode->keys[i + 1];
-		rootNode->keySizes[i] = rootNode->keySizes[i + 1];
-		rootNode->children[i] = rootNode->children[i + 1];
+		btreeSetRootNode(tree, offset);
+
+		return;
 	}
 
-	rootNode->keys[i]         = NULL;
-	rootNode->keySizes[i]     = 0;
-	rootNode->children[i]     = rootNode->children[i + 1];
-	rootNode->children[i + 1] = 0;
+	btreeShadowNode(tree, prevNode);
 
-	rootNode->keyCount--;
+	(*prevNode)->children[index] = offset;
 
-	GDB_SET_DIRTY(rootNode->block);
+	GDB_SET_DIRTY((*prevNode)->block);
+
+	btreeWriteNode(*prevNode);
+}
+
+/*
+ * Locks the left sibling of a node we hold a write lock on.
+ *
+ * Traversals lock leaves from left to right, so if the sibling can't be
+ * locked right away, let go of the node and lock both of them in that
+ * order. Nobody else can change the node in the meantime, since its
+ * parent is locked and there's only one writer.
+ *
+ * The node is locked at the offset it was read from, even if it has
+ * since been copied.
+ */
+static void
+__lockLeftSibling(BTree *tree, offset_t nodeOffset, offset_t offset)
+{
+	if (btreeTryLockNode(tree, offset, DB_WRITE_LOCK))
+		return;
+
+	btreeUnlockNode(tree, nodeOffset);
+	btreeLockNode(tree, offset, DB_WRITE_LOCK);
+	btreeLockNode(tree, nodeOffset, DB_WRITE_LOCK);
+}
+
+/*
+ * Returns whether a sibling has a key to spare.
+ */
+static char
+__canLend(BTree *tree, BTreeNode *node)
+{
+	if (BTREE_IS_LEAF(node))
+		return (node->keyCount > tree->minLeaf);
 
-	btreeWriteNode(rootNode);
+	return (node->keyCount > tree->minInt);
 }
 
 static char
 __borrowRight(BTree *tree, BTreeNode *rootNode, BTreeNode *prevNode, int div)
 {
 	BTreeNode *node;
+	offset_t offset;
 
 	if (div >= prevNode->keyCount)
 		return 0;
 
-	node = btreeReadNode(tree, prevNode->children[div + 1]);
+	offset = prevNode->children[div + 1];
 
-	if (BTREE_IS_LEAF(node) && node->keyCount > tree->minLeaf)
+	btreeLockNode(tree, offset, DB_WRITE_LOCK);
+
+	node = btreeReadNode(tree, offset);
+
+	if (!__canLend(tree, node))
 	{
-		rootNode->children[rootNode->keyCount + 1] =
-			rootNode->children[(int)rootNode->keyCount];
-		
-		free(rootNode->keys[(int)rootNode->keyCount]);
-		rootNode->keys[(int)rootNode->keyCount]     = strdup(node->keys[0]);
-		rootNode->keySizes[(int)rootNode->keyCount] = node->keySizes[0];
-		rootNode->children[(int)rootNode->keyCount] = node->children[0];
+		btreeUnlockNode(tree, offset);
+		btreeDestroyNode(node);
 
-		free(rootNode->keys[div]);
-		prevNode->keys[div] = strdup(rootNode->keys[(int)rootNode->keyCount]);
-		prevNode->keySizes[div] = rootNode->keySizes[(int)rootNode->keyCount];
+		return 0;
 	}
-	else if (!BTREE_IS_LEAF(node) && node->keyCount > tree->minInt)
-	{
-		free(rootNode->keys[(int)rootNode->keyCount]);
-		rootNode->keys[(int)rootNode->keyCount] = strdup(prevNode->keys[div]);
-		rootNode->keySizes[(int)rootNode->keyCount] = prevNode->keySizes[div];
 
-		free(rootNode->keys[div]);
-		prevNode->keys[div]                         = strdup(node->keys[0]);
-		prevNode->keySizes[div]                     = node->keySizes[0];
+	btreeShadowNode(tree, &node);
 
-		rootNode->children[rootNode->keyCount + 1] = node->children[0];
+	prevNode->children[div + 1] = node->block->offset;
+
+	if (BTREE_IS_LEAF(node))
+	{
+		/* Take the first key, and make it the new divider. */
+		__insertChild(tree, rootNode, rootNode->keyCount, node->children[0]);
+		btreeInsertKey(rootNode, rootNode->keyCount, BTREE_KEY(node, 0));
+
+		btreeSetKey(prevNode, div, BTREE_KEY(node, 0));
 	}
 	else
 	{
-		btreeDestroyNode(node);
+		/* Rotate the divider down, and the first key up. */
+		btreeInsertKey(rootNode, rootNode->keyCount, BTREE_KEY(prevNode, div));
+		rootNode->children[(int)rootNode->keyCount] = node->children[0];
 
-		return 0;
+		btreeSetKey(prevNode, div, BTREE_KEY(node, 0));
 	}
 
+	btreeRemoveKey(node, 0);
+	__removeChild(tree, node, 0);
+
 	GDB_SET_DIRTY(rootNode->block);
 	GDB_SET_DIRTY(prevNode->block);
+	GDB_SET_DIRTY(node->block);
 
-	rootNode->keyCount++;
-
-	__removeKey2(tree, node, 0);
+	btreeWriteNode(node);
 
+	btreeUnlockNode(tree, offset);
 	btreeDestroyNode(node);
 	
 	return 1;
 }
 
 static char
-__borrowLeft(BTree *tree, BTreeNode *rootNode, BTreeNode *prevNode, int div)
+__borrowLeft(BTree *tree, offset_t rootOffset, BTreeNode *rootNode,
+			 BTreeNode *prevNode, int div)
 {
-	int i;
 	BTreeNode *node;
+	offset_t offset;
+	int last;
 
 	if (div == 0)
 		return 0;
 
-	node = btreeReadNode(tree, prevNode->children[div - 1]);
+	offset = prevNode->children[div - 1];
 
-	if (BTREE_IS_LEAF(node) && node->keyCount > tree->minLeaf)
-	{
-		for (i = rootNode->keyCount; i > 0; i--)
-		{
-			rootNode->keys[i]         = rootNode->keys[i - 1];
-			rootNode->keySizes[i]     = rootNode->keySizes[i - 1];
-			rootNode->children[i + 1] = rootNode->children[i];
-		}
+	__lockLeftSibling(tree, rootOffset, offset);
 
-		rootNode->children[1] = rootNode->children[0];
-		rootNode->keys[0]     = strdup(node->keys[node->keyCount - 1]);
-		rootNode->keySizes[0] = node->keySizes[node->keyCount - 1];
-		rootNode->children[0] = node->children[node->keyCount - 1];
+	node = btreeReadNode(tree, offset);
+	last = node->keyCount - 1;
 
-		rootNode->keyCount++;
-
-		free(prevNode->keys[div - 1]);
-		prevNode->keys[div - 1]     = strdup(node->keys[node->keyCount - 2]);
-		prevNode->keySizes[div - 1] = node->keySizes[node->keyCount - 2];
+	if (!__canLend(tree, node))
+	{
+		btreeUnlockNode(tree, offset);
+		btreeDestroyNode(node);
+		
+		return 0;
+	}
 
-		node->children[node->keyCount - 1] =
-			node->children[(int)node->keyCount];
+	btreeShadowNode(tree, &node);
 
-		node->children[(int)node->keyCount] = 0;
+	prevNode->children[div - 1] = node->block->offset;
 
-		free(node->keys[node->keyCount - 1]);
-		node->keys[node->keyCount - 1]     = NULL;
-		node->keySizes[node->keyCount - 1] = 0;
-	}
-	else if (!BTREE_IS_LEAF(node) && node->keyCount > tree->minInt)
+	if (BTREE_IS_LEAF(node))
 	{
-		for (i = rootNode->keyCount; i > 0; i--)
-		{
-			rootNode->keys[i]         = rootNode->keys[i - 1];
-			rootNode->keySizes[i]     = rootNode->keySizes[i - 1];
-			rootNode->children[i + 1] = rootNode->children[i];
-		}
-
-		rootNode->children[1] = rootNode->children[0];
-		rootNode->keys[0]     = strdup(prevNode->keys[div - 1]);
-		rootNode->keySizes[0] = prevNode->keySizes[div - 1];
-		rootNode->children[0] = node->children[(int)node->keyCount];
+		/* Take the last key. The one before it is the new divider. */
+		btreeInsertKey(rootNode, 0, BTREE_KEY(node, last));
+		__insertChild(tree, rootNode, 0, node->children[last]);
 
-		rootNode->keyCount++;
+		btreeRemoveKey(node, last);
+		__removeChild(tree, node, last);
 
-		free(prevNode->keys[div - 1]);
-		prevNode->keys[div - 1]     = strdup(node->keys[node->keyCount - 1]);
-		prevNode->keySizes[div - 1] = node->keySizes[node->keyCount - 1];
-		
-		node->children[(int)node->keyCount] = 0;
-
-		free(node->keys[node->keyCount - 1]);
-		node->keys[node->keyCount - 1]     = NULL;
-		node->keySizes[node->keyCount - 1] = 0;
+		btreeSetKey(prevNode, div - 1, BTREE_KEY(node, last - 1));
 	}
 	else
 	{
-		btreeDestroyNode(node);
-		
-		return 0;
-	}
+		/* Rotate the divider down, and the last key up. */
+		btreeInsertKey(rootNode, 0, BTREE_KEY(prevNode, div - 1));
+		__insertChild(tree, rootNode, 0, node->children[last + 1]);
 
-	node->keyCount--;
+		btreeSetKey(prevNode, div - 1, BTREE_KEY(node, last));
+
+		btreeRemoveKey(node, last);
+		node->children[last + 1] = 0;
+	}
 
 	GDB_SET_DIRTY(rootNode->block);
 	GDB_SET_DIRTY(prevNode->block);
 	GDB_SET_DIRTY(node->block);
 
 	btreeWriteNode(node);
+
+	btreeUnlockNode(tree, offset);
 	btreeDestroyNode(node);
 
 	return 1;
 }
 
-static char
-__mergeNode(BTree *tree, BTreeNode *rootNode, BTreeNode *prevNode, int div)
+/*
+ * Moves everything in a node into its left sibling, and removes the
+ * divider between them from the parent.
+ */
+static void
+__mergeInto(BTree *tree, BTreeNode *leftNode, BTreeNode *rightNode,
+			BTreeNode *prevNode, int div)
 {
 	int i, j;
-	BTreeNode *node;
 
-	/* Try to merge the node with its left sibling. */
-	if (div > 0)
+	i = leftNode->keyCount;
+
+	if (!BTREE_IS_LEAF(leftNode))
 	{
-		node = btreeReadNode(tree, prevNode->children[div - 1]);
-		i    = node->keyCount;
+		btreeInsertKey(leftNode, i, BTREE_KEY(prevNode, div));
+		i++;
+	}
 
-		if (!BTREE_IS_LEAF(rootNode))
-		{
-			free(node->keys[i]);
-			
-			node->keys[i]     = strdup(prevNode->keys[div - 1]);
-			node->keySizes[i] = prevNode->keySizes[div - 1];
-			node->keyCount++;
-			
-			i++;
-		}
+	/* In a leaf, this replaces the next leaf pointer. */
+	for (j = 0; j < rightNode->keyCount; j++, i++)
+	{
+		btreeInsertKey(leftNode, i, BTREE_KEY(rightNode, j));
+		leftNode->children[i] = rightNode->children[j];
+	}
 
-		for (j = 0; j < rootNode->keyCount; j++, i++)
-		{
-			free(node->keys[i]);
+	leftNode->children[i] = rightNode->children[j];
 
-			node->keys[i]     = strdup(rootNode->keys[j]);
-			node->keySizes[i] = rootNode->keySizes[j];
-			node->children[i] = rootNode->children[j];
-			node->keyCount++;
-		}
+	btreeRemoveKey(prevNode, div);
+	__removeChild(tree, prevNode, div + 1);
 
-		node->children[i] = rootNode->children[j];
+	GDB_SET_DIRTY(leftNode->block);
+	GDB_SET_DIRTY(prevNode->block);
 
-		GDB_SET_DIRTY(node->block);
+	btreeWriteNode(leftNode);
 
-		btreeWriteNode(node);
-		
-		prevNode->children[div] = node->block->offset;
+	btreeEraseNode(rightNode);
+}
 
-		GDB_SET_DIRTY(prevNode->block);
+static void
+__mergeNode(BTree *tree, offset_t rootOffset, BTreeNode *rootNode,
+			BTreeNode *prevNode, int div)
+{
+	BTreeNode *node;
+	offset_t offset;
 
-		btreeEraseNode(rootNode);
-		__removeKey2(tree, prevNode, div - 1);
-	}
-	else
+	/* Try to merge the node with its left sibling. */
+	if (div > 0)
 	{
-		/* Must merge the node with its right sibling. */
-		node = btreeReadNode(tree, prevNode->children[div + 1]);
-		i    = rootNode->keyCount;
+		offset = prevNode->children[div - 1];
 
-		if (!BTREE_IS_LEAF(rootNode))
-		{
-			free(node->keys[i]);
-			
-			rootNode->keys[i]     = strdup(prevNode->keys[div]);
-			rootNode->keySizes[i] = prevNode->keySizes[div];
-			rootNode->keyCount++;
-			
-			i++;
-		}
+		__lockLeftSibling(tree, rootOffset, offset);
 
-		for (j = 0; j < node->keyCount; j++, i++)
-		{
-			free(node->keys[i]);
-			rootNode->keys[i]     = strdup(node->keys[j]);
-			rootNode->keySizes[i] = node->keySizes[j];
-			rootNode->children[i] = node->children[j];
-			rootNode->keyCount++;
-		}
-		
-		rootNode->children[i]       = node->children[j];
-		prevNode->children[div + 1] = rootNode->block->offset;
+		node = btreeReadNode(tree, offset);
 
-		GDB_SET_DIRTY(rootNode->block);
-		GDB_SET_DIRTY(prevNode->block);
+		btreeShadowNode(tree, &node);
 
-		btreeEraseNode(node);
+		prevNode->children[div - 1] = node->block->offset;
 
-		__removeKey2(tree, prevNode, div);
+		__mergeInto(tree, node, rootNode, prevNode, div - 1);
 	}
+	else
+	{
+		/* Must merge the node with its right sibling. */
+		offset = prevNode->children[div + 1];
 
-	btreeWriteNode(node);
-	btreeWriteNode(prevNode);
-	btreeWriteNode(rootNode);
+		btreeLockNode(tree, offset, DB_WRITE_LOCK);
 
-	btreeDestroyNode(node);
+		node = btreeReadNode(tree, offset);
 
-	return 1;
+		__mergeInto(tree, rootNode, node, prevNode, div);
+	}
+
+	btreeUnlockNode(tree, offset);
+	btreeDestroyNode(node);
 }
 
+/*
+ * Deletes a key from the subtree at rootOffset.
+ *
+ * prevNode is the parent, or NULL at the root of the tree. In a
+ * copy-on-write file, committed nodes are copied before they're
+ * changed, and the parent (or the tree) is pointed at the copy.
+ */
 static char
-__delete(BTree *tree, offset_t rootOffset, BTreeNode *prevNode,
-		 const char *key, int index, offset_t *filePos, char *merged)
+__delete(BTree *tree, offset_t rootOffset, BTreeNode **prevNode,
+		 const char *key, int index, offset_t *filePos, char *merged,
+		 BTreeLockPath *path)
 {
 	char success = 0;
 	BTreeNode *rootNode;
 
+	btreeLockPathNode(path, rootOffset);
+
 	rootNode = btreeReadNode(tree, rootOffset);
 
+	/*
+	 * If this node can lose a key without underflowing, nothing above
+	 * it will change, unless the node has to be copied. The root only
+	 * changes when it runs out of keys.
+	 */
+	if (((prevNode == NULL && rootNode->keyCount > 1) ||
+		 (prevNode != NULL &&
+		  ((BTREE_IS_LEAF(rootNode)  && rootNode->keyCount > tree->minLeaf) ||
+		   (!BTREE_IS_LEAF(rootNode) && rootNode->keyCount > tree->minInt)))) &&
+		gdbCanWriteInPlace(tree->block->db, rootOffset))
+	{
+		btreeReleaseAncestors(path);
+	}
+
 	if (BTREE_IS_LEAF(rootNode))
 	{
-		success = __removeKey(tree, rootNode, key, filePos);
+		success = __removeKey(tree, &rootNode, key, filePos);
 	}
 	else
 	{
 		int i;
 		
-		for (i = 0;
-			 i < rootNode->keyCount && strcmp(rootNode->keys[i], key) < 0;
-			 i++)
-			;
+		i = btreeFindKey(rootNode, key, NULL);
 
-		success = __delete(tree, rootNode->children[i], rootNode, key, i,
-						   filePos, merged);
+		success = __delete(tree, rootNode->children[i], &rootNode, key, i,
+						   filePos, merged, path);
 	}
 
 	if (success == 0)
@@ -352,29 +382,38 @@ __delete(BTree *tree, offset_t rootOffset, BTreeNode *prevNode,
 		
 		return 0;
 	}
-	else if ((rootNode->block->offset == tree->root) ||
+	else if ((prevNode == NULL) ||
 			 (BTREE_IS_LEAF(rootNode)  && rootNode->keyCount >= tree->minLeaf) ||
 			 (!BTREE_IS_LEAF(rootNode) && rootNode->keyCount >= tree->minInt))
 	{
+		if (rootNode->block->offset != rootOffset)
+			__relink(tree, prevNode, index, rootNode->block->offset);
+
 		btreeDestroyNode(rootNode);
 		
 		return 1;
 	}
 	else
 	{
-		if (__borrowRight(tree, rootNode, prevNode, index) ||
-			__borrowLeft(tree, rootNode, prevNode, index))
+		btreeShadowNode(tree, prevNode);
+
+		(*prevNode)->children[index] = rootNode->block->offset;
+
+		if (__borrowRight(tree, rootNode, *prevNode, index) ||
+			__borrowLeft(tree, rootOffset, rootNode, *prevNode, index))
 		{
 			*merged = 0;
+
+			btreeWriteNode(rootNode);
 		}
 		else
 		{
+			/* This may erase the node, so it's written by the merge. */
 			*merged = 1;
-			__mergeNode(tree, rootNode, prevNode, index);
+			__mergeNode(tree, rootOffset, rootNode, *prevNode, index);
 		}
 
-		btreeWriteNode(rootNode);
-		btreeWriteNode(prevNode);
+		btreeWriteNode(*prevNode);
 	}
 
 	btreeDestroyNode(rootNode);
@@ -385,12 +424,12 @@ __delete(BTree *tree, offset_t rootOffset, BTreeNode *prevNode,
 int
 btreeDelete(BTree *tree, const char *key)
 {
-	int i;
 	offset_t filePos;
 	char merged, success;
 	BTreeNode *rootNode;
+	BTreeLockPath path;
 
-	if (tree == NULL || key == NULL ||
+	if (tree == NULL || key == NULL || tree->snapshot != NULL ||
 		tree->block->db->mode == PM_MODE_READ_ONLY)
 	{
 		return 0;
@@ -405,32 +444,46 @@ btreeDelete(BTree *tree, const char *key)
 	merged  = 0;
 	success = 0;
 
+	btreeLockWriter(tree);
+	btreeInitLockPath(&path, tree, DB_WRITE_LOCK);
+
 	/* Read in the tree data. */
 	tree->root     = btreeGetRootNode(tree);
 	tree->leftLeaf = btreeGetLeftLeaf(tree);
 	tree->size     = btreeGetTreeSize(tree);
 
-	/* Read in the root node. */
-	rootNode = btreeReadNode(tree, tree->root);
-	
-	for (i = 0;
-		 i < rootNode->keyCount && strcmp(rootNode->keys[i], key) < 0;
-		 i++)
-		;
+	if (tree->root == 0)
+	{
+		btreeReleaseLockPath(&path);
+		btreeUnlockWriter(tree);
 
-	success = __delete(tree, tree->root, NULL, key, i, &filePos, &merged);
+		return 0;
+	}
+
+	success = __delete(tree, tree->root, NULL, key, 0, &filePos, &merged,
+					   &path);
 
 	if (success == 0)
 	{
-		btreeDestroyNode(rootNode);
+		btreeReleaseLockPath(&path);
+		btreeUnlockWriter(tree);
+
 		return 0;
 	}
 	
 	btreeSetTreeSize(tree, tree->size - 1);
+	gdbBloomRemove(tree, key);
+
+	/*
+	 * Read in the root node, which may have been copied. Only the writer
+	 * changes nodes, so this can be looked at without a lock.
+	 */
+	rootNode = btreeReadNode(tree, tree->root);
 
 	if (BTREE_IS_LEAF(rootNode) && rootNode->keyCount == 0)
 	{
 		btreeSetRootNode(tree, 0);
+		btreeSetLeftLeaf(tree, 0);
 		btreeEraseNode(rootNode);
 	}
 	else if (merged == 1 && rootNode->keyCount == 0)
@@ -449,8 +502,10 @@ btreeDelete(BTree *tree, const char *key)
 		btreeEraseNode(rootNode);
 	}
 
+	btreeReleaseLockPath(&path);
+	btreeUnlockWriter(tree);
+
 	btreeDestroyNode(rootNode);
 
 	return filePos;
 }
-
@@ -20,9 +20,25 @@
  */
 #include "db_internal.h"
 
+/* Returns where a header field is stored, in the file's format. */
+static offset_t
+__fieldPos(GDatabase *db, offset_t field)
+{
+	if (!GDB_IS_PAGED(db))
+		return field;
+
+	switch (field)
+	{
+		case BTREE_SIZE_OFFSET: return BTREE_PAGED_SIZE_OFFSET;
+		case BTREE_ROOT_OFFSET: return BTREE_PAGED_ROOT_OFFSET;
+		default:                return BTREE_PAGED_LEFT_LEAF_OFFSET;
+	}
+}
+
 void *
 btreeReadHeader(GdbBlock *block, const char *buffer, void *extra)
 {
+	GDatabase *db = block->db;
 	BTree *tree;
 	int counter = 0;
 
@@ -31,33 +47,45 @@ btreeReadHeader(GdbBlock *block, const char *buffer, void *extra)
 
 	tree->block = block;
 	
-	tree->order    = gdbGet8(buffer,  &counter);
+	if (GDB_IS_PAGED(db))
+		tree->order = gdbGet16(buffer, &counter);
+	else
+		tree->order = gdbGet8(buffer, &counter);
+
 	tree->size     = gdbGet32(buffer, &counter);
-	tree->root     = gdbGet32(buffer, &counter);
-	tree->leftLeaf = gdbGet32(buffer, &counter);
+	tree->root     = gdbGetOffset(buffer, &counter, db->offsetSize);
+	tree->leftLeaf = gdbGetOffset(buffer, &counter, db->offsetSize);
 
 	tree->minLeaf = (tree->order / 2);
 	tree->minInt  = ((tree->order + 1) / 2) - 1;
 
+	pthread_mutex_init(&tree->writeLock, NULL);
+
 	return tree;
 }
 
 void
 btreeWriteHeader(GdbBlock *block, char **buffer, unsigned long *size)
 {
+	GDatabase *db = block->db;
 	int counter = 0;
 	BTree *tree;
 	
 	tree = (BTree *)block->detail;
 
-	*size = BTREE_HEADER_DATA_SIZE;
+	*size = (GDB_IS_PAGED(db) ? BTREE_PAGED_HEADER_DATA_SIZE :
+			 BTREE_HEADER_DATA_SIZE);
 
-	MEM_CHECK(*buffer = (char *)malloc(BTREE_HEADER_DATA_SIZE));
+	MEM_CHECK(*buffer = (char *)malloc(*size));
 	
-	gdbPut8(*buffer,  &counter, tree->order);
+	if (GDB_IS_PAGED(db))
+		gdbPut16(*buffer, &counter, tree->order);
+	else
+		gdbPut8(*buffer, &counter, tree->order);
+
 	gdbPut32(*buffer, &counter, tree->size);
-	gdbPut32(*buffer, &counter, tree->root);
-	gdbPut32(*buffer, &counter, tree->leftLeaf);
+	gdbPutOffset(*buffer, &counter, tree->root,     db->offsetSize);
+	gdbPutOffset(*buffer, &counter, tree->leftLeaf, db->offsetSize);
 }
 
 void *
@@ -69,11 +97,21 @@ btreeCreateHeader(GdbBlock *block, void *extra)
 	memset(tree, 0, sizeof(BTree));
 	
 	tree->block = block;
-	tree->order = 5;
+
+	/* Paged trees get as many keys as typically fit in a page. */
+	if (GDB_IS_PAGED(block->db))
+	{
+		tree->order = (block->db->pageSize - GDB_BLOCK_HEADER_SIZE(block->db) -
+					   sizeof(short)) / BTREE_PAGED_ENTRY_SIZE;
+	}
+	else
+		tree->order = BTREE_DEFAULT_ORDER;
 	
 	tree->minLeaf = (tree->order / 2);
 	tree->minInt  = ((tree->order + 1) / 2) - 1;
 
+	pthread_mutex_init(&tree->writeLock, NULL);
+
 	return tree;
 }
 
@@ -83,6 +121,8 @@ btreeDestroyHeader(void *tree)
 	if (tree == NULL)
 		return;
 
+	pthread_mutex_destroy(&((BTree *)tree)->writeLock);
+
 	free(tree);
 }
 
@@ -91,6 +131,8 @@ btreeSetRootNode(BTree *tree, offset_t offset)
 {
 	FILE *fp;
 	GdbBlock *block;
+	unsigned char buffer[8];
+	int counter = 0;
 	
 	if (tree == NULL)
 		return;
@@ -98,17 +140,24 @@ btreeSetRootNode(BTree *tree, offset_t offset)
 	block = tree->block;
 	
 	fp = block->db->fp;
+
+	/* Snapshots still see the header as it was committed. */
+	gdbKeepTreeImage(tree);
 	
 	tree->root = offset;
 
-	fseek(fp, block->offset + GDB_BLOCK_HEADER_SIZE + BTREE_ROOT_OFFSET,
-		  SEEK_SET);
-	
-	offset = htonl(offset);
+	gdbPutOffset(buffer, &counter, offset, block->db->offsetSize);
+
+	gdbLockDatabase(block->db);
 
-	fwrite(&offset, sizeof(offset_t), 1, fp);
+	gdbFileWrite(block->db,
+				 block->offset + GDB_BLOCK_HEADER_SIZE(block->db) +
+				 __fieldPos(block->db, BTREE_ROOT_OFFSET),
+				 buffer, block->db->offsetSize);
 
 	fflush(fp);
+
+	gdbUnlockDatabase(block->db);
 }
 
 void
@@ -116,6 +165,8 @@ btreeSetLeftLeaf(BTree *tree, offset_t offset)
 {
 	FILE *fp;
 	GdbBlock *block;
+	unsigned char buffer[8];
+	int counter = 0;
 	
 	if (tree == NULL)
 		return;
@@ -123,17 +174,23 @@ btreeSetLeftLeaf(BTree *tree, offset_t offset)
 	block = tree->block;
 
 	fp = block->db->fp;
+
+	gdbKeepTreeImage(tree);
 	
 	tree->leftLeaf = offset;
 
-	fseek(fp, block->offset + GDB_BLOCK_HEADER_SIZE + BTREE_LEFT_LEAF_OFFSET,
-		  SEEK_SET);
+	gdbPutOffset(buffer, &counter, offset, block->db->offsetSize);
 
-	offset = htonl(offset);
+	gdbLockDatabase(block->db);
 
-	fwrite(&offset, sizeof(offset_t), 1, fp);
+	gdbFileWrite(block->db,
+				 block->offset + GDB_BLOCK_HEADER_SIZE(block->db) +
+				 __fieldPos(block->db, BTREE_LEFT_LEAF_OFFSET),
+				 buffer, block->db->offsetSize);
 
 	fflush(fp);
+
+	gdbUnlockDatabase(block->db);
 }
 
 void
@@ -141,6 +198,8 @@ btreeSetTreeSize(BTree *tree, unsigned long size)
 {
 	FILE *fp;
 	GdbBlock *block;
+	unsigned char buffer[4];
+	int counter = 0;
 	
 	if (tree == NULL)
 		return;
@@ -148,109 +207,144 @@ btreeSetTreeSize(BTree *tree, unsigned long size)
 	block = tree->block;
 
 	fp = block->db->fp;
+
+	gdbKeepTreeImage(tree);
 	
 	tree->size = size;
 
-	fseek(fp, block->offset + GDB_BLOCK_HEADER_SIZE + BTREE_SIZE_OFFSET,
-		  SEEK_SET);
+	gdbPut32(buffer, &counter, size);
 
-	size = htonl(size);
+	gdbLockDatabase(block->db);
 
-	fwrite(&size, sizeof(unsigned long), 1, fp);
+	gdbFileWrite(block->db,
+				 block->offset + GDB_BLOCK_HEADER_SIZE(block->db) +
+				 __fieldPos(block->db, BTREE_SIZE_OFFSET),
+				 buffer, counter);
 
 	fflush(fp);
+
+	gdbUnlockDatabase(block->db);
+}
+
+/*
+ * Reads a field of the tree header from disk, or from the database's
+ * mapping if it has one.
+ */
+static int
+__readField(GdbBlock *block, offset_t field, void *data, size_t size)
+{
+	GDatabase *db = block->db;
+	offset_t offset = block->offset + GDB_BLOCK_HEADER_SIZE(db) +
+	                  __fieldPos(db, field);
+
+	if (db->map != NULL && offset + size <= db->mapSize)
+	{
+		memcpy(data, db->map + offset, size);
+
+		return 1;
+	}
+
+	return (gdbFileRead(db, offset, data, size) == size);
 }
 
 offset_t
 btreeGetRootNode(BTree *tree)
 {
-	FILE *fp;
 	GdbBlock *block;
+	unsigned char root[8];
+	int counter = 0;
 	
 	if (tree == NULL)
 		return 0;
+
+	/* A snapshot's view keeps the root it was opened with. */
+	if (tree->snapshot != NULL)
+		return tree->root;
 	
 	block = tree->block;
 
-	fp = block->db->fp;
-	
-	fseek(fp, block->offset + GDB_BLOCK_HEADER_SIZE + BTREE_ROOT_OFFSET,
-		  SEEK_SET);
+	gdbLockDatabase(block->db);
 
-	if (fread(&tree->root, sizeof(offset_t), 1, fp) != 1)
+	if (!__readField(block, BTREE_ROOT_OFFSET, root, block->db->offsetSize))
 	{
 		pmError(PM_ERROR_FATAL,
 				_("GNUpdate DB: B+Tree: Unable to read the root node offset "
 				  "at %ld in %s, line %d\n"),
-				block->offset + GDB_BLOCK_HEADER_SIZE + BTREE_ROOT_OFFSET,
+				block->offset + GDB_BLOCK_HEADER_SIZE(block->db) +
+				__fieldPos(block->db, BTREE_ROOT_OFFSET),
 				__FILE__, __LINE__);
 		exit(1);
 	}
 
-	tree->root = ntohl(tree->root);
+	gdbUnlockDatabase(block->db);
 
-	return tree->root;
+	return gdbGetOffset(root, &counter, block->db->offsetSize);
 }
 
 offset_t
 btreeGetLeftLeaf(BTree *tree)
 {
-	FILE *fp;
 	GdbBlock *block;
+	unsigned char leftLeaf[8];
+	int counter = 0;
 	
 	if (tree == NULL)
 		return 0;
 
+	if (tree->snapshot != NULL)
+		return tree->leftLeaf;
+
 	block = tree->block;
 
-	fp = block->db->fp;
-	
-	fseek(fp, block->offset + GDB_BLOCK_HEADER_SIZE + BTREE_LEFT_LEAF_OFFSET,
-		  SEEK_SET);
+	gdbLockDatabase(block->db);
 
-	if (fread(&tree->leftLeaf, sizeof(offset_t), 1, fp) != 1)
+	if (!__readField(block, BTREE_LEFT_LEAF_OFFSET, leftLeaf,
+					 block->db->offsetSize))
 	{
 		pmError(PM_ERROR_FATAL,
 				_("GNUpdate DB: B+Tree: Unable to read the left leaf offset "
 				  "at %ld in %s, line %d\n"),
-				block->offset + GDB_BLOCK_HEADER_SIZE + BTREE_LEFT_LEAF_OFFSET,
+				block->offset + GDB_BLOCK_HEADER_SIZE(block->db) +
+				__fieldPos(block->db, BTREE_LEFT_LEAF_OFFSET),
 				__FILE__, __LINE__);
 		exit(1);
 	}
 
-	tree->leftLeaf = ntohl(tree->leftLeaf);
+	gdbUnlockDatabase(block->db);
 
-	return tree->leftLeaf;
+	return gdbGetOffset(leftLeaf, &counter, block->db->offsetSize);
 }
 
 unsigned long
 btreeGetTreeSize(BTree *tree)
 {
-	FILE *fp;
 	GdbBlock *block;
+	unsigned char size[4];
+	int counter = 0;
 	
 	if (tree == NULL)
 		return 0;
 
+	if (tree->snapshot != NULL)
+		return tree->size;
+
 	block = tree->block;
 
-	fp = block->db->fp;
-	
-	fseek(fp, block->offset + GDB_BLOCK_HEADER_SIZE + BTREE_SIZE_OFFSET,
-		  SEEK_SET);
+	gdbLockDatabase(block->db);
 
-	if (fread(&tree->size, sizeof(unsigned long), 1, fp) != 1)
+	if (!__readField(block, BTREE_SIZE_OFFSET, size, sizeof(size)))
 	{
 		pmError(PM_ERROR_FATAL,
 				_("GNUpdate DB: B+Tree: Unable to read the tree size at "
 				  "offset (%ld) in %s, line %d\n"),
-				block->offset + GDB_BLOCK_HEADER_SIZE + BTREE_SIZE_OFFSET,
+				block->offset + GDB_BLOCK_HEADER_SIZE(block->db) +
+				__fieldPos(block->db, BTREE_SIZE_OFFSET),
 				__FILE__, __LINE__);
 		exit(1);
 	}
 
-	tree->size = ntohl(tree->size);
+	gdbUnlockDatabase(block->db);
 
-	return tree->size;
+	return gdbGet32(size, &counter);
 }
 
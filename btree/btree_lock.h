@@ -24,6 +24,26 @@
 #include "btree.h"
 #include "db_lock.h"
 
+/**
+ * The locks held while descending a B+Tree.
+ *
+ * Nodes are locked top-down, each one before its parent is released
+ * (latch coupling.) Once a node is known to be safe, that is, it
+ * won't split or underflow, the locks above it are released.
+ */
+typedef struct
+{
+	BTree *tree;          /**< The active B+Tree.                  */
+	GdbLockType type;     /**< The type of locks taken.            */
+
+	char treeLocked;      /**< 1 if the tree lock is held.         */
+
+	offset_t *offsets;    /**< The locked nodes, top-down.         */
+	int count;            /**< The number of locked nodes.         */
+	int size;             /**< The size of the offsets array.      */
+
+} BTreeLockPath;
+
 /**
  * Locks a node.
  * 
@@ -38,6 +58,17 @@
  */
 char btreeLockNode(BTree *tree, offset_t nodeOffset, GdbLockType type);
 
+/**
+ * Locks a node, if that can be done without waiting.
+ *
+ * @param tree       The active B+Tree.
+ * @param nodeOffset The offset of the node to lock.
+ * @param type       The type of lock.
+ *
+ * @return 1 if the node was locked, or 0 otherwise.
+ */
+char btreeTryLockNode(BTree *tree, offset_t nodeOffset, GdbLockType type);
+
 /**
  * Unlocks a node.
  *
@@ -89,5 +120,56 @@ GdbLockType btreeGetNodeLock(BTree *tree, offset_t nodeOffset);
  */
 GdbLockType btreeGetTreeLock(BTree *tree);
 
+/**
+ * Waits until no other thread is writing to the tree, and marks the
+ * calling thread as the tree's writer.
+ *
+ * Only one insert or delete runs on a tree at a time. Readers are not
+ * blocked by this, only by the node locks the writer holds.
+ *
+ * @param tree The active B+Tree.
+ */
+void btreeLockWriter(BTree *tree);
+
+/**
+ * Lets the next writer into the tree.
+ *
+ * @param tree The active B+Tree.
+ */
+void btreeUnlockWriter(BTree *tree);
+
+/**
+ * Starts a lock path, locking the tree.
+ *
+ * @param path The lock path.
+ * @param tree The active B+Tree.
+ * @param type The type of lock to take on the tree and its nodes.
+ */
+void btreeInitLockPath(BTreeLockPath *path, BTree *tree, GdbLockType type);
+
+/**
+ * Locks a node and adds it to the bottom of a lock path.
+ *
+ * @param path       The lock path.
+ * @param nodeOffset The offset of the node.
+ */
+void btreeLockPathNode(BTreeLockPath *path, offset_t nodeOffset);
+
+/**
+ * Releases the tree and every node in a lock path except the last one.
+ *
+ * This is called when the last node is safe.
+ *
+ * @param path The lock path.
+ */
+void btreeReleaseAncestors(BTreeLockPath *path);
+
+/**
+ * Releases every lock in a lock path.
+ *
+ * @param path The lock path.
+ */
+void btreeReleaseLockPath(BTreeLockPath *path);
+
 #endif /* _BTREE_LOCK_H_ */
 
@@ -20,194 +20,454 @@
  */
 #include "db_internal.h"
 
+/*
+ * Packs the 4 bytes at the start of a key (or less, if it ends first)
+ * into an integer that sorts the same way strcmp() does.
+ */
 static unsigned long
-__getNodeSize(BTreeNode *node, const unsigned short *keySizes)
+__packPrefix(const char *key)
 {
-	long l, i;
-
-	if (node == NULL)
-		return 0;
+	const unsigned char *c = (const unsigned char *)key;
+	unsigned long prefix = 0;
+	int i;
 
-	if (keySizes == NULL)
-		keySizes = node->keySizes;
-	
-	l = sizeof(char) +
-		(node->tree->order * sizeof(offset_t)) +
-		((node->tree->order - 1) * sizeof(unsigned short));
+	for (i = 0; i < 4; i++)
+	{
+		prefix <<= 8;
 
-	for (i = 0; i < node->tree->order - 1; i++)
-		l += keySizes[i];
+		if (*c != '\0')
+			prefix |= *c++;
+	}
 
-	return l;
+	return prefix;
 }
 
+/*
+ * Updates the shared prefix length after a change to the node's keys,
+ * and the packed prefix of the changed key (if any.)
+ *
+ * Keys are sorted, so the prefix they all share is the one shared by
+ * the first and last keys.
+ */
 static void
-__compressNode(BTreeNode *node, char ***newKeys, unsigned short **newKeySizes)
+__updatePrefixes(BTreeNode *node, int index)
 {
+	const char *first, *last;
+	unsigned short len;
 	int i;
 
-	if (node == NULL || node->keyCount < 2)
+	if (node->keyCount == 0)
+	{
+		node->prefixLen = 0;
 		return;
+	}
 
-	MEM_CHECK(*newKeys = (char **)malloc((node->tree->order - 1) *
-										 sizeof(char *)));
-	memset(*newKeys, 0, (node->tree->order - 1) * sizeof(char *));
+	first = BTREE_KEY(node, 0);
+	last  = BTREE_KEY(node, node->keyCount - 1);
 
-	
-	MEM_CHECK(*newKeySizes =
-			  (unsigned short *)malloc((node->tree->order - 1) *
-									   sizeof(unsigned short)));
-	memset(*newKeySizes, 0, (node->tree->order - 1) * sizeof(unsigned short));
+	for (len = 0; first[len] != '\0' && first[len] == last[len]; len++)
+		;
 
-	(*newKeys)[0]     = strdup(node->keys[0]);
-	(*newKeySizes)[0] = node->keySizes[0];
-	
-	for (i = node->keyCount - 1; i > 0; i--)
+	if (len != node->prefixLen)
+	{
+		node->prefixLen = len;
+
+		for (i = 0; i < node->keyCount; i++)
+			node->keyPrefixes[i] = __packPrefix(BTREE_KEY(node, i) + len);
+	}
+	else if (index >= 0)
 	{
-		gdbCompressString(node->keys[i - 1], node->keySizes[i - 1],
-						  node->keys[i], node->keySizes[i],
-						  &(*newKeys)[i], &(*newKeySizes)[i]);
+		node->keyPrefixes[index] =
+			__packPrefix(BTREE_KEY(node, index) + node->prefixLen);
 	}
 }
 
-static void
-__uncompressNode(BTreeNode *node, char ***newKeys,
-				 unsigned short **newKeySizes)
+/*
+ * Copies a key into the key buffer, and returns its offset.
+ *
+ * When the buffer is full, the live keys are copied to a new buffer,
+ * leaving behind the space used by keys that were replaced or removed.
+ * The key may point into the old buffer.
+ */
+static unsigned long
+__storeKey(BTreeNode *node, const char *key, unsigned short size)
 {
-	int i;
-	
-	if (node == NULL || node->keyCount < 2)
-		return;
+	unsigned long offset;
+
+	if (node->keyBufUsed + size > node->keyBufSize)
+	{
+		char *newBuf;
+		unsigned long newSize, used;
+		int i;
+
+		newSize = size;
+
+		for (i = 0; i < node->keyCount; i++)
+			newSize += node->keySizes[i];
+
+		newSize = (newSize < 32 ? 64 : 2 * newSize);
+
+		MEM_CHECK(newBuf = (char *)malloc(newSize));
+
+		for (i = 0, used = 0; i < node->keyCount; i++)
+		{
+			if (node->keySizes[i] == 0)
+				continue;
+
+			memcpy(newBuf + used, BTREE_KEY(node, i), node->keySizes[i]);
+
+			node->keyOffsets[i] = used;
+			used += node->keySizes[i];
+		}
+
+		memcpy(newBuf + used, key, size);
+
+		if (node->keyBuf != NULL)
+			free(node->keyBuf);
+
+		node->keyBuf     = newBuf;
+		node->keyBufSize = newSize;
+		node->keyBufUsed = used + size;
+
+		return used;
+	}
+
+	offset = node->keyBufUsed;
+
+	memcpy(node->keyBuf + offset, key, size);
+
+	node->keyBufUsed += size;
+
+	return offset;
+}
+
+static int
+__compareKey(BTreeNode *node, int index, const char *key,
+			 unsigned long keyPrefix)
+{
+	unsigned long prefix = node->keyPrefixes[index];
+
+	if (prefix != keyPrefix)
+		return (prefix < keyPrefix ? -1 : 1);
+
+	/* The keys end within the packed bytes. */
+	if ((prefix & 0xFF) == 0)
+		return 0;
+
+	return strcmp(BTREE_KEY(node, index) + node->prefixLen + 4,
+				  key + node->prefixLen + 4);
+}
+
+int
+btreeFindKey(BTreeNode *node, const char *key, char *found)
+{
+	unsigned long keyPrefix;
+	int lo, hi, mid, cmp;
+
+	if (found != NULL)
+		*found = 0;
+
+	if (node->keyCount == 0)
+		return 0;
+
+	/* Every key in the node starts with the same prefix. */
+	cmp = strncmp(key, BTREE_KEY(node, 0), node->prefixLen);
+
+	if (cmp < 0)
+		return 0;
+	else if (cmp > 0)
+		return node->keyCount;
+
+	keyPrefix = __packPrefix(key + node->prefixLen);
+
+	lo = 0;
+	hi = node->keyCount;
+
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+
+		if (__compareKey(node, mid, key, keyPrefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (found != NULL && lo < node->keyCount &&
+		__compareKey(node, lo, key, keyPrefix) == 0)
+	{
+		*found = 1;
+	}
+
+	return lo;
+}
+
+void
+btreeSetKey(BTreeNode *node, int index, const char *key)
+{
+	unsigned short size = strlen(key) + 1;
+
+	node->keyOffsets[index] = __storeKey(node, key, size);
+	node->keySizes[index]   = size;
+
+	__updatePrefixes(node, index);
+}
+
+void
+btreeInsertKey(BTreeNode *node, int index, const char *key)
+{
+	int count = node->keyCount - index;
+
+	if (count > 0)
+	{
+		memmove(&node->keySizes[index + 1], &node->keySizes[index],
+				count * sizeof(unsigned short));
+		memmove(&node->keyOffsets[index + 1], &node->keyOffsets[index],
+				count * sizeof(unsigned long));
+		memmove(&node->keyPrefixes[index + 1], &node->keyPrefixes[index],
+				count * sizeof(unsigned long));
+	}
+
+	/* Keep the key from being counted as live if the buffer moves. */
+	node->keySizes[index] = 0;
 
-	MEM_CHECK(*newKeys = (char **)malloc((node->tree->order - 1) *
-										 sizeof(char *)));
-	memset(*newKeys, 0, (node->tree->order - 1) * sizeof(char *));
+	node->keyCount++;
 
+	btreeSetKey(node, index, key);
+}
 
-	MEM_CHECK(*newKeySizes =
-			  (unsigned short *)malloc((node->tree->order - 1) *
-									   sizeof(unsigned short)));
-	memset(*newKeySizes, 0, (node->tree->order - 1) * sizeof(unsigned short));
-       	
-	(*newKeys)[0]     = strdup(node->keys[0]);
-	(*newKeySizes)[0] = node->keySizes[0];
+void
+btreeRemoveKey(BTreeNode *node, int index)
+{
+	int count = node->keyCount - index - 1;
 
-	for (i = 1; i <= node->keyCount - 1; i++)
+	if (count > 0)
 	{
-		gdbUncompressString((*newKeys)[i - 1], (*newKeySizes)[i - 1],
-							node->keys[i], node->keySizes[i],
-							&(*newKeys)[i], &(*newKeySizes)[i]);
+		memmove(&node->keySizes[index], &node->keySizes[index + 1],
+				count * sizeof(unsigned short));
+		memmove(&node->keyOffsets[index], &node->keyOffsets[index + 1],
+				count * sizeof(unsigned long));
+		memmove(&node->keyPrefixes[index], &node->keyPrefixes[index + 1],
+				count * sizeof(unsigned long));
 	}
+
+	node->keyCount--;
+
+	node->keySizes[(int)node->keyCount]    = 0;
+	node->keyOffsets[(int)node->keyCount]  = 0;
+	node->keyPrefixes[(int)node->keyCount] = 0;
+
+	__updatePrefixes(node, -1);
 }
 
 void *
 btreeReadNodeBlock(GdbBlock *block, const char *buffer, void *extra)
 {
+	GDatabase *db = block->db;
 	BTreeNode *node;
-	int i, counter = 0;
+	const char *data;
+	unsigned short *diskSizes;
+	unsigned short preLen;
+	unsigned long total;
+	int i, counter = 0, childCount, sizeCount;
 
 	node = btreeCreateNodeBlock(block, extra);
 
-	node->tree  = (BTree *)extra;
-	node->block = block;
+	/*
+	 * Paged nodes only store what's in use: the keys and the children
+	 * around them. Older nodes have room for a full node.
+	 */
+	if (GDB_IS_PAGED(db))
+	{
+		node->keyCount = gdbGet16(buffer, &counter);
 
-	node->keyCount = gdbGet8(buffer, &counter);
+		childCount = node->keyCount + 1;
+		sizeCount  = node->keyCount;
+	}
+	else
+	{
+		node->keyCount = gdbGet8(buffer, &counter);
+
+		childCount = node->tree->order;
+		sizeCount  = node->tree->order - 1;
+	}
 
-	for (i = 0; i < node->tree->order; i++)
-		node->children[i] = gdbGet32(buffer, &counter);
+	MEM_CHECK(diskSizes = (unsigned short *)malloc(node->tree->order *
+												   sizeof(unsigned short)));
 
-	for (i = 0; i < node->tree->order - 1; i++)
-		node->keySizes[i] = gdbGet16(buffer, &counter);
+	for (i = 0; i < childCount; i++)
+		node->children[i] = gdbGetOffset(buffer, &counter, db->offsetSize);
 
-	for (i = 0; i < node->tree->order - 1; i++)
+	for (i = 0; i < sizeCount; i++)
+		diskSizes[i] = gdbGet16(buffer, &counter);
+
+	/*
+	 * All but the first key are stored as a byte holding the length of
+	 * the prefix shared with the previous key, followed by the rest of
+	 * the key. Work out the uncompressed size, and then expand them all
+	 * into the key buffer in one pass.
+	 */
+	data  = buffer + counter;
+	total = 0;
+
+	for (i = 0; i < node->keyCount; i++)
 	{
-		if (node->keySizes[i] > 0)
+		if (i == 0 || node->keyCount < 2)
+			node->keySizes[i] = diskSizes[i];
+		else
 		{
-			MEM_CHECK(node->keys[i] = (char *)malloc(node->keySizes[i]));
-			memcpy(node->keys[i], buffer + counter, node->keySizes[i]);
+			preLen = (unsigned char)data[0];
 
-			counter += node->keySizes[i];
+			node->keySizes[i] = preLen + diskSizes[i] - 1;
 		}
+
+		data  += diskSizes[i];
+		total += node->keySizes[i];
 	}
 
-	if (node->keyCount >= 2)
+	node->keyBufSize = (total < 64 ? 64 : total);
+
+	MEM_CHECK(node->keyBuf = (char *)malloc(node->keyBufSize));
+
+	data = buffer + counter;
+
+	for (i = 0; i < node->keyCount; i++)
 	{
-		char **newKeys;
-		unsigned short *newKeySizes;
+		char *key = node->keyBuf + node->keyBufUsed;
 
-		__uncompressNode(node, &newKeys, &newKeySizes);
+		node->keyOffsets[i] = node->keyBufUsed;
 
-		/* Free up the compressed keys. */
-		for (i = 0; i < node->keyCount; i++)
+		if (i == 0 || node->keyCount < 2)
+			memcpy(key, data, diskSizes[i]);
+		else
 		{
-			if (node->keys[i] != NULL)
-				free(node->keys[i]);
-		}
+			preLen = (unsigned char)data[0];
 
-		free(node->keys);
-		free(node->keySizes);
+			memcpy(key, BTREE_KEY(node, i - 1), preLen);
+			memcpy(key + preLen, data + 1, diskSizes[i] - 1);
+		}
 
-		/* Move over the new arrays. */
-		node->keys     = newKeys;
-		node->keySizes = newKeySizes;
+		data += diskSizes[i];
+		node->keyBufUsed += node->keySizes[i];
 	}
 
+	free(diskSizes);
+
+	__updatePrefixes(node, -1);
+
+	for (i = 0; i < node->keyCount; i++)
+		node->keyPrefixes[i] = __packPrefix(BTREE_KEY(node, i) +
+											node->prefixLen);
+
 	return node;
 }
 
+/*
+ * Returns the length of the prefix a key shares with the previous key,
+ * as stored on disk.
+ */
+static unsigned short
+__getStoredPrefix(BTreeNode *node, int index)
+{
+	const char *c1, *c2;
+	unsigned short preLen, minLen;
+
+	minLen = node->keySizes[index - 1];
+
+	if (node->keySizes[index] < minLen)
+		minLen = node->keySizes[index];
+
+	if (minLen > 255)
+		minLen = 255;
+
+	for (c1 = BTREE_KEY(node, index - 1), c2 = BTREE_KEY(node, index),
+		 preLen = 0;
+		 preLen < minLen && *c1 == *c2;
+		 c1++, c2++, preLen++)
+		;
+
+	return preLen;
+}
+
 void
 btreeWriteNodeBlock(GdbBlock *block, char **buffer, unsigned long *size)
 {
+	GDatabase *db = block->db;
 	BTreeNode *node;
-	int i, counter = 0;
-	char **newKeys;
-	unsigned short *newKeySizes;
+	unsigned short *diskSizes;
+	unsigned short preLen;
+	int i, counter = 0, childCount, sizeCount;
 
 	node = (BTreeNode *)block->detail;
 
-	/* Compress the node. */
-	if (node->keyCount >= 2)
-		__compressNode(node, &newKeys, &newKeySizes);
-	else
+	if (GDB_IS_PAGED(db))
 	{
-		newKeys     = node->keys;
-		newKeySizes = node->keySizes;
+		childCount = node->keyCount + 1;
+		sizeCount  = node->keyCount;
+
+		*size = sizeof(short);
 	}
-	
-	*size = __getNodeSize(node, newKeySizes);
+	else
+	{
+		childCount = node->tree->order;
+		sizeCount  = node->tree->order - 1;
 
-	MEM_CHECK(*buffer = (char *)malloc(*size));
-			
-	gdbPut8(*buffer, &counter, node->keyCount);
+		*size = sizeof(char);
+	}
 
-	for (i = 0; i < node->tree->order; i++)
-		gdbPut32(*buffer, &counter, node->children[i]);
+	*size += childCount * db->offsetSize +
+	         sizeCount * sizeof(unsigned short);
 
-	for (i = 0; i < node->tree->order - 1; i++)
-		gdbPut16(*buffer, &counter, newKeySizes[i]);
+	MEM_CHECK(diskSizes = (unsigned short *)malloc(node->tree->order *
+												   sizeof(unsigned short)));
 
-	for (i = 0; i < node->tree->order - 1; i++)
+	/* Prefix-compress the keys, if there's more than one. */
+	for (i = 0; i < sizeCount; i++)
 	{
-		if (newKeySizes[i] > 0)
+		if (i >= node->keyCount)
+			diskSizes[i] = 0;
+		else if (i == 0 || node->keyCount < 2)
+			diskSizes[i] = node->keySizes[i];
+		else
 		{
-			memcpy(*buffer + counter, newKeys[i], newKeySizes[i]);
+			preLen = __getStoredPrefix(node, i);
 
-			counter += newKeySizes[i];
+			diskSizes[i] = node->keySizes[i] - preLen + 1;
 		}
+
+		*size += diskSizes[i];
 	}
 
-	if (node->keyCount >= 2)
+	MEM_CHECK(*buffer = (char *)malloc(*size));
+			
+	if (GDB_IS_PAGED(db))
+		gdbPut16(*buffer, &counter, node->keyCount);
+	else
+		gdbPut8(*buffer, &counter, node->keyCount);
+
+	for (i = 0; i < childCount; i++)
+		gdbPutOffset(*buffer, &counter, node->children[i], db->offsetSize);
+
+	for (i = 0; i < sizeCount; i++)
+		gdbPut16(*buffer, &counter, diskSizes[i]);
+
+	for (i = 0; i < node->keyCount; i++)
 	{
-		/* Free up the arrays. */
-		for (i = 0; i < node->keyCount; i++)
+		if (i == 0 || node->keyCount < 2)
+			memcpy(*buffer + counter, BTREE_KEY(node, i), diskSizes[i]);
+		else
 		{
-			if (newKeys[i] != NULL)
-				free(newKeys[i]);
+			preLen = node->keySizes[i] - diskSizes[i] + 1;
+
+			(*buffer)[counter] = (char)preLen;
+			memcpy(*buffer + counter + 1, BTREE_KEY(node, i) + preLen,
+				   diskSizes[i] - 1);
 		}
 
-		free(newKeys);
-		free(newKeySizes);
+		counter += diskSizes[i];
 	}
+
+	free(diskSizes);
 }
 
 void *
@@ -224,20 +484,30 @@ btreeCreateNodeBlock(GdbBlock *block, void *extra)
 	node->tree  = tree;
 	node->block = block;
 
-	MEM_CHECK(node->children = (offset_t *)malloc(tree->order *
+	/* Keep the tree header around for as long as the node is. */
+	gdbLockDatabase(block->db);
+	gdbCacheRefBlock(tree->block);
+	gdbUnlockDatabase(block->db);
+
+	/*
+	 * There's room for one more key and child than the order allows,
+	 * so a full node can take a new key before it's split.
+	 */
+	MEM_CHECK(node->children = (offset_t *)malloc((tree->order + 1) *
 												  sizeof(offset_t)));
-	memset(node->children, 0, tree->order * sizeof(offset_t));
-	
+	memset(node->children, 0, (tree->order + 1) * sizeof(offset_t));
 	
 	MEM_CHECK(node->keySizes =
-			  (unsigned short *)malloc((tree->order - 1) *
-									   sizeof(unsigned short)));
-	memset(node->keySizes, 0, (tree->order -1)  * sizeof(unsigned short));
+			  (unsigned short *)malloc(tree->order * sizeof(unsigned short)));
+	memset(node->keySizes, 0, tree->order * sizeof(unsigned short));
 
-	
-	MEM_CHECK(node->keys = (char **)malloc((tree->order - 1) *
-										   sizeof(char *)));
-	memset(node->keys, 0, (tree->order - 1) * sizeof(char *));
+	MEM_CHECK(node->keyOffsets =
+			  (unsigned long *)malloc(tree->order * sizeof(unsigned long)));
+	memset(node->keyOffsets, 0, tree->order * sizeof(unsigned long));
+
+	MEM_CHECK(node->keyPrefixes =
+			  (unsigned long *)malloc(tree->order * sizeof(unsigned long)));
+	memset(node->keyPrefixes, 0, tree->order * sizeof(unsigned long));
 	
 	return node;
 }
@@ -246,17 +516,10 @@ void
 btreeDestroyNodeBlock(void *data)
 {
 	BTreeNode *node = (BTreeNode *)data;
-	int i;
 	
 	if (node == NULL)
 		return;
 
-	for (i = 0; i < node->keyCount; i++)
-	{
-		if (node->keys[i] != NULL)
-			free(node->keys[i]);
-	}
-
 	if (GDB_IS_DIRTY(node->block))
 	{
 		pmError(PM_ERROR_WARNING,
@@ -265,9 +528,15 @@ btreeDestroyNodeBlock(void *data)
 				node->block->offset);
 	}
 
+	gdbDestroyBlock(node->tree->block);
+
 	free(node->children);
 	free(node->keySizes);
-	free(node->keys);
+	free(node->keyOffsets);
+	free(node->keyPrefixes);
+
+	if (node->keyBuf != NULL)
+		free(node->keyBuf);
 
 	free(node);
 }
@@ -307,7 +576,12 @@ btreeReadNode(BTree *tree, offset_t offset)
 	if (tree == NULL || offset < DB_HEADER_BLOCK_SIZE)
 		return NULL;
 
-	block = gdbReadBlock(tree->block->db, offset, GDB_BLOCK_BTREE_NODE, tree);
+	/*
+	 * Nodes are shared with the tree's own view, and may stay cached
+	 * after a snapshot's view is closed, so they belong to the tree.
+	 */
+	block = gdbReadBlock(tree->block->db, offset, GDB_BLOCK_BTREE_NODE,
+						 tree->block->detail);
 
 	if (block == NULL)
 		return NULL;
@@ -315,6 +589,28 @@ btreeReadNode(BTree *tree, offset_t offset)
 	return (BTreeNode *)block->detail;
 }
 
+void
+btreeShadowNode(BTree *tree, BTreeNode **node)
+{
+	GdbBlock *block;
+	offset_t oldOffset;
+
+	if (tree == NULL || node == NULL || *node == NULL)
+		return;
+
+	oldOffset = (*node)->block->offset;
+
+	block = gdbShadowBlock((*node)->block, tree->block->detail);
+
+	if (block->offset == oldOffset)
+		return;
+
+	*node = (BTreeNode *)block->detail;
+
+	if (btreeGetLeftLeaf(tree) == oldOffset)
+		btreeSetLeftLeaf(tree, block->offset);
+}
+
 offset_t
 btreeWriteNode(BTreeNode *node)
 {
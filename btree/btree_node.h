@@ -32,6 +32,7 @@
 /*@{*/
 #define BTREE_IS_LEAF(node) (GDB_GET_FLAG((node)->block, BTREE_FLAG_LEAF) == 1)
 #define BTREE_SET_LEAF(node) GDB_SET_FLAG((node)->block, BTREE_FLAG_LEAF)
+#define BTREE_KEY(node, i)   ((node)->keyBuf + (node)->keyOffsets[(i)])
 /*@}*/
 
 /**
@@ -118,6 +119,82 @@ BTreeNode *btreeReadNode(BTree *tree, offset_t offset);
  */
 offset_t btreeWriteNode(BTreeNode *node);
 
+/**
+ * Gets a node that can be changed without disturbing snapshots.
+ *
+ * If the node is part of a committed copy-on-write file, it is copied
+ * to a new block and the old one is retired. The parent has to be
+ * pointed at the new offset by the caller. The tree's left leaf is
+ * updated if it moves.
+ *
+ * @param tree The active B+Tree.
+ * @param node The node. It is replaced with the copy, if one is made.
+ */
+void btreeShadowNode(BTree *tree, BTreeNode **node);
+
+/**
+ * Finds the leaf node that a key belongs in.
+ *
+ * The tree is descended with read locks, each node being locked before
+ * its parent is released. The lock path must have been started with
+ * btreeInitLockPath().
+ *
+ * @param tree The active B+Tree.
+ * @param key  The key.
+ * @param path The lock path.
+ *
+ * @return The leaf node, still locked, or NULL if the tree is empty.
+ *         The caller must destroy the node and release the lock path.
+ */
+BTreeNode *btreeFindLeaf(BTree *tree, const char *key, BTreeLockPath *path);
+
+/**
+ * Finds the position of a key in a node.
+ *
+ * This is a binary search. Keys are compared first by the bytes
+ * following the prefix shared by every key in the node, and only by
+ * string comparison when those are equal.
+ *
+ * @param node  The node.
+ * @param key   The key to find.
+ * @param found Set to 1 if the key is in the node, or 0 otherwise.
+ *              This may be NULL.
+ *
+ * @return The index of the first key not less than the key, or the
+ *         number of keys if there is none.
+ */
+int btreeFindKey(BTreeNode *node, const char *key, char *found);
+
+/**
+ * Replaces a key in a node.
+ *
+ * @param node  The node.
+ * @param index The index of the key.
+ * @param key   The new key. This is copied.
+ */
+void btreeSetKey(BTreeNode *node, int index, const char *key);
+
+/**
+ * Inserts a key into a node, moving the keys after it along.
+ *
+ * The children are left as they are.
+ *
+ * @param node  The node.
+ * @param index The index to insert at.
+ * @param key   The key. This is copied.
+ */
+void btreeInsertKey(BTreeNode *node, int index, const char *key);
+
+/**
+ * Removes a key from a node, moving the keys after it back.
+ *
+ * The children are left as they are.
+ *
+ * @param node  The node.
+ * @param index The index of the key to remove.
+ */
+void btreeRemoveKey(BTreeNode *node, int index);
+
 /**
  * Erases a node from disk.
  *
@@ -20,6 +20,15 @@
  */
 #include "db_internal.h"
 
+/*
+ * Where a traversal is, relative to its current key.
+ */
+#define BTREE_TRAV_NONE   0 /* Not started.                          */
+#define BTREE_TRAV_AT     1 /* On the key, which was just returned.  */
+#define BTREE_TRAV_BEFORE 2 /* Just before the key.                  */
+#define BTREE_TRAV_AFTER  3 /* Just after the key.                   */
+#define BTREE_TRAV_END    4 /* After every key in the tree.          */
+
 void
 btreeTraverse(BTree *tree, void (*process)(offset_t filePos))
 {
@@ -43,6 +52,12 @@ btreeTraverse(BTree *tree, void (*process)(offset_t filePos))
 
 BTreeTraversal *
 btreeInitTraversal(BTree *tree)
+{
+	return btreeInitRangeTraversal(tree, NULL, NULL);
+}
+
+BTreeTraversal *
+btreeInitRangeTraversal(BTree *tree, const char *minKey, const char *maxKey)
 {
 	BTreeTraversal *trav;
 
@@ -54,6 +69,46 @@ btreeInitTraversal(BTree *tree)
 
 	trav->tree = tree;
 
+	if (minKey != NULL)
+		trav->minKey = strdup(minKey);
+
+	if (maxKey != NULL)
+		trav->maxKey = strdup(maxKey);
+
+	return trav;
+}
+
+BTreeTraversal *
+btreeInitPrefixTraversal(BTree *tree, const char *prefix)
+{
+	BTreeTraversal *trav;
+	size_t len;
+
+	if (tree == NULL || prefix == NULL)
+		return NULL;
+
+	trav = btreeInitRangeTraversal(tree, prefix, NULL);
+
+	/*
+	 * The range ends at the prefix with its last byte bumped up, after
+	 * dropping any trailing 0xFF bytes, which can't be. If that's all of
+	 * them, the range runs to the end of the tree.
+	 */
+	for (len = strlen(prefix);
+		 len > 0 && (unsigned char)prefix[len - 1] == 0xFF;
+		 len--)
+		;
+
+	if (len > 0)
+	{
+		MEM_CHECK(trav->maxKey = (char *)malloc(len + 1));
+
+		memcpy(trav->maxKey, prefix, len);
+
+		trav->maxKey[len - 1]++;
+		trav->maxKey[len] = '\0';
+	}
+
 	return trav;
 }
 
@@ -66,66 +121,498 @@ btreeDestroyTraversal(BTreeTraversal *trav)
 	if (trav->node != NULL)
 		btreeDestroyNode(trav->node);
 
+	if (trav->key != NULL)
+		free(trav->key);
+
+	if (trav->minKey != NULL)
+		free(trav->minKey);
+
+	if (trav->maxKey != NULL)
+		free(trav->maxKey);
+
 	free(trav);
 
 	return NULL;
 }
 
-offset_t
-btreeGetFirstOffset(BTreeTraversal *trav)
+static void
+__setKey(BTreeTraversal *trav, const char *key, char where)
 {
-	if (trav == NULL)
-		return -1;
+	unsigned long len = strlen(key) + 1;
+
+	if (len > trav->keyBufSize)
+	{
+		MEM_CHECK(trav->key = (char *)realloc(trav->key, len));
+		trav->keyBufSize = len;
+	}
+
+	memcpy(trav->key, key, len);
+
+	trav->where = where;
+}
+
+static char
+__inRange(BTreeTraversal *trav, const char *key)
+{
+	if (trav->minKey != NULL && strcmp(key, trav->minKey) < 0)
+		return 0;
+
+	if (trav->maxKey != NULL && strcmp(key, trav->maxKey) >= 0)
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Finds the leaf holding the last key before a key, or the last key in
+ * the tree if key is NULL. That leaf may hang off a sibling of any node
+ * on the way down, so they all stay locked.
+ */
+static BTreeNode *
+__findLeafBefore(BTree *tree, const char *key, BTreeLockPath *path)
+{
+	BTreeNode *node;
+	offset_t offset, prevOffset = 0;
+	int i;
+
+	offset = btreeGetRootNode(tree);
+
+	if (offset == 0)
+		return NULL;
+
+	btreeLockPathNode(path, offset);
+
+	node = btreeReadNode(tree, offset);
+
+	while (!BTREE_IS_LEAF(node))
+	{
+		i = (key == NULL ? node->keyCount : btreeFindKey(node, key, NULL));
+
+		/* Everything under the child to the left comes before the key. */
+		if (i > 0)
+			prevOffset = node->children[i - 1];
+
+		offset = node->children[i];
+
+		btreeLockPathNode(path, offset);
+		btreeDestroyNode(node);
+
+		node = btreeReadNode(tree, offset);
+	}
+
+	if (key != NULL && prevOffset != 0 && btreeFindKey(node, key, NULL) == 0)
+	{
+		/* Nothing here comes before the key. Take the last leaf to the left. */
+		btreeDestroyNode(node);
+
+		offset = prevOffset;
+
+		btreeLockPathNode(path, offset);
+
+		node = btreeReadNode(tree, offset);
+
+		while (!BTREE_IS_LEAF(node))
+		{
+			offset = node->children[(int)node->keyCount];
+
+			btreeLockPathNode(path, offset);
+			btreeDestroyNode(node);
+
+			node = btreeReadNode(tree, offset);
+		}
+	}
+
+	return node;
+}
+
+/*
+ * Finds the leaf after the one a key belongs in. As with
+ * __findLeafBefore, everything on the way down stays locked.
+ */
+static BTreeNode *
+__findLeafAfter(BTree *tree, const char *key, BTreeLockPath *path)
+{
+	BTreeNode *node;
+	offset_t offset, nextOffset = 0;
+	int i;
+
+	offset = btreeGetRootNode(tree);
+
+	if (offset == 0)
+		return NULL;
+
+	btreeLockPathNode(path, offset);
+
+	node = btreeReadNode(tree, offset);
+
+	while (!BTREE_IS_LEAF(node))
+	{
+		i = btreeFindKey(node, key, NULL);
+
+		/* Everything under the child to the right comes after the leaf. */
+		if (i < node->keyCount)
+			nextOffset = node->children[i + 1];
+
+		offset = node->children[i];
+
+		btreeLockPathNode(path, offset);
+		btreeDestroyNode(node);
+
+		node = btreeReadNode(tree, offset);
+	}
+
+	btreeDestroyNode(node);
+
+	if (nextOffset == 0)
+		return NULL;
+
+	offset = nextOffset;
+
+	btreeLockPathNode(path, offset);
+
+	node = btreeReadNode(tree, offset);
+
+	while (!BTREE_IS_LEAF(node))
+	{
+		offset = node->children[0];
+
+		btreeLockPathNode(path, offset);
+		btreeDestroyNode(node);
+
+		node = btreeReadNode(tree, offset);
+	}
+
+	return node;
+}
+
+/*
+ * Makes the leaf holding a key (or, if before is set, the last key
+ * before it) the traversal's node, and leaves it locked.
+ */
+static void
+__seekLeaf(BTreeTraversal *trav, const char *key, char before)
+{
+	BTreeLockPath path;
 
 	if (trav->node != NULL)
-		return btreeGetNextOffset(trav);
+	{
+		btreeDestroyNode(trav->node);
+		trav->node = NULL;
+	}
+
+	trav->retireCount = gdbGetRetireCount(trav->tree->block->db);
+
+	btreeInitLockPath(&path, trav->tree, DB_READ_LOCK);
+
+	if (before || key == NULL)
+		trav->node = __findLeafBefore(trav->tree, key, &path);
+	else
+		trav->node = btreeFindLeaf(trav->tree, key, &path);
+
+	if (trav->node != NULL)
+	{
+		/* Keep the leaf locked for the caller. */
+		btreeReleaseAncestors(&path);
+		path.count = 0;
+	}
+
+	btreeReleaseLockPath(&path);
+}
+
+/*
+ * Makes the leaf after the one a key belongs in the traversal's node,
+ * and leaves it locked. If there isn't one, the node is left alone,
+ * unlocked, and 0 is returned.
+ */
+static char
+__seekNextLeaf(BTreeTraversal *trav, const char *key)
+{
+	BTreeLockPath path;
+	BTreeNode *node;
+
+	trav->retireCount = gdbGetRetireCount(trav->tree->block->db);
+
+	btreeInitLockPath(&path, trav->tree, DB_READ_LOCK);
+
+	node = __findLeafAfter(trav->tree, key, &path);
+
+	if (node != NULL)
+	{
+		btreeReleaseAncestors(&path);
+		path.count = 0;
+
+		btreeDestroyNode(trav->node);
+		trav->node = node;
+	}
+
+	btreeReleaseLockPath(&path);
+
+	return (node != NULL);
+}
 
-	trav->tree->leftLeaf = btreeGetLeftLeaf(trav->tree);
+/*
+ * Works out where the next key in a direction is in the traversal's
+ * node. Moving forward, it's the key at the returned position. Moving
+ * back, it's the one before.
+ *
+ * If trust is set, the node may have changed since the traversal was
+ * last there, so this gives up (returning -1) unless the node still
+ * holds the current key, or keys on both sides of it. Since leaves hold
+ * runs of keys, nothing can have moved in between.
+ */
+static int
+__findPos(BTreeTraversal *trav, char forward, char trust)
+{
+	BTreeNode *node = trav->node;
+	char found, inclusive;
+	int pos;
 
-	trav->node = btreeReadNode(trav->tree, trav->tree->leftLeaf);
+	/* Only the right-most leaf is at the end. */
+	if (trav->where == BTREE_TRAV_END)
+		return (trust ? -1 : node->keyCount);
+
+	if (trav->pos < node->keyCount &&
+		!strcmp(BTREE_KEY(node, trav->pos), trav->key))
+	{
+		pos   = trav->pos;
+		found = 1;
+	}
+	else
+		pos = btreeFindKey(node, trav->key, &found);
 
-	if (trav->node == NULL)
+	if (trust && !found && (pos == 0 || pos == node->keyCount))
 		return -1;
 
-	trav->pos = 1;
+	/* Whether the current key itself is next in this direction. */
+	inclusive = (forward ? trav->where == BTREE_TRAV_BEFORE
+				 : trav->where == BTREE_TRAV_AFTER);
 
-	return trav->node->children[0];
+	if (found && forward != inclusive)
+		pos++;
+
+	return pos;
 }
 
-offset_t
-btreeGetNextOffset(BTreeTraversal *trav)
+/*
+ * Moves a traversal to the next key in a direction.
+ */
+static offset_t
+__step(BTreeTraversal *trav, char forward)
 {
-	offset_t offset;
-	
-	if (trav == NULL)
+	BTree *tree = trav->tree;
+	offset_t offset, nextNodeOffset;
+	int pos = -1;
+
+	if (trav->where == BTREE_TRAV_NONE ||
+		(forward && trav->where == BTREE_TRAV_END))
+	{
 		return -1;
+	}
 
-	if (trav->node == NULL)
-		return btreeGetNextOffset(trav);
+	if (trav->node != NULL)
+	{
+		/*
+		 * The leaf is only locked while we look at it, so writers aren't
+		 * held up by a traversal that's sitting idle. If it was freed or
+		 * changed too much in the meantime, look the key up again.
+		 * In a copy-on-write file, a node that was copied keeps its old
+		 * contents, so any block being retired makes it suspect.
+		 */
+		btreeLockNode(tree, trav->node->block->offset, DB_READ_LOCK);
+
+		if (trav->node->block->inList == 0 ||
+			(tree->snapshot == NULL &&
+			 gdbGetRetireCount(tree->block->db) != trav->retireCount) ||
+			(pos = __findPos(trav, forward, 1)) == -1)
+		{
+			btreeUnlockNode(tree, trav->node->block->offset);
+		}
+	}
 
-	if (trav->pos == trav->node->keyCount)
+	if (pos == -1)
 	{
-		offset_t nextNodeOffset = trav->node->children[trav->pos];
-		
-		btreeDestroyNode(trav->node);
+		if (!forward && trav->where == BTREE_TRAV_AFTER)
+		{
+			/* The key itself comes first, if it's still there. */
+			__seekLeaf(trav, trav->key, 0);
+
+			if (trav->node != NULL &&
+				(pos = __findPos(trav, forward, 0)) == 0)
+			{
+				btreeUnlockNode(tree, trav->node->block->offset);
+				__seekLeaf(trav, trav->key, 1);
+			}
+		}
+		else
+		{
+			__seekLeaf(trav, (trav->where == BTREE_TRAV_END ? NULL : trav->key),
+					   !forward);
+		}
+
+		if (trav->node == NULL)
+			return -1;
 
-		trav->node = NULL;
+		pos = __findPos(trav, forward, 0);
+	}
+
+	if (forward && GDB_IS_PAGED(tree->block->db))
+	{
+		/*
+		 * Leaves that were copied are still linked to from the leaf
+		 * before them, so the links can't be trusted. Look up the next
+		 * leaf from the top instead.
+		 */
+		while (pos >= trav->node->keyCount)
+		{
+			char *key;
+
+			key = strdup(trav->node->keyCount > 0
+						 ? BTREE_KEY(trav->node, trav->node->keyCount - 1)
+						 : trav->key);
+
+			/* Don't hold a leaf while locking from the top. */
+			btreeUnlockNode(tree, trav->node->block->offset);
+
+			if (!__seekNextLeaf(trav, key))
+			{
+				free(key);
+
+				btreeLockNode(tree, trav->node->block->offset, DB_READ_LOCK);
+
+				break;
+			}
+
+			free(key);
+
+			pos = __findPos(trav, forward, 0);
+		}
+	}
+	else if (forward)
+	{
+		while (pos >= trav->node->keyCount)
+		{
+			nextNodeOffset = trav->node->children[(int)trav->node->keyCount];
+
+			if (nextNodeOffset == 0)
+				break;
+
+			/* Lock the next leaf before letting go of this one. */
+			btreeLockNode(tree, nextNodeOffset, DB_READ_LOCK);
+
+			btreeUnlockNode(tree, trav->node->block->offset);
+			btreeDestroyNode(trav->node);
+
+			trav->node = btreeReadNode(tree, nextNodeOffset);
+
+			pos = 0;
+		}
+	}
+	else if (pos == 0 && trav->node->keyCount > 0)
+	{
+		/* Leaves only link forward, so look up the one before. */
+		btreeUnlockNode(tree, trav->node->block->offset);
 
-		if (nextNodeOffset == 0)
+		__seekLeaf(trav, trav->key, 1);
+
+		if (trav->node == NULL)
 			return -1;
-		
-		trav->node = btreeReadNode(trav->tree, nextNodeOffset);
 
-		trav->pos = 0;
+		pos = __findPos(trav, forward, 0);
 	}
 
-	offset = trav->node->children[trav->pos];
+	if (!forward)
+		pos--;
+
+	if (pos < 0 || pos >= trav->node->keyCount ||
+		!__inRange(trav, BTREE_KEY(trav->node, pos)))
+	{
+		/* Ran off the end. Turning around returns the current key. */
+		if (trav->where == BTREE_TRAV_AT)
+			trav->where = (forward ? BTREE_TRAV_AFTER : BTREE_TRAV_BEFORE);
+
+		offset = -1;
+	}
+	else
+	{
+		__setKey(trav, BTREE_KEY(trav->node, pos), BTREE_TRAV_AT);
+
+		trav->pos = pos;
 
-	trav->pos++;
+		offset = trav->node->children[pos];
+	}
+
+	btreeUnlockNode(tree, trav->node->block->offset);
 
 	return offset;
 }
 
+offset_t
+btreeGetFirstOffset(BTreeTraversal *trav)
+{
+	if (trav == NULL)
+		return -1;
+
+	__setKey(trav, (trav->minKey != NULL ? trav->minKey : ""),
+			 BTREE_TRAV_BEFORE);
+
+	return __step(trav, 1);
+}
+
+offset_t
+btreeGetNextOffset(BTreeTraversal *trav)
+{
+	if (trav == NULL)
+		return -1;
+
+	return __step(trav, 1);
+}
+
+offset_t
+btreeGetLastOffset(BTreeTraversal *trav)
+{
+	if (trav == NULL)
+		return -1;
+
+	if (trav->maxKey != NULL)
+		__setKey(trav, trav->maxKey, BTREE_TRAV_BEFORE);
+	else
+		trav->where = BTREE_TRAV_END;
+
+	return __step(trav, 0);
+}
+
+offset_t
+btreeGetPrevOffset(BTreeTraversal *trav)
+{
+	if (trav == NULL)
+		return -1;
+
+	return __step(trav, 0);
+}
+
+offset_t
+btreeSeekOffset(BTreeTraversal *trav, const char *key)
+{
+	if (trav == NULL)
+		return -1;
+
+	if (key == NULL || (trav->minKey != NULL && strcmp(key, trav->minKey) < 0))
+		return btreeGetFirstOffset(trav);
+
+	__setKey(trav, key, BTREE_TRAV_BEFORE);
+
+	return __step(trav, 1);
+}
+
+const char *
+btreeGetTraversalKey(BTreeTraversal *trav)
+{
+	if (trav == NULL || trav->where != BTREE_TRAV_AT)
+		return NULL;
+
+	return trav->key;
+}
+
 void
 btreePrettyPrint(BTree *tree, offset_t rootOffset, int i)
 {
@@ -148,7 +635,7 @@ btreePrettyPrint(BTree *tree, offset_t rootOffset, int i)
 	printf("[.");
 
 	for (j = 0; j < rootNode->keyCount; j++)
-		printf(" %s .", rootNode->keys[j]);
+		printf(" %s .", BTREE_KEY(rootNode, j));
 
 	for (j = tree->order - rootNode->keyCount; j > 1; j--)
 		printf(" _____ .");
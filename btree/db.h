@@ -21,6 +21,7 @@
 #ifndef _GNUPDATEDB_DB_H_
 #define _GNUPDATEDB_DB_H_
 
+#include <pthread.h>
 #include <libpackman/types.h>
 #include <libpackman/error.h>
 #include <libcomprex/debug.h>
@@ -31,6 +32,30 @@
 	fseek(a, b, c)
 
 typedef struct _GDatabase GDatabase;   /**< GNUpdate database. */
+typedef struct _GdbLatch  GdbLatch;    /**< A lock on an offset.  */
+typedef struct _GdbFreeMap GdbFreeMap; /**< Free space in a file. */
+typedef struct _GdbJournal GdbJournal; /**< A write journal.      */
+typedef struct _GdbJournalPage GdbJournalPage; /**< A journaled page. */
+typedef struct _GdbBloom  GdbBloom;    /**< A filter over keys.   */
+typedef struct _GdbSnapshot GdbSnapshot; /**< A pinned view of a file. */
+typedef struct _GdbFreshBlock GdbFreshBlock;     /**< New in a transaction. */
+typedef struct _GdbRetiredBlock GdbRetiredBlock; /**< Replaced by a copy.   */
+typedef struct _GdbTreeImage GdbTreeImage; /**< A tree header's fields.  */
+
+/**
+ * Number of hash buckets in a database's lock table.
+ */
+#define DB_LATCH_BUCKETS 64
+
+/**
+ * Number of hash buckets for a database's journaled pages.
+ */
+#define DB_JOURNAL_BUCKETS 256
+
+/**
+ * Number of hash buckets for the free space reused in a transaction.
+ */
+#define DB_FRESH_BUCKETS 256
 
 /**
  * Database types.
@@ -54,11 +79,31 @@ typedef enum
 } GdbStatus;
 
 
+/**
+ * I/O counters of a database.
+ *
+ * These are counted from when the database is opened, or from the last
+ * call to gdbResetStats().
+ */
+typedef struct
+{
+	unsigned long blocksRead;    /**< Blocks read from the file.          */
+	unsigned long bytesRead;     /**< Bytes read for those blocks.        */
+	unsigned long blocksWritten; /**< Blocks written to the file.         */
+	unsigned long bytesWritten;  /**< Bytes written for those blocks.     */
+	unsigned long cacheHits;     /**< Blocks found in the block cache.    */
+
+} GdbStats;
+
+
 #include "db_types.h"
 #include "db_blocks.h"
 #include "btree.h"
 #include "hashtable.h"
 #include "offsetlist.h"
+#include "db_journal.h"
+#include "db_bloom.h"
+#include "db_snapshot.h"
 
 
 /**
@@ -73,13 +118,48 @@ struct _GDatabase
 	
 	GdbType type;           /**< Database type.                  */
 
+	unsigned short pageSize;  /**< Node page size, or 0 for 0.2 files. */
+	unsigned char offsetSize; /**< Bytes in an offset on disk.         */
+
+	char *map;              /**< Read-only mapping of the file.  */
+	unsigned long mapSize;  /**< Size of the mapping.            */
+
 	long freeBlockCount;    /**< Number of free blocks.          */
+	GdbFreeMap *freeMap;    /**< Free space, once it's been used. */
+
+	GdbJournal *journal;    /**< Journal for writes, if attached. */
+	int journalIndex;       /**< Index in the journal.           */
+	GdbJournalPage *pages[DB_JOURNAL_BUCKETS]; /**< Journaled pages. */
 
 	BTree *mainTree;        /**< Main B+Tree.                    */
+	GdbBloom *bloom;        /**< Filter over the main tree's keys. */
+
+	unsigned long cacheCount;       /**< Number of cached blocks.       */
+	unsigned long cacheBucketCount; /**< Number of cache hash buckets.  */
+	GdbBlock **cacheBuckets;        /**< Cache hash buckets.            */
+
+	unsigned long cacheSize;        /**< Bytes charged to the cache.    */
+	unsigned long maxCacheSize;     /**< Byte budget of the cache.      */
 
-	int openBlockCount;     /**< Number of open blocks.          */
-	int openBlockSize;      /**< Size of the open blocks array.  */
-	GdbBlock **openBlocks;  /**< Open blocks array.              */
+	GdbBlock *lruHead;              /**< Most recently released block.  */
+	GdbBlock *lruTail;              /**< Least recently released block. */
+	char evicting;                  /**< 1 while evicting blocks.       */
+
+	unsigned long generation;       /**< Number of the open transaction. */
+	offset_t commitEnd;             /**< End of the file at the last commit. */
+	GdbFreshBlock *fresh[DB_FRESH_BUCKETS]; /**< Free space reused since. */
+	GdbRetiredBlock *retired;       /**< Blocks replaced by copies.     */
+	unsigned long retireCount;      /**< Number of blocks ever retired. */
+	GdbTreeImage *treeImages;       /**< Committed headers of changed trees. */
+	GdbSnapshot *snapshots;         /**< Pinned snapshots.              */
+
+	GdbStats stats;                 /**< I/O counters.                  */
+
+	pthread_mutex_t mutex;          /**< Guards the cache and file I/O. */
+
+	pthread_mutex_t latchMutex;     /**< Guards the lock table.         */
+	GdbLatch *latches[DB_LATCH_BUCKETS]; /**< Held locks, by offset.   */
+	GdbLatch *freeLatches;          /**< Unused lock entries.           */
 };
 
 /**
@@ -91,6 +171,15 @@ struct _GDatabase
  * If a type is specified that does not match the type of database, this
  * will return NULL.
  *
+ * Databases opened with PM_MODE_READ_ONLY are mapped into memory, and
+ * blocks are read straight out of the mapping. If the file can't be
+ * mapped, it's read through the file pointer as usual.
+ *
+ * Files in the older 0.2 format are opened as well, and are kept in
+ * that format when they're changed. Files in the paged format are
+ * changed copy-on-write when opened with PM_MODE_READ_WRITE, so readers
+ * can pin a snapshot of them. See gdbPinSnapshot().
+ *
  * @param filename The name of the database file.
  * @param type     The type of database to open.
  * @param mode     The access mode.
@@ -106,12 +195,56 @@ GDatabase *gdbOpen(const char *filename, GdbType type, PmAccessMode mode);
  */
 void gdbClose(GDatabase *db);
 
+/**
+ * Writes out changes held in memory.
+ *
+ * The free block list is kept in memory while the database is open,
+ * and is only written out by this and by gdbClose(). If the database
+ * is attached to a journal, the journal is committed. Either way,
+ * snapshots pinned after this see the changes made before it.
+ *
+ * @param db The active database.
+ */
+void gdbSync(GDatabase *db);
+
+/**
+ * Sets the byte budget of the database's block cache.
+ *
+ * Blocks that are no longer referenced stay cached until the cache
+ * grows past this budget, at which point the least recently used ones
+ * are written back (if dirty) and freed.
+ *
+ * @param db   The active database.
+ * @param size The maximum number of bytes to keep cached.
+ */
+void gdbSetCacheSize(GDatabase *db, unsigned long size);
+
+/**
+ * Returns the I/O counters of a database.
+ *
+ * A block that isn't found in the cache is read from the file, so the
+ * number of cache lookups is the number of cache hits plus the number
+ * of blocks read.
+ *
+ * @param db    The active database.
+ * @param stats The structure to copy the counters into.
+ */
+void gdbGetStats(GDatabase *db, GdbStats *stats);
+
+/**
+ * Resets the I/O counters of a database to 0.
+ *
+ * @param db The active database.
+ */
+void gdbResetStats(GDatabase *db);
+
 /**
  * Creates a database.
  *
  * gdbOpen() automatically calls this if the specified file does not
  * exist. Calling this instead of gdbOpen() will overwrite an existing
- * file.
+ * file. The file uses pages of DB_DEFAULT_PAGE_SIZE bytes. See
+ * gdbCreatePaged().
  *
  * @param filename The name of the file to store the database in.
  * @param type     The type of database to create.
@@ -120,6 +253,24 @@ void gdbClose(GDatabase *db);
  */
 GDatabase *gdbCreate(const char *filename, GdbType type);
 
+/**
+ * Creates a database with the given node page size.
+ *
+ * Tree nodes and Bloom filters in the file take up whole pages, aligned
+ * to the page size, and offsets are stored in 64 bits. A page size of 0
+ * creates a file in the older 0.2 format instead, with small nodes and
+ * 32-bit offsets.
+ *
+ * @param filename The name of the file to store the database in.
+ * @param type     The type of database to create.
+ * @param pageSize The page size: DB_PAGE_SIZE_SMALL, DB_PAGE_SIZE_LARGE
+ *                 or 0.
+ *
+ * @return A GDatabase structure.
+ */
+GDatabase *gdbCreatePaged(const char *filename, GdbType type,
+						  unsigned short pageSize);
+
 /**
  * Destroys a GDatabase structure in memory.
  *
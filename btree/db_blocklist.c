@@ -26,6 +26,7 @@ gdbGetFreeBlockList(GDatabase *db, GdbFreeBlock **blocks, long *count)
 	GdbFreeBlock *blockList;
 	unsigned long listSize;
 	unsigned char *buffer;
+	unsigned char countBuffer[4];
 	size_t s;
 	int i, counter = 0;
 
@@ -34,13 +35,15 @@ gdbGetFreeBlockList(GDatabase *db, GdbFreeBlock **blocks, long *count)
 
 	*blocks = NULL;
 
-	/* Seek to the start of the block list. */
-	fseek(db->fp, DB_FREE_BLOCK_LIST_OFFSET, SEEK_SET);
-
-	if (fread(&db->freeBlockCount, sizeof(long), 1, db->fp) != 1)
+	if (gdbFileRead(db, DB_FREE_BLOCK_LIST_OFFSET, countBuffer,
+					sizeof(countBuffer)) != sizeof(countBuffer))
+	{
 		db->freeBlockCount = 0;
+	}
+	else
+		db->freeBlockCount = gdbGet32(countBuffer, &counter);
 
-	db->freeBlockCount = ntohl(db->freeBlockCount);
+	counter = 0;
 
 	*count = db->freeBlockCount;
 
@@ -48,13 +51,14 @@ gdbGetFreeBlockList(GDatabase *db, GdbFreeBlock **blocks, long *count)
 		return 0;
 
 	/* Get the total size of the free blocks list. */
-	listSize = db->freeBlockCount * (sizeof(short) + sizeof(offset_t));
+	listSize = db->freeBlockCount * (sizeof(short) + db->offsetSize);
 
 	/* Allocate the buffer. */
 	MEM_CHECK(buffer = (char *)malloc(listSize));
 
 	/* Read in the list. */
-	if ((s = fread(buffer, 1, listSize, db->fp)) != listSize)
+	if ((s = gdbFileRead(db, DB_FREE_BLOCK_LIST_OFFSET + 4,
+						 buffer, listSize)) != listSize)
 	{
 		pmError(PM_ERROR_FATAL,
 			_("GNUpdate DB: Truncated block list.\n"
@@ -71,7 +75,7 @@ gdbGetFreeBlockList(GDatabase *db, GdbFreeBlock **blocks, long *count)
 	for (i = 0; i < db->freeBlockCount; i++)
 	{
 		blockList[i].size   = gdbGet16(buffer, &counter);
-		blockList[i].offset = gdbGet32(buffer, &counter);
+		blockList[i].offset = gdbGetOffset(buffer, &counter, db->offsetSize);
 	}
 
 	*blocks = blockList;
@@ -91,8 +95,19 @@ gdbWriteFreeBlockList(GDatabase *db, GdbFreeBlock *blocks, long count)
 	if (db == NULL || blocks == NULL)
 		return;
 
-	/* Get the total size of the list. */
-	listSize = sizeof(long) + count * (sizeof(short) + sizeof(offset_t));
+	/*
+	 * The list has a fixed amount of space before the main tree. Any
+	 * blocks that don't fit are forgotten, rather than written over it.
+	 */
+	if (4 + count * (sizeof(short) + db->offsetSize) >
+		DB_FREE_BLOCK_LIST_SIZE)
+	{
+		count = (DB_FREE_BLOCK_LIST_SIZE - 4) /
+		        (sizeof(short) + db->offsetSize);
+	}
+
+	/* Get the total size of the list. The count takes 4 bytes. */
+	listSize = 4 + count * (sizeof(short) + db->offsetSize);
 
 	/* Allocate the buffer for the block list. */
 	MEM_CHECK(buffer = (char *)malloc(listSize));
@@ -102,12 +117,10 @@ gdbWriteFreeBlockList(GDatabase *db, GdbFreeBlock *blocks, long count)
 	for (i = 0; i < count; i++)
 	{
 		gdbPut16(buffer, &counter, blocks[i].size);
-		gdbPut32(buffer, &counter, blocks[i].offset);
+		gdbPutOffset(buffer, &counter, blocks[i].offset, db->offsetSize);
 	}
 	
-	fseek(db->fp, DB_FREE_BLOCK_LIST_OFFSET, SEEK_SET);
-
-	fwrite(buffer, listSize, 1, db->fp);
+	gdbFileWrite(db, DB_FREE_BLOCK_LIST_OFFSET, buffer, listSize);
 
 	free(buffer);
 
@@ -123,3 +136,328 @@ gdbFreeBlockList(GdbFreeBlock *blocks)
 	free(blocks);
 }
 
+
+static int
+__freeBlockCompare(const void *a, const void *b)
+{
+	const GdbFreeBlock *block1 = (const GdbFreeBlock *)a;
+	const GdbFreeBlock *block2 = (const GdbFreeBlock *)b;
+
+	if (block1->offset < block2->offset)
+		return -1;
+
+	return (block1->offset > block2->offset);
+}
+
+static int
+__binIndex(unsigned long size)
+{
+	unsigned long bin = size / 32;
+
+	return (bin < DB_FREE_MAP_BINS ? (int)bin : DB_FREE_MAP_BINS - 1);
+}
+
+static int
+__bucketIndex(offset_t offset)
+{
+	return (int)((offset ^ (offset >> 9)) % DB_FREE_MAP_BUCKETS);
+}
+
+static void
+__insertRun(GdbFreeMap *map, GdbFreeRun *run)
+{
+	int bin = __binIndex(run->size);
+	int start = __bucketIndex(run->offset);
+	int end = __bucketIndex(run->offset + run->size);
+
+	run->prev = NULL;
+	run->next = map->bins[bin];
+
+	if (run->next != NULL)
+		run->next->prev = run;
+
+	map->bins[bin] = run;
+
+	run->nextStart = map->starts[start];
+	map->starts[start] = run;
+
+	run->nextEnd = map->ends[end];
+	map->ends[end] = run;
+
+	map->runCount++;
+}
+
+static void
+__removeRun(GdbFreeMap *map, GdbFreeRun *run)
+{
+	GdbFreeRun **link;
+
+	if (run->prev != NULL)
+		run->prev->next = run->next;
+	else
+		map->bins[__binIndex(run->size)] = run->next;
+
+	if (run->next != NULL)
+		run->next->prev = run->prev;
+
+	for (link = &map->starts[__bucketIndex(run->offset)];
+		 *link != run;
+		 link = &(*link)->nextStart)
+		;
+
+	*link = run->nextStart;
+
+	for (link = &map->ends[__bucketIndex(run->offset + run->size)];
+		 *link != run;
+		 link = &(*link)->nextEnd)
+		;
+
+	*link = run->nextEnd;
+
+	map->runCount--;
+}
+
+/* Adds free space to the map, merging it with the runs around it. */
+static void
+__addRun(GdbFreeMap *map, offset_t offset, unsigned long size)
+{
+	GdbFreeRun *run, *before, *after;
+
+	for (before = map->ends[__bucketIndex(offset)];
+		 before != NULL && before->offset + before->size != offset;
+		 before = before->nextEnd)
+		;
+
+	for (after = map->starts[__bucketIndex(offset + size)];
+		 after != NULL && after->offset != offset + size;
+		 after = after->nextStart)
+		;
+
+	if (before != NULL)
+	{
+		__removeRun(map, before);
+
+		offset = before->offset;
+		size  += before->size;
+
+		run = before;
+	}
+	else
+		MEM_CHECK(run = (GdbFreeRun *)malloc(sizeof(GdbFreeRun)));
+
+	if (after != NULL)
+	{
+		__removeRun(map, after);
+
+		size += after->size;
+
+		free(after);
+	}
+
+	run->offset = offset;
+	run->size   = size;
+
+	__insertRun(map, run);
+}
+
+/* Reads in the on-disk free block list, the first time it's needed. */
+static GdbFreeMap *
+__getFreeMap(GDatabase *db)
+{
+	GdbFreeMap *map;
+	GdbFreeBlock *blocks;
+	long count, i;
+
+	if (db->freeMap != NULL)
+		return db->freeMap;
+
+	MEM_CHECK(map = (GdbFreeMap *)malloc(sizeof(GdbFreeMap)));
+	memset(map, 0, sizeof(GdbFreeMap));
+
+	if (gdbGetFreeBlockList(db, &blocks, &count))
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (blocks[i].size > 0)
+				__addRun(map, blocks[i].offset, blocks[i].size);
+		}
+
+		gdbFreeBlockList(blocks);
+
+		map->onDisk = 1;
+	}
+
+	db->freeMap = map;
+
+	return map;
+}
+
+/* Returns the first offset in a run where an aligned block starts. */
+static offset_t
+__alignedStart(GdbFreeRun *run, unsigned short alignment)
+{
+	if (alignment == 0 || run->offset % alignment == 0)
+		return run->offset;
+
+	return run->offset + alignment - (run->offset % alignment);
+}
+
+offset_t
+gdbTakeFreeBlock(GDatabase *db, unsigned short size)
+{
+	return gdbTakeAlignedFreeBlock(db, size, 0);
+}
+
+offset_t
+gdbTakeAlignedFreeBlock(GDatabase *db, unsigned short size,
+						unsigned short alignment)
+{
+	GdbFreeMap *map;
+	GdbFreeRun *run = NULL;
+	GdbFreeBlock empty;
+	offset_t offset, start;
+	unsigned long before;
+	int bin;
+
+	if (db == NULL || size == 0)
+		return 0;
+
+	map = __getFreeMap(db);
+
+	for (bin = __binIndex(size); bin < DB_FREE_MAP_BINS && run == NULL; bin++)
+	{
+		for (run = map->bins[bin];
+			 run != NULL &&
+			 __alignedStart(run, alignment) + size > run->offset + run->size;
+			 run = run->next)
+			;
+	}
+
+	if (run == NULL)
+		return 0;
+
+	/*
+	 * The block is about to be used, so make sure the on-disk list
+	 * can't still hand it out after a crash.
+	 */
+	if (map->onDisk)
+	{
+		memset(&empty, 0, sizeof(GdbFreeBlock));
+
+		gdbWriteFreeBlockList(db, &empty, 0);
+
+		map->onDisk = 0;
+	}
+
+	__removeRun(map, run);
+
+	start  = run->offset;
+	offset = __alignedStart(run, alignment);
+	before = offset - start;
+
+	if (run->size > before + size)
+	{
+		run->offset  = offset + size;
+		run->size   -= before + size;
+
+		__insertRun(map, run);
+	}
+	else
+		free(run);
+
+	/* Whatever was skipped to reach the boundary is still free. */
+	if (before > 0)
+		__addRun(map, start, before);
+
+	map->dirty = 1;
+
+	return offset;
+}
+
+void
+gdbReturnFreeBlock(GDatabase *db, offset_t offset, unsigned short size)
+{
+	GdbFreeMap *map;
+
+	if (db == NULL || offset == 0 || size == 0)
+		return;
+
+	map = __getFreeMap(db);
+
+	__addRun(map, offset, size);
+
+	map->dirty = 1;
+}
+
+void
+gdbSyncFreeMap(GDatabase *db)
+{
+	GdbFreeMap *map;
+	GdbFreeRun *run;
+	GdbFreeBlock *blocks;
+	unsigned long left;
+	long count = 0, size = 0;
+	int bin;
+
+	if (db == NULL || (map = db->freeMap) == NULL || !map->dirty)
+		return;
+
+	for (bin = 0; bin < DB_FREE_MAP_BINS; bin++)
+	{
+		for (run = map->bins[bin]; run != NULL; run = run->next)
+			size += (run->size + DB_FREE_RUN_MAX_SIZE - 1) /
+			        DB_FREE_RUN_MAX_SIZE;
+	}
+
+	/* Make sure there's something to pass, even for an empty list. */
+	MEM_CHECK(blocks = (GdbFreeBlock *)malloc((size + 1) *
+											  sizeof(GdbFreeBlock)));
+
+	/* Runs too big for one entry are split up. */
+	for (bin = 0; bin < DB_FREE_MAP_BINS; bin++)
+	{
+		for (run = map->bins[bin]; run != NULL; run = run->next)
+		{
+			for (left = run->size; left > 0; count++)
+			{
+				blocks[count].offset = run->offset + (run->size - left);
+				blocks[count].size   = (left > DB_FREE_RUN_MAX_SIZE
+										? DB_FREE_RUN_MAX_SIZE : left);
+
+				left -= blocks[count].size;
+			}
+		}
+	}
+
+	qsort(blocks, count, sizeof(GdbFreeBlock), __freeBlockCompare);
+
+	gdbWriteFreeBlockList(db, blocks, count);
+
+	free(blocks);
+
+	map->onDisk = (count > 0);
+	map->dirty  = 0;
+}
+
+void
+gdbDestroyFreeMap(GDatabase *db)
+{
+	GdbFreeRun *run, *next;
+	int bin;
+
+	if (db == NULL || db->freeMap == NULL)
+		return;
+
+	for (bin = 0; bin < DB_FREE_MAP_BINS; bin++)
+	{
+		for (run = db->freeMap->bins[bin]; run != NULL; run = next)
+		{
+			next = run->next;
+			free(run);
+		}
+	}
+
+	free(db->freeMap);
+
+	db->freeMap = NULL;
+}
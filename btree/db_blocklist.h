@@ -41,6 +41,60 @@ typedef struct
 
 } GdbFreeBlock;
 
+/**
+ * Number of size bins in the free space map.
+ *
+ * Bin n holds free runs of n * 32 to n * 32 + 31 bytes. The last bin
+ * holds everything larger.
+ */
+#define DB_FREE_MAP_BINS 64
+
+/**
+ * Number of hash buckets used to find a free run's neighbors.
+ */
+#define DB_FREE_MAP_BUCKETS 256
+
+/**
+ * The largest free run that fits in one free block list entry.
+ */
+#define DB_FREE_RUN_MAX_SIZE 0xFFE0
+
+typedef struct _GdbFreeRun GdbFreeRun; /**< A run of free space. */
+
+/**
+ * A run of free space in the file. Adjacent freed blocks are merged
+ * into one run.
+ */
+struct _GdbFreeRun
+{
+	offset_t offset;        /**< Offset of the run.             */
+	unsigned long size;     /**< Size of the run, in bytes.     */
+
+	GdbFreeRun *prev;       /**< Previous run in the size bin.  */
+	GdbFreeRun *next;       /**< Next run in the size bin.      */
+	GdbFreeRun *nextStart;  /**< Next run in the start bucket.  */
+	GdbFreeRun *nextEnd;    /**< Next run in the end bucket.    */
+};
+
+/**
+ * The free space in a database, held in memory.
+ *
+ * The on-disk free block list is read once, the first time a block is
+ * reserved or freed, and written back by gdbSync() and gdbClose().
+ * While blocks from the map may be handed out, the on-disk list is left
+ * empty, so a crash leaks free space instead of using a block twice.
+ */
+struct _GdbFreeMap
+{
+	GdbFreeRun *bins[DB_FREE_MAP_BINS];       /**< Runs, by size.       */
+	GdbFreeRun *starts[DB_FREE_MAP_BUCKETS];  /**< Runs, by offset.     */
+	GdbFreeRun *ends[DB_FREE_MAP_BUCKETS];    /**< Runs, by end offset. */
+
+	unsigned long runCount; /**< Number of runs.                      */
+	char dirty;             /**< 1 if the on-disk list is out of date. */
+	char onDisk;            /**< 1 if the on-disk list has entries.    */
+};
+
 /**
  * Returns the free block list.
  *
@@ -68,5 +122,70 @@ void gdbWriteFreeBlockList(GDatabase *db, GdbFreeBlock *blocks, long count);
  */
 void gdbFreeBlockList(GdbFreeBlock *blocks);
 
+/**
+ * Takes a block from the free space map.
+ *
+ * The smallest free run that holds the block is used, and whatever is
+ * left of it stays free.
+ *
+ * The database must be locked.
+ *
+ * @param db   The active database.
+ * @param size The size of the block.
+ *
+ * @return The offset of the block, or 0 if there's no free run big
+ *         enough.
+ */
+offset_t gdbTakeFreeBlock(GDatabase *db, unsigned short size);
+
+/**
+ * Takes a block that starts on a boundary from the free space map.
+ *
+ * This is like gdbTakeFreeBlock(), but only part of a free run may be
+ * used. Space before the boundary stays free.
+ *
+ * The database must be locked.
+ *
+ * @param db        The active database.
+ * @param size      The size of the block.
+ * @param alignment The boundary, or 0 for none.
+ *
+ * @return The offset of the block, or 0 if there's no free run that
+ *         holds it.
+ */
+offset_t gdbTakeAlignedFreeBlock(GDatabase *db, unsigned short size,
+								 unsigned short alignment);
+
+/**
+ * Returns a block to the free space map, merging it with any free
+ * runs on either side.
+ *
+ * The database must be locked.
+ *
+ * @param db     The active database.
+ * @param offset The offset of the block.
+ * @param size   The size of the block.
+ */
+void gdbReturnFreeBlock(GDatabase *db, offset_t offset, unsigned short size);
+
+/**
+ * Writes the free space map out to the free block list, if it changed.
+ *
+ * Runs that don't fit in the list are forgotten on disk, but stay
+ * free in memory.
+ *
+ * The database must be locked.
+ *
+ * @param db The active database.
+ */
+void gdbSyncFreeMap(GDatabase *db);
+
+/**
+ * Frees the free space map in memory. It is not written out.
+ *
+ * @param db The active database.
+ */
+void gdbDestroyFreeMap(GDatabase *db);
+
 #endif /* _DB_BLOCKLIST_H_ */
 
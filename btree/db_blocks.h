@@ -29,9 +29,10 @@
 #define GDB_BLOCK_BTREE_NODE    0x03  /**< B+Tree node block.    */
 #define GDB_BLOCK_HASHTABLE     0x04  /**< Hashtable block.      */
 #define GDB_BLOCK_OFFSET_LIST   0x05  /**< An offset list block. */
+#define GDB_BLOCK_BLOOM         0x06  /**< A Bloom filter block. */
 
 #define GDB_BLOCK_MIN_TYPE  GDB_BLOCK_DATA
-#define GDB_BLOCK_MAX_TYPE  GDB_BLOCK_OFFSET_LIST
+#define GDB_BLOCK_MAX_TYPE  GDB_BLOCK_BLOOM
 
 #define GDB_VALID_BLOCK_TYPE(type) ((type) >= GDB_BLOCK_MIN_TYPE && \
 									(type) <= GDB_BLOCK_MAX_TYPE)
@@ -43,9 +44,16 @@
 #define GDB_BLOCK_SIZE_OFFSET       1 /**< Offset of the data size.          */
 #define GDB_BLOCK_FLAGS_OFFSET      5 /**< Offset of the flags.              */
 #define GDB_BLOCK_NEXT_OFFSET       7 /**< Offset of the continuation block. */
-#define GDB_BLOCK_LIST_NEXT_OFFSET 11 /**< Offset of the next linked block.  */
 
-#define GDB_BLOCK_HEADER_SIZE      15 /**< Size of the block header.         */
+/** Offset of the next linked block. */
+#define GDB_BLOCK_LIST_NEXT_OFFSET(db) \
+	(GDB_BLOCK_NEXT_OFFSET + (db)->offsetSize)
+
+/** Size of the block header. */
+#define GDB_BLOCK_HEADER_SIZE(db) \
+	(GDB_BLOCK_NEXT_OFFSET + 2 * (db)->offsetSize)
+
+#define GDB_BLOCK_MAX_HEADER_SIZE  23 /**< Largest block header.             */
 /*@}*/
 
 /** @name Block flags */
@@ -71,7 +79,7 @@
 /**
  * A block of data.
  */
-typedef struct
+typedef struct _GdbBlock
 {
 	GDatabase *db;           /**< The database the block is part of.  */
 
@@ -90,10 +98,18 @@ typedef struct
 	unsigned int chainCount; /**< The number of blocks in the chain.  */
 
 	void *detail;            /**< The detailed data (BTreeNode, etc.) */
+	char *buffer;            /**< Read buffer the detail points into. */
 
 	char dirty;              /**< The dirty state of the block.       */
-	char inList;             /**< 1 if in the open blocks list.       */ 
-	char refCount;           /**< Reference count.                    */
+	char inList;             /**< 1 if in the block cache.            */
+	char mapped;             /**< 1 if detail points into the map.    */
+	unsigned short refCount; /**< Reference count.                    */
+
+	unsigned long charge;    /**< Bytes charged to the block cache.   */
+
+	struct _GdbBlock *hashNext; /**< Next block in the cache bucket.  */
+	struct _GdbBlock *lruPrev;  /**< Previous block in the LRU list.  */
+	struct _GdbBlock *lruNext;  /**< Next block in the LRU list.      */
 	
 } GdbBlock;
 
@@ -117,12 +133,26 @@ typedef struct
 GdbBlock *gdbNewBlock(GDatabase *db, blocktype_t blockType, void *extra);
 
 /**
- * Frees up a block in memory.
+ * Releases a reference to a block.
  *
- * @param block The block to free.
+ * Blocks in the block cache stay in memory after the last reference
+ * is released, and are freed when the cache evicts them. Blocks that
+ * were never cached are freed right away.
+ *
+ * @param block The block to release.
  */
 void gdbDestroyBlock(GdbBlock *block);
 
+/**
+ * Frees up a block in memory, bypassing the block cache.
+ *
+ * This is meant to be called by the cache functions. Don't call this
+ * directly.
+ *
+ * @param block The block to free.
+ */
+void gdbPurgeBlock(GdbBlock *block);
+
 /**
  * Reads a block's header from disk.
  *
@@ -164,6 +194,29 @@ void gdbWriteBlockHeader(GdbBlock *block);
 GdbBlock *gdbReadBlock(GDatabase *db, offset_t offset, blocktype_t blockType,
 					   void *extra);
 
+/**
+ * Reads several blocks from disk.
+ *
+ * The blocks are read in file order rather than in the order given,
+ * so a set of scattered offsets becomes a mostly forward scan. If
+ * @a readAhead is set, the kernel is first told which parts of the
+ * file will be needed.
+ *
+ * @param db        The active database.
+ * @param offsets   The offsets of the blocks.
+ * @param count     The number of offsets.
+ * @param blockType The block type to read.
+ * @param extra     Block-specific extra data.
+ * @param readAhead 1 to hint the reads to the kernel first.
+ * @param blocks    The array to fill with the blocks, in the order of
+ *                  @a offsets.
+ *
+ * @return The number of blocks read.
+ */
+unsigned long gdbReadBlocks(GDatabase *db, const offset_t *offsets,
+							unsigned long count, blocktype_t blockType,
+							void *extra, char readAhead, GdbBlock **blocks);
+
 /**
  * Writes a block to disk.
  *
@@ -172,6 +225,26 @@ GdbBlock *gdbReadBlock(GDatabase *db, offset_t offset, blocktype_t blockType,
  */
 void gdbWriteBlock(GdbBlock *block);
 
+/**
+ * Makes a block safe to change.
+ *
+ * In a database with copy-on-write, a block written before the current
+ * transaction may be in a snapshot, so it's copied into new space, and
+ * the copy returned in its place. The old block is freed when no
+ * snapshot can see it anymore. Whatever pointed to the block has to be
+ * pointed at the copy by the caller.
+ *
+ * Other blocks are returned as they are.
+ *
+ * The reference on @a block is passed on to the returned block.
+ *
+ * @param block The block to change.
+ * @param extra Block-specific extra data, as for gdbReadBlock().
+ *
+ * @return The block to change, which may be @a block.
+ */
+GdbBlock *gdbShadowBlock(GdbBlock *block, void *extra);
+
 /**
  * Determines the block type at the specified offset.
  *
@@ -228,12 +301,14 @@ void gdbFreeBlock(GDatabase *db, offset_t offset, blocktype_t blockType);
  * Returnes the number of required blocks to fit the specified amount
  * of data.
  *
+ * @param db       The active database.
  * @param dataSize The size of the data.
  * @param multiple The block multiple.
  *
  * @return The number of needed blocks.
  */
-unsigned long gdbGetNeededBlockCount(unsigned long dataSize, short multiple);
+unsigned long gdbGetNeededBlockCount(GDatabase *db, unsigned long dataSize,
+									 unsigned short multiple);
 
 #endif /* _DB_BLOCKS_H_ */
 
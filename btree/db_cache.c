@@ -20,73 +20,296 @@
  */
 #include "db_internal.h"
 
-void
-gdbCacheAddBlock(GDatabase *db, GdbBlock *block)
+static unsigned long
+__hashOffset(GDatabase *db, offset_t offset)
 {
-	GdbBlock *tempBlock;
-	int i;
+	/* Block offsets are multiples of at least 32 bytes. */
+	return ((offset >> 5) ^ (offset >> 13)) & (db->cacheBucketCount - 1);
+}
 
-	if (block->offset == 0)
+static unsigned long
+__blockCharge(GdbBlock *block)
+{
+	return sizeof(GdbBlock) + block->dataSize;
+}
+
+static void
+__lruUnlink(GDatabase *db, GdbBlock *block)
+{
+	if (block->lruPrev != NULL)
+		block->lruPrev->lruNext = block->lruNext;
+	else
+		db->lruHead = block->lruNext;
+
+	if (block->lruNext != NULL)
+		block->lruNext->lruPrev = block->lruPrev;
+	else
+		db->lruTail = block->lruPrev;
+
+	block->lruPrev = NULL;
+	block->lruNext = NULL;
+}
+
+static void
+__lruPushHead(GDatabase *db, GdbBlock *block)
+{
+	block->lruPrev = NULL;
+	block->lruNext = db->lruHead;
+
+	if (db->lruHead != NULL)
+		db->lruHead->lruPrev = block;
+	else
+		db->lruTail = block;
+
+	db->lruHead = block;
+}
+
+static void
+__hashUnlink(GDatabase *db, GdbBlock *block)
+{
+	GdbBlock **link;
+
+	link = &db->cacheBuckets[__hashOffset(db, block->offset)];
+
+	for (; *link != NULL; link = &(*link)->hashNext)
 	{
-		pmError(PM_ERROR_FATAL,
-				_("Trying to add a block to the list with offset 0.\n"));
-		abort();
+		if (*link == block)
+		{
+			*link = block->hashNext;
+			break;
+		}
 	}
 
-	if (block->inList == 1)
+	block->hashNext = NULL;
+	block->inList   = 0;
+
+	db->cacheCount--;
+	db->cacheSize -= block->charge;
+	block->charge  = 0;
+}
+
+static void
+__growBuckets(GDatabase *db)
+{
+	GdbBlock **oldBuckets;
+	unsigned long oldCount, i;
+
+	oldBuckets = db->cacheBuckets;
+	oldCount   = db->cacheBucketCount;
+
+	db->cacheBucketCount = 2 * oldCount;
+
+	MEM_CHECK(db->cacheBuckets =
+			  (GdbBlock **)malloc(db->cacheBucketCount * sizeof(GdbBlock *)));
+	memset(db->cacheBuckets, 0, db->cacheBucketCount * sizeof(GdbBlock *));
+
+	for (i = 0; i < oldCount; i++)
+	{
+		GdbBlock *block, *next;
+
+		for (block = oldBuckets[i]; block != NULL; block = next)
+		{
+			unsigned long bucket = __hashOffset(db, block->offset);
+
+			next = block->hashNext;
+
+			block->hashNext = db->cacheBuckets[bucket];
+			db->cacheBuckets[bucket] = block;
+		}
+	}
+
+	free(oldBuckets);
+}
+
+/*
+ * Evicts unreferenced blocks, least recently used first, until the
+ * cache is within its budget. Dirty blocks are written back first.
+ */
+static void
+__evictBlocks(GDatabase *db, unsigned long maxSize)
+{
+	GdbBlock *block;
+
+	if (db->evicting)
 		return;
 
-	/* See if it's already in the list. */
-	tempBlock = gdbCacheGetBlock(db, block->offset);
+	db->evicting = 1;
 
-	if (tempBlock != NULL)
+	while (db->cacheSize > maxSize && (block = db->lruTail) != NULL)
+	{
+		__lruUnlink(db, block);
+
+		if (GDB_IS_DIRTY(block) && db->fp != NULL)
+			gdbWriteBlock(block);
+
+		if (block->refCount > 0)
+		{
+			/* Writing it back referenced it again. */
+			continue;
+		}
+
+		__hashUnlink(db, block);
+
+		gdbPurgeBlock(block);
+	}
+
+	db->evicting = 0;
+}
+
+void
+gdbCacheInit(GDatabase *db)
+{
+	db->cacheCount       = 0;
+	db->cacheSize        = 0;
+	db->cacheBucketCount = DB_CACHE_MIN_BUCKETS;
+	db->lruHead          = NULL;
+	db->lruTail          = NULL;
+	db->evicting         = 0;
+
+	if (db->maxCacheSize == 0)
+		db->maxCacheSize = DB_DEFAULT_CACHE_SIZE;
+
+	MEM_CHECK(db->cacheBuckets =
+			  (GdbBlock **)malloc(db->cacheBucketCount * sizeof(GdbBlock *)));
+	memset(db->cacheBuckets, 0, db->cacheBucketCount * sizeof(GdbBlock *));
+}
+
+void
+gdbCacheDestroy(GDatabase *db)
+{
+	GdbBlock *block, *next;
+	unsigned long i;
+	int pass;
+
+	if (db->cacheBuckets == NULL)
 		return;
-	
-	if (db->openBlockCount >= db->openBlockSize)
+
+	/*
+	 * Evicting a node block releases its tree header, so this may
+	 * free up more blocks as it goes.
+	 */
+	__evictBlocks(db, 0);
+
+	if (db->cacheCount > 0)
 	{
-		GdbBlock **newBlocks;
-		int        newSize;
+		pmError(PM_ERROR_WARNING,
+				_("GNUpdate DB: %ld blocks are still referenced in %s.\n"),
+				db->cacheCount, db->filename);
 
-		newSize = 2 * db->openBlockSize;
+		/*
+		 * Free any node blocks before the tree headers they point to,
+		 * and everything else after.
+		 */
+		db->evicting = 1;
 
-		MEM_CHECK(newBlocks = (GdbBlock **)malloc(newSize *
-												  sizeof(GdbBlock *)));
-		memset(newBlocks, 0, newSize * sizeof(GdbBlock *));
+		for (pass = 0; pass < 2; pass++)
+		{
+			for (i = 0; i < db->cacheBucketCount; i++)
+			{
+				for (block = db->cacheBuckets[i]; block != NULL; block = next)
+				{
+					next = block->hashNext;
 
-		for (i = 0; i < db->openBlockSize; i++)
-			newBlocks[i] = db->openBlocks[i];
+					if (pass == 0 && block->type == GDB_BLOCK_BTREE_HEADER)
+						continue;
 
-		free(db->openBlocks);
+					if (block->refCount == 0)
+						__lruUnlink(db, block);
 
-		db->openBlocks    = newBlocks;
-		db->openBlockSize = newSize;
+					__hashUnlink(db, block);
+
+					gdbPurgeBlock(block);
+				}
+			}
+		}
+
+		db->evicting = 0;
 	}
-	
-	/* Find a place to put this. */
-	for (i = 0; i < db->openBlockSize; i++)
+
+	free(db->cacheBuckets);
+
+	db->cacheBuckets     = NULL;
+	db->cacheBucketCount = 0;
+	db->lruHead          = NULL;
+	db->lruTail          = NULL;
+}
+
+void
+gdbCacheFlush(GDatabase *db)
+{
+	GdbBlock *block;
+	unsigned long i;
+
+	if (db->cacheBuckets == NULL || db->fp == NULL)
+		return;
+
+	for (i = 0; i < db->cacheBucketCount; i++)
 	{
-		if (db->openBlocks[i] == NULL)
+		for (block = db->cacheBuckets[i]; block != NULL;
+			 block = block->hashNext)
 		{
-			db->openBlocks[i] = block;
-			db->openBlockCount++;
+			if (GDB_IS_DIRTY(block))
+				gdbWriteBlock(block);
+		}
+	}
+}
 
-			block->refCount++;
-			block->inList = 1;
+void
+gdbCacheSetSize(GDatabase *db, unsigned long size)
+{
+	db->maxCacheSize = size;
+
+	__evictBlocks(db, db->maxCacheSize);
+}
 
-			return;
+void
+gdbCacheAddBlock(GDatabase *db, GdbBlock *block)
+{
+	unsigned long bucket;
+
+	if (block->offset == 0)
+	{
+		pmError(PM_ERROR_FATAL,
+				_("Trying to add a block to the list with offset 0.\n"));
+		abort();
+	}
+
+	if (block->inList == 1 || db->cacheBuckets == NULL)
+		return;
+
+	/* See if it's already in the list. */
+	bucket = __hashOffset(db, block->offset);
+
+	{
+		GdbBlock *tempBlock;
+
+		for (tempBlock = db->cacheBuckets[bucket]; tempBlock != NULL;
+			 tempBlock = tempBlock->hashNext)
+		{
+			if (tempBlock->offset == block->offset)
+				return;
 		}
 	}
 
-	pmError(PM_ERROR_WARNING,
-			_("GNUpdate DB: "
-			  "Unable to place the open block in the block list!\n"));
+	if (block->refCount == 0)
+		block->refCount = 1;
+
+	block->hashNext = db->cacheBuckets[bucket];
+	db->cacheBuckets[bucket] = block;
+
+	block->inList = 1;
+	block->charge = __blockCharge(block);
+
+	db->cacheCount++;
+	db->cacheSize += block->charge;
+
+	if (db->cacheCount > 2 * db->cacheBucketCount)
+		__growBuckets(db);
 }
 
 unsigned short
 gdbCacheRemoveBlock(GDatabase *db, GdbBlock *block)
 {
-	int i;
-
 	if (block->offset == 0)
 	{
 		pmError(PM_ERROR_FATAL,
@@ -94,59 +317,100 @@ gdbCacheRemoveBlock(GDatabase *db, GdbBlock *block)
 				  "Trying to remove block from list with offset 0\n"));
 		abort();
 	}
-	
-	if (db->openBlockCount == 0)
+
+	if (block->inList == 0)
 	{
 		pmError(PM_ERROR_WARNING,
-				_("db->openBlockCount == 0 in %s, line %d\n"),
-				__FILE__, __LINE__);
+				_("GNUpdate DB: No open block found at offset %ld!\n"),
+				block->offset);
 		return 0;
 	}
 
-	for (i = 0; i < db->openBlockSize; i++)
+	if (block->refCount == 0)
 	{
-		if (db->openBlocks[i] != NULL &&
-			db->openBlocks[i]->offset == block->offset)
-		{
-			db->openBlocks[i]->refCount--;
+		pmError(PM_ERROR_WARNING,
+				_("GNUpdate DB: Block at offset %ld released too many "
+				  "times!\n"),
+				block->offset);
+		return 0;
+	}
 
-			if (db->openBlocks[i]->refCount <= 0)
-			{
-				db->openBlocks[i] = NULL;
-				db->openBlockCount--;
-				block->inList = 0;
+	block->refCount--;
 
-				return 0;
-			}
-			
-			return db->openBlocks[i]->refCount;
-		}
-	}
+	if (block->refCount > 0)
+		return block->refCount;
 
-	pmError(PM_ERROR_WARNING,
-			_("GNUpdate DB: No open block found at offset %ld!\n"),
-			block->offset);
+	/* The block may have grown or shrunk while it was in use. */
+	db->cacheSize -= block->charge;
+	block->charge  = __blockCharge(block);
+	db->cacheSize += block->charge;
+
+	__lruPushHead(db, block);
+
+	__evictBlocks(db, db->maxCacheSize);
 
 	return 0;
 }
 
+void
+gdbCacheRefBlock(GdbBlock *block)
+{
+	if (block->inList == 1 && block->refCount == 0)
+		__lruUnlink(block->db, block);
+
+	block->refCount++;
+}
+
 GdbBlock *
 gdbCacheGetBlock(GDatabase *db, offset_t offset)
 {
-	int i;
+	GdbBlock *block;
 
-	for (i = 0; i < db->openBlockSize; i++)
+	if (db->cacheBuckets == NULL)
+		return NULL;
+
+	for (block = db->cacheBuckets[__hashOffset(db, offset)]; block != NULL;
+		 block = block->hashNext)
 	{
-		if (db->openBlocks[i] != NULL &&
-			db->openBlocks[i]->offset == offset)
+		if (block->offset == offset)
 		{
-			db->openBlocks[i]->refCount++;
+			gdbCacheRefBlock(block);
+
+			db->stats.cacheHits++;
 
-			return db->openBlocks[i];
+			return block;
 		}
 	}
 	
 	return NULL;
 }
 
+void
+gdbCacheInvalidate(GDatabase *db, offset_t offset)
+{
+	GdbBlock *block;
+
+	if (db->cacheBuckets == NULL)
+		return;
+
+	for (block = db->cacheBuckets[__hashOffset(db, offset)]; block != NULL;
+		 block = block->hashNext)
+	{
+		if (block->offset == offset)
+			break;
+	}
+
+	if (block == NULL)
+		return;
 
+	/* The space is free now. Don't write anything back to it. */
+	GDB_CLEAR_DIRTY(block);
+
+	if (block->refCount == 0)
+		__lruUnlink(db, block);
+
+	__hashUnlink(db, block);
+
+	if (block->refCount == 0)
+		gdbPurgeBlock(block);
+}
@@ -24,7 +24,8 @@ char
 gdbReadHeader(GDatabase *db)
 {
 	char version[2];
-	char buffer[DB_HEADER_DATA_SIZE];
+	char buffer[DB_HEADER_BLOCK_SIZE];
+	unsigned char pageShift;
 	int counter;
 	
 	if (db == NULL || db->fp == NULL)
@@ -32,7 +33,7 @@ gdbReadHeader(GDatabase *db)
 	
 	fseek(db->fp, 0, SEEK_SET);
 
-	if (fread(buffer, DB_HEADER_DATA_SIZE, 1, db->fp) != 1)
+	if (fread(buffer, DB_HEADER_BLOCK_SIZE, 1, db->fp) != 1)
 	{
 		pmError(PM_ERROR_FATAL, _("GNUpdate DB: Truncated database.\n"));
 
@@ -53,7 +54,8 @@ gdbReadHeader(GDatabase *db)
 	version[0] = gdbGet8(buffer, &counter);
 	version[1] = gdbGet8(buffer, &counter);
 	
-	if (version[0] != DB_MAJOR_VER || version[1] != DB_MINOR_VER)
+	if (version[0] != DB_MAJOR_VER ||
+		(version[1] != DB_MINOR_VER && version[1] != DB_MINOR_VER_UNPAGED))
 	{
 		pmError(PM_ERROR_FATAL,
 				_("GNUpdate DB: Unsupported database version %d.%d\n"),
@@ -72,20 +74,50 @@ gdbReadHeader(GDatabase *db)
 		return 0;
 	}
 
+	if (version[1] == DB_MINOR_VER_UNPAGED)
+	{
+		gdbSetPageSize(db, 0);
+
+		return 1;
+	}
+
+	pageShift = gdbGet8(buffer, &counter);
+
+	if (pageShift < 12 || pageShift > 14)
+	{
+		pmError(PM_ERROR_FATAL,
+				_("GNUpdate DB: Unsupported page size %d.\n"),
+				1 << pageShift);
+
+		return 0;
+	}
+
+	gdbSetPageSize(db, 1 << pageShift);
+
 	return 1;
 }
 
+void
+gdbSetPageSize(GDatabase *db, unsigned short pageSize)
+{
+	if (db == NULL)
+		return;
+
+	db->pageSize   = pageSize;
+	db->offsetSize = (pageSize != 0 ? 8 : 4);
+}
+
 void
 gdbWriteHeader(GDatabase *db)
 {
 	char version[2];
-	char type;
+	char type, pageShift;
 	
 	if (db == NULL || db->fp == NULL)
 		return;
 
 	version[0] = DB_MAJOR_VER;
-	version[1] = DB_MINOR_VER;
+	version[1] = (GDB_IS_PAGED(db) ? DB_MINOR_VER : DB_MINOR_VER_UNPAGED);
 
 	type = (char)db->type;
 
@@ -97,7 +129,17 @@ gdbWriteHeader(GDatabase *db)
 	fwrite(version, sizeof(char), 2, db->fp);
 	fwrite(&type,   sizeof(char), 1, db->fp);
 
-	if (DB_HEADER_BLOCK_SIZE > DB_HEADER_DATA_SIZE)
+	if (GDB_IS_PAGED(db))
+	{
+		for (pageShift = 0; (1 << pageShift) < db->pageSize; pageShift++)
+			;
+
+		fwrite(&pageShift, sizeof(char), 1, db->fp);
+
+		/* No Bloom filter yet. */
+		gdbPad(db->fp, DB_HEADER_BLOCK_SIZE - DB_HEADER_DATA_SIZE - 1);
+	}
+	else if (DB_HEADER_BLOCK_SIZE > DB_HEADER_DATA_SIZE)
 		gdbPad(db->fp, DB_HEADER_BLOCK_SIZE - DB_HEADER_DATA_SIZE);
 
 	fflush(db->fp);
@@ -39,6 +39,105 @@ typedef enum
 
 #include "db.h"
 
+/**
+ * A lock on an offset in the database.
+ *
+ * Locks are kept in a per-database table and only exist while somebody
+ * holds or is waiting for them.
+ */
+struct _GdbLatch
+{
+	offset_t offset;             /**< The locked offset.                */
+
+	unsigned int readers;        /**< Number of read locks held.        */
+	char writer;                 /**< 1 if a write lock is held.        */
+	unsigned int writersWaiting; /**< Number of waiting writers.        */
+	unsigned int users;          /**< Number of holders and waiters.    */
+
+	pthread_cond_t cond;         /**< Signalled when a lock is dropped. */
+
+	GdbLatch *next;              /**< The next lock in the bucket.      */
+};
+
+/**
+ * Initializes the locks of a database.
+ *
+ * @param db The database.
+ */
+void gdbInitLocks(GDatabase *db);
+
+/**
+ * Frees up the locks of a database.
+ *
+ * @param db The database.
+ */
+void gdbDestroyLocks(GDatabase *db);
+
+/**
+ * Locks the database for cache access and file I/O.
+ *
+ * The lock is recursive. It is held only for the duration of a single
+ * block operation, and no offset lock may be waited on while holding it.
+ *
+ * @param db The active database.
+ */
+void gdbLockDatabase(GDatabase *db);
+
+/**
+ * Unlocks the database.
+ *
+ * @param db The active database.
+ */
+void gdbUnlockDatabase(GDatabase *db);
+
+/**
+ * Locks the data at an offset.
+ *
+ * Any number of readers may hold a read lock at the same time, but a
+ * write lock is exclusive. Waiting writers are given priority over new
+ * readers.
+ *
+ * If the offset is already locked, this will wait until it is unlocked
+ * before locking and returning.
+ *
+ * @param db     The active database.
+ * @param offset The offset to lock.
+ * @param type   The type of lock.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+char gdbLockOffset(GDatabase *db, offset_t offset, GdbLockType type);
+
+/**
+ * Locks the data at an offset, if that can be done without waiting.
+ *
+ * @param db     The active database.
+ * @param offset The offset to lock.
+ * @param type   The type of lock.
+ *
+ * @return 1 if the lock was taken, or 0 otherwise.
+ */
+char gdbTryLockOffset(GDatabase *db, offset_t offset, GdbLockType type);
+
+/**
+ * Releases a lock on an offset.
+ *
+ * @param db     The active database.
+ * @param offset The locked offset.
+ *
+ * @return 1 on success, 0 on failure.
+ */
+char gdbUnlockOffset(GDatabase *db, offset_t offset);
+
+/**
+ * Returns the current lock on an offset.
+ *
+ * @param db     The active database.
+ * @param offset The offset.
+ *
+ * @return The current lock on the offset (or DB_UNLOCKED if none.)
+ */
+GdbLockType gdbGetOffsetLock(GDatabase *db, offset_t offset);
 
 /**
  * Locks the free block list.
@@ -0,0 +1,176 @@
+/**
+ * @file db_paged_test.c Test of paged and 0.2 format database files.
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#include "db_internal.h"
+
+#include <unistd.h>
+
+#define TEST_FILENAME "db_paged_test.db"
+#define TEST_KEYS     3000
+
+static int failures = 0;
+
+#define CHECK(cond, what) \
+	do { \
+		if (!(cond)) \
+		{ \
+			printf("page size %u: %s failed (%s, line %d)\n", \
+				   pageSize, (what), __FILE__, __LINE__); \
+			failures++; \
+			return; \
+		} \
+	} while (0)
+
+static void
+__key(char *buffer, size_t size, unsigned long i)
+{
+	snprintf(buffer, size, "/usr/share/pkg%06lu/file", i);
+}
+
+/*
+ * The value stored for a key. Paged files store 8-byte offsets, so on
+ * hosts where offset_t is wider than 32 bits, some values are past 4 GB.
+ */
+static offset_t
+__value(unsigned short pageSize, unsigned long i)
+{
+	offset_t value = i + 1;
+
+	if (pageSize != 0 && sizeof(offset_t) > 4 && (i % 2) == 0)
+		value |= (offset_t)1 << (8 * sizeof(offset_t) - 8);
+
+	return value;
+}
+
+/*
+ * Checks that every key still in the tree is found, and every deleted
+ * one is not. Keys below "deleted" that are even were deleted.
+ */
+static int
+__checkKeys(BTree *tree, unsigned short pageSize, unsigned long deleted)
+{
+	char key[64];
+	offset_t offset;
+	unsigned long i;
+
+	for (i = 0; i < TEST_KEYS; i++)
+	{
+		__key(key, sizeof(key), i);
+
+		offset = btreeSearch(tree, key);
+
+		if (i < deleted && (i % 2) == 0)
+		{
+			if (offset != 0)
+				return 0;
+		}
+		else if (offset != __value(pageSize, i))
+			return 0;
+	}
+
+	__key(key, sizeof(key), TEST_KEYS);
+
+	return (btreeSearch(tree, key) == 0);
+}
+
+static void
+__testFormat(unsigned short pageSize)
+{
+	GDatabase *db;
+	char key[64];
+	unsigned long i, deleted = TEST_KEYS / 2;
+
+	unlink(TEST_FILENAME);
+
+	db = gdbCreatePaged(TEST_FILENAME, GDB_INDEX_FILE, pageSize);
+	CHECK(db != NULL, "create");
+	CHECK(db->pageSize == pageSize, "page size of the new file");
+
+	for (i = 0; i < TEST_KEYS; i++)
+	{
+		__key(key, sizeof(key), i);
+
+		CHECK(btreeInsert(db->mainTree, key, __value(pageSize, i), 0) ==
+			  GDB_SUCCESS, "insert");
+	}
+
+	CHECK(btreeGetSize(db->mainTree) == TEST_KEYS, "size after inserts");
+	CHECK(__checkKeys(db->mainTree, pageSize, 0), "search after inserts");
+
+	/* Deleting leaves free blocks, which are written out on close. */
+	for (i = 0; i < deleted; i += 2)
+	{
+		__key(key, sizeof(key), i);
+
+		CHECK(btreeDelete(db->mainTree, key), "delete");
+	}
+
+	gdbClose(db);
+
+	/* Everything must come back from the file's headers. */
+	db = gdbOpen(TEST_FILENAME, GDB_INDEX_FILE, PM_MODE_READ_WRITE);
+	CHECK(db != NULL, "reopen");
+	CHECK(db->pageSize == pageSize, "page size after reopening");
+	CHECK(btreeGetSize(db->mainTree) == TEST_KEYS - deleted / 2,
+		  "size after reopening");
+	CHECK(__checkKeys(db->mainTree, pageSize, deleted),
+		  "search after reopening");
+
+	/* Put the deleted keys back, into the free blocks read back in. */
+	for (i = 0; i < deleted; i += 2)
+	{
+		__key(key, sizeof(key), i);
+
+		CHECK(btreeInsert(db->mainTree, key, __value(pageSize, i), 0) ==
+			  GDB_SUCCESS, "insert after reopening");
+	}
+
+	gdbClose(db);
+
+	db = gdbOpen(TEST_FILENAME, GDB_INDEX_FILE, PM_MODE_READ_ONLY);
+	CHECK(db != NULL, "read-only reopen");
+	CHECK(btreeGetSize(db->mainTree) == TEST_KEYS, "size when read-only");
+	CHECK(__checkKeys(db->mainTree, pageSize, 0), "search when read-only");
+
+	gdbClose(db);
+
+	unlink(TEST_FILENAME);
+}
+
+int
+main(void)
+{
+	printf("long is %u bytes, offset_t is %u bytes\n",
+		   (unsigned int)sizeof(long), (unsigned int)sizeof(offset_t));
+
+	__testFormat(DB_PAGE_SIZE_SMALL);
+	__testFormat(DB_PAGE_SIZE_LARGE);
+	__testFormat(0);
+
+	if (failures > 0)
+	{
+		printf("%d formats failed\n", failures);
+		return 1;
+	}
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,442 @@
+/**
+ * @file db_snapshot.c Copy-on-write snapshots
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#include "db_internal.h"
+
+static unsigned long
+__hashOffset(offset_t offset)
+{
+	/* Block offsets are multiples of at least 32 bytes. */
+	return ((offset >> 5) ^ (offset >> 12)) % DB_FRESH_BUCKETS;
+}
+
+static GdbTreeImage *
+__findImage(GdbTreeImage *images, offset_t offset)
+{
+	GdbTreeImage *image;
+
+	for (image = images; image != NULL; image = image->next)
+	{
+		if (image->offset == offset)
+			return image;
+	}
+
+	return NULL;
+}
+
+static void
+__destroyImages(GdbTreeImage *images)
+{
+	GdbTreeImage *image, *next;
+
+	for (image = images; image != NULL; image = next)
+	{
+		next = image->next;
+
+		free(image);
+	}
+}
+
+static void
+__clearFresh(GDatabase *db)
+{
+	GdbFreshBlock *fresh, *next;
+	int i;
+
+	for (i = 0; i < DB_FRESH_BUCKETS; i++)
+	{
+		for (fresh = db->fresh[i]; fresh != NULL; fresh = next)
+		{
+			next = fresh->next;
+
+			free(fresh);
+		}
+
+		db->fresh[i] = NULL;
+	}
+}
+
+/*
+ * Frees the retired blocks that no snapshot can see, or all of them.
+ *
+ * A block retired in a transaction is seen by that transaction's
+ * committed state, and by every snapshot pinned up until it commits.
+ */
+static void
+__releaseRetired(GDatabase *db, char all)
+{
+	GdbRetiredBlock *block, *next, *released = NULL, **prev;
+	GdbSnapshot *snapshot;
+	unsigned long oldest = db->generation;
+
+	for (snapshot = db->snapshots; snapshot != NULL; snapshot = snapshot->next)
+	{
+		if (snapshot->generation < oldest)
+			oldest = snapshot->generation;
+	}
+
+	for (prev = &db->retired, block = db->retired; block != NULL; block = next)
+	{
+		next = block->next;
+
+		if (!all && block->generation >= oldest)
+		{
+			prev = &block->next;
+			continue;
+		}
+
+		*prev = next;
+
+		/* The space is going to be reused. Drop any cached copy. */
+		gdbCacheInvalidate(db, block->offset);
+
+		block->next = released;
+		released    = block;
+	}
+
+	if (released == NULL)
+		return;
+
+	gdbLockFreeBlockList(db, DB_WRITE_LOCK);
+
+	for (block = released; block != NULL; block = next)
+	{
+		next = block->next;
+
+		gdbReturnFreeBlock(db, block->offset, block->size);
+
+		free(block);
+	}
+
+	gdbUnlockFreeBlockList(db);
+}
+
+GdbSnapshot *
+gdbPinSnapshot(GDatabase *db)
+{
+	GdbSnapshot *snapshot;
+
+	if (db == NULL)
+		return NULL;
+
+	/* Files in the 0.2 format are changed in place. */
+	if (!GDB_IS_PAGED(db) && db->mode == PM_MODE_READ_WRITE)
+		return NULL;
+
+	MEM_CHECK(snapshot = (GdbSnapshot *)malloc(sizeof(GdbSnapshot)));
+	memset(snapshot, 0, sizeof(GdbSnapshot));
+
+	snapshot->db = db;
+
+	gdbLockDatabase(db);
+
+	snapshot->generation = db->generation;
+
+	snapshot->next = db->snapshots;
+
+	if (db->snapshots != NULL)
+		db->snapshots->prev = snapshot;
+
+	db->snapshots = snapshot;
+
+	gdbUnlockDatabase(db);
+
+	return snapshot;
+}
+
+void
+gdbUnpinSnapshot(GdbSnapshot *snapshot)
+{
+	GDatabase *db;
+
+	if (snapshot == NULL)
+		return;
+
+	db = snapshot->db;
+
+	gdbLockDatabase(db);
+
+	if (snapshot->prev != NULL)
+		snapshot->prev->next = snapshot->next;
+	else
+		db->snapshots = snapshot->next;
+
+	if (snapshot->next != NULL)
+		snapshot->next->prev = snapshot->prev;
+
+	__releaseRetired(db, 0);
+
+	gdbUnlockDatabase(db);
+
+	__destroyImages(snapshot->trees);
+
+	free(snapshot);
+}
+
+void
+gdbGetTreeImage(GdbSnapshot *snapshot, BTree *tree, GdbTreeImage *image)
+{
+	GDatabase *db;
+	GdbTreeImage *found;
+
+	if (snapshot == NULL || tree == NULL || image == NULL)
+		return;
+
+	db = tree->block->db;
+
+	gdbLockDatabase(db);
+
+	/*
+	 * A tree changed after the snapshot was pinned has its committed
+	 * header saved, either in the snapshot, or with the database if it
+	 * changed in the open transaction.
+	 */
+	if ((found = __findImage(snapshot->trees, tree->block->offset)) != NULL ||
+		(found = __findImage(db->treeImages, tree->block->offset)) != NULL)
+	{
+		*image = *found;
+	}
+	else
+	{
+		image->offset   = tree->block->offset;
+		image->root     = btreeGetRootNode(tree);
+		image->leftLeaf = btreeGetLeftLeaf(tree);
+		image->size     = btreeGetTreeSize(tree);
+	}
+
+	image->next = NULL;
+
+	gdbUnlockDatabase(db);
+}
+
+void
+gdbKeepTreeImage(BTree *tree)
+{
+	GDatabase *db;
+	GdbTreeImage *image;
+
+	if (tree == NULL || tree->snapshot != NULL)
+		return;
+
+	db = tree->block->db;
+
+	/* A header written in this transaction isn't in any snapshot. */
+	if (gdbCanWriteInPlace(db, tree->block->offset))
+		return;
+
+	gdbLockDatabase(db);
+
+	if (__findImage(db->treeImages, tree->block->offset) == NULL)
+	{
+		MEM_CHECK(image = (GdbTreeImage *)malloc(sizeof(GdbTreeImage)));
+
+		image->offset   = tree->block->offset;
+		image->root     = btreeGetRootNode(tree);
+		image->leftLeaf = btreeGetLeftLeaf(tree);
+		image->size     = btreeGetTreeSize(tree);
+
+		image->next     = db->treeImages;
+		db->treeImages  = image;
+	}
+
+	gdbUnlockDatabase(db);
+}
+
+char
+gdbCanWriteInPlace(GDatabase *db, offset_t offset)
+{
+	GdbFreshBlock *fresh;
+	char found = 0;
+
+	if (db == NULL || !GDB_COPY_ON_WRITE(db) || offset >= db->commitEnd)
+		return 1;
+
+	gdbLockDatabase(db);
+
+	for (fresh = db->fresh[__hashOffset(offset)]; fresh != NULL;
+		 fresh = fresh->next)
+	{
+		if (fresh->offset == offset)
+		{
+			found = 1;
+			break;
+		}
+	}
+
+	gdbUnlockDatabase(db);
+
+	return found;
+}
+
+void
+gdbAddFreshBlock(GDatabase *db, offset_t offset)
+{
+	GdbFreshBlock *fresh;
+	unsigned long bucket;
+
+	/* Anything past the end of the last commit is new anyway. */
+	if (db == NULL || !GDB_COPY_ON_WRITE(db) || offset >= db->commitEnd)
+		return;
+
+	MEM_CHECK(fresh = (GdbFreshBlock *)malloc(sizeof(GdbFreshBlock)));
+
+	bucket = __hashOffset(offset);
+
+	gdbLockDatabase(db);
+
+	fresh->offset = offset;
+	fresh->next   = db->fresh[bucket];
+
+	db->fresh[bucket] = fresh;
+
+	gdbUnlockDatabase(db);
+}
+
+char
+gdbRetireBlock(GDatabase *db, offset_t offset, unsigned short size)
+{
+	GdbFreshBlock *fresh, **prev;
+	GdbRetiredBlock *block;
+
+	if (db == NULL || !GDB_COPY_ON_WRITE(db) || offset >= db->commitEnd)
+		return 0;
+
+	gdbLockDatabase(db);
+
+	for (prev = &db->fresh[__hashOffset(offset)], fresh = *prev;
+		 fresh != NULL;
+		 prev = &fresh->next, fresh = fresh->next)
+	{
+		if (fresh->offset == offset)
+		{
+			/* Nobody else has seen it. It can go right away. */
+			*prev = fresh->next;
+
+			free(fresh);
+
+			gdbUnlockDatabase(db);
+
+			return 0;
+		}
+	}
+
+	MEM_CHECK(block = (GdbRetiredBlock *)malloc(sizeof(GdbRetiredBlock)));
+
+	block->offset     = offset;
+	block->size       = size;
+	block->generation = db->generation;
+
+	block->next = db->retired;
+	db->retired = block;
+
+	db->retireCount++;
+
+	gdbUnlockDatabase(db);
+
+	return 1;
+}
+
+unsigned long
+gdbGetRetireCount(GDatabase *db)
+{
+	unsigned long count;
+
+	if (db == NULL)
+		return 0;
+
+	gdbLockDatabase(db);
+	count = db->retireCount;
+	gdbUnlockDatabase(db);
+
+	return count;
+}
+
+void
+gdbCommitSnapshots(GDatabase *db)
+{
+	GdbTreeImage *image, *copy;
+	GdbSnapshot *snapshot;
+
+	if (db == NULL || !GDB_COPY_ON_WRITE(db))
+		return;
+
+	gdbLockDatabase(db);
+
+	/*
+	 * Snapshots that don't have their own image of a tree changed in
+	 * this transaction see it as it was before the transaction.
+	 */
+	for (image = db->treeImages; image != NULL; image = image->next)
+	{
+		for (snapshot = db->snapshots; snapshot != NULL;
+			 snapshot = snapshot->next)
+		{
+			if (__findImage(snapshot->trees, image->offset) != NULL)
+				continue;
+
+			MEM_CHECK(copy = (GdbTreeImage *)malloc(sizeof(GdbTreeImage)));
+
+			*copy = *image;
+
+			copy->next      = snapshot->trees;
+			snapshot->trees = copy;
+		}
+	}
+
+	__destroyImages(db->treeImages);
+	db->treeImages = NULL;
+
+	/* Everything written so far is committed, and may be in a snapshot. */
+	__clearFresh(db);
+
+	fseek(db->fp, 0L, SEEK_END);
+	db->commitEnd = ftell(db->fp);
+
+	db->generation++;
+
+	__releaseRetired(db, 0);
+
+	gdbUnlockDatabase(db);
+}
+
+void
+gdbDestroySnapshots(GDatabase *db)
+{
+	if (db == NULL)
+		return;
+
+	gdbLockDatabase(db);
+
+	if (db->snapshots != NULL)
+	{
+		pmError(PM_ERROR_WARNING,
+				_("GNUpdate DB: A snapshot of %s is still pinned.\n"),
+				db->filename);
+	}
+
+	__releaseRetired(db, 1);
+
+	__destroyImages(db->treeImages);
+	db->treeImages = NULL;
+
+	__clearFresh(db);
+
+	gdbUnlockDatabase(db);
+}
@@ -0,0 +1,206 @@
+/**
+ * @file db_snapshot.h Copy-on-write snapshots
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#ifndef _DB_SNAPSHOT_H_
+#define _DB_SNAPSHOT_H_
+
+/**
+ * Returns 1 if blocks in the database are copied before they change.
+ *
+ * Paged files opened for writing never change a block written before
+ * the current transaction. The block is copied to new space, and the
+ * copy changed instead, up to a new root that's put in the tree header.
+ *
+ * @param db The database.
+ */
+#define GDB_COPY_ON_WRITE(db) \
+	(GDB_IS_PAGED(db) && (db)->mode == PM_MODE_READ_WRITE)
+
+/**
+ * Space taken from the free space in the current transaction.
+ */
+struct _GdbFreshBlock
+{
+	offset_t offset;         /**< Offset of the block.             */
+
+	GdbFreshBlock *next;     /**< The next block in the bucket.    */
+};
+
+/**
+ * A block that was replaced by a copy, or freed, after it was
+ * committed. Its space is freed once no snapshot can see it.
+ */
+struct _GdbRetiredBlock
+{
+	offset_t offset;          /**< Offset of the block.             */
+	unsigned short size;      /**< Size of the block.               */
+	unsigned long generation; /**< Transaction that replaced it.    */
+
+	GdbRetiredBlock *next;    /**< The next retired block.          */
+};
+
+/**
+ * The fields of a tree header, as they were at some point.
+ */
+struct _GdbTreeImage
+{
+	offset_t offset;         /**< Offset of the tree header.       */
+
+	offset_t root;           /**< The root node's offset.          */
+	offset_t leftLeaf;       /**< The left-most leaf's offset.     */
+	unsigned long size;      /**< The size of the tree.            */
+
+	GdbTreeImage *next;      /**< The next image.                  */
+};
+
+/**
+ * A view of a database as of the last commit before it was pinned.
+ *
+ * Nothing it can see is changed or reused until it's unpinned, so
+ * trees opened through it with btreeOpenSnapshot() can be read without
+ * taking any locks, and aren't held up by a writer.
+ */
+struct _GdbSnapshot
+{
+	GDatabase *db;            /**< The database.                    */
+	unsigned long generation; /**< Transaction open when pinned.    */
+
+	GdbTreeImage *trees;      /**< Tree headers changed since.      */
+
+	GdbSnapshot *prev;        /**< The previous pinned snapshot.    */
+	GdbSnapshot *next;        /**< The next pinned snapshot.        */
+};
+
+/**
+ * Pins a snapshot of a database.
+ *
+ * The snapshot sees the database as of the last commit (see
+ * gdbJournalCommit() and gdbSync()), and keeps seeing it that way
+ * while the database changes, until it's unpinned. Blocks replaced in
+ * the meantime stay on disk until then, so a snapshot shouldn't be
+ * held longer than needed.
+ *
+ * Snapshots only cover changes made through this GDatabase. Files in
+ * the 0.2 format are changed in place, and can't be pinned when opened
+ * for writing.
+ *
+ * @param db The database.
+ *
+ * @return The snapshot, or NULL if the database can't be pinned.
+ */
+GdbSnapshot *gdbPinSnapshot(GDatabase *db);
+
+/**
+ * Unpins a snapshot, freeing the space of blocks that only it could
+ * see.
+ *
+ * Trees opened through the snapshot must be closed first. Snapshots
+ * must be unpinned before their database is closed.
+ *
+ * @param snapshot The snapshot.
+ */
+void gdbUnpinSnapshot(GdbSnapshot *snapshot);
+
+/**
+ * Returns the fields of a tree header as a snapshot sees them.
+ *
+ * @param snapshot The snapshot.
+ * @param tree     The tree, opened through the database.
+ * @param image    The image to fill in.
+ */
+void gdbGetTreeImage(GdbSnapshot *snapshot, BTree *tree, GdbTreeImage *image);
+
+/**
+ * Keeps the committed fields of a tree header, for the snapshots, before
+ * the header changes for the first time in a transaction.
+ *
+ * @param tree The tree.
+ */
+void gdbKeepTreeImage(BTree *tree);
+
+/**
+ * Returns whether the block at an offset may be changed in place.
+ *
+ * That's the case for every block in a database without copy-on-write,
+ * and for blocks given space in the current transaction otherwise.
+ *
+ * @param db     The database.
+ * @param offset The offset of the block.
+ *
+ * @return 1 if the block may be changed in place; 0 otherwise.
+ */
+char gdbCanWriteInPlace(GDatabase *db, offset_t offset);
+
+/**
+ * Notes that a block was given space in the current transaction.
+ *
+ * @param db     The database.
+ * @param offset The offset of the block.
+ */
+void gdbAddFreshBlock(GDatabase *db, offset_t offset);
+
+/**
+ * Retires a block that's being freed, if a snapshot may still see it.
+ *
+ * A block that can be changed in place is left to be freed right away.
+ * Anything else is kept until the transaction commits and no snapshot
+ * pinned before then is left.
+ *
+ * @param db     The database.
+ * @param offset The offset of the block.
+ * @param size   The size of the block.
+ *
+ * @return 1 if the block was retired; 0 if it should be freed now.
+ */
+char gdbRetireBlock(GDatabase *db, offset_t offset, unsigned short size);
+
+/**
+ * Returns the number of blocks retired so far.
+ *
+ * This changes whenever a node is replaced by a copy, so anything
+ * holding on to a node across calls can tell if it may be out of date.
+ *
+ * @param db The database.
+ *
+ * @return The number of retired blocks.
+ */
+unsigned long gdbGetRetireCount(GDatabase *db);
+
+/**
+ * Ends the current transaction for the snapshots.
+ *
+ * Blocks written in it can't be changed in place anymore, and retired
+ * blocks no snapshot can see are freed. This is called as part of
+ * committing, before the free space is written out.
+ *
+ * @param db The database.
+ */
+void gdbCommitSnapshots(GDatabase *db);
+
+/**
+ * Frees every retired block, and the state kept for snapshots.
+ *
+ * This is called when the database is closed.
+ *
+ * @param db The database.
+ */
+void gdbDestroySnapshots(GDatabase *db);
+
+#endif /* _DB_SNAPSHOT_H_ */
@@ -21,7 +21,6 @@
 #ifndef _HASHTABLE_H_
 #define _HASHTABLE_H_
 
-typedef struct _GdbBucket    GdbBucket;    /**< A bucket.    */
 typedef struct _GdbHashTable GdbHashTable; /**< A HashTable. */
 
 #include "db.h"
@@ -40,32 +39,37 @@ typedef struct _GdbHashTable GdbHashTable; /**< A HashTable. */
 #define GDB_HT_MAX_TYPE  GDB_HT_OFFSET
 /*@}*/
 
-/**
- * A bucket.
+/** @name Table layout
+ *
+ * A hashtable is stored as a header, an open-addressed array of slots,
+ * and an arena holding the values, one after another. The same bytes
+ * are used in memory, so a table read from disk is used in place.
+ *
+ * The header is a 0 byte (older tables start with a non-zero bucket
+ * count), the number of slots, and the number of items. Each slot has
+ * a key (0 if empty), a type, a pad byte, the value's size, and the
+ * value's position from the start of the table. All numbers are 16-bit
+ * and in network byte order.
  */
-struct _GdbBucket
-{
-	unsigned short  key;   /**< The key.              */
-
-	unsigned char   type;  /**< Data type.            */
-	unsigned short  size;  /**< The size of the data. */
-	void           *data;  /**< The data.             */
-
-	GdbBucket      *next;  /**< The next bucket.      */
-};
+/*@{*/
+#define GDB_HT_FLAT_MARKER   0x00  /**< First byte of the flat layout.  */
+#define GDB_HT_HEADER_SIZE   5     /**< Size of the table header.       */
+#define GDB_HT_SLOT_SIZE     8     /**< Size of a slot.                 */
+#define GDB_HT_MIN_SLOTS     16    /**< Slots in a new table.           */
+#define GDB_HT_MAX_SIZE      0xFFFF /**< Largest a table can grow to.  */
+/*@}*/
 
 /**
  * A hashtable.
  */
 struct _GdbHashTable
 {
-	GdbBlock *block;            /**< The associated block.           */
+	GdbBlock *block;            /**< The associated block.             */
 
-	unsigned char  bucketCount; /**< The number of buckets.          */
-	unsigned short itemCount;   /**< The number of items.            */
-
-	GdbBucket    **buckets;     /**< The buckets.                    */
-	unsigned char *counts;      /**< Number of items in each bucket. */
+	unsigned char *data;        /**< The table, laid out as on disk.   */
+	unsigned long  size;        /**< Bytes of data in use.             */
+	unsigned long  capacity;    /**< Bytes allocated for data, or 0 if
+	                                 data belongs to the block.        */
 };
 
 /**
@@ -74,6 +78,9 @@ struct _GdbHashTable
  * This is meant to be called by the block functions. Don't call this
  * directly.
  *
+ * The table points into the buffer, which the block keeps. Tables in
+ * the older chained layout are converted.
+ *
  * @param block  The block.
  * @param buffer The buffer to read from.
  * @param extra  NULL.
@@ -127,6 +134,23 @@ void htDestroyBlock(void *data);
  */
 GdbHashTable *htOpen(GDatabase *db, offset_t offset);
 
+/**
+ * Opens several hashtables from inside a database.
+ *
+ * The tables are read in file order, with the reads hinted to the
+ * kernel first. See gdbReadBlocks().
+ *
+ * @param db      The active database.
+ * @param offsets The offsets of the hashtables.
+ * @param count   The number of offsets.
+ * @param tables  The array to fill with the tables, in the order of
+ *                @a offsets. Tables that couldn't be read are NULL.
+ *
+ * @return The number of tables opened.
+ */
+unsigned long htOpenMany(GDatabase *db, const offset_t *offsets,
+						 unsigned long count, GdbHashTable **tables);
+
 /**
  * Creates a hashtable inside a database.
  *
@@ -136,6 +160,20 @@ GdbHashTable *htOpen(GDatabase *db, offset_t offset);
  */
 GdbHashTable *htCreate(GDatabase *db);
 
+/**
+ * Copies a hashtable into a database.
+ *
+ * The copy is new, and isn't written until gdbWriteBlock() is called
+ * on its block. Offsets are copied as they are, so any that point into
+ * the table's own database need to be replaced with htAddOffset().
+ *
+ * @param table The hashtable to copy.
+ * @param db    The database to copy it into.
+ *
+ * @return The new GdbHashTable structure.
+ */
+GdbHashTable *htCopy(GdbHashTable *table, GDatabase *db);
+
 /**
  * Adds a key and value to the hashtable.
  *
@@ -162,6 +200,9 @@ char htRemove(GdbHashTable *table, unsigned short key);
 /**
  * Gets the data associated with the specified key.
  *
+ * The data points into the table, and is only good until the table
+ * is next changed.
+ *
  * @param table The hashtable.
  * @param key   The key associated with the data.
  * @param size  The returned size of the data.
@@ -127,6 +127,28 @@ GdbOffsetList *olOpen(GDatabase *db, offset_t offset);
  */
 void olAddOffset(GdbOffsetList *list, offset_t offset);
 
+/**
+ * Removes an offset from the list.
+ *
+ * The offsets after it move up one place.
+ *
+ * @param list   The offsets list.
+ * @param offset The offset to remove.
+ *
+ * @return 1 if the offset was in the list, or 0 otherwise.
+ */
+char olRemoveOffset(GdbOffsetList *list, offset_t offset);
+
+/**
+ * Returns the index of an offset in the list.
+ *
+ * @param list   The offset list.
+ * @param offset The offset to look for.
+ *
+ * @return The index of the offset, or -1 if it's not in the list.
+ */
+int olFindOffset(GdbOffsetList *list, offset_t offset);
+
 /**
  * Returns an offset in the list.
  *
@@ -20,9 +20,55 @@
  */
 #include "gnupdate.h"
 
+#include <pthread.h>
+
 #define HEX_TO_DEC(x) (((x) >= '0' && (x) <= '9') ? (x) - '0' : \
 					   ((x) >= 'a' && (x) <= 'f') ? ((x) - 'a') + 10 : 0)
 
+/*
+ * The index files a package goes into.
+ */
+#define DB_INDEX_NAMES     0
+#define DB_INDEX_FILES     1
+#define DB_INDEX_GROUPS    2
+#define DB_INDEX_REQ_DEPS  3
+#define DB_INDEX_PROV_DEPS 4
+#define DB_INDEX_COUNT     5
+
+typedef struct
+{
+	const char *key;
+	offset_t    offset;
+
+} DbIndexEntry;
+
+/*
+ * The entries a package adds to one index file. They're gathered while
+ * the package data is written, and then each index file is updated by
+ * a thread of its own.
+ *
+ * For the names and files indexes, the key maps straight to the
+ * package. For the others, the key maps to a tree that maps the package
+ * name (subKey) to the package.
+ */
+typedef struct
+{
+	GDatabase    *index;
+	const char   *subKey;
+
+	GdbStatus   (*addEntry)(GDatabase *index, const char *key,
+							const char *subKey, offset_t offset);
+
+	DbIndexEntry *entries;
+	unsigned long count;
+	unsigned long size;
+
+	GdbStatus     status;
+	pthread_t     thread;
+	char          threaded;
+
+} DbIndexBatch;
+
 static char *
 __compressMd5(const char *md5)
 {
@@ -43,15 +89,223 @@ __compressMd5(const char *md5)
 	return strdup(newMd5);
 }
 
+static void
+__addBatchEntry(DbIndexBatch *batch, const char *key, offset_t offset)
+{
+	if (batch->count == batch->size)
+	{
+		batch->size = (batch->size == 0 ? 32 : batch->size * 2);
+
+		MEM_CHECK(batch->entries = (DbIndexEntry *)realloc(batch->entries,
+				  batch->size * sizeof(DbIndexEntry)));
+	}
+
+	batch->entries[batch->count].key    = key;
+	batch->entries[batch->count].offset = offset;
+
+	batch->count++;
+}
+
+static GdbStatus
+__addKeyEntry(GDatabase *index, const char *key, const char *subKey,
+			  offset_t offset)
+{
+	return gdbAddIndexEntry(index, index->mainTree, key, offset);
+}
+
+/*
+ * Adds a package to a file's entry in the files index. A file owned by
+ * more than one package points to a list of them.
+ */
+static GdbStatus
+__addFileEntry(GDatabase *index, const char *fileName, const char *subKey,
+			   offset_t pkgOffset)
+{
+	GdbOffsetList *list;
+	offset_t       listOffset;
+	blocktype_t    type;
+
+	listOffset = btreeSearch(index->mainTree, fileName);
+
+	if (listOffset == 0)
+	{
+		btreeInsert(index->mainTree, fileName, pkgOffset, 0);
+
+		return GDB_SUCCESS;
+	}
+
+	type = gdbBlockTypeAt(index, listOffset);
+
+	if (type == GDB_BLOCK_OFFSET_LIST)
+	{
+		list = olOpen(index, listOffset);
+
+		/* Readers with a snapshot still see the list as it was. */
+		list = (GdbOffsetList *)gdbShadowBlock(list->block, NULL)->detail;
+
+		olAddOffset(list, pkgOffset);
+
+		GDB_SET_DIRTY(list->block);
+		gdbWriteBlock(list->block);
+
+		if (list->block->offset != listOffset)
+			btreeInsert(index->mainTree, fileName, list->block->offset, 1);
+	}
+	else
+	{
+		/*
+		 * The index is (probably) pointing to a BTreeNode. Convert it.
+		 */
+		list = olCreate(index);
+
+		olAddOffset(list, listOffset);
+		olAddOffset(list, pkgOffset);
+
+		GDB_SET_DIRTY(list->block);
+		gdbWriteBlock(list->block);
+
+		btreeInsert(index->mainTree, fileName, list->block->offset, 1);
+	}
+
+	gdbDestroyBlock(list->block);
+
+	return GDB_SUCCESS;
+}
+
+/*
+ * Adds a package, by name, to the tree a key maps to in an index,
+ * creating the tree if it's not there yet.
+ */
+static GdbStatus
+__addTreeEntry(GDatabase *index, const char *key, const char *subKey,
+			   offset_t offset)
+{
+	BTree *indexTree;
+	GdbStatus status;
+
+	status = gdbAddTree(index, index->mainTree, key, &indexTree);
+
+	if (status != GDB_SUCCESS || indexTree == NULL)
+	{
+		/* Shouldn't happen. */
+		pmError(PM_ERROR_FATAL,
+				_("GNUpdate DB: "
+				  "Unable to add index tree for %s in %s, line %d\n"),
+				key, __FILE__, __LINE__);
+		abort();
+	}
+
+	status = gdbAddIndexEntry(index, indexTree, subKey, offset);
+
+	btreeClose(indexTree);
+
+	return status;
+}
+
+static void
+__initBatch(DbIndexBatch *batch, GDatabase *index, const char *subKey,
+			GdbStatus (*addEntry)(GDatabase *, const char *, const char *,
+								  offset_t))
+{
+	memset(batch, 0, sizeof(DbIndexBatch));
+
+	batch->index    = index;
+	batch->subKey   = subKey;
+	batch->addEntry = addEntry;
+	batch->status   = GDB_SUCCESS;
+}
+
+static int
+__compareEntries(const void *a, const void *b)
+{
+	return strcmp(((const DbIndexEntry *)a)->key,
+				  ((const DbIndexEntry *)b)->key);
+}
+
+static void *
+__applyBatch(void *data)
+{
+	DbIndexBatch *batch = (DbIndexBatch *)data;
+	GdbStatus status;
+	unsigned long i;
+
+	/* Neighbouring keys share nodes, so this keeps the cache warm. */
+	qsort(batch->entries, batch->count, sizeof(DbIndexEntry),
+		  __compareEntries);
+
+	for (i = 0; i < batch->count; i++)
+	{
+		status = batch->addEntry(batch->index, batch->entries[i].key,
+								 batch->subKey, batch->entries[i].offset);
+
+		/* A package that's already there is fine. */
+		if (status == GDB_ERROR)
+			batch->status = GDB_ERROR;
+	}
+
+	return NULL;
+}
+
+/*
+ * Applies each batch to its index file, all at once. Every file has
+ * its own locks, cache and journal pages, so they don't get in each
+ * other's way. The last batch is applied by the calling thread, and
+ * any that can't get a thread are too.
+ */
+static GdbStatus
+__applyBatches(DbIndexBatch *batches, int count)
+{
+	GdbStatus status = GDB_SUCCESS;
+	int i;
+
+	for (i = 0; i < count - 1; i++)
+	{
+		if (batches[i].count > 0 &&
+			pthread_create(&batches[i].thread, NULL, __applyBatch,
+						   &batches[i]) == 0)
+		{
+			batches[i].threaded = 1;
+		}
+	}
+
+	for (i = count - 1; i >= 0; i--)
+	{
+		if (!batches[i].threaded)
+			__applyBatch(&batches[i]);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (batches[i].threaded)
+			pthread_join(batches[i].thread, NULL);
+
+		if (status == GDB_SUCCESS)
+			status = batches[i].status;
+	}
+
+	return status;
+}
+
+static void
+__destroyBatches(DbIndexBatch *batches, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (batches[i].entries != NULL)
+			free(batches[i].entries);
+	}
+}
+
 static offset_t
-__addPackageFiles(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset)
+__addPackageFiles(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset,
+				  DbIndexBatch *batch)
 {
 	GdbHashTable  *table, *prevTable = NULL;
-	GdbOffsetList *list;
 	DbData        *data;
 	PmFile        *file;
 	offset_t       firstOffset = 0, prevOffset = 0;
-	offset_t       listOffset;
 
 	data = (DbData *)db->db;
 
@@ -108,67 +362,8 @@ __addPackageFiles(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset)
 		if (firstOffset == 0)
 			firstOffset = prevOffset;
 
-		/* Add to the index file */
-		listOffset = btreeSearch(data->filesIndex->mainTree, fileName);
-
-		if (listOffset == 0)
-		{
-			btreeInsert(data->filesIndex->mainTree, fileName, pkgOffset, 0);
-#if 0
-			list = olCreate(data->filesIndex);
-
-			olAddOffset(list, pkgOffset);
-
-			GDB_SET_DIRTY(list->block);
-			gdbWriteBlock(list->block);
-
-			btreeInsert(data->filesIndex->mainTree, fileName,
-						list->block->offset);
-#endif
-		}
-		else
-		{
-			blocktype_t type;
-
-			type = gdbBlockTypeAt(data->filesIndex, listOffset);
-
-			if (type == GDB_BLOCK_OFFSET_LIST)
-			{
-				list = olOpen(data->filesIndex, listOffset);
-
-				olAddOffset(list, pkgOffset);
-
-				GDB_SET_DIRTY(list->block);
-				gdbWriteBlock(list->block);
-			}
-			else
-			{
-				/*
-				 * The index is (probably) pointing to a BTreeNode. Convert it.
-				 */
-				list = olCreate(data->filesIndex);
-
-				olAddOffset(list, listOffset);
-				olAddOffset(list, pkgOffset);
-
-				GDB_SET_DIRTY(list->block);
-				gdbWriteBlock(list->block);
-
-				btreeInsert(data->filesIndex->mainTree, fileName,
-							list->block->offset, 1);
-			}
-
-			gdbDestroyBlock(list->block);
-
-#if 0
-			list = olOpen(data->filesIndex, listOffset);
-
-			olAddOffset(list, pkgOffset);
-
-			GDB_SET_DIRTY(list->block);
-			gdbWriteBlock(list->block);
-#endif
-		}
+		/* Queue it up for the index file. */
+		__addBatchEntry(batch, fileName, pkgOffset);
 
 		/* Update the progress */
 		pmPackageUpdateProgress(pkg);
@@ -183,11 +378,11 @@ __addPackageFiles(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset)
 }
 
 static offset_t
-__addRequiredDeps(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset)
+__addRequiredDeps(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset,
+				  DbIndexBatch *batch)
 {
 	DbData       *data;
 	GdbHashTable *table, *prevTable = NULL;
-	BTree        *indexTree;
 	PmDependency *dep;
 	offset_t      firstOffset = 0, prevOffset = 0;
 
@@ -242,24 +437,8 @@ __addRequiredDeps(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset)
 		if (firstOffset == 0)
 			firstOffset = prevOffset;
 
-		/* Add to the index file */
-		gdbAddTree(data->reqDepsIndex, data->reqDepsIndex->mainTree,
-				   pmGetDependencyName(dep), &indexTree);
-
-		if (indexTree == NULL)
-		{
-			/* Shouldn't happen. */
-			pmError(PM_ERROR_FATAL,
-					_("GNUpdate DB: "
-					  "indexTree == NULL in %s, line %d\n"),
-					__FILE__, __LINE__);
-			abort();
-		}
-
-		gdbAddIndexEntry(data->reqDepsIndex, indexTree,
-						 pmGetPackageName(pkg), pkgOffset);
-
-		btreeClose(indexTree);
+		/* Queue it up for the index file. */
+		__addBatchEntry(batch, pmGetDependencyName(dep), pkgOffset);
 
 		/* Update the progress */
 		pmPackageUpdateProgress(pkg);
@@ -274,11 +453,11 @@ __addRequiredDeps(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset)
 }
 
 static offset_t
-__addProvidedDeps(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset)
+__addProvidedDeps(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset,
+				  DbIndexBatch *batch)
 {
 	DbData       *data;
 	GdbHashTable *table, *prevTable = NULL;
-	BTree        *indexTree;
 	PmDependency *dep;
 	offset_t      firstOffset = 0, prevOffset = 0;
 
@@ -333,24 +512,8 @@ __addProvidedDeps(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset)
 		if (firstOffset == 0)
 			firstOffset = prevOffset;
 
-		/* Add to the index file */
-		gdbAddTree(data->provDepsIndex, data->provDepsIndex->mainTree,
-				   pmGetDependencyName(dep), &indexTree);
-
-		if (indexTree == NULL)
-		{
-			/* Shouldn't happen. */
-			pmError(PM_ERROR_FATAL,
-					_("GNUpdate DB: "
-					  "indexTree == NULL in %s, line %d\n"),
-					__FILE__, __LINE__);
-			abort();
-		}
-
-		gdbAddIndexEntry(data->provDepsIndex, indexTree,
-						 pmGetPackageName(pkg), pkgOffset);
-		
-		btreeClose(indexTree);
+		/* Queue it up for the index file. */
+		__addBatchEntry(batch, pmGetDependencyName(dep), pkgOffset);
 
 		/* Update the progress */
 		pmPackageUpdateProgress(pkg);
@@ -368,7 +531,7 @@ __addProvidedDeps(PmDatabase *db, PmPackage *pkg, offset_t pkgOffset)
  * Writes an entry in the main package data file.
  */
 static offset_t
-__writePackageEntry(PmDatabase *db, PmPackage *pkg)
+__writePackageEntry(PmDatabase *db, PmPackage *pkg, DbIndexBatch *batches)
 {
 	DbData *data;
 	GdbHashTable *table;
@@ -441,21 +604,24 @@ __writePackageEntry(PmDatabase *db, PmPackage *pkg)
 	/* Add a files B+Tree and populate it. */
 	if (pmFirstFile(pkg) != NULL)
 	{
-		childOffset = __addPackageFiles(db, pkg, table->block->offset);
+		childOffset = __addPackageFiles(db, pkg, table->block->offset,
+										&batches[DB_INDEX_FILES]);
 		htAddOffset(table, GDBTAG_FILES, childOffset);
 	}
 
 	/* Add a required dependencies B+Tree and populate it. */
 	if (pmFirstRequirement(pkg) != NULL)
 	{
-		childOffset = __addRequiredDeps(db, pkg, table->block->offset);
+		childOffset = __addRequiredDeps(db, pkg, table->block->offset,
+										&batches[DB_INDEX_REQ_DEPS]);
 		htAddOffset(table, GDBTAG_REQ_DEPS, childOffset);
 	}
 
 	/* Add a provided dependencies B+Tree and populate it. */
 	if (pmFirstProvide(pkg) != NULL)
 	{
-		childOffset = __addProvidedDeps(db, pkg, table->block->offset);
+		childOffset = __addProvidedDeps(db, pkg, table->block->offset,
+										&batches[DB_INDEX_PROV_DEPS]);
 		htAddOffset(table, GDBTAG_PROV_DEPS, childOffset);
 	}
 
@@ -478,74 +644,58 @@ __writePackageEntry(PmDatabase *db, PmPackage *pkg)
 	return offset;
 }
 
-/**
- * Writes the Name index file.
- */
-static PmStatus
-__writeNameIndexFile(PmDatabase *db, PmPackage *pkg, offset_t offset)
+PmStatus
+dbAddPackage(PmDatabase *db, PmPackage *pkg)
 {
+	DbIndexBatch batches[DB_INDEX_COUNT];
 	const char *pkgName;
 	GdbStatus status;
 	DbData *data;
+	offset_t offset;
 
 	data = (DbData *)db->db;
-	
-	pkgName = pmGetPackageName(pkg);
-	
-	status = gdbAddIndexEntry(data->namesIndex, data->namesIndex->mainTree,
-							  pkgName, offset);
-	
-	return PM_SUCCESS;
-}
 
-static PmStatus
-__writeGroupIndexFile(PmDatabase *db, PmPackage *pkg, offset_t offset)
-{
-	BTree *indexTree;
-	GdbStatus status;
-	DbData *data;
-
-	data = (DbData *)db->db;
+	/* XXX This should be moved elsewhere I think? */
+	if (pmGetPackageBranch(pkg) == NULL)
+		pmSetPackageBranch(pkg, "default");
 
-	status = gdbAddTree(data->groupsIndex, data->groupsIndex->mainTree,
-						pmGetPackageGroup(pkg), &indexTree);
+	pkgName = pmGetPackageName(pkg);
 
-	if (status != PM_SUCCESS)
+	__initBatch(&batches[DB_INDEX_NAMES], data->namesIndex, NULL,
+				__addKeyEntry);
+	__initBatch(&batches[DB_INDEX_FILES], data->filesIndex, NULL,
+				__addFileEntry);
+	__initBatch(&batches[DB_INDEX_GROUPS], data->groupsIndex, pkgName,
+				__addTreeEntry);
+	__initBatch(&batches[DB_INDEX_REQ_DEPS], data->reqDepsIndex, pkgName,
+				__addTreeEntry);
+	__initBatch(&batches[DB_INDEX_PROV_DEPS], data->provDepsIndex, pkgName,
+				__addTreeEntry);
+
+	/* The package data goes first. The index entries point into it. */
+	if ((offset = __writePackageEntry(db, pkg, batches)) == 0)
 	{
-		/* Shouldn't happen. */
-		pmError(PM_ERROR_FATAL,
-				_("GNUpdate DB: "
-				  "Unable to add groups index tree in %s, line %d\n"),
-				__FILE__, __LINE__);
-		abort();
-	}
+		__destroyBatches(batches, DB_INDEX_COUNT);
 
-	status = gdbAddIndexEntry(data->groupsIndex, indexTree,
-							  pmGetPackageName(pkg), offset);
-
-	btreeClose(indexTree);
+		return PM_FAILED;
+	}
 
-	return status;
-}
+	__addBatchEntry(&batches[DB_INDEX_NAMES], pkgName, offset);
+	__addBatchEntry(&batches[DB_INDEX_GROUPS], pmGetPackageGroup(pkg), offset);
 
-PmStatus
-dbAddPackage(PmDatabase *db, PmPackage *pkg)
-{
-	PmStatus status;
-	offset_t offset;
+	status = __applyBatches(batches, DB_INDEX_COUNT);
 
-	/* XXX This should be moved elsewhere I think? */
-	if (pmGetPackageBranch(pkg) == NULL)
-		pmSetPackageBranch(pkg, "default");
+	__destroyBatches(batches, DB_INDEX_COUNT);
 
-	if ((offset = __writePackageEntry(db, pkg)) == 0)
+	if (status != GDB_SUCCESS)
 		return PM_FAILED;
 
-	if ((status = __writeNameIndexFile(db, pkg, offset)) != PM_SUCCESS)
-		return status;
+	/* Link it up with what it requires, and what requires it. */
+	dbLinkPackage(data, offset, 1);
 
-	if ((status = __writeGroupIndexFile(db, pkg, offset)) != PM_SUCCESS)
-		return status;
+	/* The package goes into every file at once, or not at all. */
+	if (gdbJournalCommit(data->journal) != GDB_SUCCESS)
+		return PM_FAILED;
 
 	return PM_SUCCESS;
 }
@@ -34,14 +34,21 @@ typedef struct _BTreeTraversal BTreeTraversal; /**< A traversal.        */
  */
 struct _BTreeNode
 {
-	BTree *tree;               /**< Parent B+Tree.                     */
-	GdbBlock *block;           /**< Parent block.                      */
+	BTree *tree;                /**< Parent B+Tree.                     */
+	GdbBlock *block;            /**< Parent block.                      */
 
-	char keyCount;             /**< The number of keys in the node.    */
+	short keyCount;             /**< The number of keys in the node.    */
 
-	offset_t *children;        /**< An array of children node offsets. */
-	unsigned short *keySizes;  /**< An array of key sizes.             */
-	char **keys;               /**< An array of keys.                  */
+	offset_t *children;         /**< An array of children node offsets. */
+	unsigned short *keySizes;   /**< An array of key sizes.             */
+	unsigned long *keyOffsets;  /**< Offsets of the keys in keyBuf.     */
+	unsigned long *keyPrefixes; /**< Packed bytes after prefixLen.      */
+
+	unsigned short prefixLen;   /**< Length of the shared key prefix.   */
+
+	char *keyBuf;               /**< Uncompressed keys, back to back.   */
+	unsigned long keyBufSize;   /**< Allocated size of keyBuf.          */
+	unsigned long keyBufUsed;   /**< Bytes of keyBuf in use.            */
 };
 
 /**
@@ -51,16 +58,20 @@ struct _BTree
 {
 	GdbBlock *block;         /**< The B+Tree's block.                      */
 
-	unsigned char order;     /**< The order of this tree.                  */
+	unsigned short order;    /**< The order of this tree.                  */
 	unsigned long size;      /**< The size of the tree.                    */
 
-	unsigned char minLeaf;   /**< Minimum key count in a leaf              */
-	unsigned char minInt;    /**< Minimum key count in an internal node.   */
+	unsigned short minLeaf;  /**< Minimum key count in a leaf              */
+	unsigned short minInt;   /**< Minimum key count in an internal node.   */
 	
 	offset_t root;           /**< The root node's offset.                  */
 	offset_t leftLeaf;       /**< The left-most leaf's offset.             */
 
 	offset_t _insFilePos;    /**< Current filePos on inserts. Don't touch! */
+
+	pthread_mutex_t writeLock; /**< Serializes inserts and deletes.        */
+
+	GdbSnapshot *snapshot;   /**< The snapshot this is a view of, or NULL. */
 };
 
 /**
@@ -68,9 +79,18 @@ struct _BTree
  */
 struct _BTreeTraversal
 {
-	BTree     *tree;       /**< The active B+Tree.               */
-	BTreeNode *node;       /**< The current node.                */
-	short      pos;        /**< The position of the current key. */
+	BTree         *tree;       /**< The active B+Tree.                 */
+	BTreeNode     *node;       /**< The current node.                  */
+	short          pos;        /**< The position of the current key.   */
+
+	char          *key;        /**< The current key.                   */
+	unsigned long  keyBufSize; /**< Allocated size of key.             */
+	char           where;      /**< Where we are relative to key.      */
+
+	char          *minKey;     /**< The first key in range, or NULL.   */
+	char          *maxKey;     /**< The key past the range, or NULL.   */
+
+	unsigned long  retireCount; /**< Retired blocks when node was read. */
 };
 
 /**
@@ -83,6 +103,21 @@ struct _BTreeTraversal
  */
 BTree *btreeOpen(GDatabase *db, offset_t offset);
 
+/**
+ * Opens a B+Tree as a snapshot sees it.
+ *
+ * The tree can be searched and traversed like any other, without
+ * taking locks, and doesn't see changes committed after the snapshot
+ * was pinned. It can't be changed. It must be closed with btreeClose()
+ * before the snapshot is unpinned.
+ *
+ * @param snapshot The snapshot.
+ * @param offset   The offset of the tree.
+ *
+ * @return A BTree structure.
+ */
+BTree *btreeOpenSnapshot(GdbSnapshot *snapshot, offset_t offset);
+
 /**
  * Closes a B+Tree.
  *
@@ -113,6 +148,40 @@ BTree *btreeCreate(GDatabase *db, char order);
 GdbStatus btreeInsert(BTree *tree, const char *key, offset_t filePos,
 					  char replaceDup);
 
+/**
+ * Returns the next key and offset for btreeBulkLoad().
+ *
+ * @param data   The user data passed to btreeBulkLoad().
+ * @param key    The returned key. This only needs to stay valid until
+ *               the next call.
+ * @param offset The returned offset.
+ *
+ * @return 1 if a key was returned, or 0 when there are no more.
+ */
+typedef int (*BTreeLoadFunc)(void *data, const char **key, offset_t *offset);
+
+/**
+ * Builds an empty B+Tree from keys in sorted order.
+ *
+ * The leaves are filled and written in one pass, left to right, with
+ * each level of internal nodes built above them as they go. This is
+ * much faster than inserting the keys one by one, and leaves the nodes
+ * fuller.
+ *
+ * Of any duplicate keys, only the first is kept. If the keys are out of
+ * order, GDB_ERROR is returned, and the tree is left empty.
+ *
+ * @param tree       The tree to load. This must be empty.
+ * @param next       The function returning the keys.
+ * @param data       User data passed to @a next.
+ * @param fillFactor The percentage of each node to fill, from 1 to 100.
+ *                   Nodes are never filled below the tree's minimum.
+ *
+ * @return The status of the load operation.
+ */
+GdbStatus btreeBulkLoad(BTree *tree, BTreeLoadFunc next, void *data,
+						unsigned char fillFactor);
+
 /**
  * Deletes a value from a B+Tree.
  *
@@ -177,6 +246,31 @@ void btreePrettyPrint(BTree *tree, offset_t rootOffset, int i);
  */
 BTreeTraversal *btreeInitTraversal(BTree *tree);
 
+/**
+ * Prepares a traversal over a range of keys.
+ *
+ * The range includes @a minKey, and stops just short of @a maxKey.
+ * Either bound may be NULL, leaving that end of the range open.
+ *
+ * @param tree   The tree.
+ * @param minKey The first key in the range, or NULL.
+ * @param maxKey The first key past the range, or NULL.
+ *
+ * @return A BTreeTraversal structure.
+ */
+BTreeTraversal *btreeInitRangeTraversal(BTree *tree, const char *minKey,
+										const char *maxKey);
+
+/**
+ * Prepares a traversal over every key starting with a prefix.
+ *
+ * @param tree   The tree.
+ * @param prefix The prefix.
+ *
+ * @return A BTreeTraversal structure.
+ */
+BTreeTraversal *btreeInitPrefixTraversal(BTree *tree, const char *prefix);
+
 /**
  * Destroys a traversal.
  *
@@ -204,5 +298,54 @@ offset_t btreeGetFirstOffset(BTreeTraversal *trav);
  */
 offset_t btreeGetNextOffset(BTreeTraversal *trav);
 
+/**
+ * Returns the last offset in a traversal.
+ *
+ * @param trav The active traversal.
+ *
+ * @return The last offset, or -1 if empty.
+ */
+offset_t btreeGetLastOffset(BTreeTraversal *trav);
+
+/**
+ * Returns the previous offset in a traversal.
+ *
+ * Traversals can change direction at any point. The previous offset is
+ * the one before the offset last returned, whichever way the traversal
+ * was going. Once the traversal runs off either end, the next call in
+ * the other direction returns the offset at that end.
+ *
+ * @param trav The active traversal.
+ *
+ * @return The previous offset, or -1 when done.
+ */
+offset_t btreeGetPrevOffset(BTreeTraversal *trav);
+
+/**
+ * Moves a traversal to a key.
+ *
+ * This is btreeGetFirstOffset() for a traversal starting at @a key.
+ * From there, btreeGetNextOffset() and btreeGetPrevOffset() return the
+ * offsets after and before it.
+ *
+ * @param trav The active traversal.
+ * @param key  The key to seek to.
+ *
+ * @return The offset of the first key at or after @a key, or -1 if
+ *         there is none in range.
+ */
+offset_t btreeSeekOffset(BTreeTraversal *trav, const char *key);
+
+/**
+ * Returns the key of the offset last returned from a traversal.
+ *
+ * The key is only valid until the traversal moves again.
+ *
+ * @param trav The active traversal.
+ *
+ * @return The key, or NULL if no offset has been returned.
+ */
+const char *btreeGetTraversalKey(BTreeTraversal *trav);
+
 #endif /* _BTREE_H_ */
 
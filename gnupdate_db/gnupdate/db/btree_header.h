@@ -35,6 +35,30 @@
 #define BTREE_LEFT_LEAF_OFFSET     9  /**< Offset of the left-most leaf.   */
 /*@}*/
 
+/** @name B+Tree header offsets in paged files
+ * The order takes two bytes, and node offsets take eight.
+ */
+/*@{*/
+#define BTREE_PAGED_HEADER_DATA_SIZE  22 /**< Header data size.            */
+#define BTREE_PAGED_SIZE_OFFSET        2 /**< Size of the B+Tree.          */
+#define BTREE_PAGED_ROOT_OFFSET        6 /**< Offset of the root node.     */
+#define BTREE_PAGED_LEFT_LEAF_OFFSET  14 /**< Offset of the left-most leaf. */
+/*@}*/
+
+/**
+ * Order of trees in files without pages.
+ */
+#define BTREE_DEFAULT_ORDER 5
+
+/**
+ * Bytes planned for each key in a paged node.
+ *
+ * This covers the child offset, the key size and a prefix-compressed
+ * key, so the order of a paged tree fills a page with typical keys.
+ * Nodes with longer keys spill into an overflow page.
+ */
+#define BTREE_PAGED_ENTRY_SIZE 32
+
 /**
  * Reads a B+Tree header from a buffer.
  *
@@ -117,6 +141,9 @@ void btreeSetTreeSize(BTree *tree, unsigned long size);
 /**
  * Returns the root node offset in the header.
  *
+ * A tree opened through a snapshot returns the offsets and size the
+ * snapshot sees, here and in the functions below.
+ *
  * @param tree The active B+Tree.
  *
  * @return The root node offset.
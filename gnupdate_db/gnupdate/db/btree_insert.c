@@ -20,157 +20,78 @@
  */
 #include "db_internal.h"
 
-static char
-__splitNode(BTree *tree, BTreeNode *rootNode, char **key,
-			offset_t *filePos, char *split, char replaceDup)
+/*
+ * Splits a node that has taken one key more than it can hold.
+ *
+ * On return, key holds the separator to add to the parent, and filePos
+ * the offset of the new right-hand node.
+ */
+static void
+__splitNode(BTree *tree, BTreeNode *rootNode, char **key, offset_t *filePos)
 {
-	char      *temp1, *temp2;
 	BTreeNode *tempNode;
-	offset_t   offset1 = 0, offset2;
-	char       tempSize1, tempSize2;
-	int        i, j, div;
-
-	for (i = 0;
-		 i < (tree->order - 1) && strcmp(*key, rootNode->keys[i]) > 0;
-		 i++)
-		;
-
-	if (i < (tree->order - 1) && strcmp(*key, rootNode->keys[i]) == 0)
-	{
-		if (replaceDup && BTREE_IS_LEAF(rootNode))
-		{
-			rootNode->children[i] = *filePos;
-			GDB_SET_DIRTY(rootNode->block);
-			btreeWriteNode(rootNode);
-		}
-
-		*split = 0;
-		return 0;
-	}
+	int        i, j, div, keyCount;
 
-	*split = 1;
-	
-	if (i < (tree->order - 1))
+	if (BTREE_IS_LEAF(rootNode))
 	{
-		temp1                 = rootNode->keys[i];
-		tempSize1             = rootNode->keySizes[i];
-		rootNode->keys[i]     = strdup(*key);
-		rootNode->keySizes[i] = strlen(*key) + 1;
-		j = i;
-
-		for (i++; i < (tree->order - 1); i++)
-		{
-			temp2     = rootNode->keys[i];
-			tempSize2 = rootNode->keySizes[i];
-			
-			rootNode->keys[i]     = temp1;
-			rootNode->keySizes[i] = tempSize1;
-			
-			temp1     = temp2;
-			tempSize1 = tempSize2;
-		}
-
-		if (!BTREE_IS_LEAF(rootNode))
-			j++;
-
-		offset1 = rootNode->children[j];
-		rootNode->children[j] = *filePos;
-		
-		for (j++; j <= (tree->order - 1); j++)
-		{
-			offset2 = rootNode->children[j];
-			rootNode->children[j] = offset1;
-			offset1 = offset2;
-		}
+		div      = (int)((tree->order + 1) / 2) - 1;
+		keyCount = div + 1;
 	}
 	else
 	{
-		temp1     = strdup(*key);
-		tempSize1 = strlen(temp1) + 1;
-
-		if (BTREE_IS_LEAF(rootNode))
-		{
-			offset1 = rootNode->children[tree->order - 1];
-			rootNode->children[tree->order - 1] = *filePos;
-		}
-		else
-			offset1 = *filePos;
+		div      = (int)(tree->order / 2);
+		keyCount = div;
 	}
 
-	if (BTREE_IS_LEAF(rootNode))
-		div = (int)((tree->order + 1) / 2) - 1;
-	else
-		div = (int)(tree->order / 2);
-
 	free(*key);
-	*key = strdup(rootNode->keys[div]);
-	
-	tempNode           = btreeNewNode(tree);
-	tempNode->keyCount = tree->order - 1 - div;
+	*key = strdup(BTREE_KEY(rootNode, div));
+
+	tempNode = btreeNewNode(tree);
 
 	if (BTREE_IS_LEAF(rootNode))
 		BTREE_SET_LEAF(tempNode);
 
-	i = div + 1;
-
-	for (j = 0; j < tempNode->keyCount - 1; j++, i++)
+	/*
+	 * The right node takes the keys after the divider, along with their
+	 * children. In a leaf, the last child is the next leaf pointer.
+	 */
+	for (i = div + 1, j = 0; i < rootNode->keyCount; i++, j++)
 	{
-		tempNode->keys[j]     = rootNode->keys[i];
-		tempNode->keySizes[j] = rootNode->keySizes[i];
+		btreeInsertKey(tempNode, j, BTREE_KEY(rootNode, i));
 		tempNode->children[j] = rootNode->children[i];
-
-		rootNode->keys[i]     = NULL;
-		rootNode->keySizes[i] = 0;
-		rootNode->children[i] = 0;
 	}
 
-	tempNode->keys[j]         = temp1;
-	tempNode->keySizes[j]     = tempSize1;
-	tempNode->children[j]     = rootNode->children[i];
-	rootNode->children[i]     = 0;
-	tempNode->children[j + 1] = offset1;
+	tempNode->children[j] = rootNode->children[i];
 
 	*filePos = btreeWriteNode(tempNode);
 
-	if (BTREE_IS_LEAF(rootNode))
-	{
-		rootNode->keyCount = div + 1;
-		rootNode->children[(int)rootNode->keyCount] = *filePos;
-	}
-	else
-	{
-		rootNode->keyCount = div;
+	while (rootNode->keyCount > keyCount)
+		btreeRemoveKey(rootNode, rootNode->keyCount - 1);
 
-		free(rootNode->keys[(int)rootNode->keyCount]);
-		rootNode->keys[(int)rootNode->keyCount]     = NULL;
-		rootNode->keySizes[(int)rootNode->keyCount] = 0;
-	}
+	for (i = keyCount + 1; i <= tree->order; i++)
+		rootNode->children[i] = 0;
+
+	if (BTREE_IS_LEAF(rootNode))
+		rootNode->children[keyCount] = *filePos;
 
 	GDB_SET_DIRTY(rootNode->block);
 	btreeWriteNode(rootNode);
 
 	btreeDestroyNode(tempNode);
-
-	return 1;
 }
 
 static char
 __addKey(BTree *tree, BTreeNode *rootNode, char **key, offset_t *filePos,
 		 char *split, char replaceDup)
 {
-	char     *temp1, *temp2;
-	offset_t  offset1, offset2;
-	char      tempSize1, tempSize2;
-	int       i, j;
+	char found;
+	int  i, count;
 
 	*split = 0;
 
-	for (i = 0;
-		 i < rootNode->keyCount && strcmp(*key, rootNode->keys[i]) > 0;
-		 i++)
-		;
+	i = btreeFindKey(rootNode, *key, &found);
 
-	if (i < rootNode->keyCount && strcmp(*key, rootNode->keys[i]) == 0)
+	if (found)
 	{
 		if (replaceDup && BTREE_IS_LEAF(rootNode))
 		{
@@ -182,115 +103,131 @@ __addKey(BTree *tree, BTreeNode *rootNode, char **key, offset_t *filePos,
 		return 0;
 	}
 
-	rootNode->keyCount++;
+	/*
+	 * A leaf's children line up with its keys, with the next leaf
+	 * pointer after them. An internal node's new child goes to the
+	 * right of the new key.
+	 */
+	count = rootNode->keyCount - i;
 
-	if (i < rootNode->keyCount)
+	if (BTREE_IS_LEAF(rootNode))
 	{
-		temp1     = rootNode->keys[i];
-		tempSize1 = rootNode->keySizes[i];
+		memmove(&rootNode->children[i + 1], &rootNode->children[i],
+				(count + 1) * sizeof(offset_t));
 
-		rootNode->keys[i]     = strdup(*key);
-		rootNode->keySizes[i] = strlen(*key) + 1;
-		
-		j = i;
-		
-		for (i++; i < rootNode->keyCount; i++)
-		{
-			temp2     = rootNode->keys[i];
-			tempSize2 = rootNode->keySizes[i];
-
-			rootNode->keys[i]     = temp1;
-			rootNode->keySizes[i] = tempSize1;
-
-			temp1     = temp2;
-			tempSize1 = tempSize2;
-		}
-
-		if (!BTREE_IS_LEAF(rootNode))
-			j++;
-
-		offset1 = rootNode->children[j];
-		rootNode->children[j] = *filePos;
-		
-		for (j++; j <= rootNode->keyCount; j++)
-		{
-			offset2 = rootNode->children[j];
-			rootNode->children[j] = offset1;
-			offset1 = offset2;
-		}
+		rootNode->children[i] = *filePos;
 	}
 	else
 	{
-		rootNode->keys[i]     = strdup(*key);
-		rootNode->keySizes[i] = strlen(*key) + 1;
-	
-		if (BTREE_IS_LEAF(rootNode))
-		{
-			rootNode->children[i + 1] = rootNode->children[i];
-			rootNode->children[i]     = *filePos;
-		}
-		else
-			rootNode->children[i + 1] = *filePos;
+		memmove(&rootNode->children[i + 2], &rootNode->children[i + 1],
+				count * sizeof(offset_t));
+
+		rootNode->children[i + 1] = *filePos;
 	}
 
+	btreeInsertKey(rootNode, i, *key);
+
 	GDB_SET_DIRTY(rootNode->block);
-	btreeWriteNode(rootNode);
+
+	if (rootNode->keyCount == tree->order)
+	{
+		__splitNode(tree, rootNode, key, filePos);
+		*split = 1;
+	}
+	else
+		btreeWriteNode(rootNode);
 
 	return 1;
 }
 
+/*
+ * Adds a key to the subtree at *rootOffset.
+ *
+ * In a copy-on-write file, committed nodes along the way are copied
+ * before they're changed, and *rootOffset is set to wherever the root
+ * of the subtree ends up.
+ */
 static char
-__insertKey(BTree *tree, offset_t rootOffset, char **key,
-			offset_t *filePos, char *split, char replaceDup)
+__insertKey(BTree *tree, offset_t *rootOffset, char **key,
+			offset_t *filePos, char *split, char replaceDup,
+			BTreeLockPath *path)
 {
 	char success = 0;
 	BTreeNode *rootNode;
 
-	if (rootOffset < DB_HEADER_BLOCK_SIZE)
+	if (*rootOffset < DB_HEADER_BLOCK_SIZE)
 	{
 		pmError(PM_ERROR_FATAL,
 				_("GNUpdate DB: rootOffset = %ld in __insertKey('%s') in "
 				  "%s, line %d\n"),
-				rootOffset, *key, __FILE__, __LINE__);
+				*rootOffset, *key, __FILE__, __LINE__);
 		exit(1);
 	}
 
-	rootNode = btreeReadNode(tree, rootOffset);
+	btreeLockPathNode(path, *rootOffset);
+
+	rootNode = btreeReadNode(tree, *rootOffset);
+
+	/*
+	 * If there's room for another key here, this node won't split,
+	 * so nothing above it will change. That is, unless the node has to
+	 * be copied, which changes its offset in the parent.
+	 */
+	if (rootNode->keyCount < (tree->order - 1) &&
+		gdbCanWriteInPlace(tree->block->db, *rootOffset))
+	{
+		btreeReleaseAncestors(path);
+	}
 
 	if (BTREE_IS_LEAF(rootNode))
 	{
-		if (rootNode->keyCount < (tree->order - 1))
-			success = __addKey(tree, rootNode, key, filePos, split, replaceDup);
-		else
-			success = __splitNode(tree, rootNode, key, filePos, split,
-								  replaceDup);
+		char found;
+		int i;
+
+		i = btreeFindKey(rootNode, *key, &found);
 
-		btreeDestroyNode(rootNode);
+		/* Don't copy a node that isn't going to change. */
+		if (found && (!replaceDup || rootNode->children[i] == *filePos))
+		{
+			btreeDestroyNode(rootNode);
 
-		return success;
+			return 0;
+		}
+
+		btreeShadowNode(tree, &rootNode);
+
+		success = __addKey(tree, rootNode, key, filePos, split, replaceDup);
 	}
 	else
 	{
 		/* Internal node. */
+		offset_t childOffset;
 		int i;
 
-		for (i = 0;
-			 i < rootNode->keyCount && strcmp(*key, rootNode->keys[i]) > 0;
-			 i++)
-			;
-		
-		success = __insertKey(tree, rootNode->children[i], key, filePos,
-							  split, replaceDup);
-	}
+		i = btreeFindKey(rootNode, *key, NULL);
 
-	if (success == 1 && *split == 1)
-	{
-		if (rootNode->keyCount < (tree->order - 1))
-			__addKey(tree, rootNode, key, filePos, split, replaceDup);
-		else
-			__splitNode(tree, rootNode, key, filePos, split, replaceDup);
+		childOffset = rootNode->children[i];
+
+		success = __insertKey(tree, &childOffset, key, filePos,
+							  split, replaceDup, path);
+
+		if (childOffset != rootNode->children[i] ||
+			(success == 1 && *split == 1))
+		{
+			btreeShadowNode(tree, &rootNode);
+
+			rootNode->children[i] = childOffset;
+			GDB_SET_DIRTY(rootNode->block);
+
+			if (success == 1 && *split == 1)
+				__addKey(tree, rootNode, key, filePos, split, replaceDup);
+			else
+				btreeWriteNode(rootNode);
+		}
 	}
 
+	*rootOffset = rootNode->block->offset;
+
 	btreeDestroyNode(rootNode);
 	
 	return success;
@@ -299,6 +236,7 @@ __insertKey(BTree *tree, offset_t rootOffset, char **key,
 GdbStatus
 btreeInsert(BTree *tree, const char *key, offset_t filePos, char replaceDup)
 {
+	BTreeLockPath path;
 	char  success, split;
 	char *newKey;
 	
@@ -316,11 +254,18 @@ btreeInsert(BTree *tree, const char *key, offset_t filePos, char replaceDup)
 		return GDB_SUCCESS;
 	}
 
+	/* A snapshot doesn't change. */
+	if (tree->snapshot != NULL)
+		return GDB_ERROR;
+
 	newKey = strdup(key);
 	
 	success = 0;
 	split = 0;
 
+	btreeLockWriter(tree);
+	btreeInitLockPath(&path, tree, DB_WRITE_LOCK);
+
 	tree->_insFilePos = filePos;
 	
 	/* Read in the tree data. */
@@ -330,25 +275,33 @@ btreeInsert(BTree *tree, const char *key, offset_t filePos, char replaceDup)
 
 	if (tree->root != 0)
 	{
-		success = __insertKey(tree, tree->root, &newKey, &tree->_insFilePos,
-							  &split, replaceDup);
+		offset_t rootOffset = tree->root;
+
+		success = __insertKey(tree, &rootOffset, &newKey, &tree->_insFilePos,
+							  &split, replaceDup, &path);
+
+		/* The root was copied. A replaced value doesn't count as a key. */
+		if (rootOffset != tree->root)
+			btreeSetRootNode(tree, rootOffset);
 
 		if (success == 0)
 		{
+			btreeReleaseLockPath(&path);
+			btreeUnlockWriter(tree);
+
 			free(newKey);
 			return (replaceDup ? GDB_SUCCESS : GDB_DUPLICATE);
 		}
 	}
 
 	btreeSetTreeSize(tree, tree->size + 1);
+	gdbBloomAdd(tree, key);
 
 	if (tree->root == 0 || split == 1)
 	{
 		BTreeNode *node = btreeNewNode(tree);
 
-		node->keys[0]     = strdup(newKey);
-		node->keySizes[0] = strlen(newKey) + 1;
-		node->keyCount    = 1;
+		btreeInsertKey(node, 0, newKey);
 
 		if (tree->root == 0)
 		{
@@ -370,6 +323,9 @@ btreeInsert(BTree *tree, const char *key, offset_t filePos, char replaceDup)
 		btreeSetRootNode(tree, node->block->offset);
 		btreeDestroyNode(node);
 	}
+
+	btreeReleaseLockPath(&path);
+	btreeUnlockWriter(tree);
 	
 	free(newKey);
 
@@ -23,48 +23,166 @@
 char
 btreeLockNode(BTree *tree, offset_t nodeOffset, GdbLockType type)
 {
-	if (tree == NULL || nodeOffset < DB_HEADER_BLOCK_SIZE)
+	/* Nothing a snapshot sees changes, so it doesn't need locks. */
+	if (tree == NULL || tree->snapshot != NULL ||
+		nodeOffset < DB_HEADER_BLOCK_SIZE)
+	{
 		return 0;
+	}
 
 	if (type == DB_UNLOCKED)
 		return btreeUnlockNode(tree, nodeOffset);
 	
-	return 1;
+	return gdbLockOffset(tree->block->db, nodeOffset, type);
+}
+
+char
+btreeTryLockNode(BTree *tree, offset_t nodeOffset, GdbLockType type)
+{
+	if (tree == NULL || tree->snapshot != NULL ||
+		nodeOffset < DB_HEADER_BLOCK_SIZE)
+	{
+		return 0;
+	}
+
+	return gdbTryLockOffset(tree->block->db, nodeOffset, type);
 }
 
 char
 btreeUnlockNode(BTree *tree, offset_t nodeOffset)
 {
-	return 0;
+	if (tree == NULL || tree->snapshot != NULL ||
+		nodeOffset < DB_HEADER_BLOCK_SIZE)
+	{
+		return 0;
+	}
+
+	return gdbUnlockOffset(tree->block->db, nodeOffset);
 }
 
 char
 btreeLockTree(BTree *tree, GdbLockType type)
 {
-	if (tree == NULL)
+	if (tree == NULL || tree->snapshot != NULL)
 		return 0;
 
 	if (type == DB_UNLOCKED)
 		return btreeUnlockTree(tree);
 
-	return 0;
+	/* The tree lock guards the root node offset in the tree header. */
+	return gdbLockOffset(tree->block->db, tree->block->offset, type);
 }
 
 char
 btreeUnlockTree(BTree *tree)
 {
-	return 0;
+	if (tree == NULL || tree->snapshot != NULL)
+		return 0;
+
+	return gdbUnlockOffset(tree->block->db, tree->block->offset);
 }
 
 GdbLockType
 btreeGetNodeLock(BTree *tree, offset_t nodeOffset)
 {
-	return DB_UNLOCKED;
+	if (tree == NULL)
+		return DB_UNLOCKED;
+
+	return gdbGetOffsetLock(tree->block->db, nodeOffset);
 }
 
 GdbLockType
 btreeGetTreeLock(BTree *tree)
 {
-	return DB_UNLOCKED;
+	if (tree == NULL)
+		return DB_UNLOCKED;
+
+	return gdbGetOffsetLock(tree->block->db, tree->block->offset);
+}
+
+void
+btreeLockWriter(BTree *tree)
+{
+	pthread_mutex_lock(&tree->writeLock);
+}
+
+void
+btreeUnlockWriter(BTree *tree)
+{
+	pthread_mutex_unlock(&tree->writeLock);
+}
+
+void
+btreeInitLockPath(BTreeLockPath *path, BTree *tree, GdbLockType type)
+{
+	path->tree    = tree;
+	path->type    = type;
+	path->count   = 0;
+	path->size    = 8;
+
+	MEM_CHECK(path->offsets = (offset_t *)malloc(path->size *
+												 sizeof(offset_t)));
+
+	path->treeLocked = btreeLockTree(tree, type);
+}
+
+void
+btreeLockPathNode(BTreeLockPath *path, offset_t nodeOffset)
+{
+	if (path->count == path->size)
+	{
+		path->size *= 2;
+
+		MEM_CHECK(path->offsets =
+				  (offset_t *)realloc(path->offsets,
+									  path->size * sizeof(offset_t)));
+	}
+
+	btreeLockNode(path->tree, nodeOffset, path->type);
+
+	path->offsets[path->count++] = nodeOffset;
+}
+
+void
+btreeReleaseAncestors(BTreeLockPath *path)
+{
+	int i;
+
+	if (path->treeLocked)
+	{
+		btreeUnlockTree(path->tree);
+
+		path->treeLocked = 0;
+	}
+
+	if (path->count <= 1)
+		return;
+
+	for (i = 0; i < path->count - 1; i++)
+		btreeUnlockNode(path->tree, path->offsets[i]);
+
+	path->offsets[0] = path->offsets[path->count - 1];
+	path->count      = 1;
 }
 
+void
+btreeReleaseLockPath(BTreeLockPath *path)
+{
+	int i;
+
+	if (path->treeLocked)
+	{
+		btreeUnlockTree(path->tree);
+
+		path->treeLocked = 0;
+	}
+
+	for (i = 0; i < path->count; i++)
+		btreeUnlockNode(path->tree, path->offsets[i]);
+
+	path->count = 0;
+
+	free(path->offsets);
+
+	path->offsets = NULL;
+}
@@ -20,67 +20,76 @@
  */
 #include "db_internal.h"
 
-static char
-__search(BTree *tree, offset_t rootOffset, const char *key, offset_t *filePos)
+BTreeNode *
+btreeFindLeaf(BTree *tree, const char *key, BTreeLockPath *path)
 {
+	BTreeNode *node;
+	offset_t offset;
 	int i;
-	BTreeNode *rootNode;
-	char result;
 
-	rootNode = btreeReadNode(tree, rootOffset);
-	
-	for (i = 0;
-		 i < rootNode->keyCount && strcmp(rootNode->keys[i], key) < 0;
-		 i++)
-		;
+	offset = btreeGetRootNode(tree);
 
-	if (BTREE_IS_LEAF(rootNode))
-	{
-		if (i < rootNode->keyCount && strcmp(rootNode->keys[i], key) == 0)
-		{
-			*filePos = rootNode->children[i];
+	if (offset == 0)
+		return NULL;
 
-			btreeDestroyNode(rootNode);
+	btreeLockPathNode(path, offset);
+	btreeReleaseAncestors(path);
 
-			return 1;
-		}
+	node = btreeReadNode(tree, offset);
 
-		btreeDestroyNode(rootNode);
-		
-		return 0;
-	}
+	while (!BTREE_IS_LEAF(node))
+	{
+		i = btreeFindKey(node, key, NULL);
 
-	result = __search(tree, rootNode->children[i], key, filePos);
+		offset = node->children[i];
 
-	btreeDestroyNode(rootNode);
+		/* Lock the child before letting go of the parent. */
+		btreeLockPathNode(path, offset);
+		btreeReleaseAncestors(path);
 
-	return result;
+		btreeDestroyNode(node);
+
+		node = btreeReadNode(tree, offset);
+	}
+
+	return node;
 }
 
 offset_t
 btreeSearch(BTree *tree, const char *key)
 {
+	BTreeLockPath path;
+	BTreeNode *node;
 	offset_t filePos;
-	char found;
+	int i;
 	
 	if (tree == NULL || key == NULL)
 		return 0;
 
+	/* Most searches for missing keys stop here. */
+	if (!gdbBloomMayContain(tree, key))
+		return 0;
+
 	filePos = 0;
-	found   = 0;
 
-	/* Read in the tree data. */
-	tree->root     = btreeGetRootNode(tree);
-	tree->leftLeaf = btreeGetLeftLeaf(tree);
+	/* Hold the tree lock until the root is locked, so it can't move. */
+	btreeInitLockPath(&path, tree, DB_READ_LOCK);
 
-	if (btreeIsEmpty(tree) == 1)
-		return 0;
+	node = btreeFindLeaf(tree, key, &path);
 
-	found = __search(tree, tree->root, key, &filePos);
+	if (node != NULL)
+	{
+		char found;
 
-	if (found != 0)
-		return filePos;
+		i = btreeFindKey(node, key, &found);
 
-	return 0;
-}
+		if (found)
+			filePos = node->children[i];
 
+		btreeDestroyNode(node);
+	}
+
+	btreeReleaseLockPath(&path);
+
+	return filePos;
+}
@@ -19,16 +19,32 @@
  * Boston, MA  02111-1307, USA.
  */
 #include "db_internal.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static void
-__setupDatabase(GDatabase *db)
+__mapDatabase(GDatabase *db)
 {
-	db->openBlockCount = 0;
-	db->openBlockSize  = 10;
+	struct stat sb;
+	void *map;
+
+	if (fstat(fileno(db->fp), &sb) != 0 || sb.st_size == 0)
+		return;
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fileno(db->fp), 0);
+
+	if (map == MAP_FAILED)
+		return;
 
-	MEM_CHECK(db->openBlocks = (GdbBlock **)malloc(db->openBlockSize *
-												   sizeof(GdbBlock *)));
-	memset(db->openBlocks, 0, db->openBlockSize * sizeof(GdbBlock *));
+	db->map     = (char *)map;
+	db->mapSize = sb.st_size;
+}
+
+static void
+__setupDatabase(GDatabase *db)
+{
+	gdbInitLocks(db);
+	gdbCacheInit(db);
 }
 
 GDatabase *
@@ -78,8 +94,20 @@ gdbOpen(const char *filename, GdbType type, PmAccessMode mode)
 
 	db->mode     = mode;
 	db->filename = strdup(filename);
+
+	if (mode == PM_MODE_READ_ONLY)
+		__mapDatabase(db);
+	else
+	{
+		/* Everything in the file so far is committed. */
+		fseek(db->fp, 0L, SEEK_END);
+		db->commitEnd = ftell(db->fp);
+	}
+
 	db->mainTree = btreeOpen(db, DB_MAIN_TREE_OFFSET);
 
+	gdbLoadBloom(db);
+
 	return db;
 }
 
@@ -88,21 +116,103 @@ gdbClose(GDatabase *db)
 {
 	cxReturnUnless(db != NULL);
 
-	if (db->fp != NULL)
-		fclose(db->fp);
+	gdbSyncBloom(db);
+	gdbDestroyBloom(db);
 
 	btreeClose(db->mainTree);
 
+	/* Write back and free the cached blocks while the file is open. */
+	gdbCacheDestroy(db);
+
+	gdbDestroySnapshots(db);
+
+	gdbSyncFreeMap(db);
+
+	/* Put anything journaled into place. */
+	gdbJournalDetach(db);
+
+	if (db->map != NULL)
+		munmap(db->map, db->mapSize);
+
+	if (db->fp != NULL)
+		fclose(db->fp);
+
 	gdbDestroy(db);
 }
 
+void
+gdbSync(GDatabase *db)
+{
+	cxReturnUnless(db != NULL);
+
+	/* A filter that outgrew itself is refilled at its new size. */
+	if (db->bloom != NULL && db->bloom->stale)
+		gdbEnableBloom(db, 0);
+
+	gdbLockDatabase(db);
+
+	gdbSyncBloom(db);
+
+	/* A journal commits the snapshots along with everything else. */
+	if (db->journal == NULL)
+		gdbCommitSnapshots(db);
+
+	gdbSyncFreeMap(db);
+	fflush(db->fp);
+
+	gdbUnlockDatabase(db);
+
+	if (db->journal != NULL)
+		gdbJournalCommit(db->journal);
+}
+
+void
+gdbSetCacheSize(GDatabase *db, unsigned long size)
+{
+	cxReturnUnless(db != NULL);
+
+	gdbLockDatabase(db);
+	gdbCacheSetSize(db, size);
+	gdbUnlockDatabase(db);
+}
+
+void
+gdbGetStats(GDatabase *db, GdbStats *stats)
+{
+	cxReturnUnless(db != NULL && stats != NULL);
+
+	gdbLockDatabase(db);
+	*stats = db->stats;
+	gdbUnlockDatabase(db);
+}
+
+void
+gdbResetStats(GDatabase *db)
+{
+	cxReturnUnless(db != NULL);
+
+	gdbLockDatabase(db);
+	memset(&db->stats, 0, sizeof(GdbStats));
+	gdbUnlockDatabase(db);
+}
+
 GDatabase *
 gdbCreate(const char *filename, GdbType type)
+{
+	return gdbCreatePaged(filename, type, DB_DEFAULT_PAGE_SIZE);
+}
+
+GDatabase *
+gdbCreatePaged(const char *filename, GdbType type, unsigned short pageSize)
 {
 	GDatabase *db;
 	FILE      *fp;
 
 	cxReturnValueUnless(filename != NULL, NULL);
+	cxReturnValueUnless(pageSize == 0 ||
+						((pageSize & (pageSize - 1)) == 0 &&
+						 pageSize >= DB_PAGE_SIZE_SMALL &&
+						 pageSize <= DB_PAGE_SIZE_LARGE), NULL);
 
 	fp = fopen(filename, "w+");
 
@@ -124,6 +234,9 @@ gdbCreate(const char *filename, GdbType type)
 	db->filename = strdup(filename);
 	db->type     = type;
 	db->fp       = fp;
+	db->mode     = PM_MODE_READ_WRITE;
+
+	gdbSetPageSize(db, pageSize);
 
 	gdbWriteHeader(db);
 
@@ -133,6 +246,18 @@ gdbCreate(const char *filename, GdbType type)
 
 	db->mainTree = btreeCreate(db, 5);
 
+	/*
+	 * The header, free block list and main tree header share the first
+	 * page. The rest of it is left unused, so the first blocks written
+	 * start on the next page instead of being scattered into the gap.
+	 */
+	if (GDB_IS_PAGED(db))
+	{
+		fseek(db->fp, 0L, SEEK_END);
+		gdbPad(db->fp, db->pageSize - ftell(db->fp) % db->pageSize);
+		fflush(db->fp);
+	}
+
 	return db;
 }
 
@@ -141,7 +266,12 @@ gdbDestroy(GDatabase *db)
 {
 	cxReturnValueUnless(db != NULL, NULL);
 
-	free(db->openBlocks);
+	if (db->cacheBuckets != NULL)
+		free(db->cacheBuckets);
+
+	gdbDestroyFreeMap(db);
+	gdbDestroyLocks(db);
+
 	free(db->filename);
 	free(db);
 
@@ -19,10 +19,27 @@
  * Boston, MA  02111-1307, USA.
  */
 #include "db_internal.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Blocks closer together than this are hinted as one range by
+ * gdbReadBlocks().
+ */
+#define GDB_READ_AHEAD_GAP 4096
+
+typedef struct
+{
+	offset_t      offset;
+	unsigned long index;
+
+} GdbBlockRequest;
 
 typedef struct
 {
 	unsigned short multiple;
+	unsigned short pagedMultiple; /* Size in paged files, or 0 for a page. */
 
 	void *(*readBlock)(GdbBlock *block, const char *buffer, void *extra);
 	void (*writeBlock)(GdbBlock *block, char **buffer, unsigned long *size);
@@ -35,34 +52,53 @@ typedef struct
 static GdbBlockTypeInfo blockTypeInfo[] =
 {
 	/** Raw data block */
-	{ 64, NULL, NULL, NULL, NULL },
+	{ 64, 64, NULL, NULL, NULL, NULL },
 
-	/** B+Tree header block */
-	{ 32, btreeReadHeader, btreeWriteHeader, btreeCreateHeader,
-	      btreeDestroyHeader },
+	/**
+	 * B+Tree header block. Its fields are changed in place, so it has to
+	 * fit in one block, with the bigger offsets of paged files too.
+	 */
+	{ 32, 64, btreeReadHeader, btreeWriteHeader, btreeCreateHeader,
+	          btreeDestroyHeader },
 
 	/** B+Tree node block */
-	{ 128, btreeReadNodeBlock, btreeWriteNodeBlock, btreeCreateNodeBlock,
-	       btreeDestroyNodeBlock },
+	{ 128, 0, btreeReadNodeBlock, btreeWriteNodeBlock, btreeCreateNodeBlock,
+	          btreeDestroyNodeBlock },
 
 	/** Hashtable block */
-	{ 64, htReadBlock, htWriteBlock, htCreateBlock, htDestroyBlock },
+	{ 64, 64, htReadBlock, htWriteBlock, htCreateBlock, htDestroyBlock },
 
 	/** Offset List block */
-	{ 32, olReadBlock, olWriteBlock, olCreateBlock, olDestroyBlock }
+	{ 32, 32, olReadBlock, olWriteBlock, olCreateBlock, olDestroyBlock },
+
+	/** Bloom filter block */
+	{ 256, 0, gdbBloomReadBlock, gdbBloomWriteBlock, gdbBloomCreateBlock,
+	          gdbBloomDestroyBlock }
 };
 
-static int
-__blockCompare(const void *a, const void *b)
+/*
+ * Returns the block size for a type. In paged files, nodes and filters
+ * take up a page, so each one is read and written in one aligned piece.
+ */
+static unsigned short
+__blockMultiple(GDatabase *db, blocktype_t blockType)
 {
-	const GdbFreeBlock *block1 = (const GdbFreeBlock *)a;
-	const GdbFreeBlock *block2 = (const GdbFreeBlock *)b;
+	if (!GDB_IS_PAGED(db))
+		return blockTypeInfo[blockType - 1].multiple;
+
+	if (blockTypeInfo[blockType - 1].pagedMultiple == 0)
+		return db->pageSize;
+
+	return blockTypeInfo[blockType - 1].pagedMultiple;
+}
+
+/* Returns the alignment for a type, or 0 if it can go anywhere. */
+static unsigned short
+__blockAlignment(GDatabase *db, blocktype_t blockType)
+{
+	if (GDB_IS_PAGED(db) && blockTypeInfo[blockType - 1].pagedMultiple == 0)
+		return db->pageSize;
 
-	if (block1->size   > block2->size)   return  1;
-	if (block1->size   < block2->size)   return -1;
-	if (block1->offset > block2->offset) return  1;
-	if (block1->offset < block2->offset) return -1;
-	
 	return 0;
 }
 
@@ -93,13 +129,13 @@ gdbNewBlock(GDatabase *db, blocktype_t blockType, void *extra)
 	block->type     = blockType;
 	block->db       = db;
 	block->inList   = 0;
-	block->refCount = 0;
+	block->refCount = 1;
 
 	GDB_SET_DIRTY(block);
 
 	typeIndex = blockType - 1;
 
-	block->multiple = blockTypeInfo[typeIndex].multiple;
+	block->multiple = __blockMultiple(db, blockType);
 
 	if (blockTypeInfo[typeIndex].create != NULL)
 	{
@@ -112,17 +148,36 @@ gdbNewBlock(GDatabase *db, blocktype_t blockType, void *extra)
 void
 gdbDestroyBlock(GdbBlock *block)
 {
-	blocktype_t typeIndex;
-	
+	GDatabase *db;
+
 	if (block == NULL)
 		return;
 
-	if (gdbCacheRemoveBlock(block->db, block) > 0)
+	db = block->db;
+
+	gdbLockDatabase(db);
+
+	if (block->inList == 1)
+		gdbCacheRemoveBlock(db, block);
+	else if (block->refCount > 1)
+		block->refCount--;
+	else
+		gdbPurgeBlock(block);
+
+	gdbUnlockDatabase(db);
+}
+
+void
+gdbPurgeBlock(GdbBlock *block)
+{
+	blocktype_t typeIndex;
+
+	if (block == NULL)
 		return;
 
 	typeIndex = block->type - 1;
 	
-	if (block->detail != NULL)
+	if (block->detail != NULL && !block->mapped)
 	{
 		if (blockTypeInfo[typeIndex].destroy != NULL)
 			blockTypeInfo[typeIndex].destroy(block->detail);
@@ -141,16 +196,19 @@ gdbDestroyBlock(GdbBlock *block)
 	if (block->chain != NULL)
 		free(block->chain);
 
+	if (block->buffer != NULL)
+		free(block->buffer);
+
 	free(block);
 }
 
-GdbBlock *
-gdbReadBlockHeader(GDatabase *db, offset_t offset, blocktype_t blockType)
+static GdbBlock *
+__readBlockHeader(GDatabase *db, offset_t offset, blocktype_t blockType)
 {
 	GdbBlock *block;
-	char header[GDB_BLOCK_HEADER_SIZE];
+	char headerBuf[GDB_BLOCK_MAX_HEADER_SIZE];
+	const char *header;
 	int counter = 0;
-	blocktype_t typeIndex;
 
 	if (db == NULL || !GDB_VALID_OFFSET(offset) ||
 		(blockType != GDB_BLOCK_ANY && !GDB_VALID_BLOCK_TYPE(blockType)))
@@ -163,23 +221,33 @@ gdbReadBlockHeader(GDatabase *db, offset_t offset, blocktype_t blockType)
 	{
 		if (blockType == GDB_BLOCK_ANY || blockType == block->type)
 			return block;
-		else
-			return NULL;
+
+		gdbDestroyBlock(block);
+
+		return NULL;
 	}
 
-	/* Seek to the offset of the block. */
-	fseek(db->fp, offset, SEEK_SET);
-	
-	if (fread(header, GDB_BLOCK_HEADER_SIZE, 1, db->fp) != 1)
+	if (db->map != NULL && offset + GDB_BLOCK_HEADER_SIZE(db) <= db->mapSize)
 	{
-		return NULL;
+		header = db->map + offset;
+	}
+	else
+	{
+		if (gdbFileRead(db, offset, headerBuf,
+						GDB_BLOCK_HEADER_SIZE(db)) != GDB_BLOCK_HEADER_SIZE(db))
+		{
+			return NULL;
+		}
+
+		header = headerBuf;
 	}
 
 	/* Allocate memory for the block. */
 	MEM_CHECK(block = (GdbBlock *)malloc(sizeof(GdbBlock)));
 	memset(block, 0, sizeof(GdbBlock));
 
-	block->db = db;
+	block->db       = db;
+	block->refCount = 1;
 
 	/* Store the info from the header. */
 	block->type = gdbGet8(header, &counter);
@@ -193,16 +261,14 @@ gdbReadBlockHeader(GDatabase *db, offset_t offset, blocktype_t blockType)
 		return NULL;
 	}
 
-	typeIndex = block->type - 1;
-
 	block->offset = offset;
 	
-	block->multiple = blockTypeInfo[typeIndex].multiple;
+	block->multiple = __blockMultiple(db, block->type);
 	
 	block->dataSize = gdbGet32(header, &counter);
 	block->flags    = gdbGet16(header, &counter);
-	block->next     = gdbGet32(header, &counter);
-	block->listNext = gdbGet32(header, &counter);
+	block->next     = gdbGetOffset(header, &counter, db->offsetSize);
+	block->listNext = gdbGetOffset(header, &counter, db->offsetSize);
 
 	GDB_CLEAR_DIRTY(block);
 
@@ -215,7 +281,7 @@ void
 gdbWriteBlockHeader(GdbBlock *block)
 {
 	GDatabase *db;
-	char header[GDB_BLOCK_HEADER_SIZE];
+	char header[GDB_BLOCK_MAX_HEADER_SIZE];
 	int   counter = 0;
 
 	if (block == NULL || !GDB_IS_DIRTY(block))
@@ -230,13 +296,13 @@ gdbWriteBlockHeader(GdbBlock *block)
 	gdbPut8(header,  &counter, block->type);
 	gdbPut32(header, &counter, block->dataSize);
 	gdbPut16(header, &counter, block->flags);
-	gdbPut32(header, &counter, block->next);
-	gdbPut32(header, &counter, block->listNext);
+	gdbPutOffset(header, &counter, block->next,     db->offsetSize);
+	gdbPutOffset(header, &counter, block->listNext, db->offsetSize);
 
-	/* Write the header to disk. */
-	fseek(db->fp, block->offset, SEEK_SET);
+	gdbLockDatabase(db);
 
-	fwrite(header, GDB_BLOCK_HEADER_SIZE, 1, db->fp);
+	/* Write the header to disk. */
+	gdbFileWrite(db, block->offset, header, GDB_BLOCK_HEADER_SIZE(db));
 
 	fflush(db->fp);
 
@@ -244,80 +310,47 @@ gdbWriteBlockHeader(GdbBlock *block)
 
 	if (block->inList == 0)
 		gdbCacheAddBlock(block->db, block);
+
+	gdbUnlockDatabase(db);
 }
 
-GdbBlock *
-gdbReadBlock(GDatabase *db, offset_t offset, blocktype_t blockType,
-			 void *extra)
+/*
+ * Reads a block's data, following its overflow blocks, into a new
+ * buffer.
+ */
+static char *
+__readBlockData(GdbBlock *block)
 {
-	GdbBlock     *block;
+	GDatabase    *db = block->db;
 	char         *buffer;
-	unsigned long pos, i;
-	blocktype_t   typeIndex;
-
-	if (db == NULL || !GDB_VALID_OFFSET(offset) |
-		(blockType != GDB_BLOCK_ANY && !GDB_VALID_BLOCK_TYPE(blockType)))
-	{
-		return NULL;
-	}
-
-	if ((block = gdbCacheGetBlock(db, offset)) != NULL)
-	{
-		if (blockType == GDB_BLOCK_ANY || blockType == block->type)
-			return block;
-		else
-			return NULL;
-	}
-
-	block = gdbReadBlockHeader(db, offset, blockType);
-
-	if (block == NULL)
-	{
-		pmError(PM_ERROR_FATAL,
-				_("GNUpdate DB: Unable to read block at %ld (%s) "
-				  "in %s, line %d\n"),
-				offset, db->filename, __FILE__, __LINE__);
-		abort();
-	}
-
-	/* Get the number of needed blocks. */
-	block->chainCount =
-		gdbGetNeededBlockCount(block->dataSize, block->multiple);
-
-	/* Build the chain array. */
-	MEM_CHECK(block->chain = (offset_t *)malloc(block->chainCount *
-												sizeof(offset_t)));
-	memset(block->chain, 0, block->chainCount * sizeof(offset_t));
-
-	block->chain[0] = offset;
-	
-	typeIndex = block->type - 1;
+	unsigned long pos, i, size;
+	unsigned char next[8];
+	int           counter;
 
 	/* Create the buffer. */
 	MEM_CHECK(buffer = (char *)malloc(block->dataSize));
-		
-	/* Read in the first block. */
-	if (fread(buffer,
-			  (block->dataSize < block->multiple - GDB_BLOCK_HEADER_SIZE ?
-			   block->dataSize : block->multiple - GDB_BLOCK_HEADER_SIZE),
-			  1, db->fp) != 1)
+
+	size = (block->dataSize < block->multiple - GDB_BLOCK_HEADER_SIZE(db) ?
+			block->dataSize : block->multiple - GDB_BLOCK_HEADER_SIZE(db));
+
+	/* Read in the first block. The header may have come from the mapping. */
+	if (gdbFileRead(db, block->offset + GDB_BLOCK_HEADER_SIZE(db),
+					buffer, size) != size)
 	{
 		pmError(PM_ERROR_FATAL,
 				_("GNUpdate DB: Unable to read %ld bytes from %s at "
 				  "offset %ld\n"),
-				(block->dataSize < block->multiple - GDB_BLOCK_HEADER_SIZE ?
-				 block->dataSize : block->multiple - GDB_BLOCK_HEADER_SIZE),
-				db->filename, ftell(db->fp));
+				size, db->filename, block->offset + GDB_BLOCK_HEADER_SIZE(db));
 		exit(1);
 	}
 
-	pos = block->multiple - GDB_BLOCK_HEADER_SIZE;
+	pos = block->multiple - GDB_BLOCK_HEADER_SIZE(db);
 
 	if (block->next != 0)
 	{
 		offset_t nextOffset = block->next;
-		offset_t prevOffset = block->offset;
-		unsigned short blockDataSize = block->multiple - sizeof(offset_t);
+		offset_t prevOffset;
+		unsigned short blockDataSize = block->multiple - db->offsetSize;
 
 		block->chain[1] = nextOffset;
 
@@ -326,14 +359,12 @@ gdbReadBlock(GDatabase *db, offset_t offset, blocktype_t blockType,
 		/* Read in any overflow blocks. */
 		while (nextOffset != 0)
 		{
-			if (prevOffset + block->multiple != nextOffset)
-				fseek(db->fp, nextOffset, SEEK_SET);
-			
 			prevOffset = nextOffset;
+			counter    = 0;
 			
-			fread(&nextOffset, sizeof(offset_t), 1, db->fp);
+			gdbFileRead(db, prevOffset, next, db->offsetSize);
 
-			nextOffset = ntohl(nextOffset);
+			nextOffset = gdbGetOffset(next, &counter, db->offsetSize);
 
 			if (prevOffset == nextOffset)
 			{
@@ -347,15 +378,155 @@ gdbReadBlock(GDatabase *db, offset_t offset, blocktype_t blockType,
 			if (i < block->chainCount)
 				block->chain[i++] = nextOffset;
 			
-			fread(buffer + pos, 1,
-				  (block->dataSize - pos < blockDataSize ?
-				   block->dataSize - pos : blockDataSize),
-				  db->fp);
+			gdbFileRead(db, prevOffset + db->offsetSize, buffer + pos,
+						(block->dataSize - pos < blockDataSize ?
+						 block->dataSize - pos : blockDataSize));
 
 			pos += blockDataSize;
 		}
 	}
 
+	return buffer;
+}
+
+/*
+ * Returns a block's data from the database's mapping.
+ *
+ * Data in a single block is returned as a pointer into the mapping.
+ * Data spread over overflow blocks is copied into a new buffer, and
+ * copied is set to 1.
+ */
+static char *
+__mapBlockData(GdbBlock *block, char *copied)
+{
+	GDatabase    *db = block->db;
+	char         *buffer;
+	offset_t      nextOffset, prevOffset;
+	unsigned long pos, len, i;
+	unsigned short blockDataSize;
+	int           counter;
+
+	if (block->next == 0)
+	{
+		*copied = 0;
+
+		return db->map + block->offset + GDB_BLOCK_HEADER_SIZE(db);
+	}
+
+	*copied = 1;
+
+	MEM_CHECK(buffer = (char *)malloc(block->dataSize));
+
+	pos = block->multiple - GDB_BLOCK_HEADER_SIZE(db);
+
+	memcpy(buffer, db->map + block->offset + GDB_BLOCK_HEADER_SIZE(db), pos);
+
+	blockDataSize = block->multiple - db->offsetSize;
+	nextOffset    = block->next;
+
+	block->chain[1] = nextOffset;
+
+	for (i = 2; nextOffset != 0 && pos < block->dataSize; pos += len)
+	{
+		if (nextOffset + block->multiple > db->mapSize)
+		{
+			pmError(PM_ERROR_FATAL,
+					_("GNUpdate DB: Overflow block at %ld is past the end "
+					  "of %s\n"),
+					nextOffset, db->filename);
+			abort();
+		}
+
+		prevOffset = nextOffset;
+		counter    = 0;
+		nextOffset = gdbGetOffset(db->map + prevOffset, &counter,
+								  db->offsetSize);
+
+		if (prevOffset == nextOffset)
+		{
+			pmError(PM_ERROR_FATAL,
+					_("GNUpdate DB: Infinite loop detected in database "
+					  "blocks in %s! Report this!\n"),
+					db->filename);
+			abort();
+		}
+
+		if (i < block->chainCount)
+			block->chain[i++] = nextOffset;
+
+		len = (block->dataSize - pos < blockDataSize ?
+			   block->dataSize - pos : blockDataSize);
+
+		memcpy(buffer + pos, db->map + prevOffset + db->offsetSize, len);
+	}
+
+	return buffer;
+}
+
+static GdbBlock *
+__readBlock(GDatabase *db, offset_t offset, blocktype_t blockType,
+			void *extra)
+{
+	GdbBlock     *block;
+	char         *buffer;
+	char          copied;
+	blocktype_t   typeIndex;
+
+	if (db == NULL || !GDB_VALID_OFFSET(offset) |
+		(blockType != GDB_BLOCK_ANY && !GDB_VALID_BLOCK_TYPE(blockType)))
+	{
+		return NULL;
+	}
+
+	if ((block = gdbCacheGetBlock(db, offset)) != NULL)
+	{
+		if (blockType == GDB_BLOCK_ANY || blockType == block->type)
+			return block;
+
+		gdbDestroyBlock(block);
+
+		return NULL;
+	}
+
+	block = gdbReadBlockHeader(db, offset, blockType);
+
+	if (block == NULL)
+	{
+		pmError(PM_ERROR_FATAL,
+				_("GNUpdate DB: Unable to read block at %ld (%s) "
+				  "in %s, line %d\n"),
+				offset, db->filename, __FILE__, __LINE__);
+		abort();
+	}
+
+	/* Get the number of needed blocks. */
+	block->chainCount =
+		gdbGetNeededBlockCount(db, block->dataSize, block->multiple);
+
+	/* Build the chain array. */
+	MEM_CHECK(block->chain = (offset_t *)malloc(block->chainCount *
+												sizeof(offset_t)));
+	memset(block->chain, 0, block->chainCount * sizeof(offset_t));
+
+	block->chain[0] = offset;
+	
+	typeIndex = block->type - 1;
+
+	if (db->map != NULL &&
+		block->offset + GDB_BLOCK_HEADER_SIZE(db) + block->dataSize <=
+		db->mapSize)
+	{
+		buffer = __mapBlockData(block, &copied);
+	}
+	else
+	{
+		buffer = __readBlockData(block);
+		copied = 1;
+	}
+
+	db->stats.blocksRead++;
+	db->stats.bytesRead += GDB_BLOCK_HEADER_SIZE(db) + block->dataSize;
+
 	/* See if there is a read function assigned. */
 	if (blockTypeInfo[typeIndex].readBlock != NULL)
 	{
@@ -363,19 +534,28 @@ gdbReadBlock(GDatabase *db, offset_t offset, blocktype_t blockType,
 		block->detail =
 			blockTypeInfo[typeIndex].readBlock(block, buffer, extra);
 
-		free(buffer);
+		/*
+		 * The read function may keep pointing into the buffer by setting
+		 * block->buffer to it. A copied buffer then belongs to the block.
+		 * The mapping outlives the block anyway.
+		 */
+		if (!copied)
+			block->buffer = NULL;
+		else if (block->buffer != buffer)
+			free(buffer);
 	}
 	else
 	{
 		/* Just use the buffer as the detailed info. */
 		block->detail = buffer;
+		block->mapped = !copied;
 	}
 	
 	return block;
 }
 
-void
-gdbWriteBlock(GdbBlock *block)
+static void
+__writeBlock(GdbBlock *block)
 {
 	GDatabase    *db;
 	char         *buffer;
@@ -416,7 +596,7 @@ gdbWriteBlock(GdbBlock *block)
 	}
 
 	/* Get the number of needed blocks. */
-	block->chainCount = gdbGetNeededBlockCount(block->dataSize,
+	block->chainCount = gdbGetNeededBlockCount(db, block->dataSize,
 											   block->multiple);
 
 	if (oldChainCount == 0)
@@ -466,30 +646,40 @@ gdbWriteBlock(GdbBlock *block)
 	/* Write the first block header */
 	gdbWriteBlockHeader(block);
 
-	/* Write the first block. */
-	fwrite(buffer, 1,
-		   (block->dataSize < block->multiple - GDB_BLOCK_HEADER_SIZE ?
-			block->dataSize : block->multiple - GDB_BLOCK_HEADER_SIZE),
-		   db->fp);
+	db->stats.blocksWritten++;
+	db->stats.bytesWritten += block->chainCount * block->multiple;
 
-	if (block->dataSize < block->multiple - GDB_BLOCK_HEADER_SIZE)
+	/* Write the first block. */
+	if (block->dataSize < block->multiple - GDB_BLOCK_HEADER_SIZE(db))
 	{
-		gdbPad(db->fp, block->multiple - GDB_BLOCK_HEADER_SIZE -
-			   block->dataSize);
+		char *blockBuffer;
+
+		MEM_CHECK(blockBuffer = (char *)malloc(block->multiple));
+		memset(blockBuffer, 0, block->multiple);
+		memcpy(blockBuffer, buffer, block->dataSize);
+
+		gdbFileWrite(db, block->offset + GDB_BLOCK_HEADER_SIZE(db),
+					 blockBuffer, block->multiple - GDB_BLOCK_HEADER_SIZE(db));
+
+		free(blockBuffer);
 	}
 	else
 	{
 		char *blockBuffer;
 		
+		gdbFileWrite(db, block->offset + GDB_BLOCK_HEADER_SIZE(db), buffer,
+					 block->multiple - GDB_BLOCK_HEADER_SIZE(db));
+
 		MEM_CHECK(blockBuffer = (char *)malloc(block->multiple));
 
-		pos = block->multiple - GDB_BLOCK_HEADER_SIZE;
+		pos = block->multiple - GDB_BLOCK_HEADER_SIZE(db);
 		
 		/* Write any overflow blocks. */
 		for (i = 1; i < block->chainCount; i++)
 		{
 			offset_t nextOffset;
 			unsigned long relPos;
+			int counter = 0;
 			
 			nextOffset = ((i + 1 < block->chainCount) ?
 						  block->chain[i + 1] : 0);
@@ -500,20 +690,16 @@ gdbWriteBlock(GdbBlock *block)
 			memset(blockBuffer, 0, block->multiple);
 
 			/* Write to it. */
-			nextOffset = htonl(nextOffset);
+			gdbPutOffset(blockBuffer, &counter, nextOffset, db->offsetSize);
 
-			memcpy(blockBuffer, &nextOffset, sizeof(offset_t));
-			memcpy(blockBuffer + sizeof(offset_t), buffer + pos,
-				   (relPos < block->multiple - sizeof(offset_t) ?
-					relPos : block->multiple - sizeof(offset_t)));
+			memcpy(blockBuffer + db->offsetSize, buffer + pos,
+				   (relPos < block->multiple - db->offsetSize ?
+					relPos : block->multiple - db->offsetSize));
 			
 			/* Write the block buffer. */
-			if (block->chain[i - 1] + block->multiple != block->chain[i])
-				fseek(db->fp, block->chain[i], SEEK_SET);
+			gdbFileWrite(db, block->chain[i], blockBuffer, block->multiple);
 
-			fwrite(blockBuffer, 1, block->multiple, db->fp);
-
-			pos += block->multiple - sizeof(offset_t);
+			pos += block->multiple - db->offsetSize;
 		}
 
 		free(blockBuffer);
@@ -538,6 +724,158 @@ gdbWriteBlock(GdbBlock *block)
 		free(buffer);
 }
 
+GdbBlock *
+gdbReadBlockHeader(GDatabase *db, offset_t offset, blocktype_t blockType)
+{
+	GdbBlock *block;
+
+	if (db == NULL)
+		return NULL;
+
+	gdbLockDatabase(db);
+	block = __readBlockHeader(db, offset, blockType);
+	gdbUnlockDatabase(db);
+
+	return block;
+}
+
+GdbBlock *
+gdbReadBlock(GDatabase *db, offset_t offset, blocktype_t blockType,
+			 void *extra)
+{
+	GdbBlock *block;
+
+	if (db == NULL)
+		return NULL;
+
+	gdbLockDatabase(db);
+	block = __readBlock(db, offset, blockType, extra);
+	gdbUnlockDatabase(db);
+
+	return block;
+}
+
+static int
+__requestCompare(const void *a, const void *b)
+{
+	const GdbBlockRequest *r1 = (const GdbBlockRequest *)a;
+	const GdbBlockRequest *r2 = (const GdbBlockRequest *)b;
+
+	if (r1->offset < r2->offset) return -1;
+	if (r1->offset > r2->offset) return  1;
+
+	return 0;
+}
+
+/*
+ * Tells the kernel which ranges of the file are about to be read.
+ * Nearby blocks are merged into one range.
+ */
+static void
+__readAhead(GDatabase *db, GdbBlockRequest *requests, unsigned long count,
+			unsigned long length)
+{
+	offset_t start, end;
+	unsigned long i;
+
+	for (i = 0; i < count; )
+	{
+		start = requests[i].offset;
+		end   = start + length;
+
+		for (i++;
+			 i < count && requests[i].offset <= end + GDB_READ_AHEAD_GAP;
+			 i++)
+		{
+			end = requests[i].offset + length;
+		}
+
+		if (db->map != NULL)
+		{
+#ifdef MADV_WILLNEED
+			unsigned long pageSize = getpagesize();
+			offset_t pageStart = start - (start % pageSize);
+
+			if (end > db->mapSize)
+				end = db->mapSize;
+
+			if (end > pageStart)
+				madvise(db->map + pageStart, end - pageStart, MADV_WILLNEED);
+#endif
+		}
+		else
+		{
+#ifdef POSIX_FADV_WILLNEED
+			posix_fadvise(fileno(db->fp), start, end - start,
+						  POSIX_FADV_WILLNEED);
+#endif
+		}
+	}
+}
+
+unsigned long
+gdbReadBlocks(GDatabase *db, const offset_t *offsets, unsigned long count,
+			  blocktype_t blockType, void *extra, char readAhead,
+			  GdbBlock **blocks)
+{
+	GdbBlockRequest *requests;
+	unsigned long i, length, read = 0;
+
+	if (db == NULL || offsets == NULL || blocks == NULL || count == 0)
+		return 0;
+
+	MEM_CHECK(requests = (GdbBlockRequest *)malloc(count *
+												   sizeof(GdbBlockRequest)));
+
+	for (i = 0; i < count; i++)
+	{
+		requests[i].offset = offsets[i];
+		requests[i].index  = i;
+
+		blocks[i] = NULL;
+	}
+
+	qsort(requests, count, sizeof(GdbBlockRequest), __requestCompare);
+
+	if (readAhead)
+	{
+		/* Only the first block of each is known before its header is read. */
+		length = (GDB_VALID_BLOCK_TYPE(blockType) ?
+				  __blockMultiple(db, blockType) :
+				  GDB_BLOCK_HEADER_SIZE(db));
+
+		__readAhead(db, requests, count, length);
+	}
+
+	gdbLockDatabase(db);
+
+	for (i = 0; i < count; i++)
+	{
+		blocks[requests[i].index] = __readBlock(db, requests[i].offset,
+												blockType, extra);
+
+		if (blocks[requests[i].index] != NULL)
+			read++;
+	}
+
+	gdbUnlockDatabase(db);
+
+	free(requests);
+
+	return read;
+}
+
+void
+gdbWriteBlock(GdbBlock *block)
+{
+	if (block == NULL)
+		return;
+
+	gdbLockDatabase(block->db);
+	__writeBlock(block);
+	gdbUnlockDatabase(block->db);
+}
+
 blocktype_t
 gdbBlockTypeAt(GDatabase *db, offset_t offset)
 {
@@ -547,33 +885,40 @@ gdbBlockTypeAt(GDatabase *db, offset_t offset)
 	if (db == NULL || !GDB_VALID_OFFSET(offset))
 		return GDB_BLOCK_ANY; /* Um. Kind of an error? */
 
+	gdbLockDatabase(db);
+
 	if ((block = gdbCacheGetBlock(db, offset)) != NULL)
-		return block->type;
+	{
+		type = block->type;
 
-	fseek(db->fp, offset, SEEK_SET);
+		gdbDestroyBlock(block);
+	}
+	else
+	{
+		if (gdbFileRead(db, offset, &type, 1) != 1)
+			type = GDB_BLOCK_ANY; /* Um. Kind of an error? */
+	}
 
-	if (fread(&type, 1, 1, db->fp) != 1)
-		return GDB_BLOCK_ANY; /* Um. Kind of an error? */
+	gdbUnlockDatabase(db);
 
 	return type;
 }
 
-offset_t *
-gdbReserveBlockChain(GDatabase *db, unsigned short count,
-					 blocktype_t blockType)
+static offset_t *
+__reserveBlockChain(GDatabase *db, unsigned short count,
+					blocktype_t blockType)
 {
-	GdbFreeBlock  *freeBlocks, *newFreeBlocks;
 	offset_t      *chain;
 	offset_t       offset;
-	unsigned short blockSize;
-	long           blockCount, fillCount, newListCount;
-	long           i, j, result;
+	unsigned short blockSize, alignment, gap;
+	long           fillCount, i;
 
 	if (db == NULL || count == 0 || !GDB_VALID_BLOCK_TYPE(blockType))
 		return NULL;
 
 	/* Get the block size for this type. */
-	blockSize = blockTypeInfo[blockType - 1].multiple;
+	blockSize = __blockMultiple(db, blockType);
+	alignment = __blockAlignment(db, blockType);
 
 	/* Create the chain. */
 	MEM_CHECK(chain = (offset_t *)malloc(count * sizeof(offset_t)));
@@ -581,84 +926,47 @@ gdbReserveBlockChain(GDatabase *db, unsigned short count,
 	/* Lock the free block list. */
 	gdbLockFreeBlockList(db, DB_WRITE_LOCK);
 
-	/* Get the free block list. */
-	result = gdbGetFreeBlockList(db, &freeBlocks, &blockCount);
-
-	if (result == 0)
-	{
-		gdbUnlockFreeBlockList(db);
-		gdbFreeBlockList(freeBlocks);
-
-		fseek(db->fp, 0L, SEEK_END);
-		offset = ftell(db->fp);
-
-		/* Fill in the chain with the reserved offsets. */
-		for (i = 0; i < count; i++)
-			chain[i] = offset + (i * blockSize);
-
-		gdbPad(db->fp, count * blockSize);
-
-		return chain;
-	}
-
-	fillCount = 0;
-	j = 0;
-
-	/* Create the new array of free blocks. */
-	MEM_CHECK(newFreeBlocks = (GdbFreeBlock *)malloc(blockCount *
-													 sizeof(GdbFreeBlock)));
-	memset(newFreeBlocks, 0, blockCount * sizeof(GdbFreeBlock));
-	
-	for (i = 0; i < blockCount; i++)
+	/* Take what we can from the free space. */
+	for (fillCount = 0; fillCount < count; fillCount++)
 	{
-		if (fillCount < count && freeBlocks[i].size == blockSize)
+		if ((chain[fillCount] = gdbTakeAlignedFreeBlock(db, blockSize,
+														alignment)) == 0)
 		{
-			chain[fillCount++] = freeBlocks[i].offset;
+			break;
 		}
-		else
-		{
-			newFreeBlocks[j].offset = freeBlocks[i].offset;
-			newFreeBlocks[j].size   = freeBlocks[i].size;
 
-			j++;
-		}
+		gdbAddFreshBlock(db, chain[fillCount]);
 	}
 
-	newListCount = j;
-	
 	if (fillCount != count)
 	{
-		if (fillCount > 0)
-			gdbWriteFreeBlockList(db, newFreeBlocks, newListCount);
-
-		gdbUnlockFreeBlockList(db);
-
-		gdbFreeBlockList(newFreeBlocks);
-		gdbFreeBlockList(freeBlocks);
-
+		/* Grow the file for the rest. */
 		fseek(db->fp, 0L, SEEK_END);
 		offset = ftell(db->fp);
 
-		/* Fill in the chain with the reserved offsets. */
-		for (i = fillCount, j = 0; i < count; i++, j++)
-			chain[i] = offset + (j * blockSize);
+		/* Pages start on a page boundary. What's skipped is left free. */
+		if (alignment != 0 && (gap = offset % alignment) != 0)
+		{
+			gap = alignment - gap;
 
-		gdbPad(db->fp, (count - fillCount) * blockSize);
+			gdbPad(db->fp, gap);
+			gdbReturnFreeBlock(db, offset, gap);
 
-		qsort(chain, count, sizeof(offset_t), __offsetCompare);
-		
-		return chain;
+			offset += gap;
+		}
 	}
 
-	/* Write the new list to disk. */
-	gdbWriteFreeBlockList(db, newFreeBlocks, newListCount);
-
 	/* Unlock the list. */
 	gdbUnlockFreeBlockList(db);
 
-	/* Free up the memory for the lists. */
-	gdbFreeBlockList(newFreeBlocks);
-	gdbFreeBlockList(freeBlocks);
+	if (fillCount != count)
+	{
+		/* Fill in the chain with the reserved offsets. */
+		for (i = fillCount; i < count; i++)
+			chain[i] = offset + ((i - fillCount) * blockSize);
+
+		gdbPad(db->fp, (count - fillCount) * blockSize);
+	}
 
 	/* Sort it. */
 	qsort(chain, count, sizeof(offset_t), __offsetCompare);
@@ -666,15 +974,13 @@ gdbReserveBlockChain(GDatabase *db, unsigned short count,
 	return chain;
 }
 
-void
-gdbFreeBlockChain(GDatabase *db, offset_t *chain, unsigned short count,
-				  blocktype_t blockType)
+static void
+__freeBlockChain(GDatabase *db, offset_t *chain, unsigned short count,
+				 blocktype_t blockType)
 {
-	GdbFreeBlock  *freeBlocks;
-	GdbFreeBlock  *tempBlocks;
 	unsigned short blockSize;
-	long           blockCount;
-	int            i, j, result;
+	char          *freed;
+	int            i;
 
 	if (db == NULL || chain == NULL || count == 0 ||
 		!GDB_VALID_BLOCK_TYPE(blockType))
@@ -683,58 +989,143 @@ gdbFreeBlockChain(GDatabase *db, offset_t *chain, unsigned short count,
 	}
 
 	/* Get the block size for this type. */
-	blockSize = blockTypeInfo[blockType - 1].multiple;
+	blockSize = __blockMultiple(db, blockType);
+
+	/*
+	 * Blocks a snapshot may still read are kept until it's done with
+	 * them. Drop any cached copies of the rest.
+	 */
+	MEM_CHECK(freed = (char *)malloc(count));
+
+	for (i = 0; i < count; i++)
+	{
+		freed[i] = !gdbRetireBlock(db, chain[i], blockSize);
+
+		if (freed[i])
+			gdbCacheInvalidate(db, chain[i]);
+	}
 
 	/* Lock the free block list. */
 	gdbLockFreeBlockList(db, DB_WRITE_LOCK);
 
-	/* Get the free block list. */
-	result = gdbGetFreeBlockList(db, &freeBlocks, &blockCount);
-
-	if (blockCount == 0)
+	/* Add the blocks to the free space. It's written out on sync. */
+	for (i = 0; i < count; i++)
 	{
-		/* Block list is empty. */
-		MEM_CHECK(freeBlocks = (GdbFreeBlock *)malloc(count *
-													  sizeof(GdbFreeBlock)));
+		if (freed[i])
+			gdbReturnFreeBlock(db, chain[i], blockSize);
+	}
 
-		for (i = 0; i < count; i++)
-		{
-			freeBlocks[i].offset = chain[i];
-			freeBlocks[i].size   = blockSize;
-		}
+	gdbUnlockFreeBlockList(db);
 
-		gdbWriteFreeBlockList(db, freeBlocks, count);
+	free(freed);
+}
 
-		gdbUnlockFreeBlockList(db);
-		
-		gdbFreeBlockList(freeBlocks);
+offset_t *
+gdbReserveBlockChain(GDatabase *db, unsigned short count,
+					 blocktype_t blockType)
+{
+	offset_t *chain;
+
+	if (db == NULL)
+		return NULL;
+
+	gdbLockDatabase(db);
+	chain = __reserveBlockChain(db, count, blockType);
+	gdbUnlockDatabase(db);
+
+	return chain;
+}
 
+void
+gdbFreeBlockChain(GDatabase *db, offset_t *chain, unsigned short count,
+				  blocktype_t blockType)
+{
+	if (db == NULL)
 		return;
+
+	gdbLockDatabase(db);
+	__freeBlockChain(db, chain, count, blockType);
+	gdbUnlockDatabase(db);
+}
+
+GdbBlock *
+gdbShadowBlock(GdbBlock *block, void *extra)
+{
+	GDatabase    *db;
+	GdbBlock     *copy;
+	char         *buffer;
+	unsigned long size;
+	blocktype_t   typeIndex;
+
+	if (block == NULL)
+		return NULL;
+
+	db = block->db;
+
+	/* Blocks that aren't on disk yet, or were written since the commit. */
+	if (block->offset == 0 || block->chain == NULL ||
+		gdbCanWriteInPlace(db, block->offset))
+	{
+		return block;
 	}
 
-	/* We're going to add the block to the list by re-creating the list. */
-	tempBlocks = freeBlocks;
-	
-	MEM_CHECK(freeBlocks = (GdbFreeBlock *)malloc((blockCount + count) *
-												  sizeof(GdbFreeBlock)));
-	memcpy(freeBlocks, tempBlocks, blockCount * sizeof(GdbFreeBlock));
+	typeIndex = block->type - 1;
+
+	gdbLockDatabase(db);
+
+	/* Copy the block by writing it out and reading it back in. */
+	if (blockTypeInfo[typeIndex].writeBlock != NULL)
+	{
+		blockTypeInfo[typeIndex].writeBlock(block, &buffer, &size);
+	}
+	else
+	{
+		size = block->dataSize;
 
-	for (i = blockCount, j = 0; i < blockCount + count; i++, j++)
+		MEM_CHECK(buffer = (char *)malloc(size));
+		memcpy(buffer, block->detail, size);
+	}
+
+	MEM_CHECK(copy = (GdbBlock *)malloc(sizeof(GdbBlock)));
+	memset(copy, 0, sizeof(GdbBlock));
+
+	copy->db       = db;
+	copy->type     = block->type;
+	copy->flags    = block->flags;
+	copy->multiple = block->multiple;
+	copy->dataSize = size;
+	copy->listNext = block->listNext;
+	copy->refCount = 1;
+
+	if (blockTypeInfo[typeIndex].readBlock != NULL)
+	{
+		copy->detail = blockTypeInfo[typeIndex].readBlock(copy, buffer, extra);
+
+		if (copy->buffer != buffer)
+			free(buffer);
+	}
+	else
 	{
-		freeBlocks[i].offset = chain[j];
-		freeBlocks[i].size   = blockSize;
+		copy->detail = buffer;
 	}
 
-	gdbFreeBlockList(tempBlocks);
+	/* Put the copy in new space, and leave the old for the snapshots. */
+	copy->chainCount = gdbGetNeededBlockCount(db, size, copy->multiple);
+	copy->chain      = __reserveBlockChain(db, copy->chainCount, copy->type);
+	copy->offset     = copy->chain[0];
+	copy->next       = (copy->chainCount > 1 ? copy->chain[1] : 0);
 
-	blockCount += count;
+	__freeBlockChain(db, block->chain, block->chainCount, block->type);
 
-	qsort(freeBlocks, blockCount, sizeof(GdbFreeBlock), __blockCompare);
+	GDB_SET_DIRTY(copy);
 
-	gdbWriteFreeBlockList(db, freeBlocks, blockCount);
-	gdbFreeBlockList(freeBlocks);
+	gdbCacheAddBlock(db, copy);
 
-	gdbUnlockFreeBlockList(db);
+	gdbUnlockDatabase(db);
+
+	gdbDestroyBlock(block);
+
+	return copy;
 }
 
 offset_t
@@ -771,21 +1162,22 @@ gdbFreeBlock(GDatabase *db, offset_t offset, blocktype_t blockType)
 }
 
 unsigned long
-gdbGetNeededBlockCount(unsigned long dataSize, short multiple)
+gdbGetNeededBlockCount(GDatabase *db, unsigned long dataSize,
+					   unsigned short multiple)
 {
 	unsigned long count, i;
 
-	if (dataSize == 0 || multiple == 0)
+	if (db == NULL || dataSize == 0 || multiple == 0)
 		return 0;
 
-	dataSize += GDB_BLOCK_HEADER_SIZE;
+	dataSize += GDB_BLOCK_HEADER_SIZE(db);
 
 	if (dataSize == multiple)
 		return 1;
 
 	count = 1;
 
-	for (i = multiple; i < dataSize; i += multiple - sizeof(offset_t))
+	for (i = multiple; i < dataSize; i += multiple - db->offsetSize)
 		count++;
 
 	return count;
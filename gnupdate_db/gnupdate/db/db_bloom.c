@@ -0,0 +1,481 @@
+/**
+ * @file db_bloom.c Bloom filter functions
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#include "db_internal.h"
+
+static unsigned long
+__get32(const unsigned char *p)
+{
+	return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+	       ((unsigned long)p[2] << 8)  |  (unsigned long)p[3];
+}
+
+static void
+__put32(unsigned char *p, unsigned long value)
+{
+	p[0] = (value >> 24) & 0xFF;
+	p[1] = (value >> 16) & 0xFF;
+	p[2] = (value >> 8)  & 0xFF;
+	p[3] = value & 0xFF;
+}
+
+/* FNV-1a, kept to 32 bits so filters read the same everywhere. */
+static unsigned long
+__hash(const char *key)
+{
+	unsigned long h = 2166136261UL;
+
+	for (; *key != '\0'; key++)
+	{
+		h ^= (unsigned char)*key;
+		h  = (h * 16777619UL) & 0xFFFFFFFFUL;
+	}
+
+	return h;
+}
+
+static unsigned char
+__getCounter(const GdbBloom *bloom, unsigned long i)
+{
+	unsigned char c = bloom->counters[i / 2];
+
+	return ((i & 1) ? (c >> 4) : (c & 0x0F));
+}
+
+static void
+__setCounter(GdbBloom *bloom, unsigned long i, unsigned char value)
+{
+	unsigned char *c = &bloom->counters[i / 2];
+
+	if (i & 1)
+		*c = (*c & 0x0F) | (value << 4);
+	else
+		*c = (*c & 0xF0) | value;
+}
+
+/*
+ * Raises or lowers each of a key's counters. The positions come from
+ * one hash, stepped by a rotation of itself.
+ */
+static void
+__updateKey(GdbBloom *bloom, const char *key, int change)
+{
+	unsigned long h, delta, i;
+	unsigned char c;
+	int j;
+
+	h     = __hash(key);
+	delta = ((h >> 17) | (h << 15)) & 0xFFFFFFFFUL;
+
+	for (j = 0; j < bloom->hashCount; j++)
+	{
+		i = h % bloom->counterCount;
+		c = __getCounter(bloom, i);
+
+		if (change > 0 && c < GDB_BLOOM_COUNTER_MAX)
+			__setCounter(bloom, i, c + 1);
+		else if (change < 0 && c > 0 && c < GDB_BLOOM_COUNTER_MAX)
+			__setCounter(bloom, i, c - 1);
+
+		h = (h + delta) & 0xFFFFFFFFUL;
+	}
+}
+
+/* Sets up empty counters for a number of keys. */
+static void
+__sizeBloom(GdbBloom *bloom, unsigned long keyCount)
+{
+	if (keyCount < GDB_BLOOM_MIN_KEYS)
+		keyCount = GDB_BLOOM_MIN_KEYS;
+
+	if (bloom->counters != NULL)
+		free(bloom->counters);
+
+	bloom->hashCount    = GDB_BLOOM_HASH_COUNT;
+	bloom->counterCount = keyCount * GDB_BLOOM_COUNTERS_PER_KEY;
+	bloom->keyCount     = 0;
+
+	MEM_CHECK(bloom->counters =
+			  (unsigned char *)calloc((bloom->counterCount + 1) / 2, 1));
+}
+
+/* Returns the tree's filter, if it's a main tree with one in use. */
+static GdbBloom *
+__getBloom(BTree *tree)
+{
+	GdbBloom *bloom;
+
+	/*
+	 * The filter follows the tree as it is now. Keys deleted since a
+	 * snapshot was pinned are still in the snapshot.
+	 */
+	if (tree == NULL || tree->block->offset != DB_MAIN_TREE_OFFSET ||
+		tree->snapshot != NULL)
+	{
+		return NULL;
+	}
+
+	bloom = tree->block->db->bloom;
+
+	if (bloom == NULL || bloom->stale)
+		return NULL;
+
+	return bloom;
+}
+
+void *
+gdbBloomReadBlock(GdbBlock *block, const char *buffer, void *extra)
+{
+	GdbBloom *bloom;
+	const unsigned char *data = (const unsigned char *)buffer;
+	unsigned long counterCount;
+
+	(void)extra;
+
+	MEM_CHECK(bloom = (GdbBloom *)malloc(sizeof(GdbBloom)));
+	memset(bloom, 0, sizeof(GdbBloom));
+
+	bloom->block = block;
+
+	pthread_mutex_init(&bloom->mutex, NULL);
+
+	counterCount = (block->dataSize < GDB_BLOOM_HEADER_SIZE ? 0 :
+					__get32(data + 1));
+
+	/* Don't trust a filter that doesn't fit its block. */
+	if (counterCount == 0 || data[0] == 0 ||
+		block->dataSize < GDB_BLOOM_HEADER_SIZE + (counterCount + 1) / 2)
+	{
+		__sizeBloom(bloom, 0);
+		bloom->stale = 1;
+
+		return bloom;
+	}
+
+	bloom->hashCount    = data[0];
+	bloom->counterCount = counterCount;
+	bloom->keyCount     = __get32(data + 5);
+
+	MEM_CHECK(bloom->counters =
+			  (unsigned char *)malloc((counterCount + 1) / 2));
+	memcpy(bloom->counters, data + GDB_BLOOM_HEADER_SIZE,
+		   (counterCount + 1) / 2);
+
+	return bloom;
+}
+
+void
+gdbBloomWriteBlock(GdbBlock *block, char **buffer, unsigned long *size)
+{
+	GdbBloom *bloom;
+	unsigned char *data;
+
+	bloom = (GdbBloom *)block->detail;
+
+	*size = GDB_BLOOM_HEADER_SIZE + (bloom->counterCount + 1) / 2;
+
+	MEM_CHECK(data = (unsigned char *)malloc(*size));
+
+	pthread_mutex_lock(&bloom->mutex);
+
+	data[0] = bloom->hashCount;
+	__put32(data + 1, bloom->counterCount);
+	__put32(data + 5, bloom->keyCount);
+
+	memcpy(data + GDB_BLOOM_HEADER_SIZE, bloom->counters,
+		   (bloom->counterCount + 1) / 2);
+
+	pthread_mutex_unlock(&bloom->mutex);
+
+	*buffer = (char *)data;
+}
+
+void *
+gdbBloomCreateBlock(GdbBlock *block, void *extra)
+{
+	GdbBloom *bloom;
+
+	MEM_CHECK(bloom = (GdbBloom *)malloc(sizeof(GdbBloom)));
+	memset(bloom, 0, sizeof(GdbBloom));
+
+	bloom->block = block;
+
+	pthread_mutex_init(&bloom->mutex, NULL);
+
+	__sizeBloom(bloom, (extra == NULL ? 0 : *(unsigned long *)extra));
+
+	return bloom;
+}
+
+void
+gdbBloomDestroyBlock(void *data)
+{
+	GdbBloom *bloom = (GdbBloom *)data;
+
+	if (bloom == NULL)
+		return;
+
+	if (bloom->counters != NULL)
+		free(bloom->counters);
+
+	pthread_mutex_destroy(&bloom->mutex);
+
+	free(bloom);
+}
+
+/*
+ * Sizes the filter for twice the keys expected, so it has room to
+ * grow, and fills it from the main tree.
+ */
+static void
+__fillBloom(GDatabase *db, unsigned long keyCount)
+{
+	BTreeTraversal *trav;
+	GdbBloom *bloom;
+	offset_t offset;
+
+	if (keyCount < btreeGetTreeSize(db->mainTree))
+		keyCount = btreeGetTreeSize(db->mainTree);
+
+	keyCount *= 2;
+
+	if (db->bloom == NULL)
+	{
+		db->bloom = (GdbBloom *)gdbNewBlock(db, GDB_BLOCK_BLOOM,
+											&keyCount)->detail;
+	}
+
+	bloom = db->bloom;
+
+	pthread_mutex_lock(&bloom->mutex);
+
+	__sizeBloom(bloom, keyCount);
+
+	trav = btreeInitTraversal(db->mainTree);
+
+	for (offset = btreeGetFirstOffset(trav);
+		 offset != (offset_t)-1;
+		 offset = btreeGetNextOffset(trav))
+	{
+		__updateKey(bloom, btreeGetTraversalKey(trav), 1);
+		bloom->keyCount++;
+	}
+
+	btreeDestroyTraversal(trav);
+
+	bloom->stale = 0;
+
+	GDB_SET_DIRTY(bloom->block);
+
+	pthread_mutex_unlock(&bloom->mutex);
+}
+
+void
+gdbLoadBloom(GDatabase *db)
+{
+	GdbBlock *block;
+	unsigned char buffer[4];
+	offset_t offset;
+
+	if (db == NULL || db->mainTree == NULL || db->bloom != NULL)
+		return;
+
+	/* Paged files keep the filter on a page, and record which one. */
+	if (GDB_IS_PAGED(db))
+	{
+		if (gdbFileRead(db, DB_OFFSET_BLOOM_PAGE, buffer, 4) != 4)
+			return;
+
+		offset = (offset_t)__get32(buffer) * db->pageSize;
+	}
+	else
+	{
+		if (gdbFileRead(db, DB_OFFSET_BLOOM, buffer, 4) != 4)
+			return;
+
+		offset = __get32(buffer);
+	}
+
+	if (offset == 0)
+		return;
+
+	block = gdbReadBlock(db, offset, GDB_BLOCK_BLOOM, NULL);
+
+	if (block == NULL)
+	{
+		pmError(PM_ERROR_WARNING,
+				_("GNUpdate DB: Unable to read the Bloom filter at %ld "
+				  "in %s\n"),
+				offset, db->filename);
+		return;
+	}
+
+	db->bloom = (GdbBloom *)block->detail;
+
+	/* Something changed the tree without the filter. */
+	if (db->bloom->keyCount != btreeGetTreeSize(db->mainTree))
+		db->bloom->stale = 1;
+
+	if (db->bloom->stale && db->mode == PM_MODE_READ_WRITE)
+		__fillBloom(db, 0);
+}
+
+void
+gdbEnableBloom(GDatabase *db, unsigned long keyCount)
+{
+	if (db == NULL || db->mainTree == NULL ||
+		db->mode != PM_MODE_READ_WRITE)
+	{
+		return;
+	}
+
+	if (db->bloom != NULL && !db->bloom->stale)
+		return;
+
+	__fillBloom(db, keyCount);
+}
+
+void
+gdbBloomAdd(BTree *tree, const char *key)
+{
+	GdbBloom *bloom;
+
+	if ((bloom = __getBloom(tree)) == NULL || key == NULL)
+		return;
+
+	pthread_mutex_lock(&bloom->mutex);
+
+	__updateKey(bloom, key, 1);
+	bloom->keyCount++;
+
+	/* Past twice its size, it lets through too many misses to be worth it. */
+	if (bloom->keyCount >
+		2 * (bloom->counterCount / GDB_BLOOM_COUNTERS_PER_KEY))
+	{
+		bloom->stale = 1;
+	}
+
+	GDB_SET_DIRTY(bloom->block);
+
+	pthread_mutex_unlock(&bloom->mutex);
+}
+
+void
+gdbBloomRemove(BTree *tree, const char *key)
+{
+	GdbBloom *bloom;
+
+	if ((bloom = __getBloom(tree)) == NULL || key == NULL)
+		return;
+
+	pthread_mutex_lock(&bloom->mutex);
+
+	__updateKey(bloom, key, -1);
+
+	if (bloom->keyCount > 0)
+		bloom->keyCount--;
+
+	GDB_SET_DIRTY(bloom->block);
+
+	pthread_mutex_unlock(&bloom->mutex);
+}
+
+char
+gdbBloomMayContain(BTree *tree, const char *key)
+{
+	GdbBloom *bloom;
+	unsigned long h, delta;
+	char found = 1;
+	int j;
+
+	if ((bloom = __getBloom(tree)) == NULL || key == NULL)
+		return 1;
+
+	h     = __hash(key);
+	delta = ((h >> 17) | (h << 15)) & 0xFFFFFFFFUL;
+
+	pthread_mutex_lock(&bloom->mutex);
+
+	for (j = 0; j < bloom->hashCount && found; j++)
+	{
+		if (__getCounter(bloom, h % bloom->counterCount) == 0)
+			found = 0;
+
+		h = (h + delta) & 0xFFFFFFFFUL;
+	}
+
+	pthread_mutex_unlock(&bloom->mutex);
+
+	return found;
+}
+
+void
+gdbSyncBloom(GDatabase *db)
+{
+	GdbBloom *bloom;
+	unsigned char buffer[4];
+	offset_t offset;
+
+	if (db == NULL || (bloom = db->bloom) == NULL ||
+		db->mode != PM_MODE_READ_WRITE || !GDB_IS_DIRTY(bloom->block))
+	{
+		return;
+	}
+
+	gdbLockDatabase(db);
+
+	offset = bloom->block->offset;
+
+	gdbWriteBlock(bloom->block);
+
+	/* The first write gives the filter its place. Record it. */
+	if (bloom->block->offset != offset)
+	{
+		if (GDB_IS_PAGED(db))
+		{
+			__put32(buffer, bloom->block->offset / db->pageSize);
+
+			gdbFileWrite(db, DB_OFFSET_BLOOM_PAGE, buffer, 4);
+		}
+		else
+		{
+			__put32(buffer, bloom->block->offset);
+
+			gdbFileWrite(db, DB_OFFSET_BLOOM, buffer, 4);
+		}
+	}
+
+	gdbUnlockDatabase(db);
+}
+
+void
+gdbDestroyBloom(GDatabase *db)
+{
+	GdbBlock *block;
+
+	if (db == NULL || db->bloom == NULL)
+		return;
+
+	block = db->bloom->block;
+
+	db->bloom = NULL;
+
+	gdbDestroyBlock(block);
+}
@@ -0,0 +1,202 @@
+/**
+ * @file db_bloom.h Bloom filter functions
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#ifndef _DB_BLOOM_H_
+#define _DB_BLOOM_H_
+
+/**
+ * Counters kept for each key the filter is sized for.
+ *
+ * With GDB_BLOOM_HASH_COUNT hashes, this gives about 1% false positives
+ * when the filter holds as many keys as it was sized for.
+ */
+#define GDB_BLOOM_COUNTERS_PER_KEY 10
+
+/**
+ * Number of counters each key sets.
+ */
+#define GDB_BLOOM_HASH_COUNT 7
+
+/**
+ * Fewest keys a filter is sized for.
+ */
+#define GDB_BLOOM_MIN_KEYS 1024
+
+/**
+ * Largest value of a counter. A counter that reaches it is never
+ * lowered again, since it can't be known how many keys share it.
+ */
+#define GDB_BLOOM_COUNTER_MAX 15
+
+/**
+ * Size of the filter's header in its block.
+ */
+#define GDB_BLOOM_HEADER_SIZE 9
+
+/**
+ * A counting Bloom filter over the keys of a database's main tree.
+ *
+ * btreeSearch() checks it before reading any nodes, so most searches
+ * for keys that aren't there cost no I/O. Counters hold up to
+ * GDB_BLOOM_COUNTER_MAX, two to a byte, so keys can be removed as well
+ * as added.
+ *
+ * A filter that holds far more keys than it was sized for, or that
+ * doesn't match the tree it was loaded with, is marked stale and not
+ * used. It's refilled at the right size the next time the database is
+ * opened or synced for writing.
+ */
+struct _GdbBloom
+{
+	GdbBlock *block;              /**< The filter's block.              */
+
+	unsigned char hashCount;      /**< Counters set by each key.        */
+	unsigned long counterCount;   /**< Number of counters.              */
+	unsigned long keyCount;       /**< Number of keys in the filter.    */
+	unsigned char *counters;      /**< The counters, two to a byte.     */
+
+	char stale;                   /**< 1 if it no longer covers the tree. */
+
+	pthread_mutex_t mutex;        /**< Guards the counters.             */
+};
+
+/**
+ * Reads a Bloom filter block.
+ *
+ * This is meant to be called by the block functions. Don't call this
+ * directly.
+ *
+ * @param block  The block.
+ * @param buffer The buffer to read from.
+ * @param extra  NULL
+ *
+ * @return A GdbBloom structure.
+ */
+void *gdbBloomReadBlock(GdbBlock *block, const char *buffer, void *extra);
+
+/**
+ * Writes a Bloom filter block.
+ *
+ * This is meant to be called by the block functions. Don't call this
+ * directly.
+ *
+ * @param block  The block.
+ * @param buffer The returned buffer.
+ * @param size   The returned buffer size.
+ */
+void gdbBloomWriteBlock(GdbBlock *block, char **buffer, unsigned long *size);
+
+/**
+ * Creates a Bloom filter block.
+ *
+ * This is meant to be called by the block functions. Don't call this
+ * directly.
+ *
+ * @param block The block.
+ * @param extra A pointer to the number of keys (unsigned long) to
+ *              size the filter for.
+ *
+ * @return A GdbBloom structure.
+ */
+void *gdbBloomCreateBlock(GdbBlock *block, void *extra);
+
+/**
+ * Destroys a Bloom filter block.
+ *
+ * This is meant to be called by the block functions. Don't call this
+ * directly.
+ *
+ * @param data The GdbBloom to destroy.
+ */
+void gdbBloomDestroyBlock(void *data);
+
+/**
+ * Loads a database's Bloom filter, if it has one.
+ *
+ * gdbOpen() calls this automatically.
+ *
+ * @param db The active database.
+ */
+void gdbLoadBloom(GDatabase *db);
+
+/**
+ * Gives a database's main tree a Bloom filter.
+ *
+ * The filter is sized for at least @a keyCount keys, or the keys
+ * already in the tree, and filled from the tree. Nothing is done if
+ * the database already has a filter that's in use.
+ *
+ * @param db       A database opened with PM_MODE_READ_WRITE.
+ * @param keyCount The number of keys expected, or 0.
+ */
+void gdbEnableBloom(GDatabase *db, unsigned long keyCount);
+
+/**
+ * Adds a key to the Bloom filter, if the tree is a database's main
+ * tree and has one.
+ *
+ * btreeInsert() and btreeBulkLoad() call this automatically.
+ *
+ * @param tree The tree the key was added to.
+ * @param key  The key.
+ */
+void gdbBloomAdd(BTree *tree, const char *key);
+
+/**
+ * Removes a key from the Bloom filter, if the tree is a database's
+ * main tree and has one.
+ *
+ * btreeDelete() calls this automatically.
+ *
+ * @param tree The tree the key was removed from.
+ * @param key  The key.
+ */
+void gdbBloomRemove(BTree *tree, const char *key);
+
+/**
+ * Returns whether a key may be in a tree.
+ *
+ * @param tree The tree.
+ * @param key  The key.
+ *
+ * @return 0 if the key is certainly not in the tree, or 1 if it may be
+ *         or the tree has no filter in use.
+ */
+char gdbBloomMayContain(BTree *tree, const char *key);
+
+/**
+ * Writes out a database's Bloom filter if it has changed.
+ *
+ * gdbSync(), gdbClose() and gdbJournalCommit() call this automatically.
+ *
+ * @param db The active database.
+ */
+void gdbSyncBloom(GDatabase *db);
+
+/**
+ * Frees a database's Bloom filter.
+ *
+ * gdbClose() calls this automatically.
+ *
+ * @param db The active database.
+ */
+void gdbDestroyBloom(GDatabase *db);
+
+#endif /* _DB_BLOOM_H_ */
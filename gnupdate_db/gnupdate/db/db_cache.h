@@ -21,11 +21,52 @@
 #ifndef _DB_CACHE_H_
 #define _DB_CACHE_H_
 
+/**
+ * Default byte budget of the block cache.
+ */
+#define DB_DEFAULT_CACHE_SIZE (512 * 1024)
+
+/**
+ * Initial number of hash buckets in the block cache.
+ */
+#define DB_CACHE_MIN_BUCKETS 64
+
+/**
+ * Initializes the block cache of a database.
+ *
+ * @param db The database.
+ */
+void gdbCacheInit(GDatabase *db);
+
+/**
+ * Writes back and frees every block in the cache.
+ *
+ * This must be called while the database file is still open.
+ *
+ * @param db The database.
+ */
+void gdbCacheDestroy(GDatabase *db);
+
+/**
+ * Writes every dirty block in the cache to disk.
+ *
+ * @param db The database.
+ */
+void gdbCacheFlush(GDatabase *db);
+
+/**
+ * Sets the byte budget of the cache, evicting blocks if needed.
+ *
+ * @param db   The database.
+ * @param size The maximum number of bytes to keep cached.
+ */
+void gdbCacheSetSize(GDatabase *db, unsigned long size);
+
 /**
  * Adds a block to the cache.
- * 
- * If the block is already in the cache, the reference count will
- * be incremented.
+ *
+ * The block keeps its current reference count. If another block is
+ * already cached at the same offset, nothing is done.
  * 
  * @param db    The database.
  * @param block The block to add to the cache.
@@ -33,23 +74,32 @@
 void gdbCacheAddBlock(GDatabase *db, GdbBlock *block);
 
 /**
- * Removes a block from the cache.
+ * Releases a reference to a cached block.
  *
- * If the block's reference count is greater than 1, the block will
- * stay in the cache and the reference count will be decremented.
- * If the reference count is 1, the block will be removed from the
- * cache.
+ * When the reference count reaches 0, the block stays in the cache
+ * as the most recently used unpinned block, and least recently used
+ * blocks are evicted if the cache is over its budget.
  * 
  * @param db    The database.
- * @param block The block to remove from the cache.
+ * @param block The block to release.
  *
  * @return The reference count on the block.
  */
 unsigned short gdbCacheRemoveBlock(GDatabase *db, GdbBlock *block);
 
+/**
+ * Adds a reference to a block, pinning it in the cache.
+ *
+ * @param block The block.
+ */
+void gdbCacheRefBlock(GdbBlock *block);
+
 /**
  * Returns a block from the cache.
  *
+ * The returned block is referenced, and must be released through
+ * gdbDestroyBlock().
+ *
  * @param db     The database.
  * @param offset The offset of the block.
  *
@@ -57,5 +107,17 @@ unsigned short gdbCacheRemoveBlock(GDatabase *db, GdbBlock *block);
  */
 GdbBlock *gdbCacheGetBlock(GDatabase *db, offset_t offset);
 
-#endif /* _DB_CACHE_H_ */
+/**
+ * Drops the block at the specified offset from the cache.
+ *
+ * This is called when the block's space is freed. An unreferenced block
+ * is freed immediately without being written back. A referenced block
+ * is detached from the cache and freed when its last reference goes
+ * away.
+ *
+ * @param db     The database.
+ * @param offset The offset of the block.
+ */
+void gdbCacheInvalidate(GDatabase *db, offset_t offset);
 
+#endif /* _DB_CACHE_H_ */
@@ -26,15 +26,40 @@
 
 #define DB_MAGIC     "\1GDBDBF\2" /**< Database magic string.  */
 #define DB_MAJOR_VER            0 /**< Database major version. */
-#define DB_MINOR_VER            2 /**< Database minor version. */
+#define DB_MINOR_VER            3 /**< Database minor version. */
+
+/**
+ * Minor version of files without pages.
+ *
+ * These files store offsets in 32 bits, and size tree nodes by their
+ * order instead of by page.
+ */
+#define DB_MINOR_VER_UNPAGED    2
 
 /** @name Database header offsets */
 /*@{*/
 #define DB_OFFSET_MAGIC             0 /**< Offset of the magic string.      */
 #define DB_OFFSET_VERSION           8 /**< Offset of the version.           */
 #define DB_OFFSET_TYPE             10 /**< Offset of the database type.     */
+#define DB_OFFSET_BLOOM            11 /**< Offset of the Bloom filter (0.2). */
+#define DB_OFFSET_PAGE_SHIFT       11 /**< Offset of the page size's log2.  */
+#define DB_OFFSET_BLOOM_PAGE       12 /**< Page of the Bloom filter.        */
+/*@}*/
+
+/** @name Page sizes */
+/*@{*/
+#define DB_PAGE_SIZE_SMALL     4096 /**< 4 KiB pages.               */
+#define DB_PAGE_SIZE_LARGE    16384 /**< 16 KiB pages.              */
+#define DB_DEFAULT_PAGE_SIZE  DB_PAGE_SIZE_SMALL /**< Page size of new files. */
 /*@}*/
 
+/**
+ * Returns 1 if the database's nodes are sized and aligned by page.
+ *
+ * @param db The database.
+ */
+#define GDB_IS_PAGED(db) ((db)->pageSize != 0)
+
 /**
  * Offset of the main tree.
  *
@@ -58,6 +83,15 @@
  */
 char gdbReadHeader(GDatabase *db);
 
+/**
+ * Sets the page size of a database, and with it, the format used for
+ * everything written to it.
+ *
+ * @param db       The database.
+ * @param pageSize The page size, or 0 for the 0.2 format.
+ */
+void gdbSetPageSize(GDatabase *db, unsigned short pageSize);
+
 /**
  * Writes the database header to the file.
  *
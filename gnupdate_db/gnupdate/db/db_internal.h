@@ -91,8 +91,10 @@
 #include "db.h"
 #include "db_blocks.h"
 #include "db_blocklist.h"
+#include "db_bloom.h"
 #include "db_cache.h"
 #include "db_header.h"
+#include "db_journal.h"
 #include "db_utils.h"
 
 #include "hashtable.h"
@@ -0,0 +1,736 @@
+/**
+ * @file db_journal.c Write journal functions
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#include "db_internal.h"
+#include "db_internal.h"
+#include <unistd.h>
+
+/*
+ * A transaction being put together in memory, so it can be appended to
+ * the journal with one write.
+ */
+typedef struct
+{
+	unsigned char *data;
+	unsigned long  size;
+	int            len;
+
+} GdbJournalBuffer;
+
+static unsigned long
+__checksum(const unsigned char *data, unsigned long size)
+{
+	unsigned long sum = 2166136261UL;
+	unsigned long i;
+
+	for (i = 0; i < size; i++)
+	{
+		sum ^= data[i];
+		sum  = (sum * 16777619UL) & 0xFFFFFFFFUL;
+	}
+
+	return sum;
+}
+
+/* Makes room for another record, with some slack for the fields. */
+static void
+__growBuffer(GdbJournalBuffer *buffer, unsigned long size)
+{
+	size += 32;
+
+	if (buffer->len + size <= buffer->size)
+		return;
+
+	while (buffer->len + size > buffer->size)
+		buffer->size = (buffer->size == 0 ? 4096 : buffer->size * 2);
+
+	MEM_CHECK(buffer->data = (unsigned char *)realloc(buffer->data,
+													  buffer->size));
+}
+
+static int
+__hashPage(offset_t offset)
+{
+	return (int)((offset / GDB_JOURNAL_PAGE_SIZE) % DB_JOURNAL_BUCKETS);
+}
+
+static GdbJournalPage *
+__findPage(GDatabase *db, offset_t offset)
+{
+	GdbJournalPage *page;
+
+	for (page = db->pages[__hashPage(offset)];
+		 page != NULL && page->offset != offset;
+		 page = page->next)
+		;
+
+	return page;
+}
+
+/* Returns the page at an offset, reading it in from the file if needed. */
+static GdbJournalPage *
+__getPage(GDatabase *db, offset_t offset)
+{
+	GdbJournalPage *page;
+	size_t s;
+	int bucket;
+
+	if ((page = __findPage(db, offset)) != NULL)
+		return page;
+
+	MEM_CHECK(page = (GdbJournalPage *)malloc(sizeof(GdbJournalPage)));
+
+	page->offset = offset;
+	page->dirty  = 0;
+	page->saved  = NULL;
+
+	fseek(db->fp, offset, SEEK_SET);
+
+	s = fread(page->data, 1, GDB_JOURNAL_PAGE_SIZE, db->fp);
+
+	/* Past the end of the file, the page reads as zeros. */
+	memset(page->data + s, 0, GDB_JOURNAL_PAGE_SIZE - s);
+
+	bucket = __hashPage(offset);
+
+	page->next = db->pages[bucket];
+	db->pages[bucket] = page;
+
+	return page;
+}
+
+size_t
+gdbFileRead(GDatabase *db, offset_t offset, void *data, size_t size)
+{
+	GdbJournalPage *page;
+	offset_t pageOffset, start, end;
+	size_t result;
+
+	fseek(db->fp, offset, SEEK_SET);
+
+	result = fread(data, 1, size, db->fp);
+
+	if (db->journal == NULL)
+		return result;
+
+	/* Journaled writes may reach past the end of the file. */
+	memset((char *)data + result, 0, size - result);
+
+	for (pageOffset = offset - (offset % GDB_JOURNAL_PAGE_SIZE);
+		 pageOffset < offset + size;
+		 pageOffset += GDB_JOURNAL_PAGE_SIZE)
+	{
+		if ((page = __findPage(db, pageOffset)) == NULL)
+			continue;
+
+		start = (pageOffset > offset ? pageOffset : offset);
+		end   = pageOffset + GDB_JOURNAL_PAGE_SIZE;
+
+		if (end > offset + size)
+			end = offset + size;
+
+		memcpy((char *)data + (start - offset),
+			   page->data + (start - pageOffset), end - start);
+
+		if (end - offset > result)
+			result = end - offset;
+	}
+
+	return result;
+}
+
+void
+gdbFileWrite(GDatabase *db, offset_t offset, const void *data, size_t size)
+{
+	GdbJournalPage *page;
+	offset_t pageOffset, start, end;
+
+	if (db->journal == NULL)
+	{
+		fseek(db->fp, offset, SEEK_SET);
+		fwrite(data, 1, size, db->fp);
+
+		return;
+	}
+
+	for (pageOffset = offset - (offset % GDB_JOURNAL_PAGE_SIZE);
+		 pageOffset < offset + size;
+		 pageOffset += GDB_JOURNAL_PAGE_SIZE)
+	{
+		if ((page = __findPage(db, pageOffset)) == NULL)
+			page = __getPage(db, pageOffset);
+		else if (!page->dirty && page->saved == NULL)
+		{
+			/* Keep the committed image until it's checkpointed. */
+			MEM_CHECK(page->saved = (char *)malloc(GDB_JOURNAL_PAGE_SIZE));
+			memcpy(page->saved, page->data, GDB_JOURNAL_PAGE_SIZE);
+		}
+
+		start = (pageOffset > offset ? pageOffset : offset);
+		end   = pageOffset + GDB_JOURNAL_PAGE_SIZE;
+
+		if (end > offset + size)
+			end = offset + size;
+
+		memcpy(page->data + (start - pageOffset),
+			   (const char *)data + (start - offset), end - start);
+
+		page->dirty = 1;
+	}
+}
+
+/*
+ * Writes the complete transactions in a journal into their database
+ * files. The journal is read up to the first torn or damaged
+ * transaction, which never committed.
+ */
+static void
+__recover(const char *filename, FILE *fp)
+{
+	unsigned char *buffer;
+	char *names[GDB_JOURNAL_MAX_DBS];
+	FILE *files[GDB_JOURNAL_MAX_DBS];
+	unsigned char type, index;
+	unsigned short nameLen;
+	offset_t offset;
+	unsigned long sum;
+	unsigned char offsetSize;
+	long len;
+	int counter, start, i, applied = 0;
+
+	fseek(fp, 0L, SEEK_END);
+	len = ftell(fp);
+
+	if (len <= GDB_JOURNAL_HEADER_SIZE)
+		return;
+
+	/* Some slack, so reading a torn record's fields stays in bounds. */
+	MEM_CHECK(buffer = (unsigned char *)malloc(len + 32));
+	memset(buffer, 0, len + 32);
+
+	fseek(fp, 0L, SEEK_SET);
+
+	if (fread(buffer, 1, len, fp) != (size_t)len ||
+		memcmp(buffer, GDB_JOURNAL_MAGIC, strlen(GDB_JOURNAL_MAGIC)) ||
+		(buffer[strlen(GDB_JOURNAL_MAGIC)] != GDB_JOURNAL_VERSION &&
+		 buffer[strlen(GDB_JOURNAL_MAGIC)] != GDB_JOURNAL_VERSION_32))
+	{
+		free(buffer);
+
+		return;
+	}
+
+	offsetSize = (buffer[strlen(GDB_JOURNAL_MAGIC)] == GDB_JOURNAL_VERSION
+				  ? 8 : 4);
+
+	memset(names, 0, sizeof(names));
+	memset(files, 0, sizeof(files));
+
+	counter = start = GDB_JOURNAL_HEADER_SIZE;
+
+	/* First pass over each transaction checks it. Second one applies it. */
+	while (counter < len)
+	{
+		type = gdbGet8(buffer, &counter);
+
+		if (type == GDB_JOURNAL_COMMIT)
+		{
+			gdbGet32(buffer, &counter);  /* Sequence. */
+
+			sum = __checksum(buffer + start, counter - start);
+
+			if (gdbGet32(buffer, &counter) != sum || counter > len)
+				break;
+
+			for (i = start; i < counter; )
+			{
+				type = gdbGet8(buffer, &i);
+
+				if (type == GDB_JOURNAL_FILE)
+				{
+					index   = gdbGet8(buffer, &i);
+					nameLen = gdbGet16(buffer, &i);
+
+					if (names[index] != NULL)
+						free(names[index]);
+
+					MEM_CHECK(names[index] = (char *)malloc(nameLen + 1));
+					memcpy(names[index], buffer + i, nameLen);
+					names[index][nameLen] = '\0';
+
+					i += nameLen;
+				}
+				else if (type == GDB_JOURNAL_PAGE)
+				{
+					index  = gdbGet8(buffer, &i);
+					offset = gdbGetOffset(buffer, &i, offsetSize);
+
+					if (files[index] == NULL && names[index] != NULL)
+						files[index] = fopen(names[index], "r+");
+
+					if (files[index] != NULL)
+					{
+						fseek(files[index], offset, SEEK_SET);
+						fwrite(buffer + i, 1, GDB_JOURNAL_PAGE_SIZE,
+							   files[index]);
+					}
+
+					i += GDB_JOURNAL_PAGE_SIZE;
+				}
+				else
+				{
+					/* The commit record. */
+					gdbGet32(buffer, &i);
+					gdbGet32(buffer, &i);
+				}
+			}
+
+			applied++;
+			start = counter;
+		}
+		else if (type == GDB_JOURNAL_FILE)
+		{
+			index   = gdbGet8(buffer, &counter);
+			nameLen = gdbGet16(buffer, &counter);
+
+			if (index >= GDB_JOURNAL_MAX_DBS || counter + nameLen > len)
+				break;
+
+			counter += nameLen;
+		}
+		else if (type == GDB_JOURNAL_PAGE)
+		{
+			index = gdbGet8(buffer, &counter);
+			gdbGetOffset(buffer, &counter, offsetSize);
+
+			if (index >= GDB_JOURNAL_MAX_DBS ||
+				counter + GDB_JOURNAL_PAGE_SIZE > len)
+			{
+				break;
+			}
+
+			counter += GDB_JOURNAL_PAGE_SIZE;
+		}
+		else
+			break;
+	}
+
+	for (i = 0; i < GDB_JOURNAL_MAX_DBS; i++)
+	{
+		if (files[i] != NULL)
+		{
+			fflush(files[i]);
+			fsync(fileno(files[i]));
+			fclose(files[i]);
+		}
+		else if (names[i] != NULL)
+		{
+			pmError(PM_ERROR_WARNING,
+					_("GNUpdate DB: Unable to open %s to replay journal "
+					  "%s\n"),
+					names[i], filename);
+		}
+
+		if (names[i] != NULL)
+			free(names[i]);
+	}
+
+	if (applied > 0)
+	{
+		pmError(PM_ERROR_WARNING,
+				_("GNUpdate DB: Replayed %d transactions from journal %s\n"),
+				applied, filename);
+	}
+
+	free(buffer);
+}
+
+/* Starts the journal over, with just its header. */
+static void
+__resetJournal(GdbJournal *journal)
+{
+	unsigned char header[GDB_JOURNAL_HEADER_SIZE];
+
+	memset(header, 0, GDB_JOURNAL_HEADER_SIZE);
+	memcpy(header, GDB_JOURNAL_MAGIC, strlen(GDB_JOURNAL_MAGIC));
+	header[strlen(GDB_JOURNAL_MAGIC)] = GDB_JOURNAL_VERSION;
+
+	fflush(journal->fp);
+
+	if (ftruncate(fileno(journal->fp), 0) != 0)
+	{
+		pmError(PM_ERROR_WARNING,
+				_("GNUpdate DB: Unable to truncate journal %s\n"),
+				journal->filename);
+	}
+
+	fseek(journal->fp, 0L, SEEK_SET);
+	fwrite(header, 1, GDB_JOURNAL_HEADER_SIZE, journal->fp);
+	fflush(journal->fp);
+	fsync(fileno(journal->fp));
+
+	memset(journal->named, 0, sizeof(journal->named));
+
+	journal->size = 0;
+}
+
+GdbJournal *
+gdbJournalOpen(const char *filename)
+{
+	GdbJournal *journal;
+	FILE *fp;
+
+	cxReturnValueUnless(filename != NULL, NULL);
+
+	if ((fp = fopen(filename, "r+")) != NULL)
+		__recover(filename, fp);
+	else if ((fp = fopen(filename, "w+")) == NULL)
+	{
+		pmError(PM_ERROR_WARNING,
+				_("GNUpdate DB: Unable to open journal %s\n"), filename);
+
+		return NULL;
+	}
+
+	MEM_CHECK(journal = (GdbJournal *)malloc(sizeof(GdbJournal)));
+	memset(journal, 0, sizeof(GdbJournal));
+
+	journal->filename = strdup(filename);
+	journal->fp       = fp;
+	journal->maxSize  = GDB_JOURNAL_MAX_SIZE;
+
+	pthread_mutex_init(&journal->mutex, NULL);
+
+	__resetJournal(journal);
+
+	return journal;
+}
+
+/* Throws away a database's pages, along with any uncommitted writes. */
+static void
+__discardPages(GDatabase *db)
+{
+	GdbJournalPage *page, *next;
+	int i;
+
+	gdbLockDatabase(db);
+
+	for (i = 0; i < DB_JOURNAL_BUCKETS; i++)
+	{
+		for (page = db->pages[i]; page != NULL; page = next)
+		{
+			next = page->next;
+
+			if (page->saved != NULL)
+				free(page->saved);
+
+			free(page);
+		}
+
+		db->pages[i] = NULL;
+	}
+
+	gdbUnlockDatabase(db);
+}
+
+void
+gdbJournalClose(GdbJournal *journal)
+{
+	int i;
+
+	cxReturnUnless(journal != NULL);
+
+	gdbJournalCheckpoint(journal);
+
+	for (i = 0; i < GDB_JOURNAL_MAX_DBS; i++)
+	{
+		if (journal->dbs[i] != NULL)
+		{
+			__discardPages(journal->dbs[i]);
+			journal->dbs[i]->journal = NULL;
+		}
+	}
+
+	fclose(journal->fp);
+
+	pthread_mutex_destroy(&journal->mutex);
+
+	free(journal->filename);
+	free(journal);
+}
+
+GdbStatus
+gdbJournalAttach(GdbJournal *journal, GDatabase *db)
+{
+	int i;
+
+	if (journal == NULL || db == NULL || db->journal != NULL ||
+		db->mode != PM_MODE_READ_WRITE)
+	{
+		return GDB_ERROR;
+	}
+
+	pthread_mutex_lock(&journal->mutex);
+
+	for (i = 0; i < GDB_JOURNAL_MAX_DBS && journal->dbs[i] != NULL; i++)
+		;
+
+	if (i < GDB_JOURNAL_MAX_DBS)
+	{
+		gdbLockDatabase(db);
+
+		/* Writes so far go straight to the file. */
+		fflush(db->fp);
+
+		journal->dbs[i]     = db;
+		journal->named[i]   = 0;
+		db->journal      = journal;
+		db->journalIndex = i;
+
+		gdbUnlockDatabase(db);
+	}
+
+	pthread_mutex_unlock(&journal->mutex);
+
+	return (i < GDB_JOURNAL_MAX_DBS ? GDB_SUCCESS : GDB_ERROR);
+}
+
+void
+gdbJournalDetach(GDatabase *db)
+{
+	GdbJournal *journal;
+
+	if (db == NULL || (journal = db->journal) == NULL)
+		return;
+
+	gdbJournalCheckpoint(journal);
+
+	pthread_mutex_lock(&journal->mutex);
+
+	__discardPages(db);
+
+	journal->dbs[db->journalIndex] = NULL;
+	db->journal = NULL;
+
+	pthread_mutex_unlock(&journal->mutex);
+}
+
+/* Adds a database's pages written since the last commit to a buffer. */
+static void
+__addPages(GdbJournal *journal, GDatabase *db, GdbJournalBuffer *buffer)
+{
+	GdbJournalPage *page;
+	int i;
+
+	gdbLockDatabase(db);
+
+	/*
+	 * Dirty blocks and the free block list go in with the rest, along
+	 * with the space of blocks replaced in the transaction that no
+	 * snapshot needs.
+	 */
+	gdbSyncBloom(db);
+	gdbCacheFlush(db);
+	gdbCommitSnapshots(db);
+	gdbSyncFreeMap(db);
+
+	for (i = 0; i < DB_JOURNAL_BUCKETS; i++)
+	{
+		for (page = db->pages[i]; page != NULL; page = page->next)
+		{
+			if (!page->dirty)
+				continue;
+
+			if (!journal->named[db->journalIndex])
+			{
+				__growBuffer(buffer, strlen(db->filename));
+
+				gdbPut8(buffer->data,  &buffer->len, GDB_JOURNAL_FILE);
+				gdbPut8(buffer->data,  &buffer->len, db->journalIndex);
+				gdbPut16(buffer->data, &buffer->len, strlen(db->filename));
+
+				memcpy(buffer->data + buffer->len, db->filename,
+					   strlen(db->filename));
+				buffer->len += strlen(db->filename);
+
+				journal->named[db->journalIndex] = 1;
+			}
+
+			__growBuffer(buffer, GDB_JOURNAL_PAGE_SIZE);
+
+			gdbPut8(buffer->data,  &buffer->len, GDB_JOURNAL_PAGE);
+			gdbPut8(buffer->data,  &buffer->len, db->journalIndex);
+			gdbPutOffset(buffer->data, &buffer->len, page->offset, 8);
+
+			memcpy(buffer->data + buffer->len, page->data,
+				   GDB_JOURNAL_PAGE_SIZE);
+			buffer->len += GDB_JOURNAL_PAGE_SIZE;
+
+			page->dirty = 0;
+
+			if (page->saved != NULL)
+			{
+				free(page->saved);
+				page->saved = NULL;
+			}
+		}
+	}
+
+	gdbUnlockDatabase(db);
+}
+
+static GdbStatus
+__commit(GdbJournal *journal)
+{
+	GdbJournalBuffer buffer;
+	GdbStatus status = GDB_SUCCESS;
+	int i;
+
+	memset(&buffer, 0, sizeof(GdbJournalBuffer));
+
+	for (i = 0; i < GDB_JOURNAL_MAX_DBS; i++)
+	{
+		if (journal->dbs[i] != NULL)
+			__addPages(journal, journal->dbs[i], &buffer);
+	}
+
+	if (buffer.len == 0)
+		return GDB_SUCCESS;
+
+	__growBuffer(&buffer, 0);
+
+	gdbPut8(buffer.data,  &buffer.len, GDB_JOURNAL_COMMIT);
+	gdbPut32(buffer.data, &buffer.len, journal->sequence++);
+	gdbPut32(buffer.data, &buffer.len, __checksum(buffer.data, buffer.len));
+
+	fseek(journal->fp, 0L, SEEK_END);
+
+	if (fwrite(buffer.data, 1, buffer.len, journal->fp) != (size_t)buffer.len ||
+		fflush(journal->fp) != 0 || fsync(fileno(journal->fp)) != 0)
+	{
+		pmError(PM_ERROR_WARNING,
+				_("GNUpdate DB: Unable to write to journal %s\n"),
+				journal->filename);
+
+		status = GDB_ERROR;
+	}
+
+	journal->size += buffer.len;
+
+	free(buffer.data);
+
+	return status;
+}
+
+GdbStatus
+gdbJournalCommit(GdbJournal *journal)
+{
+	GdbStatus status;
+
+	if (journal == NULL)
+		return GDB_ERROR;
+
+	pthread_mutex_lock(&journal->mutex);
+	status = __commit(journal);
+	pthread_mutex_unlock(&journal->mutex);
+
+	if (status == GDB_SUCCESS && journal->size >= journal->maxSize)
+		gdbJournalCheckpoint(journal);
+
+	return status;
+}
+
+void
+gdbJournalCheckpoint(GdbJournal *journal)
+{
+	GdbJournalPage *page, *next, **prev;
+	GDatabase *db;
+	char written;
+	int i, j;
+
+	cxReturnUnless(journal != NULL);
+
+	pthread_mutex_lock(&journal->mutex);
+
+	/*
+	 * Only committed pages go into place. Writes since the last commit
+	 * stay in memory, and a page they changed puts its committed image
+	 * in place instead.
+	 */
+	for (i = 0; i < GDB_JOURNAL_MAX_DBS; i++)
+	{
+		if ((db = journal->dbs[i]) == NULL)
+			continue;
+
+		gdbLockDatabase(db);
+
+		written = 0;
+
+		for (j = 0; j < DB_JOURNAL_BUCKETS; j++)
+		{
+			prev = &db->pages[j];
+
+			for (page = db->pages[j]; page != NULL; page = next)
+			{
+				next = page->next;
+
+				if (page->dirty && page->saved == NULL)
+				{
+					*prev = page;
+					prev  = &page->next;
+
+					continue;
+				}
+
+				fseek(db->fp, page->offset, SEEK_SET);
+				fwrite((page->dirty ? page->saved : page->data), 1,
+					   GDB_JOURNAL_PAGE_SIZE, db->fp);
+
+				written = 1;
+
+				if (page->dirty)
+				{
+					free(page->saved);
+					page->saved = NULL;
+
+					*prev = page;
+					prev  = &page->next;
+				}
+				else
+					free(page);
+			}
+
+			*prev = NULL;
+		}
+
+		if (written)
+		{
+			fflush(db->fp);
+			fsync(fileno(db->fp));
+		}
+
+		gdbUnlockDatabase(db);
+	}
+
+	if (journal->size > 0)
+		__resetJournal(journal);
+
+	pthread_mutex_unlock(&journal->mutex);
+}
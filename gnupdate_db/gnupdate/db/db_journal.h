@@ -0,0 +1,184 @@
+/**
+ * @file db_journal.h Write journal functions
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#ifndef _DB_JOURNAL_H_
+#define _DB_JOURNAL_H_
+
+/**
+ * Size of the pages that journaled writes are kept in.
+ */
+#define GDB_JOURNAL_PAGE_SIZE 512
+
+/**
+ * Most databases that can share one journal.
+ */
+#define GDB_JOURNAL_MAX_DBS 8
+
+/**
+ * Size the journal can grow to before it's checkpointed.
+ */
+#define GDB_JOURNAL_MAX_SIZE (2 * 1024 * 1024)
+
+/** @name Journal file format */
+/*@{*/
+#define GDB_JOURNAL_MAGIC       "GDBJ" /**< Journal magic string.        */
+#define GDB_JOURNAL_VERSION     2      /**< Journal format version.      */
+#define GDB_JOURNAL_HEADER_SIZE 8      /**< Size of the journal header.  */
+
+/**
+ * Journal format version with 32-bit page offsets. These journals are
+ * still put in place on recovery.
+ */
+#define GDB_JOURNAL_VERSION_32  1
+
+#define GDB_JOURNAL_FILE   'F'  /**< Names a database file.              */
+#define GDB_JOURNAL_PAGE   'P'  /**< A page of a database file.          */
+#define GDB_JOURNAL_COMMIT 'C'  /**< Ends a transaction, with a checksum. */
+/*@}*/
+
+/**
+ * A page of a database file, with writes not yet checkpointed.
+ */
+struct _GdbJournalPage
+{
+	offset_t offset;             /**< Offset of the page.               */
+	char dirty;                  /**< 1 if written since the commit.    */
+	char *saved;                 /**< Committed image, if dirty.        */
+
+	GdbJournalPage *next;        /**< Next page in the hash bucket.     */
+
+	char data[GDB_JOURNAL_PAGE_SIZE]; /**< Contents of the page.        */
+};
+
+/**
+ * A redo journal shared by a group of databases.
+ *
+ * Once a database is attached, its writes are held in memory instead
+ * of going to the file. gdbJournalCommit() appends everything written
+ * since the last commit to the journal, as one transaction, with a
+ * single fsync. The pages are written into place later, when the
+ * journal is checkpointed.
+ */
+struct _GdbJournal
+{
+	char *filename;                     /**< Filename of the journal.   */
+	FILE *fp;                           /**< Journal file pointer.      */
+
+	GDatabase *dbs[GDB_JOURNAL_MAX_DBS]; /**< Attached databases.       */
+	char named[GDB_JOURNAL_MAX_DBS];    /**< 1 if named in the journal. */
+
+	unsigned long size;     /**< Bytes written since the checkpoint.   */
+	unsigned long maxSize;  /**< Size that triggers a checkpoint.      */
+	unsigned long sequence; /**< Number of the next transaction.       */
+
+	pthread_mutex_t mutex;  /**< Guards commits and checkpoints.       */
+};
+
+/**
+ * Opens a journal, creating it if it doesn't exist.
+ *
+ * Any complete transactions left in the journal by a crash are written
+ * into their database files first. This must be done before the
+ * databases are opened.
+ *
+ * @param filename The name of the journal file.
+ *
+ * @return The journal, or NULL if it can't be opened.
+ */
+GdbJournal *gdbJournalOpen(const char *filename);
+
+/**
+ * Checkpoints and closes a journal, detaching its databases.
+ *
+ * Writes that were never committed are thrown away.
+ *
+ * @param journal The journal to close.
+ */
+void gdbJournalClose(GdbJournal *journal);
+
+/**
+ * Attaches a database to a journal.
+ *
+ * @param journal The journal.
+ * @param db      A database opened with PM_MODE_READ_WRITE.
+ *
+ * @return The status of the operation.
+ */
+GdbStatus gdbJournalAttach(GdbJournal *journal, GDatabase *db);
+
+/**
+ * Detaches a database from its journal, checkpointing the journal
+ * first.
+ *
+ * The database's writes that were never committed are thrown away.
+ *
+ * gdbClose() calls this automatically.
+ *
+ * @param db The database.
+ */
+void gdbJournalDetach(GDatabase *db);
+
+/**
+ * Commits everything written to the journal's databases since the
+ * last commit.
+ *
+ * If the journal has grown past its maximum size, it's checkpointed.
+ *
+ * @param journal The journal.
+ *
+ * @return The status of the operation.
+ */
+GdbStatus gdbJournalCommit(GdbJournal *journal);
+
+/**
+ * Writes every committed page into its database file, and empties the
+ * journal.
+ *
+ * Writes since the last commit stay pending. They're not committed
+ * here.
+ *
+ * @param journal The journal.
+ */
+void gdbJournalCheckpoint(GdbJournal *journal);
+
+/**
+ * Reads from a database file, seeing any journaled writes.
+ *
+ * @param db     The database.
+ * @param offset The offset to read from.
+ * @param data   The buffer to read into.
+ * @param size   The number of bytes to read.
+ *
+ * @return The number of bytes read.
+ */
+size_t gdbFileRead(GDatabase *db, offset_t offset, void *data, size_t size);
+
+/**
+ * Writes to a database file, or to the journal if one is attached.
+ *
+ * @param db     The database.
+ * @param offset The offset to write to.
+ * @param data   The data to write.
+ * @param size   The number of bytes to write.
+ */
+void gdbFileWrite(GDatabase *db, offset_t offset, const void *data,
+				  size_t size);
+
+#endif /* _DB_JOURNAL_H_ */
@@ -20,6 +20,288 @@
  */
 #include "db_internal.h"
 
+#define __LATCH_BUCKET(offset) \
+	((((offset) >> 5) ^ ((offset) >> 13)) & (DB_LATCH_BUCKETS - 1))
+
+/*
+ * Returns the lock entry for an offset, creating it if needed.
+ * db->latchMutex must be held.
+ */
+static GdbLatch *
+__getLatch(GDatabase *db, offset_t offset, char create)
+{
+	GdbLatch *latch;
+	unsigned long bucket;
+
+	bucket = __LATCH_BUCKET(offset);
+
+	for (latch = db->latches[bucket]; latch != NULL; latch = latch->next)
+	{
+		if (latch->offset == offset)
+			return latch;
+	}
+
+	if (!create)
+		return NULL;
+
+	if (db->freeLatches != NULL)
+	{
+		latch = db->freeLatches;
+		db->freeLatches = latch->next;
+	}
+	else
+	{
+		MEM_CHECK(latch = (GdbLatch *)malloc(sizeof(GdbLatch)));
+
+		pthread_cond_init(&latch->cond, NULL);
+	}
+
+	latch->offset         = offset;
+	latch->readers        = 0;
+	latch->writer         = 0;
+	latch->writersWaiting = 0;
+	latch->users          = 0;
+
+	latch->next = db->latches[bucket];
+	db->latches[bucket] = latch;
+
+	return latch;
+}
+
+/*
+ * Drops a user from a lock entry, and moves the entry to the free list
+ * once nobody is using it. db->latchMutex must be held.
+ */
+static void
+__putLatch(GDatabase *db, GdbLatch *latch)
+{
+	GdbLatch **link;
+
+	if (--latch->users > 0)
+		return;
+
+	for (link = &db->latches[__LATCH_BUCKET(latch->offset)];
+		 *link != NULL;
+		 link = &(*link)->next)
+	{
+		if (*link == latch)
+		{
+			*link = latch->next;
+			break;
+		}
+	}
+
+	latch->next = db->freeLatches;
+	db->freeLatches = latch;
+}
+
+static char
+__canLock(GdbLatch *latch, GdbLockType type)
+{
+	if (type == DB_WRITE_LOCK)
+		return (!latch->writer && latch->readers == 0);
+
+	return (!latch->writer && latch->writersWaiting == 0);
+}
+
+static void
+__takeLock(GdbLatch *latch, GdbLockType type)
+{
+	if (type == DB_WRITE_LOCK)
+		latch->writer = 1;
+	else
+		latch->readers++;
+}
+
+void
+gdbInitLocks(GDatabase *db)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&db->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	pthread_mutex_init(&db->latchMutex, NULL);
+
+	memset(db->latches, 0, DB_LATCH_BUCKETS * sizeof(GdbLatch *));
+
+	db->freeLatches = NULL;
+}
+
+void
+gdbDestroyLocks(GDatabase *db)
+{
+	GdbLatch *latch, *next;
+	int i;
+
+	for (i = 0; i < DB_LATCH_BUCKETS; i++)
+	{
+		if (db->latches[i] != NULL)
+		{
+			pmError(PM_ERROR_WARNING,
+					_("GNUpdate DB: Offset %ld is still locked in %s.\n"),
+					db->latches[i]->offset, db->filename);
+		}
+	}
+
+	for (latch = db->freeLatches; latch != NULL; latch = next)
+	{
+		next = latch->next;
+
+		pthread_cond_destroy(&latch->cond);
+		free(latch);
+	}
+
+	db->freeLatches = NULL;
+
+	pthread_mutex_destroy(&db->latchMutex);
+	pthread_mutex_destroy(&db->mutex);
+}
+
+void
+gdbLockDatabase(GDatabase *db)
+{
+	pthread_mutex_lock(&db->mutex);
+}
+
+void
+gdbUnlockDatabase(GDatabase *db)
+{
+	pthread_mutex_unlock(&db->mutex);
+}
+
+char
+gdbLockOffset(GDatabase *db, offset_t offset, GdbLockType type)
+{
+	GdbLatch *latch;
+
+	if (db == NULL)
+		return 0;
+
+	if (type == DB_UNLOCKED)
+		return gdbUnlockOffset(db, offset);
+
+	pthread_mutex_lock(&db->latchMutex);
+
+	latch = __getLatch(db, offset, 1);
+	latch->users++;
+
+	if (!__canLock(latch, type))
+	{
+		if (type == DB_WRITE_LOCK)
+			latch->writersWaiting++;
+
+		do
+		{
+			pthread_cond_wait(&latch->cond, &db->latchMutex);
+		}
+		while (!__canLock(latch, type));
+
+		if (type == DB_WRITE_LOCK)
+			latch->writersWaiting--;
+	}
+
+	__takeLock(latch, type);
+
+	pthread_mutex_unlock(&db->latchMutex);
+
+	return 1;
+}
+
+char
+gdbTryLockOffset(GDatabase *db, offset_t offset, GdbLockType type)
+{
+	GdbLatch *latch;
+	char result = 0;
+
+	if (db == NULL || type == DB_UNLOCKED)
+		return 0;
+
+	pthread_mutex_lock(&db->latchMutex);
+
+	latch = __getLatch(db, offset, 1);
+	latch->users++;
+
+	if (__canLock(latch, type))
+	{
+		__takeLock(latch, type);
+		result = 1;
+	}
+	else
+		__putLatch(db, latch);
+
+	pthread_mutex_unlock(&db->latchMutex);
+
+	return result;
+}
+
+char
+gdbUnlockOffset(GDatabase *db, offset_t offset)
+{
+	GdbLatch *latch;
+
+	if (db == NULL)
+		return 0;
+
+	pthread_mutex_lock(&db->latchMutex);
+
+	latch = __getLatch(db, offset, 0);
+
+	if (latch == NULL || (!latch->writer && latch->readers == 0))
+	{
+		pthread_mutex_unlock(&db->latchMutex);
+
+		pmError(PM_ERROR_WARNING,
+				_("GNUpdate DB: Trying to unlock offset %ld, which is not "
+				  "locked.\n"),
+				offset);
+
+		return 0;
+	}
+
+	if (latch->writer)
+		latch->writer = 0;
+	else
+		latch->readers--;
+
+	if (!latch->writer && latch->readers == 0)
+		pthread_cond_broadcast(&latch->cond);
+
+	__putLatch(db, latch);
+
+	pthread_mutex_unlock(&db->latchMutex);
+
+	return 1;
+}
+
+GdbLockType
+gdbGetOffsetLock(GDatabase *db, offset_t offset)
+{
+	GdbLatch *latch;
+	GdbLockType type = DB_UNLOCKED;
+
+	if (db == NULL)
+		return DB_UNLOCKED;
+
+	pthread_mutex_lock(&db->latchMutex);
+
+	latch = __getLatch(db, offset, 0);
+
+	if (latch != NULL)
+	{
+		if (latch->writer)
+			type = DB_WRITE_LOCK;
+		else if (latch->readers > 0)
+			type = DB_READ_LOCK;
+	}
+
+	pthread_mutex_unlock(&db->latchMutex);
+
+	return type;
+}
+
 char
 gdbLockFreeBlockList(GDatabase *db, GdbLockType type)
 {
@@ -29,18 +311,17 @@ gdbLockFreeBlockList(GDatabase *db, GdbLockType type)
 	if (type == DB_UNLOCKED)
 		return gdbUnlockFreeBlockList(db);
 
-	return 0;
+	return gdbLockOffset(db, DB_FREE_BLOCK_LIST_OFFSET, type);
 }
 
 char
 gdbUnlockFreeBlockList(GDatabase *db)
 {
-	return 0;
+	return gdbUnlockOffset(db, DB_FREE_BLOCK_LIST_OFFSET);
 }
 
 GdbLockType
 gdbGetFreeBlockListLock(GDatabase *db)
 {
-	return DB_UNLOCKED;
+	return gdbGetOffsetLock(db, DB_FREE_BLOCK_LIST_OFFSET);
 }
-
@@ -54,17 +54,15 @@ gdbGet32(const unsigned char *buffer, int *counter)
 {
 	unsigned long l;
 
-	memcpy(&l, buffer + *counter, sizeof(unsigned long));
-	l = ntohl(l);
+	/* Always 4 bytes, big-endian, however wide a long is on this host. */
+	l = ((unsigned long)buffer[*counter]     << 24) |
+	    ((unsigned long)buffer[*counter + 1] << 16) |
+	    ((unsigned long)buffer[*counter + 2] <<  8) |
+	    ((unsigned long)buffer[*counter + 3]);
 
-	*counter += sizeof(unsigned long);
+	*counter += 4;
 
 	return l;
-
-#if 0
-	return (((unsigned long)gdbGet16(buffer, counter) |
-			 ((unsigned long)gdbGet16(buffer, counter) << 16)));
-#endif
 }
 
 void
@@ -92,15 +90,42 @@ gdbPut16(unsigned char *buffer, int *counter, unsigned short s)
 void
 gdbPut32(unsigned char *buffer, int *counter, unsigned long l)
 {
-	l = htonl(l);
+	buffer[*counter]     = (l >> 24) & 0xFF;
+	buffer[*counter + 1] = (l >> 16) & 0xFF;
+	buffer[*counter + 2] = (l >>  8) & 0xFF;
+	buffer[*counter + 3] = l & 0xFF;
 
-	memcpy(buffer + *counter, &l, sizeof(unsigned long));
-	*counter += sizeof(unsigned long);
+	*counter += 4;
+}
 
-#if 0
-	gdbPut16(buffer, counter, (unsigned short)l);
-	gdbPut16(buffer, counter, (unsigned short)(l >> 16));
-#endif
+offset_t
+gdbGetOffset(const unsigned char *buffer, int *counter, unsigned char size)
+{
+	offset_t offset = 0;
+	int i;
+
+	for (i = 0; i < size; i++)
+		offset = (offset << 8) | buffer[*counter + i];
+
+	*counter += size;
+
+	return offset;
+}
+
+void
+gdbPutOffset(unsigned char *buffer, int *counter, offset_t offset,
+			 unsigned char size)
+{
+	int i;
+
+	/* Shifted a byte at a time, so a narrow offset_t fills with zeros. */
+	for (i = size - 1; i >= 0; i--)
+	{
+		buffer[*counter + i] = offset & 0xFF;
+		offset >>= 8;
+	}
+
+	*counter += size;
 }
 
 void
@@ -80,6 +80,32 @@ void gdbPut16(unsigned char *buffer, int *counter, unsigned short s);
  */
 void gdbPut32(unsigned char *buffer, int *counter, unsigned long l);
 
+/**
+ * Returns an offset from a buffer.
+ *
+ * Offsets are stored in network byte order, in as many bytes as the
+ * database's format uses.
+ *
+ * @param buffer  The buffer.
+ * @param counter A pointer to the current offset.
+ * @param size    The number of bytes the offset is stored in (4 or 8).
+ *
+ * @return The offset.
+ */
+offset_t gdbGetOffset(const unsigned char *buffer, int *counter,
+					  unsigned char size);
+
+/**
+ * Writes an offset to a buffer.
+ *
+ * @param buffer  The buffer.
+ * @param counter A pointer to the current offset.
+ * @param offset  The offset to write.
+ * @param size    The number of bytes to store the offset in (4 or 8).
+ */
+void gdbPutOffset(unsigned char *buffer, int *counter, offset_t offset,
+				  unsigned char size);
+
 /**
  * Pads data in a file.
  *
@@ -20,176 +20,284 @@
  */
 #include "db_internal.h"
 
-#define HASHTABLE_HEADER_SIZE \
-	(sizeof(char) + sizeof(unsigned short))
+/* Positions of the fields in a slot. */
+#define SLOT_KEY   0
+#define SLOT_TYPE  2
+#define SLOT_SIZE  4
+#define SLOT_POS   6
+
+#define SLOT(data, i) ((data) + GDB_HT_HEADER_SIZE + (i) * GDB_HT_SLOT_SIZE)
 
 static int typeSizes[] = { -1, -1, 1, sizeof(long), sizeof(long) };
 
-static unsigned long
-__getDataSize(GdbHashTable *table)
+static unsigned short
+__get16(const unsigned char *p)
 {
-	unsigned short size;
-	GdbBucket *bucket;
-	int i;
+	return (unsigned short)((p[0] << 8) | p[1]);
+}
 
-	size = table->bucketCount * sizeof(char) +
-	       table->itemCount   * (sizeof(short) + sizeof(char));
-	
-	/* Get the sizes of the data. */
-	for (i = 0; i < table->bucketCount; i++)
-	{
-		for (bucket = table->buckets[i];
-			 bucket != NULL;
-			 bucket = bucket->next)
-		{
-			if (typeSizes[bucket->type] == -1)
-				size += sizeof(unsigned short);
-			
-			size += bucket->size;
-		}
-	}
+static void
+__put16(unsigned char *p, unsigned short value)
+{
+	p[0] = (value >> 8) & 0xFF;
+	p[1] = value & 0xFF;
+}
 
-	return size;
+static unsigned short
+__slotCount(const unsigned char *data)
+{
+	return __get16(data + 1);
 }
 
 static unsigned short
-__getTableSize(GdbHashTable *table)
+__itemCount(const unsigned char *data)
 {
-	return HASHTABLE_HEADER_SIZE + __getDataSize(table);
+	return __get16(data + 3);
 }
 
+/*
+ * Returns the slot holding a key, or the empty slot where it would go.
+ * Keys are small tags, and the multiplier spreads runs of them evenly.
+ */
 static unsigned short
-__hash(GdbHashTable *table, unsigned short key)
+__findSlot(const unsigned char *data, unsigned short key)
 {
-	return (key % table->bucketCount);
+	unsigned short mask = __slotCount(data) - 1;
+	unsigned short i, slotKey;
+
+	for (i = (key * 40503U) & mask; ; i = (i + 1) & mask)
+	{
+		slotKey = __get16(SLOT(data, i) + SLOT_KEY);
+
+		if (slotKey == key || slotKey == 0)
+			return i;
+	}
 }
 
-void *
-htReadBlock(GdbBlock *block, const char *buffer, void *extra)
+/* Returns the number of slots to use for a number of items. */
+static unsigned short
+__slotsFor(unsigned short itemCount)
 {
-	GdbHashTable *table;
-	int counter = 0;
-	int i, j;
+	unsigned short slotCount = GDB_HT_MIN_SLOTS;
 
-	MEM_CHECK(table = (GdbHashTable *)malloc(sizeof(GdbHashTable)));
-	memset(table, 0, sizeof(GdbHashTable));
+	/* Keep the table at most three quarters full. */
+	while (itemCount * 4 > slotCount * 3)
+		slotCount *= 2;
 
-	table->block = block;
+	return slotCount;
+}
+
+/* Returns the bytes needed for a table holding the same items. */
+static unsigned long
+__packedSize(const unsigned char *data, unsigned short slotCount,
+			 unsigned short skipKey)
+{
+	const unsigned char *slot;
+	unsigned long size;
+	unsigned short i, key;
+
+	size = GDB_HT_HEADER_SIZE + slotCount * GDB_HT_SLOT_SIZE;
+
+	for (i = 0; i < __slotCount(data); i++)
+	{
+		slot = SLOT(data, i);
+		key  = __get16(slot + SLOT_KEY);
+
+		if (key != 0 && key != skipKey)
+			size += __get16(slot + SLOT_SIZE);
+	}
+
+	return size;
+}
+
+/*
+ * Copies a table into a new buffer with the given number of slots,
+ * leaving out skipKey and any values that have been replaced. The
+ * buffer has room for extra more bytes of values.
+ */
+static unsigned char *
+__pack(const unsigned char *data, unsigned short slotCount,
+	   unsigned long extra, unsigned short skipKey, unsigned long *size)
+{
+	const unsigned char *slot;
+	unsigned char *newData, *newSlot;
+	unsigned long pos;
+	unsigned short i, key, valueSize, itemCount = 0;
 
-	table->bucketCount = gdbGet8(buffer,  &counter);
-	table->itemCount   = gdbGet16(buffer, &counter);
+	pos = GDB_HT_HEADER_SIZE + slotCount * GDB_HT_SLOT_SIZE;
 
-	/* Allocate memory for the buckets. */
-	MEM_CHECK(table->buckets = (GdbBucket **)malloc(table->bucketCount *
-													sizeof(GdbBucket *)));
-	memset(table->buckets, 0, table->bucketCount * sizeof(GdbBucket *));
+	MEM_CHECK(newData = (unsigned char *)malloc(
+		__packedSize(data, slotCount, skipKey) + extra));
+	memset(newData, 0, pos);
 
-	/* Allocate memory for the bucket item counts. */
-	MEM_CHECK(table->counts = (unsigned char *)malloc(table->bucketCount));
-	memset(table->counts, 0, table->bucketCount);
+	newData[0] = GDB_HT_FLAT_MARKER;
+	__put16(newData + 1, slotCount);
 
-	/* Read in the buckets and their items. */
-	for (i = 0; i < table->bucketCount; i++)
+	for (i = 0; i < __slotCount(data); i++)
 	{
-		GdbBucket *lastBucket;
+		slot = SLOT(data, i);
+		key  = __get16(slot + SLOT_KEY);
 
-		table->counts[i] = gdbGet8(buffer, &counter);
+		if (key == 0 || key == skipKey)
+			continue;
 
-		lastBucket = NULL;
+		valueSize = __get16(slot + SLOT_SIZE);
+		newSlot   = SLOT(newData, __findSlot(newData, key));
 
-		for (j = 0; j < table->counts[i]; j++)
-		{
-			GdbBucket *bucket;
+		memcpy(newSlot, slot, GDB_HT_SLOT_SIZE);
+		__put16(newSlot + SLOT_POS, pos);
 
-			MEM_CHECK(bucket = (GdbBucket *)malloc(sizeof(GdbBucket)));	
+		memcpy(newData + pos, data + __get16(slot + SLOT_POS), valueSize);
 
-			bucket->key  = gdbGet16(buffer, &counter);
-			bucket->type = gdbGet8(buffer,  &counter);
+		pos += valueSize;
+		itemCount++;
+	}
 
-			if (typeSizes[bucket->type] == -1)
-				bucket->size = gdbGet16(buffer, &counter);
-			else
-				bucket->size = typeSizes[bucket->type];
+	__put16(newData + 3, itemCount);
 
-			MEM_CHECK(bucket->data = malloc(bucket->size));
-			memcpy(bucket->data, buffer + counter, bucket->size);
+	*size = pos;
 
-			counter += bucket->size;
+	return newData;
+}
 
-			bucket->next = NULL;
+/* Replaces a table's data with a packed copy the table owns. */
+static void
+__repack(GdbHashTable *table, unsigned short slotCount, unsigned long extra,
+		 unsigned short skipKey)
+{
+	unsigned char *data;
 
-			if (lastBucket == NULL)
-				table->buckets[i] = bucket;
-			else
-				lastBucket->next = bucket;
+	data = __pack(table->data, slotCount, extra, skipKey, &table->size);
 
-			lastBucket = bucket;
-		}
+	if (table->capacity > 0)
+		free(table->data);
+	else if (table->block->buffer == (char *)table->data)
+	{
+		free(table->block->buffer);
+		table->block->buffer = NULL;
 	}
 
-	return table;
+	table->data     = data;
+	table->capacity = table->size + extra;
 }
 
-void
-htWriteBlock(GdbBlock *block, char **buffer, unsigned long *size)
+/* Builds a table from the older chained layout. */
+static void
+__readChained(GdbHashTable *table, const unsigned char *buffer)
 {
-	GdbHashTable *table;
+	unsigned char *slot;
+	unsigned char bucketCount, count, type;
+	unsigned short itemCount, slotCount, key, size;
+	unsigned long pos;
 	int counter = 0;
-	int i;
+	int i, j;
 
-	table = (GdbHashTable *)block->detail;
-	
-	*size = __getTableSize(table);
+	bucketCount = gdbGet8(buffer,  &counter);
+	itemCount   = gdbGet16(buffer, &counter);
 
-	MEM_CHECK(*buffer = (char *)malloc(*size));
-	
-	/* Write the hashtable header */
-	gdbPut8(*buffer,  &counter, table->bucketCount);
-	gdbPut16(*buffer, &counter, table->itemCount);
+	slotCount = __slotsFor(itemCount);
+	pos       = GDB_HT_HEADER_SIZE + slotCount * GDB_HT_SLOT_SIZE;
+
+	/* The values take up less room than they did with their headers. */
+	table->capacity = pos + table->block->dataSize;
+
+	MEM_CHECK(table->data = (unsigned char *)malloc(table->capacity));
+	memset(table->data, 0, pos);
 
-	/* Write the buckets and their items. */
-	for (i = 0; i < table->bucketCount; i++)
+	table->data[0] = GDB_HT_FLAT_MARKER;
+	__put16(table->data + 1, slotCount);
+	__put16(table->data + 3, itemCount);
+
+	for (i = 0; i < bucketCount; i++)
 	{
-		GdbBucket *bucket;
-		
-		gdbPut8(*buffer, &counter, table->counts[i]);
+		count = gdbGet8(buffer, &counter);
 
-		for (bucket = table->buckets[i];
-			 bucket != NULL;
-			 bucket = bucket->next)
+		for (j = 0; j < count; j++)
 		{
-			gdbPut16(*buffer, &counter, bucket->key);
-			gdbPut8(*buffer,  &counter, bucket->type);
+			key  = gdbGet16(buffer, &counter);
+			type = gdbGet8(buffer,  &counter);
+
+			if (typeSizes[type] == -1)
+				size = gdbGet16(buffer, &counter);
+			else
+				size = typeSizes[type];
+
+			slot = SLOT(table->data, __findSlot(table->data, key));
+
+			__put16(slot + SLOT_KEY,  key);
+			slot[SLOT_TYPE] = type;
+			__put16(slot + SLOT_SIZE, size);
+			__put16(slot + SLOT_POS,  pos);
 
-			if (typeSizes[bucket->type] == -1)
-				gdbPut16(*buffer, &counter, bucket->size);
+			memcpy(table->data + pos, buffer + counter, size);
 
-			memcpy(*buffer + counter, bucket->data, bucket->size);
-			counter += bucket->size;
+			counter += size;
+			pos     += size;
 		}
 	}
+
+	table->size = pos;
+}
+
+void *
+htReadBlock(GdbBlock *block, const char *buffer, void *extra)
+{
+	GdbHashTable *table;
+
+	MEM_CHECK(table = (GdbHashTable *)malloc(sizeof(GdbHashTable)));
+	memset(table, 0, sizeof(GdbHashTable));
+
+	table->block = block;
+
+	if (buffer[0] != GDB_HT_FLAT_MARKER)
+	{
+		__readChained(table, (const unsigned char *)buffer);
+
+		return table;
+	}
+
+	/* Use the table right where it was read. */
+	table->data     = (unsigned char *)buffer;
+	table->size     = block->dataSize;
+	table->capacity = 0;
+
+	block->buffer = (char *)buffer;
+
+	return table;
+}
+
+void
+htWriteBlock(GdbBlock *block, char **buffer, unsigned long *size)
+{
+	GdbHashTable *table;
+
+	table = (GdbHashTable *)block->detail;
+
+	*buffer = (char *)__pack(table->data, __slotCount(table->data), 0, 0,
+							 size);
 }
 
 void *
 htCreateBlock(GdbBlock *block, void *extra)
 {
 	GdbHashTable *table;
+	unsigned long size;
 
 	MEM_CHECK(table = (GdbHashTable *)malloc(sizeof(GdbHashTable)));
 	memset(table, 0, sizeof(GdbHashTable));
 
-	table->block       = block;
-	table->bucketCount = 11; /* Prime number. */
-	table->itemCount   = 0;
+	table->block = block;
+
+	size = GDB_HT_HEADER_SIZE + GDB_HT_MIN_SLOTS * GDB_HT_SLOT_SIZE;
 
-	/* Allocate memory for the buckets. */
-	MEM_CHECK(table->buckets = (GdbBucket **)malloc(table->bucketCount *
-													sizeof(GdbBucket *)));
-	memset(table->buckets, 0, table->bucketCount * sizeof(GdbBucket *));
+	table->size     = size;
+	table->capacity = size + 256;
 
-	/* Allocate memory for the bucket item counts. */
-	MEM_CHECK(table->counts = (unsigned char *)malloc(table->bucketCount));
-	memset(table->counts, 0, table->bucketCount);
+	MEM_CHECK(table->data = (unsigned char *)malloc(table->capacity));
+	memset(table->data, 0, size);
+
+	table->data[0] = GDB_HT_FLAT_MARKER;
+	__put16(table->data + 1, GDB_HT_MIN_SLOTS);
 
 	return table;
 }
@@ -198,26 +306,13 @@ void
 htDestroyBlock(void *data)
 {
 	GdbHashTable *table;
-	GdbBucket *bucket, *nextBucket;
-	int i;
 	
 	table = (GdbHashTable *)data;
 
-	for (i = 0; i < table->bucketCount; i++)
-	{
-		for (bucket = table->buckets[i];
-			 bucket != NULL;
-			 bucket = nextBucket)
-		{
-			nextBucket = bucket->next;
-
-			free(bucket->data);
-			free(bucket);
-		}
-	}
+	/* Otherwise, the data belongs to the block. */
+	if (table->capacity > 0)
+		free(table->data);
 
-	free(table->buckets);
-	free(table->counts);
 	free(table);
 }
 
@@ -237,6 +332,52 @@ htOpen(GDatabase *db, offset_t offset)
 	return (GdbHashTable *)block->detail;
 }
 
+unsigned long
+htOpenMany(GDatabase *db, const offset_t *offsets, unsigned long count,
+		   GdbHashTable **tables)
+{
+	GdbBlock **blocks;
+	unsigned long i, read;
+
+	if (db == NULL || offsets == NULL || tables == NULL || count == 0)
+		return 0;
+
+	MEM_CHECK(blocks = (GdbBlock **)malloc(count * sizeof(GdbBlock *)));
+
+	read = gdbReadBlocks(db, offsets, count, GDB_BLOCK_HASHTABLE, NULL, 1,
+						 blocks);
+
+	for (i = 0; i < count; i++)
+	{
+		tables[i] = (blocks[i] == NULL ? NULL :
+					 (GdbHashTable *)blocks[i]->detail);
+	}
+
+	free(blocks);
+
+	return read;
+}
+
+GdbHashTable *
+htCopy(GdbHashTable *table, GDatabase *db)
+{
+	GdbHashTable *copy;
+
+	if (table == NULL || db == NULL)
+		return NULL;
+
+	if ((copy = htCreate(db)) == NULL)
+		return NULL;
+
+	free(copy->data);
+
+	copy->data     = __pack(table->data, __slotCount(table->data), 256, 0,
+							&copy->size);
+	copy->capacity = copy->size + 256;
+
+	return copy;
+}
+
 GdbHashTable *
 htCreate(GDatabase *db)
 {
@@ -257,8 +398,9 @@ void
 htAdd(GdbHashTable *table, unsigned short key, const void *data,
 	  unsigned char type, unsigned short size)
 {
-	unsigned short index;
-	GdbBucket *bucket, *nextBucket = NULL;
+	unsigned char *slot;
+	unsigned short slotCount, itemCount;
+	char found;
 	
 	if (table == NULL || key == 0 || data == NULL ||
 		size == 0 || type > GDB_HT_MAX_TYPE)
@@ -266,115 +408,104 @@ htAdd(GdbHashTable *table, unsigned short key, const void *data,
 		return;
 	}
 
-	if (typeSizes[type] != -1)
+	/* Offsets are as wide as the file's format makes them. */
+	if (typeSizes[type] != -1 && type != GDB_HT_OFFSET)
 		size = typeSizes[type];
 
-	index = __hash(table, key);
+	slot  = SLOT(table->data, __findSlot(table->data, key));
+	found = (__get16(slot + SLOT_KEY) == key);
 
 	GDB_SET_DIRTY(table->block);
 
-	if (table->buckets[index] != NULL)
+	/* A value that fits where the old one was is replaced in place. */
+	if (found && table->capacity > 0 && size <= __get16(slot + SLOT_SIZE))
 	{
-		/* See if this already exists in this bucket. */
-		for (bucket = table->buckets[index];
-			 bucket != NULL;
-			 bucket = bucket->next)
-		{
-			if (bucket->key == key)
-			{
-				/* It already exists. Update the data. */
+		memcpy(table->data + __get16(slot + SLOT_POS), data, size);
+
+		slot[SLOT_TYPE] = type;
+		__put16(slot + SLOT_SIZE, size);
+
+		return;
+	}
 
-				if (bucket->data != NULL)
-					free(bucket->data);
+	slotCount = __slotCount(table->data);
+	itemCount = __itemCount(table->data) + (found ? 0 : 1);
 
-				bucket->type = type;
-				bucket->size = size;
-				
-				MEM_CHECK(bucket->data = malloc(size));
-				memcpy(bucket->data, data, size);
+	if (table->capacity == 0 || table->size + size > table->capacity ||
+		__slotsFor(itemCount) > slotCount)
+	{
+		if (__slotsFor(itemCount) > slotCount)
+			slotCount = __slotsFor(itemCount);
+
+		if (__packedSize(table->data, slotCount, (found ? key : 0)) + size >
+			GDB_HT_MAX_SIZE)
+		{
+			pmError(PM_ERROR_WARNING,
+					_("GNUpdate DB: Hashtable at %ld is full. Dropping "
+					  "key %d.\n"),
+					table->block->offset, key);
 
-				return;
-			}
+			return;
 		}
 
-		/* Wasn't found. Just add it to the beginning. */
-		nextBucket = table->buckets[index];
+		/* Leave some room to grow. */
+		__repack(table, slotCount, size + 256, (found ? key : 0));
+
+		slot = SLOT(table->data, __findSlot(table->data, key));
 	}
 
-	/* Create the bucket for this. */
-	MEM_CHECK(bucket = (GdbBucket *)malloc(sizeof(GdbBucket)));	
-	bucket->key  = key;
-	bucket->next = nextBucket;
-	
-	/* Add the data. */
-	bucket->type = type;
-	bucket->size = size;
-	
-	MEM_CHECK(bucket->data = malloc(size));
-	memcpy(bucket->data, data, size);
+	/* Add the value to the end of the arena. */
+	memcpy(table->data + table->size, data, size);
+
+	__put16(slot + SLOT_KEY,  key);
+	slot[SLOT_TYPE] = type;
+	__put16(slot + SLOT_SIZE, size);
+	__put16(slot + SLOT_POS,  table->size);
+
+	table->size += size;
 
-	table->buckets[index] = bucket;
-	table->counts[index]++;
-	table->itemCount++;
+	if (!found)
+		__put16(table->data + 3, __itemCount(table->data) + 1);
 }
 
 char
 htRemove(GdbHashTable *table, unsigned short key)
 {
-	unsigned short index;
-	GdbBucket *bucket, *prevBucket = NULL;
+	unsigned char *slot;
 	
 	if (table == NULL || key == 0)
 		return 0;
 
-	index = __hash(table, key);
-
-	for (bucket = table->buckets[index];
-		 bucket != NULL;
-		 bucket = bucket->next)
-	{
-		if (bucket->key == key)
-		{
-			prevBucket->next = bucket->next;
-			table->itemCount--;
+	slot = SLOT(table->data, __findSlot(table->data, key));
 
-			table->counts[index]--;
+	if (__get16(slot + SLOT_KEY) != key)
+		return 0;
 
-			free(bucket->data);
-			free(bucket);
+	/* Open addressing leaves no hole to just clear, so pack without it. */
+	__repack(table, __slotCount(table->data), 0, key);
 
-			return 1;
-		}
-		
-		prevBucket = bucket;
-	}
+	GDB_SET_DIRTY(table->block);
 
-	return 0;
+	return 1;
 }
 
 const void *
 htGetData(GdbHashTable *table, unsigned short key, unsigned short *size,
 		  unsigned char *type)
 {
-	unsigned short index;
-	GdbBucket *bucket;
+	const unsigned char *slot;
 	
 	if (table == NULL || key == 0)
 		return 0;
 
-	index = __hash(table, key);
+	slot = SLOT(table->data, __findSlot(table->data, key));
 
-	for (bucket = table->buckets[index];
-		 bucket != NULL;
-		 bucket = bucket->next)
+	if (__get16(slot + SLOT_KEY) == key)
 	{
-		if (bucket->key == key)
-		{
-			if (size != NULL) *size = bucket->size;
-			if (type != NULL) *type = bucket->type;
+		if (size != NULL) *size = __get16(slot + SLOT_SIZE);
+		if (type != NULL) *type = slot[SLOT_TYPE];
 
-			return bucket->data;
-		}
+		return table->data + __get16(slot + SLOT_POS);
 	}
 
 	if (size != NULL) *size = 0;
@@ -409,14 +540,15 @@ htAddLong(GdbHashTable *table, unsigned short key, long value)
 void
 htAddOffset(GdbHashTable *table, unsigned short key, offset_t value)
 {
-	offset_t newValue;
+	unsigned char newValue[8];
+	int counter = 0;
 
 	if (table == NULL || key == 0 || value == 0)
 		return;
 
-	newValue = htonl(value);
+	gdbPutOffset(newValue, &counter, value, table->block->db->offsetSize);
 
-	htAdd(table, key, &newValue, GDB_HT_OFFSET, sizeof(offset_t));
+	htAdd(table, key, newValue, GDB_HT_OFFSET, counter);
 }
 
 char *
@@ -472,20 +604,17 @@ htGetOffset(GdbHashTable *table, unsigned short key)
 	unsigned short size;
 	unsigned char  type;
 	const void    *data;
-	offset_t       value;
+	int            counter = 0;
 
 	if (table == NULL || key == 0)
 		return 0;
 
 	data = htGetData(table, key, &size, &type);
 
-	if (type != GDB_HT_OFFSET)
+	/* A table copied from an older file may still hold short offsets. */
+	if (data == NULL || type != GDB_HT_OFFSET || (size != 4 && size != 8))
 		return 0;
 
-	memcpy(&value, data, sizeof(offset_t));
-
-	value = ntohl(value);
-
-	return value;
+	return gdbGetOffset(data, &counter, (unsigned char)size);
 }
 
@@ -40,7 +40,8 @@ olReadBlock(GdbBlock *block, const char *buffer, void *extra)
 												 sizeof(offset_t)));
 
 	for (i = 0; i < list->count; i++)
-		list->offsets[i] = gdbGet32(buffer, &counter);
+		list->offsets[i] = gdbGetOffset(buffer, &counter,
+										block->db->offsetSize);
 
 	return list;
 }
@@ -51,14 +52,15 @@ olWriteBlock(GdbBlock *block, char **buffer, unsigned long *size)
 	GdbOffsetList *list = (GdbOffsetList *)block->detail;
 	int i, counter = 0;
 
-	*size = sizeof(short) + list->count * sizeof(offset_t);
+	*size = sizeof(short) + list->count * block->db->offsetSize;
 
 	MEM_CHECK(*buffer = (char *)malloc(*size));
 		
 	gdbPut16(*buffer, &counter, list->count);
 	
 	for (i = 0; i < list->count; i++)
-		gdbPut32(*buffer, &counter, list->offsets[i]);
+		gdbPutOffset(*buffer, &counter, list->offsets[i],
+					 block->db->offsetSize);
 }
 
 void *
@@ -162,6 +164,39 @@ olAddOffset(GdbOffsetList *list, offset_t offset)
 	list->count++;
 }
 
+char
+olRemoveOffset(GdbOffsetList *list, offset_t offset)
+{
+	int index;
+
+	if ((index = olFindOffset(list, offset)) == -1)
+		return 0;
+
+	memmove(list->offsets + index, list->offsets + index + 1,
+			(list->count - index - 1) * sizeof(offset_t));
+
+	list->count--;
+
+	return 1;
+}
+
+int
+olFindOffset(GdbOffsetList *list, offset_t offset)
+{
+	int i;
+
+	if (list == NULL || offset == 0)
+		return -1;
+
+	for (i = 0; i < list->count; i++)
+	{
+		if (list->offsets[i] == offset)
+			return i;
+	}
+
+	return -1;
+}
+
 offset_t
 olGetOffset(GdbOffsetList *list, unsigned short index)
 {
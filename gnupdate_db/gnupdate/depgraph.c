@@ -0,0 +1,625 @@
+/**
+ * @file depgraph.c Package dependency graph
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#include "gnupdate.h"
+
+/*
+ * Every package has two offset lists in graph.idx: the packages
+ * providing something it requires, and the packages requiring something
+ * it provides. Each is keyed by the package's offset and a direction
+ * (DB_GRAPH_REQUIRES or DB_GRAPH_REQUIRED_BY). A requirement is met by
+ * a package's name, one of its provides, or, for a path, one of its
+ * files. Versions aren't looked at, so the edges are a superset of what
+ * an exact resolve would pick.
+ *
+ * The lists are kept out of the package tables, so linking a package
+ * never changes a table that a snapshot may be reading.
+ */
+
+#define DB_GRAPH_REQUIRES    'r'
+#define DB_GRAPH_REQUIRED_BY 'b'
+
+#define DB_GRAPH_KEY_SIZE    32
+
+typedef struct
+{
+	offset_t      *offsets;
+	unsigned long  count;
+	unsigned long  size;
+
+} DbOffsetSet;
+
+/*
+ * The packages reached so far by a closure. An open-addressed hash of
+ * offsets, where 0 is an empty slot.
+ */
+typedef struct
+{
+	offset_t      *slots;
+	unsigned long  size;
+	unsigned long  count;
+
+} DbVisited;
+
+typedef struct
+{
+	offset_t      *offsets;
+	unsigned long  count;
+	unsigned long  index;
+
+} DbClosureMatches;
+
+static void
+__addOffset(DbOffsetSet *set, offset_t offset)
+{
+	if (set->count == set->size)
+	{
+		set->size = (set->size == 0 ? 16 : set->size * 2);
+
+		MEM_CHECK(set->offsets = (offset_t *)realloc(set->offsets,
+				  set->size * sizeof(offset_t)));
+	}
+
+	set->offsets[set->count++] = offset;
+}
+
+static GdbHashTable *
+__openPackage(DbData *data, offset_t offset)
+{
+	GdbHashTable *table;
+
+	table = htOpen(data->packageDb, offset);
+
+	if (table == NULL)
+	{
+		pmError(PM_ERROR_FATAL,
+				_("GNUpdate DB: "
+				  "Unable to open package table at %ld in %s, line %d\n"),
+				offset, __FILE__, __LINE__);
+		exit(1);
+	}
+
+	return table;
+}
+
+/* Adds the packages in a tree of an index, keyed by package name. */
+static void
+__addTreeOffsets(GDatabase *index, offset_t treeOffset, DbOffsetSet *set)
+{
+	BTreeTraversal *trav;
+	BTree *tree;
+	offset_t offset;
+
+	if ((tree = btreeOpen(index, treeOffset)) == NULL)
+		return;
+
+	trav = btreeInitTraversal(tree);
+
+	for (offset = btreeGetFirstOffset(trav);
+		 offset != (offset_t)-1;
+		 offset = btreeGetNextOffset(trav))
+	{
+		__addOffset(set, offset);
+	}
+
+	btreeDestroyTraversal(trav);
+	btreeClose(tree);
+}
+
+/* Finds the packages that meet a requirement. */
+static void
+__findProviders(DbData *data, const char *name, DbOffsetSet *set)
+{
+	GdbOffsetList *list;
+	offset_t offset;
+	unsigned short i;
+
+	if ((offset = btreeSearch(data->namesIndex->mainTree, name)) != 0)
+		__addOffset(set, offset);
+
+	if ((offset = btreeSearch(data->provDepsIndex->mainTree, name)) != 0)
+		__addTreeOffsets(data->provDepsIndex, offset, set);
+
+	if (*name != '/' ||
+		(offset = btreeSearch(data->filesIndex->mainTree, name)) == 0)
+	{
+		return;
+	}
+
+	/* Files owned by more than one package go through an offset list. */
+	if (gdbBlockTypeAt(data->filesIndex, offset) != GDB_BLOCK_OFFSET_LIST)
+	{
+		__addOffset(set, offset);
+		return;
+	}
+
+	if ((list = olOpen(data->filesIndex, offset)) == NULL)
+		return;
+
+	for (i = 0; i < olGetCount(list); i++)
+		__addOffset(set, olGetOffset(list, i));
+
+	olClose(list);
+}
+
+/* Finds the packages with a requirement. */
+static void
+__findRequirers(DbData *data, const char *name, DbOffsetSet *set)
+{
+	offset_t offset;
+
+	if ((offset = btreeSearch(data->reqDepsIndex->mainTree, name)) != 0)
+		__addTreeOffsets(data->reqDepsIndex, offset, set);
+}
+
+/* Builds the key of one of a package's lists. */
+static void
+__listKey(char *key, offset_t pkgOffset, char dir)
+{
+	snprintf(key, DB_GRAPH_KEY_SIZE, "%016lx%c", (unsigned long)pkgOffset,
+			 dir);
+}
+
+/*
+ * Adds an offset to one of a package's lists, creating the list if the
+ * package doesn't have it yet.
+ */
+static void
+__addToList(DbData *data, offset_t pkgOffset, char dir, offset_t offset)
+{
+	GDatabase     *index = data->graphIndex;
+	GdbOffsetList *list;
+	offset_t       listOffset;
+	char           key[DB_GRAPH_KEY_SIZE];
+
+	__listKey(key, pkgOffset, dir);
+
+	if ((listOffset = btreeSearch(index->mainTree, key)) != 0 &&
+		(list = olOpen(index, listOffset)) != NULL)
+	{
+		/* Already there, or the list can't hold any more. */
+		if (olFindOffset(list, offset) != -1 ||
+			olGetCount(list) == (unsigned short)~0)
+		{
+			olClose(list);
+
+			return;
+		}
+
+		/* Readers with a snapshot still see the list as it was. */
+		list = (GdbOffsetList *)gdbShadowBlock(list->block, NULL)->detail;
+	}
+	else
+		list = olCreate(index);
+
+	olAddOffset(list, offset);
+
+	GDB_SET_DIRTY(list->block);
+	gdbWriteBlock(list->block);
+
+	if (list->block->offset != listOffset)
+		btreeInsert(index->mainTree, key, list->block->offset, 1);
+
+	olClose(list);
+}
+
+static void
+__removeFromList(DbData *data, offset_t pkgOffset, char dir, offset_t offset)
+{
+	GDatabase     *index = data->graphIndex;
+	GdbOffsetList *list;
+	offset_t       listOffset;
+	char           key[DB_GRAPH_KEY_SIZE];
+
+	__listKey(key, pkgOffset, dir);
+
+	if ((listOffset = btreeSearch(index->mainTree, key)) == 0 ||
+		(list = olOpen(index, listOffset)) == NULL)
+	{
+		return;
+	}
+
+	if (olFindOffset(list, offset) == -1)
+	{
+		olClose(list);
+
+		return;
+	}
+
+	/* A list that would be left empty goes away. */
+	if (olGetCount(list) == 1)
+	{
+		btreeDelete(index->mainTree, key);
+
+		gdbFreeBlockChain(index, list->block->chain,
+						  list->block->chainCount, GDB_BLOCK_OFFSET_LIST);
+		olClose(list);
+
+		return;
+	}
+
+	list = (GdbOffsetList *)gdbShadowBlock(list->block, NULL)->detail;
+
+	olRemoveOffset(list, offset);
+
+	GDB_SET_DIRTY(list->block);
+	gdbWriteBlock(list->block);
+
+	if (list->block->offset != listOffset)
+		btreeInsert(index->mainTree, key, list->block->offset, 1);
+
+	olClose(list);
+}
+
+/* Records that one package requires another. */
+static void
+__addEdge(DbData *data, offset_t from, offset_t to)
+{
+	if (from == to)
+		return;
+
+	__addToList(data, from, DB_GRAPH_REQUIRES, to);
+	__addToList(data, to, DB_GRAPH_REQUIRED_BY, from);
+}
+
+/*
+ * Links a package to the packages that meet what it requires, or, if
+ * requires is 0, to the packages requiring a name it provides.
+ */
+static void
+__linkName(DbData *data, offset_t pkgOffset, const char *name,
+		   char requires)
+{
+	DbOffsetSet set;
+	unsigned long i;
+
+	memset(&set, 0, sizeof(DbOffsetSet));
+
+	if (requires)
+		__findProviders(data, name, &set);
+	else
+		__findRequirers(data, name, &set);
+
+	for (i = 0; i < set.count; i++)
+	{
+		if (requires)
+			__addEdge(data, pkgOffset, set.offsets[i]);
+		else
+			__addEdge(data, set.offsets[i], pkgOffset);
+	}
+
+	if (set.offsets != NULL)
+		free(set.offsets);
+}
+
+/* Links every name in a package's files or dependencies chain. */
+static void
+__linkChain(DbData *data, offset_t pkgOffset, offset_t chainOffset,
+			char requires)
+{
+	GdbHashTable *table;
+	offset_t      nextOffset;
+	char         *name;
+
+	for (; chainOffset != 0; chainOffset = nextOffset)
+	{
+		table = htOpen(data->packageDb, chainOffset);
+
+		if (table == NULL)
+		{
+			pmError(PM_ERROR_FATAL,
+					_("GNUpdate DB: "
+					  "Unable to open hashtable at %ld in %s, line %d\n"),
+					chainOffset, __FILE__, __LINE__);
+			abort();
+		}
+
+		nextOffset = table->block->listNext;
+
+		if ((name = htGetString(table, GDBTAG_NAME)) != NULL)
+		{
+			__linkName(data, pkgOffset, name, requires);
+			free(name);
+		}
+
+		gdbDestroyBlock(table->block);
+	}
+}
+
+void
+dbLinkPackage(DbData *data, offset_t offset, char requirers)
+{
+	GdbHashTable *table;
+	offset_t      reqDeps, provDeps, files;
+	char         *name;
+
+	table = __openPackage(data, offset);
+
+	reqDeps  = htGetOffset(table, GDBTAG_REQ_DEPS);
+	provDeps = htGetOffset(table, GDBTAG_PROV_DEPS);
+	files    = htGetOffset(table, GDBTAG_FILES);
+	name     = htGetString(table, GDBTAG_NAME);
+
+	gdbDestroyBlock(table->block);
+
+	__linkChain(data, offset, reqDeps, 1);
+
+	if (requirers)
+	{
+		if (name != NULL)
+			__linkName(data, offset, name, 0);
+
+		__linkChain(data, offset, provDeps, 0);
+		__linkChain(data, offset, files,    0);
+	}
+
+	if (name != NULL)
+		free(name);
+}
+
+/* Copies the offsets out of one of a package's lists. */
+static void
+__readList(DbData *data, offset_t pkgOffset, char dir, DbOffsetSet *set)
+{
+	GdbOffsetList *list;
+	offset_t       listOffset;
+	unsigned short i;
+	char           key[DB_GRAPH_KEY_SIZE];
+
+	/* Read-only databases from before the graph don't have one. */
+	if (data->graphIndex == NULL)
+		return;
+
+	__listKey(key, pkgOffset, dir);
+
+	if ((listOffset = btreeSearch(data->graphIndex->mainTree, key)) == 0 ||
+		(list = olOpen(data->graphIndex, listOffset)) == NULL)
+	{
+		return;
+	}
+
+	for (i = 0; i < olGetCount(list); i++)
+		__addOffset(set, olGetOffset(list, i));
+
+	olClose(list);
+}
+
+/* Frees one of a package's lists. */
+static void
+__dropList(DbData *data, offset_t pkgOffset, char dir)
+{
+	GDatabase     *index = data->graphIndex;
+	GdbOffsetList *list;
+	offset_t       listOffset;
+	char           key[DB_GRAPH_KEY_SIZE];
+
+	__listKey(key, pkgOffset, dir);
+
+	if ((listOffset = btreeSearch(index->mainTree, key)) == 0)
+		return;
+
+	if ((list = olOpen(index, listOffset)) != NULL)
+	{
+		gdbFreeBlockChain(index, list->block->chain,
+						  list->block->chainCount, GDB_BLOCK_OFFSET_LIST);
+		olClose(list);
+	}
+
+	btreeDelete(index->mainTree, key);
+}
+
+void
+dbUnlinkPackage(DbData *data, offset_t offset)
+{
+	DbOffsetSet   required, requiredBy;
+	unsigned long i;
+
+	memset(&required,   0, sizeof(DbOffsetSet));
+	memset(&requiredBy, 0, sizeof(DbOffsetSet));
+
+	__readList(data, offset, DB_GRAPH_REQUIRES,    &required);
+	__readList(data, offset, DB_GRAPH_REQUIRED_BY, &requiredBy);
+
+	for (i = 0; i < required.count; i++)
+	{
+		__removeFromList(data, required.offsets[i], DB_GRAPH_REQUIRED_BY,
+						 offset);
+	}
+
+	for (i = 0; i < requiredBy.count; i++)
+	{
+		__removeFromList(data, requiredBy.offsets[i], DB_GRAPH_REQUIRES,
+						 offset);
+	}
+
+	__dropList(data, offset, DB_GRAPH_REQUIRES);
+	__dropList(data, offset, DB_GRAPH_REQUIRED_BY);
+
+	if (required.offsets != NULL)
+		free(required.offsets);
+
+	if (requiredBy.offsets != NULL)
+		free(requiredBy.offsets);
+}
+
+/* Returns 1 if the offset was already visited, and marks it if not. */
+static char
+__visit(DbVisited *visited, offset_t offset)
+{
+	offset_t *oldSlots;
+	unsigned long i, oldSize;
+
+	if (visited->count * 2 >= visited->size)
+	{
+		oldSlots = visited->slots;
+		oldSize  = visited->size;
+
+		visited->size  = (oldSize == 0 ? 64 : oldSize * 2);
+		visited->count = 0;
+
+		MEM_CHECK(visited->slots = (offset_t *)calloc(visited->size,
+													  sizeof(offset_t)));
+
+		for (i = 0; i < oldSize; i++)
+		{
+			if (oldSlots[i] != 0)
+				__visit(visited, oldSlots[i]);
+		}
+
+		if (oldSlots != NULL)
+			free(oldSlots);
+	}
+
+	/* Offsets are multiples of the block size, so mix the bits up. */
+	i = (unsigned long)((offset >> 5) * 2654435761UL) & (visited->size - 1);
+
+	for (; visited->slots[i] != 0; i = (i + 1) & (visited->size - 1))
+	{
+		if (visited->slots[i] == offset)
+			return 1;
+	}
+
+	visited->slots[i] = offset;
+	visited->count++;
+
+	return 0;
+}
+
+static int
+__compareOffsets(const void *a, const void *b)
+{
+	offset_t offset1 = *(const offset_t *)a;
+	offset_t offset2 = *(const offset_t *)b;
+
+	return (offset1 < offset2 ? -1 : offset1 > offset2);
+}
+
+offset_t *
+dbGetDependencyClosure(DbData *data, offset_t offset, char reverse,
+					   unsigned long *count)
+{
+	DbOffsetSet   found;
+	DbVisited     visited;
+	unsigned long i;
+	char          dir;
+
+	dir = (reverse ? DB_GRAPH_REQUIRED_BY : DB_GRAPH_REQUIRES);
+
+	memset(&found,   0, sizeof(DbOffsetSet));
+	memset(&visited, 0, sizeof(DbVisited));
+
+	__visit(&visited, offset);
+
+	/* Breadth first. The found set doubles as the queue. */
+	__readList(data, offset, dir, &found);
+
+	for (i = 0; i < found.count; )
+	{
+		if (__visit(&visited, found.offsets[i]))
+		{
+			found.offsets[i] = found.offsets[--found.count];
+			continue;
+		}
+
+		__readList(data, found.offsets[i], dir, &found);
+
+		i++;
+	}
+
+	free(visited.slots);
+
+	/* Hand them out in file order. */
+	qsort(found.offsets, found.count, sizeof(offset_t), __compareOffsets);
+
+	*count = found.count;
+
+	return found.offsets;
+}
+
+static PmPackage *
+__nextClosurePackage(PmDatabase *db, DbMatchData *data)
+{
+	DbClosureMatches *closure = (DbClosureMatches *)data->data;
+
+	if (closure->index >= closure->count)
+		return NULL;
+
+	return dbReadPackage(db, closure->offsets[closure->index++]);
+}
+
+static PmPackage *
+__firstClosurePackage(PmDatabase *db, DbMatchData *data)
+{
+	DbClosureMatches *closure = (DbClosureMatches *)data->data;
+
+	closure->index = 0;
+
+	return __nextClosurePackage(db, data);
+}
+
+static void
+__destroyClosureData(DbMatchData *data)
+{
+	DbClosureMatches *closure = (DbClosureMatches *)data->data;
+
+	if (closure->offsets != NULL)
+		free(closure->offsets);
+
+	free(closure);
+}
+
+PmStatus
+dbFindDependencyClosure(PmDatabase *db, PmPackage *pkg, char reverse,
+						PmMatches *matches)
+{
+	DbClosureMatches *closure;
+	GdbHashTable     *table;
+	DbMatchData      *data;
+
+	table = (GdbHashTable *)PM_PACKAGE_DB_DATA(pkg);
+
+	if (table == NULL)
+		return PM_FAILED;
+
+	MEM_CHECK(closure = (DbClosureMatches *)malloc(sizeof(DbClosureMatches)));
+	memset(closure, 0, sizeof(DbClosureMatches));
+
+	closure->offsets = dbGetDependencyClosure((DbData *)db->db,
+											  table->block->offset, reverse,
+											  &closure->count);
+
+	if (closure->count == 0)
+	{
+		if (closure->offsets != NULL)
+			free(closure->offsets);
+
+		free(closure);
+
+		return PM_FAILED; /* Nothing required. */
+	}
+
+	data = newMatchData(__firstClosurePackage, __nextClosurePackage,
+						__destroyClosureData);
+	matches->matches = data;
+
+	data->data = closure;
+
+	return PM_SUCCESS;
+}
@@ -0,0 +1,228 @@
+/**
+ * @file depgraph_test.c Test of the package dependency graph.
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#include "gnupdate.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The database lives here instead of GNUPDATE_DB_PATH. */
+#define TEST_DB_PATH "depgraph_test.d"
+
+static const char *fileNames[] =
+{
+	"packages.db", "names.idx", "files.idx", "groups.idx", "reqdeps.idx",
+	"provdeps.idx", "graph.idx", "journal"
+};
+
+static char *
+__path(const char *baseName)
+{
+	static char filename[256];
+
+	snprintf(filename, sizeof(filename), "%s/%s", TEST_DB_PATH, baseName);
+
+	return filename;
+}
+
+static void
+__removeFiles(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(fileNames) / sizeof(*fileNames); i++)
+		unlink(__path(fileNames[i]));
+
+	rmdir(TEST_DB_PATH);
+}
+
+/* Opens the files, or creates them, and puts them under the journal. */
+static void
+__openFiles(DbData *data, char create)
+{
+	GDatabase **dbs[] =
+	{
+		&data->packageDb, &data->namesIndex, &data->filesIndex,
+		&data->groupsIndex, &data->reqDepsIndex, &data->provDepsIndex,
+		&data->graphIndex
+	};
+	GdbType type;
+	unsigned int i;
+
+	memset(data, 0, sizeof(DbData));
+
+	data->journal = gdbJournalOpen(__path("journal"));
+
+	for (i = 0; i < sizeof(dbs) / sizeof(*dbs); i++)
+	{
+		type = (i == 0 ? GDB_DATA_FILE : GDB_INDEX_FILE);
+
+		if (create)
+			*dbs[i] = gdbCreate(__path(fileNames[i]), type);
+		else
+		{
+			*dbs[i] = gdbOpen(__path(fileNames[i]), type,
+							  PM_MODE_READ_WRITE);
+		}
+
+		gdbJournalAttach(data->journal, *dbs[i]);
+	}
+}
+
+static void
+__closeFiles(DbData *data)
+{
+	gdbClose(data->packageDb);
+	gdbClose(data->namesIndex);
+	gdbClose(data->filesIndex);
+	gdbClose(data->groupsIndex);
+	gdbClose(data->reqDepsIndex);
+	gdbClose(data->provDepsIndex);
+	gdbClose(data->graphIndex);
+
+	gdbJournalClose(data->journal);
+}
+
+static PmPackage *
+__newPackage(const char *name, const char *requires, const char *provides)
+{
+	PmPackage *pkg;
+	PmDependency *dep;
+
+	pkg = pmNewPackage();
+
+	pmSetPackageName(pkg, name);
+	pmSetPackageVersion(pkg, "1.0");
+	pmSetPackageRelease(pkg, "1");
+	pmSetPackageGroup(pkg, "test");
+
+	if (requires != NULL)
+	{
+		dep = pmNewDependency();
+		pmSetDependencyName(dep, requires);
+		pmPackageAddRequirement(pkg, dep);
+	}
+
+	if (provides != NULL)
+	{
+		dep = pmNewDependency();
+		pmSetDependencyName(dep, provides);
+		pmPackageAddProvide(pkg, dep);
+	}
+
+	return pkg;
+}
+
+/* Returns 1 if exactly the given packages require a provider. */
+static int
+__checkRequirers(DbData *data, offset_t provider, offset_t requirer1,
+				 offset_t requirer2)
+{
+	offset_t *offsets;
+	unsigned long count, i;
+	int found = 0;
+
+	offsets = dbGetDependencyClosure(data, provider, 1, &count);
+
+	for (i = 0; i < count; i++)
+	{
+		if (offsets[i] != requirer1 && offsets[i] != requirer2)
+		{
+			free(offsets);
+
+			return 0;
+		}
+
+		found++;
+	}
+
+	if (offsets != NULL)
+		free(offsets);
+
+	return (found == (requirer1 != 0) + (requirer2 != 0));
+}
+
+int
+main(void)
+{
+	PmDatabase db;
+	DbData data;
+	PmPackage *provider, *app1, *app2;
+	offset_t providerOffset, app1Offset, app2Offset;
+
+	__removeFiles();
+	mkdir(TEST_DB_PATH, 0755);
+
+	memset(&db, 0, sizeof(PmDatabase));
+	db.db = &data;
+
+	__openFiles(&data, 1);
+
+	provider = __newPackage("libfoo",  NULL,         "libfoo.so");
+	app1     = __newPackage("foo-app", "libfoo.so", NULL);
+	app2     = __newPackage("foo-cli", "libfoo.so", NULL);
+
+	if (dbAddPackage(&db, provider) != PM_SUCCESS ||
+		dbAddPackage(&db, app1) != PM_SUCCESS ||
+		dbAddPackage(&db, app2) != PM_SUCCESS)
+	{
+		printf("adding the packages failed\n");
+		return 1;
+	}
+
+	providerOffset = btreeSearch(data.namesIndex->mainTree, "libfoo");
+	app1Offset     = btreeSearch(data.namesIndex->mainTree, "foo-app");
+	app2Offset     = btreeSearch(data.namesIndex->mainTree, "foo-cli");
+
+	if (!__checkRequirers(&data, providerOffset, app1Offset, app2Offset))
+	{
+		printf("libfoo isn't required by both packages\n");
+		return 1;
+	}
+
+	/*
+	 * The rest of the removal isn't written yet, so it fails, but the
+	 * package is unlinked from the graph either way.
+	 */
+	dbRemovePackage(&db, app1);
+
+	if (!__checkRequirers(&data, providerOffset, app2Offset, 0))
+	{
+		printf("libfoo is still required by the removed package\n");
+		return 1;
+	}
+
+	/* The unlinked graph must be what was committed. */
+	__closeFiles(&data);
+	__openFiles(&data, 0);
+
+	if (!__checkRequirers(&data, providerOffset, app2Offset, 0))
+	{
+		printf("the removed package is back after reopening\n");
+		return 1;
+	}
+
+	__closeFiles(&data);
+	__removeFiles();
+
+	printf("PASS\n");
+
+	return 0;
+}
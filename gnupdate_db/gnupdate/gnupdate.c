@@ -67,12 +67,92 @@ __createDatabase(const char *baseName, GdbType type)
 	return db;
 }
 
+static GdbJournal *
+__openJournal(void)
+{
+	char *filename;
+	GdbJournal *journal;
+	size_t len;
+
+	len = strlen(GNUPDATE_DB_PATH) + strlen(GNUPDATE_JOURNAL_NAME) + 2;
+
+	MEM_CHECK(filename = (char *)malloc(len));
+
+	snprintf(filename, len, "%s/%s", GNUPDATE_DB_PATH, GNUPDATE_JOURNAL_NAME);
+
+	journal = gdbJournalOpen(filename);
+
+	free(filename);
+
+	return journal;
+}
+
+/*
+ * Puts every file under the journal, so each package added or removed
+ * is committed as one transaction.
+ */
+static void
+__attachJournal(DbData *data)
+{
+	if (data->journal == NULL)
+		return;
+
+	gdbJournalAttach(data->journal, data->packageDb);
+	gdbJournalAttach(data->journal, data->namesIndex);
+	gdbJournalAttach(data->journal, data->filesIndex);
+	gdbJournalAttach(data->journal, data->groupsIndex);
+	gdbJournalAttach(data->journal, data->reqDepsIndex);
+	gdbJournalAttach(data->journal, data->provDepsIndex);
+	gdbJournalAttach(data->journal, data->graphIndex);
+}
+
+/*
+ * Links every package into a new dependency graph. Each one links itself
+ * to what it requires, which also links it to what requires it.
+ */
+static void
+__linkPackages(DbData *data)
+{
+	BTreeTraversal *trav;
+	offset_t offset;
+
+	trav = btreeInitTraversal(data->packageDb->mainTree);
+
+	for (offset = btreeGetFirstOffset(trav);
+		 offset != (offset_t)-1;
+		 offset = btreeGetNextOffset(trav))
+	{
+		dbLinkPackage(data, offset, 0);
+	}
+
+	btreeDestroyTraversal(trav);
+
+	gdbJournalCommit(data->journal);
+}
+
+/*
+ * Dependency checks look up many names that aren't in these indexes,
+ * so they get Bloom filters to turn those away without reading the
+ * trees.
+ */
+static void
+__enableFilters(DbData *data)
+{
+	gdbEnableBloom(data->namesIndex,    0);
+	gdbEnableBloom(data->provDepsIndex, 0);
+
+	/* A filter built here is kept only once it's committed. */
+	if (data->journal != NULL)
+		gdbJournalCommit(data->journal);
+}
+
 PmStatus
 dbOpen(PmDatabase *db)
 {
 	struct stat sb;
 	DbData *data;
 	PmAccessMode mode;
+	char linkPackages = 0;
 
 	if (stat(GNUPDATE_DB_PATH, &sb) != 0)
 		return PM_FAILED;
@@ -83,11 +163,25 @@ dbOpen(PmDatabase *db)
 	MEM_CHECK(data = (DbData *)malloc(sizeof(DbData)));
 	memset(data, 0, sizeof(DbData));
 
+	/*
+	 * Open the journal first, so anything committed before a crash is
+	 * put in place before the files are read.
+	 */
+	if (mode == PM_MODE_READ_WRITE &&
+		(data->journal = __openJournal()) == NULL)
+	{
+		free(data);
+
+		return PM_FAILED;
+	}
+
 	/* Open the package data file. */
 	data->packageDb = __loadDatabase("packages.db", GDB_DATA_FILE, mode);
 
 	if (data->packageDb == NULL)
 	{
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
@@ -100,6 +194,8 @@ dbOpen(PmDatabase *db)
 	{
 		gdbClose(data->packageDb);
 
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
@@ -113,6 +209,8 @@ dbOpen(PmDatabase *db)
 		gdbClose(data->packageDb);
 		gdbClose(data->namesIndex);
 
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
@@ -127,6 +225,8 @@ dbOpen(PmDatabase *db)
 		gdbClose(data->namesIndex);
 		gdbClose(data->filesIndex);
 
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
@@ -142,6 +242,8 @@ dbOpen(PmDatabase *db)
 		gdbClose(data->filesIndex);
 		gdbClose(data->groupsIndex);
 
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
@@ -158,11 +260,50 @@ dbOpen(PmDatabase *db)
 		gdbClose(data->groupsIndex);
 		gdbClose(data->reqDepsIndex);
 
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
 	}
 
+	/*
+	 * Open the dependency graph index file. A database from before the
+	 * graph gets one when opened for writing. A read-only one goes
+	 * without.
+	 */
+	data->graphIndex = __loadDatabase("graph.idx", GDB_INDEX_FILE, mode);
+
+	if (data->graphIndex == NULL && mode == PM_MODE_READ_WRITE)
+	{
+		data->graphIndex = __createDatabase("graph.idx", GDB_INDEX_FILE);
+
+		if (data->graphIndex == NULL)
+		{
+			gdbClose(data->packageDb);
+			gdbClose(data->namesIndex);
+			gdbClose(data->filesIndex);
+			gdbClose(data->groupsIndex);
+			gdbClose(data->reqDepsIndex);
+			gdbClose(data->provDepsIndex);
+
+			gdbJournalClose(data->journal);
+
+			free(data);
+
+			return PM_FAILED;
+		}
+
+		linkPackages = 1;
+	}
+
+	__attachJournal(data);
+
+	if (linkPackages)
+		__linkPackages(data);
+
+	__enableFilters(data);
+
 	db->db = data;
 
 	return PM_SUCCESS;
@@ -181,11 +322,20 @@ dbCreate(PmDatabase *db)
 	MEM_CHECK(data = (DbData *)malloc(sizeof(DbData)));
 	memset(data, 0, sizeof(DbData));
 	
+	if ((data->journal = __openJournal()) == NULL)
+	{
+		free(data);
+
+		return PM_FAILED;
+	}
+
 	/* Create the package data file. */
 	data->packageDb = __createDatabase("packages.db", GDB_DATA_FILE);
 
 	if (data->packageDb == NULL)
 	{
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
@@ -198,6 +348,8 @@ dbCreate(PmDatabase *db)
 	{
 		gdbClose(data->packageDb);
 
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
@@ -211,6 +363,8 @@ dbCreate(PmDatabase *db)
 		gdbClose(data->packageDb);
 		gdbClose(data->namesIndex);
 
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
@@ -225,6 +379,8 @@ dbCreate(PmDatabase *db)
 		gdbClose(data->namesIndex);
 		gdbClose(data->filesIndex);
 
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
@@ -240,6 +396,8 @@ dbCreate(PmDatabase *db)
 		gdbClose(data->filesIndex);
 		gdbClose(data->groupsIndex);
 
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
@@ -256,11 +414,35 @@ dbCreate(PmDatabase *db)
 		gdbClose(data->groupsIndex);
 		gdbClose(data->reqDepsIndex);
 
+		gdbJournalClose(data->journal);
+
 		free(data);
 
 		return PM_FAILED;
 	}
 
+	/* Create the dependency graph index file. */
+	data->graphIndex = __createDatabase("graph.idx", GDB_INDEX_FILE);
+
+	if (data->graphIndex == NULL)
+	{
+		gdbClose(data->packageDb);
+		gdbClose(data->namesIndex);
+		gdbClose(data->filesIndex);
+		gdbClose(data->groupsIndex);
+		gdbClose(data->reqDepsIndex);
+		gdbClose(data->provDepsIndex);
+
+		gdbJournalClose(data->journal);
+
+		free(data);
+
+		return PM_FAILED;
+	}
+
+	__attachJournal(data);
+	__enableFilters(data);
+
 	db->db = data;
 
 	return PM_SUCCESS;
@@ -271,24 +453,26 @@ dbClose(PmDatabase *db)
 {
 	DbData *data = (DbData *)db->db;
 
+	/*
+	 * Closing a file puts what it committed in place, and throws away
+	 * the rest. The journal goes last, so nothing written on the way
+	 * out bypasses it.
+	 */
 	gdbClose(data->packageDb);
 	gdbClose(data->namesIndex);
 	gdbClose(data->filesIndex);
 	gdbClose(data->groupsIndex);
 	gdbClose(data->reqDepsIndex);
 	gdbClose(data->provDepsIndex);
+	gdbClose(data->graphIndex);
+
+	gdbJournalClose(data->journal);
 
 	free(data);
 
 	return PM_SUCCESS;
 }
 
-PmStatus
-dbRebuild(PmDatabase *db)
-{
-	return PM_NOT_SUPPORTED;
-}
-
 unsigned long
 dbGetPackageCount(PmDatabase *db)
 {
@@ -29,6 +29,9 @@
 /* XXX Hard-code the database path.. for now. */
 #define GNUPDATE_DB_PATH "/var/lib/gnupdate"
 
+/* The journal shared by the database files, under GNUPDATE_DB_PATH. */
+#define GNUPDATE_JOURNAL_NAME "journal"
+
 
 /**************************************************************************
  * A search type.
@@ -49,6 +52,9 @@ typedef struct
 	GDatabase *groupsIndex;    /**< Groups index file.                */
 	GDatabase *reqDepsIndex;   /**< Required dependencies index file. */
 	GDatabase *provDepsIndex;  /**< Provided dependencies index file. */
+	GDatabase *graphIndex;     /**< Dependency graph index file.      */
+
+	GdbJournal *journal;       /**< Journal for all of the above.     */
 
 } DbData;
 
@@ -80,6 +86,7 @@ PmStatus dbClose(PmDatabase *db);
  **************************************************************************/
 PmStatus dbAddPackage(PmDatabase *db, PmPackage *pkg);
 PmStatus dbRemovePackage(PmDatabase *db, PmPackage *pkg);
+PmStatus dbRebuild(PmDatabase *db);
 
 
 /**************************************************************************
@@ -112,6 +119,16 @@ void dbGetFiles(PmDatabase *db, PmPackage *pkg);
 void dbGetRequiredDeps(PmDatabase *db, PmPackage *pkg);
 void dbGetProvidedDeps(PmDatabase *db, PmPackage *pkg);
 
+/**************************************************************************
+ * Dependency Graph Functions
+ **************************************************************************/
+void dbLinkPackage(DbData *data, offset_t offset, char requirers);
+void dbUnlinkPackage(DbData *data, offset_t offset);
+offset_t *dbGetDependencyClosure(DbData *data, offset_t offset, char reverse,
+								 unsigned long *count);
+PmStatus dbFindDependencyClosure(PmDatabase *db, PmPackage *pkg,
+								 char reverse, PmMatches *matches);
+
 /**************************************************************************
  * Search Helper Functions
  **************************************************************************/
@@ -122,11 +139,34 @@ DbMatchData *newMatchData(
 
 void destroyMatchData(DbMatchData *data);
 
+/**************************************************************************
+ * A pattern search over an index.
+ **************************************************************************/
+typedef struct
+{
+	GdbSnapshot    *snapshot; /**< What the search sees, if pinned.    */
+	BTree          *tree;     /**< The snapshot's view of the index.   */
+	BTreeTraversal *trav;     /**< Keys starting with the prefix.      */
+	char           *pattern;  /**< The glob pattern, or NULL for all.  */
+	int             flags;    /**< The fnmatch() flags.                */
+
+} DbPatternData;
+
+DbPatternData *newPatternData(BTree *tree, const char *prefix,
+							  const char *pattern, int flags);
+offset_t getFirstPatternOffset(DbPatternData *data);
+offset_t getNextPatternOffset(DbPatternData *data);
+void destroyPatternData(DbPatternData *data);
+
 /**************************************************************************
  * Utility Functions
  **************************************************************************/
 char *dbPackToString(void *data, size_t size);
 char *dbPackTimestamp(void);
+char *dbGetGlobPrefix(const char *pattern);
 PmPackage *dbReadPackage(PmDatabase *db, offset_t offset);
+void dbReadPackageTables(PmDatabase *db, const offset_t *offsets,
+						 unsigned long count, GdbHashTable **tables);
+PmPackage *dbMakePackage(GdbHashTable *table);
 
 #endif /* _GNUPDATE_H_ */
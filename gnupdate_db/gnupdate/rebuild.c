@@ -0,0 +1,665 @@
+/**
+ * @file rebuild.c Index rebuilding functions
+ *
+ * @Copyright (C) 1999-2004 The GNUpdate Project.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA  02111-1307, USA.
+ */
+#include "gnupdate.h"
+
+#include <unistd.h>
+
+/*
+ * How full to pack the rebuilt index nodes. Leave a little room, since
+ * packages will be added to the indexes afterward.
+ */
+#define DB_REBUILD_FILL_FACTOR 90
+
+/*
+ * One entry in an index. For the files and names indexes, the key maps
+ * straight to the package. For the others, the key maps to a tree that
+ * maps the package name (subKey) to the package.
+ */
+typedef struct
+{
+	char          *key;
+	char          *subKey;
+	offset_t       offset;
+	unsigned long  seq;     /* Keeps duplicates in package order. */
+
+} DbRebuildEntry;
+
+typedef struct
+{
+	DbRebuildEntry *entries;
+	unsigned long   count;
+	unsigned long   size;
+
+} DbRebuildList;
+
+/*
+ * Walks a range of a sorted list, feeding it to btreeBulkLoad().
+ */
+typedef struct
+{
+	GDatabase     *db;
+	DbRebuildList *list;
+	unsigned long  index;
+	unsigned long  end;
+
+} DbRebuildIter;
+
+static void
+__addEntry(DbRebuildList *list, char *key, const char *subKey,
+		   offset_t offset)
+{
+	DbRebuildEntry *entry;
+
+	if (list->count == list->size)
+	{
+		list->size = (list->size == 0 ? 256 : list->size * 2);
+
+		MEM_CHECK(list->entries = (DbRebuildEntry *)realloc(list->entries,
+				  list->size * sizeof(DbRebuildEntry)));
+	}
+
+	entry = &list->entries[list->count];
+
+	entry->key    = key;
+	entry->subKey = (subKey == NULL ? NULL : strdup(subKey));
+	entry->offset = offset;
+	entry->seq    = list->count;
+
+	list->count++;
+}
+
+static int
+__compareEntries(const void *a, const void *b)
+{
+	const DbRebuildEntry *entry1 = (const DbRebuildEntry *)a;
+	const DbRebuildEntry *entry2 = (const DbRebuildEntry *)b;
+	int cmp;
+
+	if ((cmp = strcmp(entry1->key, entry2->key)) != 0)
+		return cmp;
+
+	if (entry1->subKey != NULL && entry2->subKey != NULL &&
+		(cmp = strcmp(entry1->subKey, entry2->subKey)) != 0)
+	{
+		return cmp;
+	}
+
+	return (entry1->seq < entry2->seq ? -1 : entry1->seq > entry2->seq);
+}
+
+static void
+__destroyList(DbRebuildList *list)
+{
+	unsigned long i;
+
+	for (i = 0; i < list->count; i++)
+	{
+		free(list->entries[i].key);
+
+		if (list->entries[i].subKey != NULL)
+			free(list->entries[i].subKey);
+	}
+
+	if (list->entries != NULL)
+		free(list->entries);
+}
+
+/*
+ * Adds the name of each hashtable in a package's files or dependencies
+ * chain to a list.
+ */
+static void
+__addChain(DbData *data, DbRebuildList *list, GdbHashTable *pkgTable,
+		   GdbTag tag, const char *pkgName, offset_t pkgOffset)
+{
+	GdbHashTable *table;
+	offset_t      offset, nextOffset;
+	char         *name;
+
+	for (offset = htGetOffset(pkgTable, tag);
+		 offset != 0;
+		 offset = nextOffset)
+	{
+		table = htOpen(data->packageDb, offset);
+
+		if (table == NULL)
+		{
+			pmError(PM_ERROR_FATAL,
+					_("GNUpdate DB: "
+					  "Unable to open hashtable at %ld in %s, line %d\n"),
+					offset, __FILE__, __LINE__);
+			abort();
+		}
+
+		nextOffset = table->block->listNext;
+
+		if ((name = htGetString(table, GDBTAG_NAME)) != NULL)
+			__addEntry(list, name, pkgName, pkgOffset);
+
+		gdbDestroyBlock(table->block);
+	}
+}
+
+static int
+__nextEntry(void *data, const char **key, offset_t *offset)
+{
+	DbRebuildIter *iter = (DbRebuildIter *)data;
+	DbRebuildEntry *entry;
+
+	if (iter->index >= iter->end)
+		return 0;
+
+	entry = &iter->list->entries[iter->index++];
+
+	*key    = entry->key;
+	*offset = entry->offset;
+
+	return 1;
+}
+
+static int
+__nextSubEntry(void *data, const char **key, offset_t *offset)
+{
+	DbRebuildIter *iter = (DbRebuildIter *)data;
+	DbRebuildEntry *entry;
+
+	if (iter->index >= iter->end)
+		return 0;
+
+	entry = &iter->list->entries[iter->index++];
+
+	*key    = entry->subKey;
+	*offset = entry->offset;
+
+	return 1;
+}
+
+/* Returns the end of the run of entries sharing a key. */
+static unsigned long
+__findRunEnd(DbRebuildIter *iter)
+{
+	DbRebuildEntry *entries = iter->list->entries;
+	unsigned long i;
+
+	for (i = iter->index + 1;
+		 i < iter->end && !strcmp(entries[i].key, entries[iter->index].key);
+		 i++)
+		;
+
+	return i;
+}
+
+/*
+ * Files owned by one package point straight to it. Files owned by
+ * more go through an offset list, as dbAddPackage() leaves them.
+ */
+static int
+__nextFile(void *data, const char **key, offset_t *offset)
+{
+	DbRebuildIter *iter = (DbRebuildIter *)data;
+	DbRebuildEntry *entries = iter->list->entries;
+	GdbOffsetList *list;
+	unsigned long i, end;
+
+	if (iter->index >= iter->end)
+		return 0;
+
+	end = __findRunEnd(iter);
+
+	*key = entries[iter->index].key;
+
+	if (end - iter->index == 1)
+	{
+		*offset = entries[iter->index].offset;
+	}
+	else
+	{
+		list = olCreate(iter->db);
+
+		for (i = iter->index; i < end; i++)
+			olAddOffset(list, entries[i].offset);
+
+		GDB_SET_DIRTY(list->block);
+		gdbWriteBlock(list->block);
+
+		*offset = list->block->offset;
+
+		gdbDestroyBlock(list->block);
+	}
+
+	iter->index = end;
+
+	return 1;
+}
+
+/*
+ * Builds the tree of packages for each key, and hands the key and the
+ * tree's offset up to the main tree.
+ */
+static int
+__nextTree(void *data, const char **key, offset_t *offset)
+{
+	DbRebuildIter *iter = (DbRebuildIter *)data;
+	DbRebuildIter subIter;
+	BTree *tree;
+
+	if (iter->index >= iter->end)
+		return 0;
+
+	subIter.db    = iter->db;
+	subIter.list  = iter->list;
+	subIter.index = iter->index;
+	subIter.end   = __findRunEnd(iter);
+
+	tree = btreeCreate(iter->db, 5);
+
+	if (tree == NULL)
+	{
+		pmError(PM_ERROR_FATAL,
+				_("GNUpdate DB: "
+				  "Unable to create index tree in %s, line %d\n"),
+				__FILE__, __LINE__);
+		abort();
+	}
+
+	btreeBulkLoad(tree, __nextSubEntry, &subIter, DB_REBUILD_FILL_FACTOR);
+
+	*key    = iter->list->entries[iter->index].key;
+	*offset = tree->block->offset;
+
+	btreeClose(tree);
+
+	iter->index = subIter.end;
+
+	return 1;
+}
+
+/*
+ * Replaces an index file with an empty one, and fills it from a list.
+ */
+static GDatabase *
+__rebuildIndex(GDatabase *db, DbRebuildList *list, BTreeLoadFunc next)
+{
+	DbRebuildIter iter;
+	GdbJournal *journal;
+	char *filename;
+	char hasBloom;
+	unsigned short pageSize;
+
+	filename = strdup(db->filename);
+	journal  = db->journal;
+	hasBloom = (db->bloom != NULL);
+	pageSize = db->pageSize;
+
+	gdbClose(db);
+
+	/* Indexes in the old format are moved to the current one. */
+	if (pageSize != 0)
+		db = gdbCreatePaged(filename, GDB_INDEX_FILE, pageSize);
+	else
+		db = gdbCreate(filename, GDB_INDEX_FILE);
+
+	free(filename);
+
+	if (db == NULL)
+		return NULL;
+
+	/* The filter is filled as the tree is loaded. */
+	if (hasBloom)
+		gdbEnableBloom(db, list->count);
+
+	qsort(list->entries, list->count, sizeof(DbRebuildEntry),
+		  __compareEntries);
+
+	iter.db    = db;
+	iter.list  = list;
+	iter.index = 0;
+	iter.end   = list->count;
+
+	if (btreeBulkLoad(db->mainTree, next, &iter,
+					  DB_REBUILD_FILL_FACTOR) != GDB_SUCCESS)
+	{
+		gdbClose(db);
+
+		return NULL;
+	}
+
+	/* The new file is complete, so only later changes are journaled. */
+	if (journal != NULL)
+		gdbJournalAttach(journal, db);
+
+	return db;
+}
+
+/*
+ * Copies a chain of file or dependency hashtables into another
+ * database, and returns the offset of the new first table.
+ */
+static offset_t
+__copyChain(GDatabase *srcDb, GDatabase *destDb, offset_t offset)
+{
+	GdbHashTable *table, *newTable, *prevTable = NULL;
+	offset_t      nextOffset, firstOffset = 0;
+
+	for (; offset != 0; offset = nextOffset)
+	{
+		table = htOpen(srcDb, offset);
+
+		if (table == NULL)
+		{
+			pmError(PM_ERROR_FATAL,
+					_("GNUpdate DB: "
+					  "Unable to open hashtable at %ld in %s, line %d\n"),
+					offset, __FILE__, __LINE__);
+			abort();
+		}
+
+		nextOffset = table->block->listNext;
+
+		newTable = htCopy(table, destDb);
+
+		gdbDestroyBlock(table->block);
+
+		gdbWriteBlock(newTable->block);
+
+		if (prevTable != NULL)
+		{
+			prevTable->block->listNext = newTable->block->offset;
+
+			GDB_SET_DIRTY(prevTable->block);
+
+			gdbWriteBlockHeader(prevTable->block);
+
+			gdbDestroyBlock(prevTable->block);
+		}
+		else
+			firstOffset = newTable->block->offset;
+
+		prevTable = newTable;
+	}
+
+	if (prevTable != NULL)
+		gdbDestroyBlock(prevTable->block);
+
+	return firstOffset;
+}
+
+/*
+ * Rewrites the package data file into a new file, and puts it in place
+ * of the old one. Packages are written in the order of the main tree,
+ * each one after its files and dependencies, with every block chain in
+ * one piece. The main tree is loaded last, so its nodes end up together
+ * too. Files in the old format are moved to the current one.
+ *
+ * The old file is read through a snapshot where there can be one, and
+ * is only replaced once the new one is complete. The package offsets
+ * all change, so the indexes must be rebuilt afterward.
+ */
+static void
+__compactPackages(DbData *data)
+{
+	GDatabase      *newDb;
+	GdbSnapshot    *snapshot;
+	BTree          *tree;
+	BTreeTraversal *trav;
+	GdbHashTable   *table, *newTable;
+	DbRebuildList   packages;
+	DbRebuildIter   iter;
+	offset_t        offset, chainOffset;
+	char           *filename, *newFilename;
+	unsigned short  pageSize;
+	static const GdbTag chainTags[] =
+	{
+		GDBTAG_FILES, GDBTAG_REQ_DEPS, GDBTAG_PROV_DEPS
+	};
+	int i;
+
+	filename = strdup(data->packageDb->filename);
+
+	MEM_CHECK(newFilename = (char *)malloc(strlen(filename) + 5));
+	sprintf(newFilename, "%s.new", filename);
+
+	unlink(newFilename);
+
+	pageSize = data->packageDb->pageSize;
+
+	if (pageSize != 0)
+		newDb = gdbCreatePaged(newFilename, GDB_DATA_FILE, pageSize);
+	else
+		newDb = gdbCreate(newFilename, GDB_DATA_FILE);
+
+	if (newDb == NULL)
+	{
+		pmError(PM_ERROR_FATAL,
+				_("GNUpdate DB: Unable to create %s in %s, line %d\n"),
+				newFilename, __FILE__, __LINE__);
+		exit(1);
+	}
+
+	memset(&packages, 0, sizeof(DbRebuildList));
+
+	tree     = data->packageDb->mainTree;
+	snapshot = gdbPinSnapshot(data->packageDb);
+
+	if (snapshot != NULL)
+		tree = btreeOpenSnapshot(snapshot, tree->block->offset);
+
+	trav = btreeInitTraversal(tree);
+
+	for (offset = btreeGetFirstOffset(trav);
+		 offset != (offset_t)-1;
+		 offset = btreeGetNextOffset(trav))
+	{
+		table = htOpen(data->packageDb, offset);
+
+		if (table == NULL)
+		{
+			pmError(PM_ERROR_FATAL,
+					_("GNUpdate DB: "
+					  "Unable to open package table at %ld in %s, line %d\n"),
+					offset, __FILE__, __LINE__);
+			exit(1);
+		}
+
+		newTable = htCopy(table, newDb);
+
+		for (i = 0; i < sizeof(chainTags) / sizeof(*chainTags); i++)
+		{
+			if ((chainOffset = htGetOffset(table, chainTags[i])) == 0)
+				continue;
+
+			htAddOffset(newTable, chainTags[i],
+						__copyChain(data->packageDb, newDb, chainOffset));
+		}
+
+		gdbWriteBlock(newTable->block);
+
+		__addEntry(&packages, strdup(btreeGetTraversalKey(trav)), NULL,
+				   newTable->block->offset);
+
+		gdbDestroyBlock(newTable->block);
+		gdbDestroyBlock(table->block);
+	}
+
+	btreeDestroyTraversal(trav);
+
+	if (snapshot != NULL)
+	{
+		btreeClose(tree);
+		gdbUnpinSnapshot(snapshot);
+	}
+
+	/* The traversal handed the keys over in order. */
+	iter.db    = newDb;
+	iter.list  = &packages;
+	iter.index = 0;
+	iter.end   = packages.count;
+
+	if (btreeBulkLoad(newDb->mainTree, __nextEntry, &iter,
+					  DB_REBUILD_FILL_FACTOR) != GDB_SUCCESS)
+	{
+		pmError(PM_ERROR_FATAL,
+				_("GNUpdate DB: Unable to fill %s in %s, line %d\n"),
+				newFilename, __FILE__, __LINE__);
+		exit(1);
+	}
+
+	__destroyList(&packages);
+
+	gdbClose(newDb);
+	gdbClose(data->packageDb);
+
+	if (rename(newFilename, filename) != 0)
+	{
+		pmError(PM_ERROR_FATAL,
+				_("GNUpdate DB: "
+				  "Unable to rename %s to %s in %s, line %d\n"),
+				newFilename, filename, __FILE__, __LINE__);
+		exit(1);
+	}
+
+	data->packageDb = gdbOpen(filename, GDB_DATA_FILE, PM_MODE_READ_WRITE);
+
+	if (data->packageDb == NULL)
+	{
+		pmError(PM_ERROR_FATAL,
+				_("GNUpdate DB: Unable to open %s in %s, line %d\n"),
+				filename, __FILE__, __LINE__);
+		exit(1);
+	}
+
+	if (data->journal != NULL)
+		gdbJournalAttach(data->journal, data->packageDb);
+
+	free(newFilename);
+	free(filename);
+}
+
+PmStatus
+dbRebuild(PmDatabase *db)
+{
+	DbData         *data;
+	DbRebuildList   names, files, groups, reqDeps, provDeps, graph;
+	BTreeTraversal *trav;
+	GdbHashTable   *table;
+	PmStatus        status = PM_SUCCESS;
+	offset_t        offset;
+	unsigned long   i;
+	char           *name, *group;
+
+	if (pmGetDbAccessMode(db) != PM_MODE_READ_WRITE)
+		return PM_FAILED;
+
+	data = (DbData *)db->db;
+
+	memset(&names,    0, sizeof(DbRebuildList));
+	memset(&files,    0, sizeof(DbRebuildList));
+	memset(&groups,   0, sizeof(DbRebuildList));
+	memset(&reqDeps,  0, sizeof(DbRebuildList));
+	memset(&provDeps, 0, sizeof(DbRebuildList));
+	memset(&graph,    0, sizeof(DbRebuildList));
+
+	/*
+	 * The data file is compacted first, so the indexes are rebuilt
+	 * against the new package offsets.
+	 */
+	__compactPackages(data);
+
+	/* Gather every index entry from the package data file. */
+	trav = btreeInitTraversal(data->packageDb->mainTree);
+
+	for (offset = btreeGetFirstOffset(trav);
+		 offset != (offset_t)-1;
+		 offset = btreeGetNextOffset(trav))
+	{
+		table = htOpen(data->packageDb, offset);
+
+		if (table == NULL)
+		{
+			pmError(PM_ERROR_FATAL,
+					_("GNUpdate DB: "
+					  "Unable to open package table at %ld in %s, line %d\n"),
+					offset, __FILE__, __LINE__);
+			exit(1);
+		}
+
+		if ((name = htGetString(table, GDBTAG_NAME)) == NULL)
+		{
+			gdbDestroyBlock(table->block);
+			continue;
+		}
+
+		if ((group = htGetString(table, GDBTAG_GROUP)) != NULL)
+			__addEntry(&groups, group, name, offset);
+
+		__addChain(data, &files,    table, GDBTAG_FILES,     NULL, offset);
+		__addChain(data, &reqDeps,  table, GDBTAG_REQ_DEPS,  name, offset);
+		__addChain(data, &provDeps, table, GDBTAG_PROV_DEPS, name, offset);
+
+		__addEntry(&names, name, NULL, offset);
+
+		gdbDestroyBlock(table->block);
+	}
+
+	btreeDestroyTraversal(trav);
+
+	if ((data->namesIndex = __rebuildIndex(data->namesIndex, &names,
+										   __nextEntry)) == NULL ||
+		(data->filesIndex = __rebuildIndex(data->filesIndex, &files,
+										   __nextFile)) == NULL ||
+		(data->groupsIndex = __rebuildIndex(data->groupsIndex, &groups,
+											__nextTree)) == NULL ||
+		(data->reqDepsIndex = __rebuildIndex(data->reqDepsIndex, &reqDeps,
+											 __nextTree)) == NULL ||
+		(data->provDepsIndex = __rebuildIndex(data->provDepsIndex, &provDeps,
+											  __nextTree)) == NULL ||
+		(data->graphIndex = __rebuildIndex(data->graphIndex, &graph,
+										   __nextEntry)) == NULL)
+	{
+		status = PM_FAILED;
+	}
+
+	/*
+	 * The graph starts out empty. Every package links itself to what it
+	 * requires. That also links each package to what requires it.
+	 */
+	if (status == PM_SUCCESS)
+	{
+		for (i = 0; i < names.count; i++)
+			dbLinkPackage(data, names.entries[i].offset, 0);
+	}
+
+	/* What was written since the files were rebuilt goes in as one. */
+	if (status == PM_SUCCESS &&
+		gdbJournalCommit(data->journal) != GDB_SUCCESS)
+	{
+		status = PM_FAILED;
+	}
+
+	__destroyList(&names);
+	__destroyList(&files);
+	__destroyList(&groups);
+	__destroyList(&reqDeps);
+	__destroyList(&provDeps);
+	__destroyList(&graph);
+
+	return status;
+}
@@ -31,9 +31,13 @@ __removeFromNames(PmDatabase *db, PmPackage *package, offset_t offset)
 	r = btreeDelete(dbData->namesIndex->mainTree, pmGetPackageName(package));
 
 	if (r == 0)
+	{
 		pmError(PM_ERROR_WARNING, "Unable to delete key from names.idx\n");
 
-	return PM_FAILED;
+		return PM_FAILED;
+	}
+
+	return PM_SUCCESS;
 }
 
 static PmStatus
@@ -101,25 +105,38 @@ dbRemovePackage(PmDatabase *db, PmPackage *pkg)
 	/*
 	 * The package was found.
 	 *
-	 * Start off by removing from indexes.
+	 * Nothing else depends on its graph edges, so it's unlinked from
+	 * the dependency graph first, as a transaction of its own.
 	 */
-	if ((status = __removeFromNames(db, pkg, offset)) != PM_SUCCESS)
-		return status;
-
-	if ((status = __removeFromProvDeps(db, pkg, offset)) != PM_SUCCESS)
-		return status;
-
-	if ((status = __removeFromReqDeps(db, pkg, offset)) != PM_SUCCESS)
-		return status;
+	dbUnlinkPackage(dbData, offset);
 
-	if ((status = __removeFromFiles(db, pkg, offset)) != PM_SUCCESS)
-		return status;
+	if (gdbJournalCommit(dbData->journal) != GDB_SUCCESS)
+		return PM_FAILED;
 
-	if ((status = __removeFromGroups(db, pkg, offset)) != PM_SUCCESS)
-		return status;
+	/*
+	 * Then it's removed from the indexes and the package data file. The
+	 * names entry goes last, so the package can still be found by name
+	 * until everything else is gone.
+	 */
+	if ((status = __removeFromProvDeps(db, pkg, offset)) == PM_SUCCESS &&
+		(status = __removeFromReqDeps(db, pkg, offset)) == PM_SUCCESS &&
+		(status = __removeFromFiles(db, pkg, offset)) == PM_SUCCESS &&
+		(status = __removeFromGroups(db, pkg, offset)) == PM_SUCCESS &&
+		(status = __removeFromPackages(db, pkg, offset)) == PM_SUCCESS)
+	{
+		status = __removeFromNames(db, pkg, offset);
+	}
 
-	if ((status = __removeFromPackages(db, pkg, offset)) != PM_SUCCESS)
-		return status;
+	/*
+	 * Only a complete removal is committed, as one transaction. A partial
+	 * one never reaches the journal, and is thrown away when the files
+	 * are closed.
+	 */
+	if (status == PM_SUCCESS &&
+		gdbJournalCommit(dbData->journal) != GDB_SUCCESS)
+	{
+		status = PM_FAILED;
+	}
 
-	return PM_SUCCESS;
+	return status;
 }
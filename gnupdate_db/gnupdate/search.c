@@ -20,6 +20,8 @@
  */
 #include "gnupdate.h"
 
+#include <fnmatch.h>
+
 DbMatchData *
 newMatchData(PmPackage *(*firstPackage)(PmDatabase *db, DbMatchData *data),
 			 PmPackage *(*nextPackage)(PmDatabase *db, DbMatchData *data),
@@ -50,6 +52,85 @@ destroyMatchData(DbMatchData *data)
 	free(data);
 }
 
+DbPatternData *
+newPatternData(BTree *tree, const char *prefix, const char *pattern, int flags)
+{
+	DbPatternData *data;
+
+	MEM_CHECK(data = (DbPatternData *)malloc(sizeof(DbPatternData)));
+
+	/*
+	 * Search a snapshot of the index where there can be one, so a
+	 * package being installed doesn't hold up, or show up halfway in,
+	 * the results.
+	 */
+	data->snapshot = gdbPinSnapshot(tree->block->db);
+	data->tree     = NULL;
+
+	if (data->snapshot != NULL)
+	{
+		data->tree = btreeOpenSnapshot(data->snapshot, tree->block->offset);
+		tree       = data->tree;
+	}
+
+	data->trav    = btreeInitPrefixTraversal(tree, prefix);
+	data->pattern = (pattern == NULL ? NULL : strdup(pattern));
+	data->flags   = flags;
+
+	return data;
+}
+
+/*
+ * Skips over keys that have the prefix but don't match the pattern.
+ */
+static offset_t
+__findPatternMatch(DbPatternData *data, offset_t offset)
+{
+	if (data->pattern == NULL)
+		return offset;
+
+	while (offset != -1 &&
+		   fnmatch(data->pattern, btreeGetTraversalKey(data->trav),
+				   data->flags) != 0)
+	{
+		offset = btreeGetNextOffset(data->trav);
+	}
+
+	return offset;
+}
+
+offset_t
+getFirstPatternOffset(DbPatternData *data)
+{
+	return __findPatternMatch(data, btreeGetFirstOffset(data->trav));
+}
+
+offset_t
+getNextPatternOffset(DbPatternData *data)
+{
+	return __findPatternMatch(data, btreeGetNextOffset(data->trav));
+}
+
+void
+destroyPatternData(DbPatternData *data)
+{
+	if (data == NULL)
+		return;
+
+	btreeDestroyTraversal(data->trav);
+
+	if (data->tree != NULL)
+		btreeClose(data->tree);
+
+	if (data->snapshot != NULL)
+		gdbUnpinSnapshot(data->snapshot);
+
+	if (data->pattern != NULL)
+		free(data->pattern);
+
+	free(data);
+}
+
 PmStatus
 dbFindByConflicts(PmDatabase *db, const char *name, PmMatches *matches)
 {
@@ -20,81 +20,260 @@
  */
 #include "gnupdate.h"
 
-static PmPackage *
-__firstListPackage(PmDatabase *db, DbMatchData *data)
+#include <fnmatch.h>
+
+/*
+ * How many package tables to read at a time. Each batch is read in
+ * file order.
+ */
+#define DB_MATCH_BATCH_SIZE 256
+
+/*
+ * The packages owning any of a set of files.
+ */
+typedef struct
 {
-	offset_t offset;
-	GdbOffsetList *list;
+	offset_t      *offsets;
+	GdbHashTable **tables;   /* Tables read so far, up to loaded. */
+	unsigned long  count;
+	unsigned long  size;
+	unsigned long  index;
+	unsigned long  loaded;
 
-	list = (GdbOffsetList *)data->data;
+} DbFileMatches;
 
-	offset = olGetOffset(list, data->index++);
+static PmPackage *
+__firstNodePackage(PmDatabase *db, DbMatchData *data)
+{
+	offset_t offset;
 
-	/* Extra precaution. */
-	if (offset == 0)
-		return NULL;
+	offset = (offset_t)data->data;
 
 	return dbReadPackage(db, offset);
 }
 
 static PmPackage *
-__nextListPackage(PmDatabase *db, DbMatchData *data)
+__nextNodePackage(PmDatabase *db, DbMatchData *data)
 {
-	offset_t offset;
-	GdbOffsetList *list;
+	return NULL;
+}
 
-	list = (GdbOffsetList *)data->data;
+static void
+__destroyNodeData(DbMatchData *data)
+{
+}
 
-	offset = olGetOffset(list, data->index++);
+/* Frees the tables read ahead but not handed out. */
+static void
+__releaseFilesTables(DbFileMatches *files)
+{
+	unsigned long i;
 
-	if (offset == 0)
-		return NULL;
+	for (i = files->index; i < files->loaded; i++)
+	{
+		if (files->tables[i] != NULL)
+			gdbDestroyBlock(files->tables[i]->block);
 
-	return dbReadPackage(db, offset);
+		files->tables[i] = NULL;
+	}
+
+	files->loaded = files->index;
 }
 
-static void
-__destroyListData(DbMatchData *data)
+static PmPackage *
+__nextFilesPackage(PmDatabase *db, DbMatchData *data)
 {
-	GdbOffsetList *list;
-	
-	list = (GdbOffsetList *)data->data;
-	
-	olClose(list);
+	DbFileMatches *files = (DbFileMatches *)data->data;
+	GdbHashTable  *table;
+	unsigned long  count;
+
+	if (files->index >= files->count)
+		return NULL;
+
+	if (files->index >= files->loaded)
+	{
+		if (files->tables == NULL)
+		{
+			MEM_CHECK(files->tables = (GdbHashTable **)calloc(files->count,
+					  sizeof(GdbHashTable *)));
+		}
+
+		count = files->count - files->index;
+
+		if (count > DB_MATCH_BATCH_SIZE)
+			count = DB_MATCH_BATCH_SIZE;
+
+		dbReadPackageTables(db, files->offsets + files->index, count,
+							files->tables + files->index);
+
+		files->loaded = files->index + count;
+	}
+
+	table = files->tables[files->index];
+	files->tables[files->index++] = NULL;
+
+	return dbMakePackage(table);
 }
 
 static PmPackage *
-__firstNodePackage(PmDatabase *db, DbMatchData *data)
+__firstFilesPackage(PmDatabase *db, DbMatchData *data)
 {
-	offset_t offset;
+	DbFileMatches *files = (DbFileMatches *)data->data;
 
-	offset = (offset_t)data->data;
+	__releaseFilesTables(files);
 
-	return dbReadPackage(db, offset);
+	files->index  = 0;
+	files->loaded = 0;
+
+	return __nextFilesPackage(db, data);
 }
 
-static PmPackage *
-__nextNodePackage(PmDatabase *db, DbMatchData *data)
+static void
+__destroyFilesData(DbMatchData *data)
 {
-	return NULL;
+	DbFileMatches *files = (DbFileMatches *)data->data;
+
+	if (files->tables != NULL)
+	{
+		__releaseFilesTables(files);
+		free(files->tables);
+	}
+
+	if (files->offsets != NULL)
+		free(files->offsets);
+
+	free(files);
 }
 
 static void
-__destroyNodeData(DbMatchData *data)
+__addFilesPackage(DbFileMatches *files, offset_t offset)
 {
+	if (files->count == files->size)
+	{
+		files->size = (files->size == 0 ? 32 : files->size * 2);
+
+		MEM_CHECK(files->offsets = (offset_t *)realloc(files->offsets,
+				  files->size * sizeof(offset_t)));
+	}
+
+	files->offsets[files->count++] = offset;
+}
+
+static int
+__compareOffsets(const void *a, const void *b)
+{
+	offset_t offset1 = *(const offset_t *)a;
+	offset_t offset2 = *(const offset_t *)b;
+
+	return (offset1 < offset2 ? -1 : offset1 > offset2);
+}
+
+/*
+ * Finds the packages owning any file matching a pattern, or any file
+ * under a directory if pattern is NULL. Packages usually own several
+ * matching files, so they're gathered up front and repeats dropped.
+ */
+static PmStatus
+__findByPattern(PmDatabase *db, const char *prefix, const char *pattern,
+				PmMatches *matches)
+{
+	DbPatternData *patternData;
+	DbFileMatches *files;
+	GdbOffsetList *list;
+	DbMatchData   *data;
+	DbData        *dbData;
+	offset_t       offset;
+	unsigned long  i, j;
+	unsigned short k;
+
+	dbData = (DbData *)db->db;
+
+	MEM_CHECK(files = (DbFileMatches *)malloc(sizeof(DbFileMatches)));
+	memset(files, 0, sizeof(DbFileMatches));
+
+	patternData = newPatternData(dbData->filesIndex->mainTree, prefix,
+								 pattern, FNM_PATHNAME);
+
+	for (offset = getFirstPatternOffset(patternData);
+		 offset != -1;
+		 offset = getNextPatternOffset(patternData))
+	{
+		if (gdbBlockTypeAt(dbData->filesIndex, offset) != GDB_BLOCK_OFFSET_LIST)
+		{
+			__addFilesPackage(files, offset);
+			continue;
+		}
+
+		list = olOpen(dbData->filesIndex, offset);
+
+		if (list == NULL)
+			continue;
+
+		for (k = 0; k < olGetCount(list); k++)
+			__addFilesPackage(files, olGetOffset(list, k));
+
+		olClose(list);
+	}
+
+	destroyPatternData(patternData);
+
+	if (files->count == 0)
+	{
+		free(files);
+
+		return PM_FAILED; /* Not found. */
+	}
+
+	qsort(files->offsets, files->count, sizeof(offset_t), __compareOffsets);
+
+	for (i = 1, j = 1; i < files->count; i++)
+	{
+		if (files->offsets[i] != files->offsets[j - 1])
+			files->offsets[j++] = files->offsets[i];
+	}
+
+	files->count = j;
+
+	data = newMatchData(__firstFilesPackage, __nextFilesPackage,
+						__destroyFilesData);
+	matches->matches = data;
+
+	data->data = files;
+
+	return PM_SUCCESS;
 }
 
 PmStatus
 dbFindByFile(PmDatabase *db, const char *file, PmMatches *matches)
 {
+	DbFileMatches *files;
 	GdbOffsetList *list;
 	DbMatchData   *data;
 	DbData        *dbData;
 	offset_t       offset;
 	blocktype_t    type;
+	PmStatus       status;
+	char          *prefix;
+	size_t         len;
+	unsigned short k;
 
 	dbData = (DbData *)db->db;
 
+	/* A directory matches every file under it. */
+	len = strlen(file);
+
+	if (len > 0 && file[len - 1] == '/')
+		return __findByPattern(db, file, NULL, matches);
+
+	if ((prefix = dbGetGlobPrefix(file)) != NULL)
+	{
+		status = __findByPattern(db, prefix, file, matches);
+
+		free(prefix);
+
+		return status;
+	}
+
 	/* Search for the file. */
 	offset = btreeSearch(dbData->filesIndex->mainTree, file);
 
@@ -117,10 +296,19 @@ dbFindByFile(PmDatabase *db, const char *file, PmMatches *matches)
 			return PM_FAILED;
 		}
 
-		data = newMatchData(__firstListPackage, __nextListPackage,
-							__destroyListData);
+		/* Read the owners together, keeping the list's order. */
+		MEM_CHECK(files = (DbFileMatches *)malloc(sizeof(DbFileMatches)));
+		memset(files, 0, sizeof(DbFileMatches));
+
+		for (k = 0; k < olGetCount(list); k++)
+			__addFilesPackage(files, olGetOffset(list, k));
+
+		olClose(list);
+
+		data = newMatchData(__firstFilesPackage, __nextFilesPackage,
+							__destroyFilesData);
 
-		data->data = list;
+		data->data = files;
 	}
 	else
 	{
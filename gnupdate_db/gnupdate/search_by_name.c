@@ -37,15 +37,72 @@ __destroyData(DbMatchData *data)
 {
 }
 
+static PmPackage *
+__firstPatternPackage(PmDatabase *db, DbMatchData *data)
+{
+	offset_t offset;
+
+	offset = getFirstPatternOffset((DbPatternData *)data->data);
+
+	if (offset == -1)
+		return NULL;
+
+	return dbReadPackage(db, offset);
+}
+
+static PmPackage *
+__nextPatternPackage(PmDatabase *db, DbMatchData *data)
+{
+	offset_t offset;
+
+	offset = getNextPatternOffset((DbPatternData *)data->data);
+
+	if (offset == -1)
+		return NULL;
+
+	return dbReadPackage(db, offset);
+}
+
+static void
+__destroyPatternData(DbMatchData *data)
+{
+	destroyPatternData((DbPatternData *)data->data);
+}
+
 PmStatus
 dbFindByName(PmDatabase *db, const char *name, PmMatches *matches)
 {
+	DbPatternData *pattern;
 	DbMatchData *data;
 	DbData *dbData;
 	offset_t offset;
+	char *prefix;
 
 	dbData = (DbData *)db->db;
-	
+
+	/* Glob patterns only need to look at names with the same prefix. */
+	if ((prefix = dbGetGlobPrefix(name)) != NULL)
+	{
+		pattern = newPatternData(dbData->namesIndex->mainTree, prefix, name, 0);
+
+		free(prefix);
+
+		if (getFirstPatternOffset(pattern) == -1)
+		{
+			destroyPatternData(pattern);
+
+			return PM_FAILED; /* Not found. */
+		}
+
+		data = newMatchData(__firstPatternPackage, __nextPatternPackage,
+							__destroyPatternData);
+		matches->matches = data;
+
+		data->data = pattern;
+
+		return PM_SUCCESS;
+	}
+
 	/* Search for the name. */
 	offset = btreeSearch(dbData->namesIndex->mainTree, name);
 
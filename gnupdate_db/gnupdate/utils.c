@@ -56,6 +56,29 @@ dbPackTimestamp(void)
 	return str;
 }
 
+/*
+ * Returns the part of a glob pattern before the first special
+ * character, or NULL if there are none.
+ */
+char *
+dbGetGlobPrefix(const char *pattern)
+{
+	char *prefix;
+	size_t len;
+
+	len = strcspn(pattern, "*?[\\");
+
+	if (pattern[len] == '\0')
+		return NULL;
+
+	MEM_CHECK(prefix = (char *)malloc(len + 1));
+
+	memcpy(prefix, pattern, len);
+	prefix[len] = '\0';
+
+	return prefix;
+}
+
 #if 0
 static BTree *
 __getDbTree(BTree *tree, GdbTag tag)
@@ -80,10 +103,7 @@ PmPackage *
 dbReadPackage(PmDatabase *db, offset_t offset)
 {
 	GdbHashTable *table;
-	PmPackage    *package;
 	DbData       *data;
-	char         *str;
-	long          l;
 
 	data = (DbData *)db->db;
 
@@ -98,6 +118,41 @@ dbReadPackage(PmDatabase *db, offset_t offset)
 		exit(1);
 	}
 
+	return dbMakePackage(table);
+}
+
+void
+dbReadPackageTables(PmDatabase *db, const offset_t *offsets,
+					unsigned long count, GdbHashTable **tables)
+{
+	DbData       *data;
+	unsigned long i;
+
+	data = (DbData *)db->db;
+
+	if (htOpenMany(data->packageDb, offsets, count, tables) == count)
+		return;
+
+	for (i = 0; i < count; i++)
+	{
+		if (tables[i] == NULL)
+		{
+			pmError(PM_ERROR_FATAL,
+					_("GNUpdate DB: "
+					  "Unable to open package table at %ld in %s, line %d\n"),
+					offsets[i], __FILE__, __LINE__);
+			exit(1);
+		}
+	}
+}
+
+PmPackage *
+dbMakePackage(GdbHashTable *table)
+{
+	PmPackage    *package;
+	char         *str;
+	long          l;
+
 	package = pmNewPackage();
 
 	PM_PACKAGE_DB_DATA(package) = table;
@@ -215,6 +215,36 @@ char* leveldb_get(
   return result;
 }
 
+void leveldb_multiget(
+    leveldb_t* db,
+    const leveldb_readoptions_t* options,
+    size_t num_keys,
+    const char* const* keys_list,
+    const size_t* keys_list_sizes,
+    char** values_list,
+    size_t* values_list_sizes,
+    char** errptr) {
+  std::vector<Slice> keys(num_keys);
+  for (size_t i = 0; i < num_keys; i++) {
+    keys[i] = Slice(keys_list[i], keys_list_sizes[i]);
+  }
+  std::vector<std::string> values;
+  std::vector<Status> statuses;
+  db->rep->MultiGet(options->rep, keys, &values, &statuses);
+  for (size_t i = 0; i < num_keys; i++) {
+    if (statuses[i].ok()) {
+      values_list_sizes[i] = values[i].size();
+      values_list[i] = CopyString(values[i]);
+    } else {
+      values_list_sizes[i] = 0;
+      values_list[i] = NULL;
+      if (!statuses[i].IsNotFound()) {
+        SaveError(errptr, statuses[i]);
+      }
+    }
+  }
+}
+
 leveldb_iterator_t* leveldb_create_iterator(
     leveldb_t* db,
     const leveldb_readoptions_t* options) {
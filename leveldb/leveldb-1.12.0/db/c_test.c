@@ -251,6 +251,23 @@ int main(int argc, char** argv) {
     leveldb_writebatch_destroy(wb);
   }
 
+  StartPhase("multiget");
+  {
+    const char* keys[4] = { "box", "foo", "notfound", "bar" };
+    const size_t keys_sizes[4] = { 3, 3, 8, 3 };
+    char* vals[4];
+    size_t vals_sizes[4];
+    leveldb_multiget(db, roptions, 4, keys, keys_sizes, vals, vals_sizes,
+                     &err);
+    CheckNoError(err);
+    CheckEqual("c", vals[0], vals_sizes[0]);
+    CheckEqual("hello", vals[1], vals_sizes[1]);
+    CheckEqual(NULL, vals[2], vals_sizes[2]);
+    CheckEqual(NULL, vals[3], vals_sizes[3]);
+    Free(&vals[0]);
+    Free(&vals[1]);
+  }
+
   StartPhase("iter");
   {
     leveldb_iterator_t* iter = leveldb_create_iterator(db, roptions);
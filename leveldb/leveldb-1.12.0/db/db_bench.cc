@@ -30,9 +30,12 @@
 //      readseq       -- read N times sequentially
 //      readreverse   -- read N times in reverse order
 //      readrandom    -- read N times in random order
+//      multireadrandom -- read N times in random order, in MultiGet() batches
 //      readmissing   -- read N missing keys in random order
 //      readhot       -- read N times in random order from 1% section of DB
 //      seekrandom    -- N random seeks
+//      seekprefix    -- N random seeks, each reading all keys that share
+//                       the first --prefix_size bytes of the sought key
 //      crc32c        -- repeated crc32c of 4K of data
 //      acquireload   -- load N*1000 times
 //   Meta operations:
@@ -87,6 +90,17 @@ static int FLAGS_write_buffer_size = 0;
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
 
+// Number of bytes to use as a cache of blocks as stored in the files.
+// Negative means no such cache.
+static int FLAGS_compressed_cache_size = -1;
+
+// If true, keep index blocks and filters in the block cache, and pin
+// those of level-0 tables
+static bool FLAGS_cache_index_and_filter_blocks = false;
+
+// If true, use the CLOCK cache instead of the LRU cache
+static bool FLAGS_clock_cache = false;
+
 // Maximum number of files to keep open at the same time (use default if == 0)
 static int FLAGS_open_files = 0;
 
@@ -94,6 +108,33 @@ static int FLAGS_open_files = 0;
 // Negative means use default settings.
 static int FLAGS_bloom_bits = -1;
 
+// If true, use the cache-line-blocked bloom filter
+static bool FLAGS_blocked_bloom = false;
+
+// If true, build one filter per table instead of one per 2KB of blocks
+static bool FLAGS_full_file_filter = false;
+
+// Maximum number of compactions to run at the same time
+static int FLAGS_max_background_compactions = 0;
+
+// Maximum number of threads to split a single compaction into
+static int FLAGS_max_subcompactions = 0;
+
+// If true, writers in a group insert their batches into the memtable
+// in parallel
+static bool FLAGS_concurrent_memtable_write = false;
+
+// If true, overlap log writes with memtable inserts of the previous group
+static bool FLAGS_pipelined_write = false;
+
+// Number of keys per MultiGet() call in multireadrandom
+static int FLAGS_multiget_batch = 100;
+
+// If positive, add the first this many bytes of each key to the bloom
+// filters as its prefix (requires --bloom_bits), and scan that many
+// leading bytes in seekprefix
+static int FLAGS_prefix_size = 0;
+
 // If true, do not destroy the existing database.  If you set this
 // flag and also specify a benchmark that wants a fresh database, that
 // benchmark will fail.
@@ -302,7 +343,9 @@ struct ThreadState {
 class Benchmark {
  private:
   Cache* cache_;
+  Cache* compressed_cache_;
   const FilterPolicy* filter_policy_;
+  const PrefixExtractor* prefix_extractor_;
   DB* db_;
   int num_;
   int value_size_;
@@ -387,10 +430,19 @@ class Benchmark {
 
  public:
   Benchmark()
-  : cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : NULL),
-    filter_policy_(FLAGS_bloom_bits >= 0
-                   ? NewBloomFilterPolicy(FLAGS_bloom_bits)
-                   : NULL),
+  : cache_(FLAGS_cache_size < 0 ? NULL
+           : FLAGS_clock_cache
+           ? NewClockCache(FLAGS_cache_size, Options().block_size)
+           : NewLRUCache(FLAGS_cache_size)),
+    compressed_cache_(FLAGS_compressed_cache_size < 0 ? NULL
+                      : NewLRUCache(FLAGS_compressed_cache_size)),
+    filter_policy_(FLAGS_bloom_bits < 0 ? NULL
+                   : FLAGS_blocked_bloom
+                   ? NewBlockedBloomFilterPolicy(FLAGS_bloom_bits)
+                   : NewBloomFilterPolicy(FLAGS_bloom_bits)),
+    prefix_extractor_(FLAGS_prefix_size > 0
+                      ? NewFixedPrefixExtractor(FLAGS_prefix_size)
+                      : NULL),
     db_(NULL),
     num_(FLAGS_num),
     value_size_(FLAGS_value_size),
@@ -412,7 +464,9 @@ class Benchmark {
   ~Benchmark() {
     delete db_;
     delete cache_;
+    delete compressed_cache_;
     delete filter_policy_;
+    delete prefix_extractor_;
   }
 
   void Run() {
@@ -471,10 +525,14 @@ class Benchmark {
         method = &Benchmark::ReadReverse;
       } else if (name == Slice("readrandom")) {
         method = &Benchmark::ReadRandom;
+      } else if (name == Slice("multireadrandom")) {
+        method = &Benchmark::MultiReadRandom;
       } else if (name == Slice("readmissing")) {
         method = &Benchmark::ReadMissing;
       } else if (name == Slice("seekrandom")) {
         method = &Benchmark::SeekRandom;
+      } else if (name == Slice("seekprefix")) {
+        method = &Benchmark::SeekPrefix;
       } else if (name == Slice("readhot")) {
         method = &Benchmark::ReadHot;
       } else if (name == Slice("readrandomsmall")) {
@@ -692,9 +750,20 @@ class Benchmark {
     Options options;
     options.create_if_missing = !FLAGS_use_existing_db;
     options.block_cache = cache_;
+    options.compressed_block_cache = compressed_cache_;
+    options.cache_index_and_filter_blocks =
+        FLAGS_cache_index_and_filter_blocks;
+    options.pin_l0_index_and_filter_blocks =
+        FLAGS_cache_index_and_filter_blocks;
     options.write_buffer_size = FLAGS_write_buffer_size;
     options.max_open_files = FLAGS_open_files;
     options.filter_policy = filter_policy_;
+    options.prefix_extractor = prefix_extractor_;
+    options.full_file_filter = FLAGS_full_file_filter;
+    options.max_background_compactions = FLAGS_max_background_compactions;
+    options.max_subcompactions = FLAGS_max_subcompactions;
+    options.allow_concurrent_memtable_write = FLAGS_concurrent_memtable_write;
+    options.enable_pipelined_write = FLAGS_pipelined_write;
     Status s = DB::Open(options, FLAGS_db, &db_);
     if (!s.ok()) {
       fprintf(stderr, "open error: %s\n", s.ToString().c_str());
@@ -784,6 +853,40 @@ class Benchmark {
     thread->stats.AddMessage(msg);
   }
 
+  void MultiReadRandom(ThreadState* thread) {
+    ReadOptions options;
+    std::vector<std::string> key_data(FLAGS_multiget_batch);
+    std::vector<Slice> keys(FLAGS_multiget_batch);
+    std::vector<std::string> values;
+    std::vector<Status> statuses;
+    int found = 0;
+    for (int i = 0; i < reads_; i += FLAGS_multiget_batch) {
+      int n = FLAGS_multiget_batch;
+      if (n > reads_ - i) {
+        n = reads_ - i;
+      }
+      key_data.resize(n);
+      keys.resize(n);
+      for (int j = 0; j < n; j++) {
+        char key[100];
+        const int k = thread->rand.Next() % FLAGS_num;
+        snprintf(key, sizeof(key), "%016d", k);
+        key_data[j] = key;
+        keys[j] = key_data[j];
+      }
+      db_->MultiGet(options, keys, &values, &statuses);
+      for (int j = 0; j < n; j++) {
+        if (statuses[j].ok()) {
+          found++;
+        }
+        thread->stats.FinishedSingleOp();
+      }
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d of %d found)", found, num_);
+    thread->stats.AddMessage(msg);
+  }
+
   void ReadMissing(ThreadState* thread) {
     ReadOptions options;
     std::string value;
@@ -828,6 +931,31 @@ class Benchmark {
     thread->stats.AddMessage(msg);
   }
 
+  void SeekPrefix(ThreadState* thread) {
+    if (prefix_extractor_ == NULL) {
+      thread->stats.AddMessage("(requires --prefix_size)");
+      return;
+    }
+    ReadOptions options;
+    options.prefix_same_as_start = true;
+    int found = 0;
+    for (int i = 0; i < reads_; i++) {
+      Iterator* iter = db_->NewIterator(options);
+      char key[100];
+      const int k = thread->rand.Next() % FLAGS_num;
+      snprintf(key, sizeof(key), "%016d", k);
+      for (iter->Seek(Slice(key, FLAGS_prefix_size)); iter->Valid();
+           iter->Next()) {
+        found++;
+      }
+      delete iter;
+      thread->stats.FinishedSingleOp();
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d keys found)", found);
+    thread->stats.AddMessage(msg);
+  }
+
   void DoDelete(ThreadState* thread, bool seq) {
     RandomGenerator gen;
     WriteBatch batch;
@@ -926,6 +1054,12 @@ class Benchmark {
 int main(int argc, char** argv) {
   FLAGS_write_buffer_size = leveldb::Options().write_buffer_size;
   FLAGS_open_files = leveldb::Options().max_open_files;
+  FLAGS_max_background_compactions =
+      leveldb::Options().max_background_compactions;
+  FLAGS_max_subcompactions = leveldb::Options().max_subcompactions;
+  FLAGS_concurrent_memtable_write =
+      leveldb::Options().allow_concurrent_memtable_write;
+  FLAGS_pipelined_write = leveldb::Options().enable_pipelined_write;
   std::string default_db_path;
 
   for (int i = 1; i < argc; i++) {
@@ -954,10 +1088,41 @@ int main(int argc, char** argv) {
       FLAGS_write_buffer_size = n;
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
+    } else if (sscanf(argv[i], "--compressed_cache_size=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_compressed_cache_size = n;
+    } else if (sscanf(argv[i], "--cache_index_and_filter_blocks=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_cache_index_and_filter_blocks = n;
+    } else if (sscanf(argv[i], "--clock_cache=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_clock_cache = n;
     } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
       FLAGS_bloom_bits = n;
+    } else if (sscanf(argv[i], "--blocked_bloom=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_blocked_bloom = n;
+    } else if (sscanf(argv[i], "--full_file_filter=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_full_file_filter = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
+    } else if (sscanf(argv[i], "--max_background_compactions=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_max_background_compactions = n;
+    } else if (sscanf(argv[i], "--max_subcompactions=%d%c", &n, &junk) == 1) {
+      FLAGS_max_subcompactions = n;
+    } else if (sscanf(argv[i], "--concurrent_memtable_write=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_concurrent_memtable_write = n;
+    } else if (sscanf(argv[i], "--pipelined_write=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_pipelined_write = n;
+    } else if (sscanf(argv[i], "--multiget_batch=%d%c", &n, &junk) == 1 &&
+               n > 0) {
+      FLAGS_multiget_batch = n;
+    } else if (sscanf(argv[i], "--prefix_size=%d%c", &n, &junk) == 1) {
+      FLAGS_prefix_size = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
       FLAGS_db = argv[i] + 5;
     } else {
@@ -43,11 +43,25 @@ struct DBImpl::Writer {
   WriteBatch* batch;
   bool sync;
   bool done;
+  WriteGroup* group;  // Non-NULL once a leader has taken this write
+  bool insert;        // Set when this writer should insert its own batch
   port::CondVar cv;
 
   explicit Writer(port::Mutex* mu) : cv(mu) { }
 };
 
+// A group of writes that a leader has appended to the log as one
+// record.  It lives on the leader's stack until the whole group is in
+// the memtable.
+struct DBImpl::WriteGroup {
+  Writer* leader;
+  std::vector<Writer*> writers;  // All members in queue order, incl. leader
+  MemTable* mem;                 // Memtable the group is inserted into
+  SequenceNumber last_sequence;  // Last sequence number used by the group
+  int pending;                   // Members still inserting their batches
+  Status status;
+};
+
 struct DBImpl::CompactionState {
   Compaction* const compaction;
 
@@ -71,16 +85,55 @@ struct DBImpl::CompactionState {
 
   uint64_t total_bytes;
 
+  // Key range of a subcompaction: the user keys after "begin" up to
+  // and including "end".  A side without its has_ flag is unbounded.
+  bool has_begin;
+  std::string begin;
+  bool has_end;
+  std::string end;
+
+  // Position of this range's keys among the grandparent files and the
+  // levels below the compaction
+  Compaction::KeyState key_state;
+
+  // Should the immutable memtable be flushed as soon as it shows up?
+  // Only ever set for one range, when there is no separate flush thread.
+  bool flush_imm;
+  int64_t imm_micros;  // Micros spent doing imm_ compactions
+
+  Status status;  // Result of a subcompaction
+
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
   explicit CompactionState(Compaction* c)
       : compaction(c),
         outfile(NULL),
         builder(NULL),
-        total_bytes(0) {
+        total_bytes(0),
+        has_begin(false),
+        has_end(false),
+        flush_imm(false),
+        imm_micros(0) {
   }
 };
 
+// A compaction picked for a background thread
+struct DBImpl::CompactionJob {
+  DBImpl* db;
+  Compaction* compaction;  // NULL if a manual compaction found nothing to do
+  bool is_manual;
+  InternalKey manual_end;  // Where the manual compaction will stop
+};
+
+// A subcompaction running in a thread of its own
+struct DBImpl::SubcompactionJob {
+  DBImpl* db;
+  CompactionState* compact;
+  port::Mutex* mu;
+  port::CondVar* cv;
+  int* pending;  // Subcompactions still running, protected by *mu
+};
+
 // Fix user-supplied options to be reasonable
 template <class T,class V>
 static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
@@ -90,13 +143,17 @@ static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
 Options SanitizeOptions(const std::string& dbname,
                         const InternalKeyComparator* icmp,
                         const InternalFilterPolicy* ipolicy,
+                        const InternalPrefixExtractor* iprefix,
                         const Options& src) {
   Options result = src;
   result.comparator = icmp;
   result.filter_policy = (src.filter_policy != NULL) ? ipolicy : NULL;
+  result.prefix_extractor = (src.prefix_extractor != NULL) ? iprefix : NULL;
   ClipToRange(&result.max_open_files,    64 + kNumNonTableCacheFiles, 50000);
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
+  ClipToRange(&result.max_background_compactions, 1,                   64);
+  ClipToRange(&result.max_subcompactions, 1,                          64);
   if (result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -117,8 +174,10 @@ DBImpl::DBImpl(const Options& options, const std::string& dbname)
     : env_(options.env),
       internal_comparator_(options.comparator),
       internal_filter_policy_(options.filter_policy),
-      options_(SanitizeOptions(
-          dbname, &internal_comparator_, &internal_filter_policy_, options)),
+      internal_prefix_extractor_(options.prefix_extractor),
+      options_(SanitizeOptions(dbname, &internal_comparator_,
+                               &internal_filter_policy_,
+                               &internal_prefix_extractor_, options)),
       owns_info_log_(options_.info_log != options.info_log),
       owns_cache_(options_.block_cache != options.block_cache),
       dbname_(dbname),
@@ -131,11 +190,21 @@ DBImpl::DBImpl(const Options& options, const std::string& dbname)
       logfile_number_(0),
       log_(NULL),
       tmp_batch_(new WriteBatch),
-      bg_compaction_scheduled_(false),
+      bg_compaction_scheduled_(0),
+      bg_flush_scheduled_(false),
+      manifest_writing_(false),
       manual_compaction_(NULL),
       consecutive_compaction_errors_(0) {
   mem_->Ref();
   has_imm_.Release_Store(NULL);
+  for (int level = 0; level < config::kNumLevels; level++) {
+    busy_levels_[level] = false;
+  }
+
+  if (options_.max_background_compactions > 1) {
+    env_->SetBackgroundThreads(options_.max_background_compactions, Env::LOW);
+    env_->SetBackgroundThreads(1, Env::HIGH);
+  }
 
   // Reserve ten files or so for other uses and give the rest to TableCache.
   const int table_cache_size = options.max_open_files - kNumNonTableCacheFiles;
@@ -149,7 +218,7 @@ DBImpl::~DBImpl() {
   // Wait for background work to finish
   mutex_.Lock();
   shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-  while (bg_compaction_scheduled_) {
+  while (bg_compaction_scheduled_ > 0 || bg_flush_scheduled_) {
     bg_cv_.Wait();
   }
   mutex_.Unlock();
@@ -426,7 +495,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
     }
 
     if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
-      status = WriteLevel0Table(mem, edit, NULL);
+      status = WriteLevel0Table(mem, edit, NULL, NULL);
       if (!status.ok()) {
         // Reflect errors immediately so that conditions like full
         // file-systems cause the DB::Open() to fail.
@@ -438,7 +507,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
   }
 
   if (status.ok() && mem != NULL) {
-    status = WriteLevel0Table(mem, edit, NULL);
+    status = WriteLevel0Table(mem, edit, NULL, NULL);
     // Reflect errors immediately so that conditions like full
     // file-systems cause the DB::Open() to fail.
   }
@@ -449,7 +518,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
 }
 
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
-                                Version* base) {
+                                Version* base, uint64_t* pending_number) {
   mutex_.AssertHeld();
   const uint64_t start_micros = env_->NowMicros();
   FileMetaData meta;
@@ -471,7 +540,11 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       (unsigned long long) meta.file_size,
       s.ToString().c_str());
   delete iter;
-  pending_outputs_.erase(meta.number);
+  if (pending_number != NULL) {
+    *pending_number = meta.number;
+  } else {
+    pending_outputs_.erase(meta.number);
+  }
 
 
   // Note that if file_size is zero, the file has been deleted and
@@ -481,7 +554,23 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
     const Slice min_user_key = meta.smallest.user_key();
     const Slice max_user_key = meta.largest.user_key();
     if (base != NULL) {
-      level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
+      // Other threads may have installed versions since "base" while the
+      // table was built, so place it against the current version, and
+      // keep anyone from installing another before the caller applies
+      // the edit.
+      while (manifest_writing_) {
+        bg_cv_.Wait();
+      }
+      Version* current = versions_->current();
+      level = current->PickLevelForMemTableOutput(min_user_key, max_user_key);
+      // Stay above the levels of ongoing compactions, or the new file
+      // could overlap the output of one of them.
+      for (int busy = 0; busy < level; busy++) {
+        if (busy_levels_[busy]) {
+          level = busy;
+          break;
+        }
+      }
     }
     edit->AddFile(level, meta.number, meta.file_size,
                   meta.smallest, meta.largest);
@@ -502,7 +591,8 @@ Status DBImpl::CompactMemTable() {
   VersionEdit edit;
   Version* base = versions_->current();
   base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit, base);
+  uint64_t number;
+  Status s = WriteLevel0Table(imm_, &edit, base, &number);
   base->Unref();
 
   if (s.ok() && shutting_down_.Acquire_Load()) {
@@ -513,8 +603,9 @@ Status DBImpl::CompactMemTable() {
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
     edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = LogAndApply(&edit);
   }
+  pending_outputs_.erase(number);
 
   if (s.ok()) {
     // Commit to the new state
@@ -553,6 +644,7 @@ void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
   ManualCompaction manual;
   manual.level = level;
   manual.done = false;
+  manual.in_progress = false;
   if (begin == NULL) {
     manual.begin = NULL;
   } else {
@@ -597,7 +689,9 @@ Status DBImpl::TEST_CompactMemTable() {
 
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (bg_compaction_scheduled_) {
+  if (options_.max_background_compactions > 1) {
+    MaybeScheduleParallelWork();
+  } else if (bg_compaction_scheduled_ > 0) {
     // Already scheduled
   } else if (shutting_down_.Acquire_Load()) {
     // DB is being deleted; no more background compactions
@@ -606,45 +700,69 @@ void DBImpl::MaybeScheduleCompaction() {
              !versions_->NeedsCompaction()) {
     // No work to be done
   } else {
-    bg_compaction_scheduled_ = true;
+    bg_compaction_scheduled_++;
     env_->Schedule(&DBImpl::BGWork, this);
   }
 }
 
+void DBImpl::MaybeScheduleParallelWork() {
+  mutex_.AssertHeld();
+  if (shutting_down_.Acquire_Load()) {
+    // DB is being deleted; no more background work
+    return;
+  }
+
+  // Memtable flushes get a thread of their own so that writers never
+  // wait for a compaction to finish before their memtable is flushed.
+  if (imm_ != NULL && !bg_flush_scheduled_) {
+    bg_flush_scheduled_ = true;
+    env_->ScheduleWithPriority(&DBImpl::BGWorkFlush, this, Env::HIGH);
+  }
+
+  // Compactions are picked here rather than by the background threads,
+  // so that no thread gets scheduled unless there is work on levels
+  // that no other compaction is using.
+  while (bg_compaction_scheduled_ < options_.max_background_compactions) {
+    CompactionJob* job = new CompactionJob;
+    job->db = this;
+    if (!PickCompaction(job)) {
+      delete job;
+      break;
+    }
+    if (job->compaction == NULL) {
+      // A manual compaction with nothing left to do
+      RunCompaction(job);
+      delete job;
+      bg_cv_.SignalAll();
+      continue;
+    }
+    bg_compaction_scheduled_++;
+    env_->ScheduleWithPriority(&DBImpl::BGWorkCompaction, job, Env::LOW);
+  }
+}
+
 void DBImpl::BGWork(void* db) {
   reinterpret_cast<DBImpl*>(db)->BackgroundCall();
 }
 
+void DBImpl::BGWorkFlush(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlush();
+}
+
+void DBImpl::BGWorkCompaction(void* job) {
+  CompactionJob* j = reinterpret_cast<CompactionJob*>(job);
+  j->db->BackgroundParallelCompaction(j);
+}
+
 void DBImpl::BackgroundCall() {
   MutexLock l(&mutex_);
-  assert(bg_compaction_scheduled_);
+  assert(bg_compaction_scheduled_ > 0);
   if (!shutting_down_.Acquire_Load()) {
     Status s = BackgroundCompaction();
-    if (s.ok()) {
-      // Success
-      consecutive_compaction_errors_ = 0;
-    } else if (shutting_down_.Acquire_Load()) {
-      // Error most likely due to shutdown; do not wait
-    } else {
-      // Wait a little bit before retrying background compaction in
-      // case this is an environmental problem and we do not want to
-      // chew up resources for failed compactions for the duration of
-      // the problem.
-      bg_cv_.SignalAll();  // In case a waiter can proceed despite the error
-      Log(options_.info_log, "Waiting after background compaction error: %s",
-          s.ToString().c_str());
-      mutex_.Unlock();
-      ++consecutive_compaction_errors_;
-      int seconds_to_sleep = 1;
-      for (int i = 0; i < 3 && i < consecutive_compaction_errors_ - 1; ++i) {
-        seconds_to_sleep *= 2;
-      }
-      env_->SleepForMicroseconds(seconds_to_sleep * 1000000);
-      mutex_.Lock();
-    }
+    RecordBackgroundResult(s);
   }
 
-  bg_compaction_scheduled_ = false;
+  bg_compaction_scheduled_--;
 
   // Previous compaction may have produced too many files in a level,
   // so reschedule another compaction if needed.
@@ -652,6 +770,65 @@ void DBImpl::BackgroundCall() {
   bg_cv_.SignalAll();
 }
 
+void DBImpl::BackgroundFlush() {
+  MutexLock l(&mutex_);
+  assert(bg_flush_scheduled_);
+  if (!shutting_down_.Acquire_Load() && imm_ != NULL) {
+    Status s = CompactMemTable();
+    RecordBackgroundResult(s);
+  }
+
+  bg_flush_scheduled_ = false;
+
+  // The new level-0 file may call for a compaction
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();
+}
+
+void DBImpl::BackgroundParallelCompaction(CompactionJob* job) {
+  MutexLock l(&mutex_);
+  assert(bg_compaction_scheduled_ > 0);
+
+  // The job owns its levels, so it runs even when shutting down;
+  // DoCompactionWork() gives up early in that case.
+  Status s = RunCompaction(job);
+  RecordBackgroundResult(s);
+  delete job;
+
+  bg_compaction_scheduled_--;
+
+  // Previous compaction may have produced too many files in a level,
+  // and freed levels other compactions were waiting for.
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();
+}
+
+void DBImpl::RecordBackgroundResult(const Status& s) {
+  mutex_.AssertHeld();
+  if (s.ok()) {
+    // Success
+    consecutive_compaction_errors_ = 0;
+  } else if (shutting_down_.Acquire_Load()) {
+    // Error most likely due to shutdown; do not wait
+  } else {
+    // Wait a little bit before retrying background compaction in
+    // case this is an environmental problem and we do not want to
+    // chew up resources for failed compactions for the duration of
+    // the problem.
+    bg_cv_.SignalAll();  // In case a waiter can proceed despite the error
+    Log(options_.info_log, "Waiting after background compaction error: %s",
+        s.ToString().c_str());
+    mutex_.Unlock();
+    ++consecutive_compaction_errors_;
+    int seconds_to_sleep = 1;
+    for (int i = 0; i < 3 && i < consecutive_compaction_errors_ - 1; ++i) {
+      seconds_to_sleep *= 2;
+    }
+    env_->SleepForMicroseconds(seconds_to_sleep * 1000000);
+    mutex_.Lock();
+  }
+}
+
 Status DBImpl::BackgroundCompaction() {
   mutex_.AssertHeld();
 
@@ -659,25 +836,56 @@ Status DBImpl::BackgroundCompaction() {
     return CompactMemTable();
   }
 
+  CompactionJob job;
+  job.db = this;
+  PickCompaction(&job);
+  return RunCompaction(&job);
+}
+
+bool DBImpl::PickCompaction(CompactionJob* job) {
+  mutex_.AssertHeld();
+  job->compaction = NULL;
+  job->is_manual = (manual_compaction_ != NULL);
+
   Compaction* c;
-  bool is_manual = (manual_compaction_ != NULL);
-  InternalKey manual_end;
-  if (is_manual) {
+  if (job->is_manual) {
     ManualCompaction* m = manual_compaction_;
+    if (m->in_progress || busy_levels_[m->level] || busy_levels_[m->level+1]) {
+      // Wait for the levels to be free, and keep automatic compactions
+      // from taking them in the meantime.
+      return false;
+    }
     c = versions_->CompactRange(m->level, m->begin, m->end);
     m->done = (c == NULL);
+    m->in_progress = true;
     if (c != NULL) {
-      manual_end = c->input(0, c->num_input_files(0) - 1)->largest;
+      job->manual_end = c->input(0, c->num_input_files(0) - 1)->largest;
     }
     Log(options_.info_log,
         "Manual compaction at level-%d from %s .. %s; will stop at %s\n",
         m->level,
         (m->begin ? m->begin->DebugString().c_str() : "(begin)"),
         (m->end ? m->end->DebugString().c_str() : "(end)"),
-        (m->done ? "(end)" : manual_end.DebugString().c_str()));
+        (m->done ? "(end)" : job->manual_end.DebugString().c_str()));
   } else {
-    c = versions_->PickCompaction();
+    c = versions_->PickCompaction(busy_levels_);
+    if (c == NULL) {
+      return false;
+    }
+  }
+
+  if (c != NULL) {
+    busy_levels_[c->level()] = true;
+    busy_levels_[c->level() + 1] = true;
   }
+  job->compaction = c;
+  return true;
+}
+
+Status DBImpl::RunCompaction(CompactionJob* job) {
+  mutex_.AssertHeld();
+  Compaction* c = job->compaction;
+  const bool is_manual = job->is_manual;
 
   Status status;
   if (c == NULL) {
@@ -689,7 +897,7 @@ Status DBImpl::BackgroundCompaction() {
     c->edit()->DeleteFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size,
                        f->smallest, f->largest);
-    status = versions_->LogAndApply(c->edit(), &mutex_);
+    status = LogAndApply(c->edit());
     VersionSet::LevelSummaryStorage tmp;
     Log(options_.info_log, "Moved #%lld to level-%d %lld bytes %s: %s\n",
         static_cast<unsigned long long>(f->number),
@@ -704,7 +912,12 @@ Status DBImpl::BackgroundCompaction() {
     c->ReleaseInputs();
     DeleteObsoleteFiles();
   }
+  if (c != NULL) {
+    busy_levels_[c->level()] = false;
+    busy_levels_[c->level() + 1] = false;
+  }
   delete c;
+  job->compaction = NULL;
 
   if (status.ok()) {
     // Done
@@ -726,14 +939,29 @@ Status DBImpl::BackgroundCompaction() {
     if (!m->done) {
       // We only compacted part of the requested range.  Update *m
       // to the range that is left to be compacted.
-      m->tmp_storage = manual_end;
+      m->tmp_storage = job->manual_end;
       m->begin = &m->tmp_storage;
     }
+    m->in_progress = false;
     manual_compaction_ = NULL;
   }
   return status;
 }
 
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  // VersionSet::LogAndApply() drops mutex_ while it writes the MANIFEST,
+  // so flushes and compactions running in parallel take turns here.
+  while (manifest_writing_) {
+    bg_cv_.Wait();
+  }
+  manifest_writing_ = true;
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  manifest_writing_ = false;
+  bg_cv_.SignalAll();
+  return s;
+}
+
 void DBImpl::CleanupCompaction(CompactionState* compact) {
   mutex_.AssertHeld();
   if (compact->builder != NULL) {
@@ -813,7 +1041,8 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
     // Verify that the table is usable
     Iterator* iter = table_cache_->NewIterator(ReadOptions(),
                                                output_number,
-                                               current_bytes);
+                                               current_bytes,
+                                               -1);
     s = iter->status();
     delete iter;
     if (s.ok()) {
@@ -846,7 +1075,7 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
         level + 1,
         out.number, out.file_size, out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  return LogAndApply(compact->compaction->edit());
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
@@ -867,20 +1096,175 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   } else {
     compact->smallest_snapshot = snapshots_.oldest()->number_;
   }
+  compact->flush_imm = (options_.max_background_compactions <= 1);
+
+  std::vector<CompactionState*> subcompactions;
+  SplitCompaction(compact, &subcompactions);
 
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
 
-  Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
   Status status;
+  if (subcompactions.empty()) {
+    status = DoSubcompactionWork(compact);
+    imm_micros = compact->imm_micros;
+  } else {
+    // Run the first range on this thread, and each of the others on a
+    // thread of its own.
+    port::Mutex mu;
+    port::CondVar cv(&mu);
+    int pending = subcompactions.size() - 1;
+    std::vector<SubcompactionJob> jobs(subcompactions.size());
+    for (size_t i = 1; i < subcompactions.size(); i++) {
+      jobs[i].db = this;
+      jobs[i].compact = subcompactions[i];
+      jobs[i].mu = &mu;
+      jobs[i].cv = &cv;
+      jobs[i].pending = &pending;
+      env_->StartThread(&DBImpl::BGWorkSubcompaction, &jobs[i]);
+    }
+    subcompactions[0]->status = DoSubcompactionWork(subcompactions[0]);
+    imm_micros = subcompactions[0]->imm_micros;
+    {
+      MutexLock l(&mu);
+      while (pending > 0) {
+        cv.Wait();
+      }
+    }
+
+    // The ranges are in key order, so their outputs are too
+    for (size_t i = 0; i < subcompactions.size(); i++) {
+      CompactionState* sub = subcompactions[i];
+      if (status.ok()) {
+        status = sub->status;
+      }
+      compact->outputs.insert(compact->outputs.end(),
+                              sub->outputs.begin(), sub->outputs.end());
+      compact->total_bytes += sub->total_bytes;
+      if (sub->builder != NULL) {
+        sub->builder->Abandon();
+        delete sub->builder;
+      }
+      delete sub->outfile;
+      delete sub;
+    }
+    Log(options_.info_log, "Merged %d subcompactions into %d files",
+        static_cast<int>(subcompactions.size()),
+        static_cast<int>(compact->outputs.size()));
+  }
+
+  CompactionStats stats;
+  stats.micros = env_->NowMicros() - start_micros - imm_micros;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+    }
+  }
+  for (size_t i = 0; i < compact->outputs.size(); i++) {
+    stats.bytes_written += compact->outputs[i].file_size;
+  }
+
+  mutex_.Lock();
+  stats_[compact->compaction->level() + 1].Add(stats);
+
+  if (status.ok()) {
+    status = InstallCompactionResults(compact);
+  }
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log,
+      "compacted to: %s", versions_->LevelSummary(&tmp));
+  return status;
+}
+
+namespace {
+struct UserKeyLess {
+  const Comparator* ucmp;
+  explicit UserKeyLess(const Comparator* c) : ucmp(c) { }
+  bool operator()(const Slice& a, const Slice& b) const {
+    return ucmp->Compare(a, b) < 0;
+  }
+};
+}  // namespace
+
+void DBImpl::SplitCompaction(CompactionState* compact,
+                             std::vector<CompactionState*>* subcompactions) {
+  if (options_.max_subcompactions <= 1) {
+    return;
+  }
+
+  // Ranges are cut after the largest user key of an input file, so that
+  // all entries for a user key end up in the same range.
+  Compaction* c = compact->compaction;
+  std::vector<Slice> bounds;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < c->num_input_files(which); i++) {
+      bounds.push_back(c->input(which, i)->largest.user_key());
+    }
+  }
+  std::sort(bounds.begin(), bounds.end(), UserKeyLess(user_comparator()));
+  size_t unique = 0;
+  for (size_t i = 0; i < bounds.size(); i++) {
+    if (unique == 0 || user_comparator()->Compare(bounds[i],
+                                                  bounds[unique-1]) != 0) {
+      bounds[unique++] = bounds[i];
+    }
+  }
+  // Nothing comes after the largest key of all
+  bounds.resize(unique > 0 ? unique - 1 : 0);
+  if (bounds.empty()) {
+    return;
+  }
+
+  const size_t n = std::min(bounds.size() + 1,
+                            static_cast<size_t>(options_.max_subcompactions));
+  for (size_t i = 0; i < n; i++) {
+    CompactionState* sub = new CompactionState(c);
+    sub->smallest_snapshot = compact->smallest_snapshot;
+    if (i > 0) {
+      sub->has_begin = true;
+      sub->begin = subcompactions->back()->end;
+    }
+    if (i + 1 < n) {
+      sub->has_end = true;
+      sub->end = bounds[(i + 1) * (bounds.size() + 1) / n - 1].ToString();
+    }
+    subcompactions->push_back(sub);
+  }
+  subcompactions->front()->flush_imm = compact->flush_imm;
+}
+
+void DBImpl::BGWorkSubcompaction(void* job) {
+  SubcompactionJob* j = reinterpret_cast<SubcompactionJob*>(job);
+  j->compact->status = j->db->DoSubcompactionWork(j->compact);
+  MutexLock l(j->mu);
+  (*j->pending)--;
+  j->cv->Signal();
+}
+
+Status DBImpl::DoSubcompactionWork(CompactionState* compact) {
+  Iterator* input = versions_->MakeInputIterator(compact->compaction);
   ParsedInternalKey ikey;
+  if (compact->has_begin) {
+    // Skip the entries of the user key that ends the previous range.
+    // Keys that fail to parse go with the range of the key before them.
+    InternalKey start(compact->begin, 0, static_cast<ValueType>(0));
+    input->Seek(start.Encode());
+    while (input->Valid() &&
+           (!ParseInternalKey(input->key(), &ikey) ||
+            user_comparator()->Compare(ikey.user_key,
+                                       Slice(compact->begin)) <= 0)) {
+      input->Next();
+    }
+  } else {
+    input->SeekToFirst();
+  }
+  Status status;
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
     // Prioritize immutable compaction work
-    if (has_imm_.NoBarrier_Load() != NULL) {
+    if (compact->flush_imm && has_imm_.NoBarrier_Load() != NULL) {
       const uint64_t imm_start = env_->NowMicros();
       mutex_.Lock();
       if (imm_ != NULL) {
@@ -888,11 +1272,17 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
       }
       mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
+      compact->imm_micros += (env_->NowMicros() - imm_start);
     }
 
     Slice key = input->key();
-    if (compact->compaction->ShouldStopBefore(key) &&
+    if (compact->has_end && ParseInternalKey(key, &ikey) &&
+        user_comparator()->Compare(ikey.user_key,
+                                   Slice(compact->end)) > 0) {
+      // Past the end of this range
+      break;
+    }
+    if (compact->compaction->ShouldStopBefore(key, &compact->key_state) &&
         compact->builder != NULL) {
       status = FinishCompactionOutputFile(compact, input);
       if (!status.ok()) {
@@ -922,7 +1312,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         drop = true;    // (A)
       } else if (ikey.type == kTypeDeletion &&
                  ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                        &compact->key_state)) {
         // For this user key:
         // (1) there is no data in higher levels
         // (2) data in lower levels will have larger sequence numbers
@@ -941,7 +1332,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         "%d smallest_snapshot: %d",
         ikey.user_key.ToString().c_str(),
         (int)ikey.sequence, ikey.type, kTypeValue, drop,
-        compact->compaction->IsBaseLevelForKey(ikey.user_key),
+        compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                               &compact->key_state),
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
 
@@ -982,28 +1374,6 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     status = input->status();
   }
   delete input;
-  input = NULL;
-
-  CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
-  for (int which = 0; which < 2; which++) {
-    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
-      stats.bytes_read += compact->compaction->input(which, i)->file_size;
-    }
-  }
-  for (size_t i = 0; i < compact->outputs.size(); i++) {
-    stats.bytes_written += compact->outputs[i].file_size;
-  }
-
-  mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
-
-  if (status.ok()) {
-    status = InstallCompactionResults(compact);
-  }
-  VersionSet::LevelSummaryStorage tmp;
-  Log(options_.info_log,
-      "compacted to: %s", versions_->LevelSummary(&tmp));
   return status;
 }
 
@@ -1112,14 +1482,128 @@ Status DBImpl::Get(const ReadOptions& options,
   return s;
 }
 
+namespace {
+// Orders indexes into a vector of user keys
+struct KeyIndexLess {
+  const Comparator* ucmp;
+  const std::vector<Slice>* keys;
+  KeyIndexLess(const Comparator* c, const std::vector<Slice>* k)
+      : ucmp(c), keys(k) { }
+  bool operator()(size_t a, size_t b) const {
+    return ucmp->Compare((*keys)[a], (*keys)[b]) < 0;
+  }
+};
+}  // namespace
+
+void DBImpl::MultiGet(const ReadOptions& options,
+                      const std::vector<Slice>& keys,
+                      std::vector<std::string>* values,
+                      std::vector<Status>* statuses) {
+  const size_t n = keys.size();
+  values->clear();
+  values->resize(n);
+  statuses->clear();
+  statuses->resize(n);
+  if (n == 0) {
+    return;
+  }
+
+  MutexLock l(&mutex_);
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  Version* current = versions_->current();
+  mem->Ref();
+  if (imm != NULL) imm->Ref();
+  current->Ref();
+
+  std::vector<LookupKey*> lkeys;
+  std::vector<Version::GetStats> stats;
+
+  // Unlock while reading from files and memtables
+  {
+    mutex_.Unlock();
+
+    // Visit the keys in order, so that they can be matched with the
+    // files of each level in one pass and nearby keys share blocks.
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) {
+      order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     KeyIndexLess(user_comparator(), &keys));
+
+    // First look in the memtable, then in the immutable memtable (if
+    // any), and collect the keys neither of them has for the files.
+    std::vector<const LookupKey*> file_keys;
+    std::vector<std::string*> file_values;
+    std::vector<size_t> file_index;
+    for (size_t k = 0; k < n; k++) {
+      const size_t i = order[k];
+      LookupKey* lkey = new LookupKey(keys[i], snapshot);
+      lkeys.push_back(lkey);
+      std::string* value = &(*values)[i];
+      Status* s = &(*statuses)[i];
+      if (mem->Get(*lkey, value, s)) {
+        // Done
+      } else if (imm != NULL && imm->Get(*lkey, value, s)) {
+        // Done
+      } else {
+        file_keys.push_back(lkey);
+        file_values.push_back(value);
+        file_index.push_back(i);
+      }
+    }
+
+    if (!file_keys.empty()) {
+      const int m = file_keys.size();
+      std::vector<Status> file_statuses(m);
+      stats.resize(m);
+      current->MultiGet(options, m, &file_keys[0], &file_values[0],
+                        &file_statuses[0], &stats[0]);
+      for (int k = 0; k < m; k++) {
+        (*statuses)[file_index[k]] = file_statuses[k];
+      }
+    }
+    mutex_.Lock();
+  }
+
+  bool schedule = false;
+  for (size_t i = 0; i < stats.size(); i++) {
+    if (current->UpdateStats(stats[i])) {
+      schedule = true;
+    }
+  }
+  if (schedule) {
+    MaybeScheduleCompaction();
+  }
+  mem->Unref();
+  if (imm != NULL) imm->Unref();
+  current->Unref();
+  for (size_t i = 0; i < lkeys.size(); i++) {
+    delete lkeys[i];
+  }
+}
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   Iterator* internal_iter = NewInternalIterator(options, &latest_snapshot);
+  const PrefixExtractor* prefix_extractor = NULL;
+  if (options.prefix_same_as_start && options_.prefix_extractor != NULL) {
+    prefix_extractor = internal_prefix_extractor_.user_extractor();
+  }
   return NewDBIterator(
       &dbname_, env_, user_comparator(), internal_iter,
       (options.snapshot != NULL
        ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
-       : latest_snapshot));
+       : latest_snapshot),
+      options.iterate_upper_bound, prefix_extractor);
 }
 
 const Snapshot* DBImpl::GetSnapshot() {
@@ -1146,18 +1630,34 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   w.batch = my_batch;
   w.sync = options.sync;
   w.done = false;
+  w.group = NULL;
+  w.insert = false;
 
   MutexLock l(&mutex_);
   writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
+  while (!w.done && !w.insert &&
+         (w.group != NULL || &w != writers_.front())) {
     w.cv.Wait();
   }
+  if (w.insert) {
+    // Our leader has logged the group and wants every member to insert
+    // its own batch.
+    InsertGroupMember(&w);
+    while (!w.done) {
+      w.cv.Wait();
+    }
+  }
   if (w.done) {
     return w.status;
   }
 
   // May temporarily unlock and wait.
   Status status = MakeRoomForWrite(my_batch == NULL);
+  if (status.ok() && my_batch != NULL &&
+      (options_.allow_concurrent_memtable_write ||
+       options_.enable_pipelined_write)) {
+    return LeadWriteGroup(options, &w);
+  }
   uint64_t last_sequence = versions_->LastSequence();
   Writer* last_writer = &w;
   if (status.ok() && my_batch != NULL) {  // NULL batch is for compactions
@@ -1204,6 +1704,147 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   return status;
 }
 
+Status DBImpl::LeadWriteGroup(const WriteOptions& options, Writer* leader) {
+  mutex_.AssertHeld();
+  assert(leader == writers_.front());
+  Writer* last_writer = leader;
+  WriteBatch* updates = BuildBatchGroup(&last_writer);
+
+  // Groups that are logged but not yet inserted have already taken
+  // the sequence numbers after LastSequence().
+  SequenceNumber sequence = mem_groups_.empty() ?
+      versions_->LastSequence() : mem_groups_.back()->last_sequence;
+  WriteBatchInternal::SetSequence(updates, sequence + 1);
+
+  // Number each member's batch too, so that the batches can be
+  // inserted on their own.
+  WriteGroup group;
+  group.leader = leader;
+  group.mem = mem_;
+  group.pending = 0;
+  for (std::deque<Writer*>::iterator iter = writers_.begin(); ; ++iter) {
+    Writer* w = *iter;
+    w->group = &group;
+    group.writers.push_back(w);
+    if (w->batch != NULL) {
+      WriteBatchInternal::SetSequence(w->batch, sequence + 1);
+      sequence += WriteBatchInternal::Count(w->batch);
+    }
+    if (w == last_writer) break;
+  }
+  group.last_sequence = sequence;
+
+  // Only the leader at the front of writers_ writes to the log, so the
+  // lock can be released here.  mem_ cannot change either: it is only
+  // switched by a leader, and not while mem_groups_ is non-empty.
+  mutex_.Unlock();
+  Status status = log_->AddRecord(WriteBatchInternal::Contents(updates));
+  if (status.ok() && options.sync) {
+    status = logfile_->Sync();
+  }
+  mutex_.Lock();
+  if (updates == tmp_batch_) tmp_batch_->Clear();
+
+  bool queued = true;
+  if (status.ok()) {
+    mem_groups_.push_back(&group);
+    if (options_.enable_pipelined_write) {
+      // Hand the log over to the next group while this one fills the
+      // memtable, after any groups that were logged before it.
+      for (size_t i = 0; i < group.writers.size(); i++) {
+        writers_.pop_front();
+      }
+      queued = false;
+      if (!writers_.empty()) {
+        writers_.front()->cv.Signal();
+      }
+      while (mem_groups_.front() != &group) {
+        leader->cv.Wait();
+      }
+    }
+
+    InsertWriteGroup(&group);
+    status = group.status;
+
+    // Groups finish in log order, so the new sequence number covers
+    // every write before it.
+    versions_->SetLastSequence(group.last_sequence);
+    assert(mem_groups_.front() == &group);
+    mem_groups_.pop_front();
+    if (!mem_groups_.empty()) {
+      mem_groups_.front()->leader->cv.Signal();
+    } else if (options_.enable_pipelined_write) {
+      bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
+    }
+  }
+
+  for (size_t i = 0; i < group.writers.size(); i++) {
+    Writer* w = group.writers[i];
+    if (queued) {
+      assert(w == writers_.front());
+      writers_.pop_front();
+    }
+    if (w != leader) {
+      w->status = status;
+      w->done = true;
+      w->cv.Signal();
+    }
+  }
+  if (queued && !writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+  return status;
+}
+
+void DBImpl::InsertWriteGroup(WriteGroup* group) {
+  mutex_.AssertHeld();
+  Writer* leader = group->leader;
+  if (options_.allow_concurrent_memtable_write && group->writers.size() > 1) {
+    for (size_t i = 0; i < group->writers.size(); i++) {
+      Writer* w = group->writers[i];
+      if (w->batch != NULL) {
+        group->pending++;
+        if (w != leader) {
+          w->insert = true;
+          w->cv.Signal();
+        }
+      }
+    }
+    InsertGroupMember(leader);
+    while (group->pending > 0) {
+      leader->cv.Wait();
+    }
+  } else {
+    // tmp_batch_ may already hold the next group, so insert the
+    // members' own batches.
+    mutex_.Unlock();
+    Status s;
+    for (size_t i = 0; s.ok() && i < group->writers.size(); i++) {
+      Writer* w = group->writers[i];
+      if (w->batch != NULL) {
+        s = WriteBatchInternal::InsertInto(w->batch, group->mem);
+      }
+    }
+    mutex_.Lock();
+    group->status = s;
+  }
+}
+
+void DBImpl::InsertGroupMember(Writer* w) {
+  mutex_.AssertHeld();
+  WriteGroup* group = w->group;
+  mutex_.Unlock();
+  Status s = WriteBatchInternal::InsertIntoConcurrently(w->batch, group->mem);
+  mutex_.Lock();
+  if (!s.ok() && group->status.ok()) {
+    group->status = s;
+  }
+  group->pending--;
+  if (group->pending == 0 && w != group->leader) {
+    group->leader->cv.Signal();
+  }
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-NULL batch
 WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
@@ -1291,6 +1932,9 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // There are too many level-0 files.
       Log(options_.info_log, "Too many L0 files; waiting...\n");
       bg_cv_.Wait();
+    } else if (!mem_groups_.empty()) {
+      // Earlier write groups are still being inserted into mem_.
+      bg_cv_.Wait();
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
       assert(versions_->PrevLogNumber() == 0);
@@ -1367,6 +2011,20 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
+  } else if (in == "block-cache-usage") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu",
+             static_cast<unsigned long long>(
+                 options_.block_cache->TotalCharge()));
+    *value = buf;
+    return true;
+  } else if (in == "table-meta-memory") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu",
+             static_cast<unsigned long long>(
+                 table_cache_->MetaMemoryUsage()));
+    *value = buf;
+    return true;
   }
 
   return false;
@@ -1412,6 +2070,29 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+void DB::MultiGet(const ReadOptions& options,
+                  const std::vector<Slice>& keys,
+                  std::vector<std::string>* values,
+                  std::vector<Status>* statuses) {
+  // Read all the keys from the same state of the database
+  ReadOptions opts = options;
+  const Snapshot* snapshot = NULL;
+  if (opts.snapshot == NULL) {
+    snapshot = GetSnapshot();
+    opts.snapshot = snapshot;
+  }
+  values->clear();
+  values->resize(keys.size());
+  statuses->clear();
+  statuses->resize(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    (*statuses)[i] = Get(opts, keys[i], &(*values)[i]);
+  }
+  if (snapshot != NULL) {
+    ReleaseSnapshot(snapshot);
+  }
+}
+
 DB::~DB() { }
 
 Status DB::Open(const Options& options, const std::string& dbname,
@@ -7,6 +7,7 @@
 
 #include <deque>
 #include <set>
+#include <vector>
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
@@ -35,6 +36,10 @@ class DBImpl : public DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key,
                      std::string* value);
+  virtual void MultiGet(const ReadOptions& options,
+                        const std::vector<Slice>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<Status>* statuses);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
@@ -62,7 +67,10 @@ class DBImpl : public DB {
  private:
   friend class DB;
   struct CompactionState;
+  struct CompactionJob;
+  struct SubcompactionJob;
   struct Writer;
+  struct WriteGroup;
 
   Iterator* NewInternalIterator(const ReadOptions&,
                                 SequenceNumber* latest_snapshot);
@@ -89,21 +97,50 @@ class DBImpl : public DB {
                         SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
+  // If pending_number is non-NULL, the new table is left in
+  // pending_outputs_ and its number is stored in *pending_number, for
+  // the caller to erase once *edit has been applied.
+  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base,
+                          uint64_t* pending_number)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
 
+  // Used instead of the plain write path when either
+  // options_.allow_concurrent_memtable_write or
+  // options_.enable_pipelined_write is set.  "leader" is at the front of
+  // writers_ and has made room for its batch.
+  Status LeadWriteGroup(const WriteOptions& options, Writer* leader)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void InsertWriteGroup(WriteGroup* group) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void InsertGroupMember(Writer* w) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void MaybeScheduleParallelWork() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   static void BGWork(void* db);
+  static void BGWorkFlush(void* db);
+  static void BGWorkCompaction(void* job);
+  static void BGWorkSubcompaction(void* job);
   void BackgroundCall();
+  void BackgroundFlush();
+  void BackgroundParallelCompaction(CompactionJob* job);
+  void RecordBackgroundResult(const Status& s) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool PickCompaction(CompactionJob* job) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status RunCompaction(CompactionJob* job) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void SplitCompaction(CompactionState* compact,
+                       std::vector<CompactionState*>* subcompactions);
+  Status DoSubcompactionWork(CompactionState* compact);
+
+  // Apply *edit through versions_, waiting for any other thread that is
+  // writing the MANIFEST.
+  Status LogAndApply(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
@@ -114,6 +151,7 @@ class DBImpl : public DB {
   Env* const env_;
   const InternalKeyComparator internal_comparator_;
   const InternalFilterPolicy internal_filter_policy_;
+  const InternalPrefixExtractor internal_prefix_extractor_;
   const Options options_;  // options_.comparator == &internal_comparator_
   bool owns_info_log_;
   bool owns_cache_;
@@ -140,19 +178,35 @@ class DBImpl : public DB {
   std::deque<Writer*> writers_;
   WriteBatch* tmp_batch_;
 
+  // Write groups that are in the log but not yet in mem_, oldest first.
+  // mem_ is not switched while this is non-empty.
+  std::deque<WriteGroup*> mem_groups_;
+
   SnapshotList snapshots_;
 
   // Set of table files to protect from deletion because they are
   // part of ongoing compactions.
   std::set<uint64_t> pending_outputs_;
 
-  // Has a background compaction been scheduled or is running?
-  bool bg_compaction_scheduled_;
+  // Number of background compactions scheduled or running.  Never more
+  // than one unless options_.max_background_compactions > 1.
+  int bg_compaction_scheduled_;
+
+  // Has a memtable flush been scheduled on the HIGH priority pool?
+  // Only used when options_.max_background_compactions > 1.
+  bool bg_flush_scheduled_;
+
+  // busy_levels_[L] is true while a compaction reads or writes level L
+  bool busy_levels_[config::kNumLevels];
+
+  // Is a thread writing the MANIFEST in VersionSet::LogAndApply()?
+  bool manifest_writing_;
 
   // Information for a manual compaction
   struct ManualCompaction {
     int level;
     bool done;
+    bool in_progress;           // Picked by a compaction job that is running
     const InternalKey* begin;   // NULL means beginning of key range
     const InternalKey* end;     // NULL means end of key range
     InternalKey tmp_storage;    // Used to keep track of compaction progress
@@ -196,6 +250,7 @@ class DBImpl : public DB {
 extern Options SanitizeOptions(const std::string& db,
                                const InternalKeyComparator* icmp,
                                const InternalFilterPolicy* ipolicy,
+                               const InternalPrefixExtractor* iprefix,
                                const Options& src);
 
 }  // namespace leveldb
@@ -47,14 +47,18 @@ class DBIter: public Iterator {
   };
 
   DBIter(const std::string* dbname, Env* env,
-         const Comparator* cmp, Iterator* iter, SequenceNumber s)
+         const Comparator* cmp, Iterator* iter, SequenceNumber s,
+         const Slice* upper_bound, const PrefixExtractor* prefix_extractor)
       : dbname_(dbname),
         env_(env),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        upper_bound_(upper_bound),
+        prefix_extractor_(prefix_extractor),
         direction_(kForward),
-        valid_(false) {
+        valid_(false),
+        prefix_bounded_(false) {
   }
   virtual ~DBIter() {
     delete iter_;
@@ -86,6 +90,18 @@ class DBIter: public Iterator {
   void FindNextUserEntry(bool skipping, std::string* skip);
   void FindPrevUserEntry();
   bool ParseKey(ParsedInternalKey* key);
+  void SetNotSupported(const char* op);
+
+  // Is "user_key" beyond the range this iterator may return?
+  inline bool OutOfRange(const Slice& user_key) const {
+    if (upper_bound_ != NULL &&
+        user_comparator_->Compare(user_key, *upper_bound_) >= 0) {
+      return true;
+    }
+    return prefix_bounded_ &&
+        (!prefix_extractor_->InDomain(user_key) ||
+         prefix_extractor_->Transform(user_key) != Slice(prefix_));
+  }
 
   inline void SaveKey(const Slice& k, std::string* dst) {
     dst->assign(k.data(), k.size());
@@ -105,12 +121,16 @@ class DBIter: public Iterator {
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
+  const Slice* const upper_bound_;                // May be NULL
+  const PrefixExtractor* const prefix_extractor_;  // NULL unless prefix mode
 
   Status status_;
   std::string saved_key_;     // == current key when direction_==kReverse
   std::string saved_value_;   // == current raw value when direction_==kReverse
   Direction direction_;
   bool valid_;
+  bool prefix_bounded_;       // Restricted to keys starting with prefix_?
+  std::string prefix_;        // Prefix of the last Seek() target
 
   // No copying allowed
   DBIter(const DBIter&);
@@ -126,6 +146,13 @@ inline bool DBIter::ParseKey(ParsedInternalKey* ikey) {
   }
 }
 
+void DBIter::SetNotSupported(const char* op) {
+  valid_ = false;
+  saved_key_.clear();
+  ClearSavedValue();
+  status_ = Status::NotSupported(op, "iterator uses prefix_same_as_start");
+}
+
 void DBIter::Next() {
   assert(valid_);
 
@@ -158,7 +185,11 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   assert(direction_ == kForward);
   do {
     ParsedInternalKey ikey;
-    if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+    if (!ParseKey(&ikey)) {
+      // Skip corrupted entry
+    } else if (OutOfRange(ikey.user_key)) {
+      break;
+    } else if (ikey.sequence <= sequence_) {
       switch (ikey.type) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
@@ -186,6 +217,10 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
 
 void DBIter::Prev() {
   assert(valid_);
+  if (prefix_extractor_ != NULL) {
+    SetNotSupported("Prev()");
+    return;
+  }
 
   if (direction_ == kForward) {  // Switch directions?
     // iter_ is pointing at the current entry.  Scan backwards until
@@ -255,6 +290,12 @@ void DBIter::FindPrevUserEntry() {
 
 void DBIter::Seek(const Slice& target) {
   direction_ = kForward;
+  prefix_bounded_ = (prefix_extractor_ != NULL &&
+                     prefix_extractor_->InDomain(target));
+  if (prefix_bounded_) {
+    Slice prefix = prefix_extractor_->Transform(target);
+    prefix_.assign(prefix.data(), prefix.size());
+  }
   ClearSavedValue();
   saved_key_.clear();
   AppendInternalKey(
@@ -269,6 +310,7 @@ void DBIter::Seek(const Slice& target) {
 
 void DBIter::SeekToFirst() {
   direction_ = kForward;
+  prefix_bounded_ = false;
   ClearSavedValue();
   iter_->SeekToFirst();
   if (iter_->Valid()) {
@@ -279,9 +321,26 @@ void DBIter::SeekToFirst() {
 }
 
 void DBIter::SeekToLast() {
+  if (prefix_extractor_ != NULL) {
+    SetNotSupported("SeekToLast()");
+    return;
+  }
   direction_ = kReverse;
   ClearSavedValue();
-  iter_->SeekToLast();
+  if (upper_bound_ != NULL) {
+    // Start from the last entry before the first one at the bound
+    saved_key_.clear();
+    AppendInternalKey(&saved_key_, ParsedInternalKey(
+        *upper_bound_, kMaxSequenceNumber, kValueTypeForSeek));
+    iter_->Seek(saved_key_);
+    if (iter_->Valid()) {
+      iter_->Prev();
+    } else {
+      iter_->SeekToLast();
+    }
+  } else {
+    iter_->SeekToLast();
+  }
   FindPrevUserEntry();
 }
 
@@ -292,8 +351,11 @@ Iterator* NewDBIterator(
     Env* env,
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
-    const SequenceNumber& sequence) {
-  return new DBIter(dbname, env, user_key_comparator, internal_iter, sequence);
+    const SequenceNumber& sequence,
+    const Slice* upper_bound,
+    const PrefixExtractor* prefix_extractor) {
+  return new DBIter(dbname, env, user_key_comparator, internal_iter, sequence,
+                    upper_bound, prefix_extractor);
 }
 
 }  // namespace leveldb
@@ -19,7 +19,9 @@ extern Iterator* NewDBIterator(
     Env* env,
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
-    const SequenceNumber& sequence);
+    const SequenceNumber& sequence,
+    const Slice* upper_bound,
+    const PrefixExtractor* prefix_extractor);
 
 }  // namespace leveldb
 
@@ -4,6 +4,7 @@
 
 #include "leveldb/db.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/prefix_extractor.h"
 #include "db/db_impl.h"
 #include "db/filename.h"
 #include "db/version_set.h"
@@ -190,12 +191,18 @@ class SpecialEnv : public EnvWrapper {
 class DBTest {
  private:
   const FilterPolicy* filter_policy_;
+  const FilterPolicy* blocked_filter_policy_;
+  const PrefixExtractor* prefix_extractor_;
 
   // Sequence of option configurations to try
   enum OptionConfig {
     kDefault,
     kFilter,
     kUncompressed,
+    kConcurrentWrite,
+    kPrefixFilter,
+    kFullFileFilter,
+    kCachedIndexAndFilter,
     kEnd
   };
   int option_config_;
@@ -210,6 +217,8 @@ class DBTest {
   DBTest() : option_config_(kDefault),
              env_(new SpecialEnv(Env::Default())) {
     filter_policy_ = NewBloomFilterPolicy(10);
+    blocked_filter_policy_ = NewBlockedBloomFilterPolicy(10);
+    prefix_extractor_ = NewFixedPrefixExtractor(1);
     dbname_ = test::TmpDir() + "/db_test";
     DestroyDB(dbname_, Options());
     db_ = NULL;
@@ -221,6 +230,8 @@ class DBTest {
     DestroyDB(dbname_, Options());
     delete env_;
     delete filter_policy_;
+    delete blocked_filter_policy_;
+    delete prefix_extractor_;
   }
 
   // Switch to a fresh database with the next option configuration to
@@ -245,6 +256,24 @@ class DBTest {
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kConcurrentWrite:
+        options.allow_concurrent_memtable_write = true;
+        options.enable_pipelined_write = true;
+        break;
+      case kPrefixFilter:
+        options.filter_policy = filter_policy_;
+        options.prefix_extractor = prefix_extractor_;
+        break;
+      case kFullFileFilter:
+        options.filter_policy = blocked_filter_policy_;
+        options.prefix_extractor = prefix_extractor_;
+        options.full_file_filter = true;
+        break;
+      case kCachedIndexAndFilter:
+        options.filter_policy = filter_policy_;
+        options.cache_index_and_filter_blocks = true;
+        options.pin_l0_index_and_filter_blocks = true;
+        break;
       default:
         break;
     }
@@ -1460,6 +1489,115 @@ TEST(DBTest, ManualCompaction) {
   ASSERT_EQ("0,0,1", FilesPerLevel());
 }
 
+TEST(DBTest, MultiGet) {
+  do {
+    // Spread the keys over several levels, both memtables and a snapshot
+    for (int i = 0; i < 300; i += 2) {
+      ASSERT_OK(Put(Key(i), "old" + Key(i)));
+    }
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
+    for (int i = 0; i < 300; i += 3) {
+      ASSERT_OK(Put(Key(i), "mid" + Key(i)));
+    }
+    dbfull()->TEST_CompactMemTable();
+    const Snapshot* snapshot = db_->GetSnapshot();
+    for (int i = 0; i < 300; i += 5) {
+      ASSERT_OK(Delete(Key(i)));
+    }
+    for (int i = 0; i < 300; i += 7) {
+      ASSERT_OK(Put(Key(i), "new" + Key(i)));
+    }
+
+    // Keys out of order, missing and repeated
+    std::vector<Slice> keys;
+    std::vector<std::string> key_data;
+    for (int i = 299; i >= 0; i -= 4) {
+      key_data.push_back(Key(i));
+      key_data.push_back(Key((i * 7) % 300));
+    }
+    key_data.push_back("missing");
+    for (size_t i = 0; i < key_data.size(); i++) {
+      keys.push_back(key_data[i]);
+    }
+
+    std::vector<std::string> values;
+    std::vector<Status> statuses;
+    db_->MultiGet(ReadOptions(), keys, &values, &statuses);
+    ASSERT_EQ(keys.size(), values.size());
+    ASSERT_EQ(keys.size(), statuses.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      const std::string want = Get(key_data[i]);
+      if (want == "NOT_FOUND") {
+        ASSERT_TRUE(statuses[i].IsNotFound());
+      } else {
+        ASSERT_OK(statuses[i]);
+        ASSERT_EQ(want, values[i]);
+      }
+    }
+
+    ReadOptions options;
+    options.snapshot = snapshot;
+    db_->MultiGet(options, keys, &values, &statuses);
+    for (size_t i = 0; i < keys.size(); i++) {
+      const std::string want = Get(key_data[i], snapshot);
+      ASSERT_EQ(want, statuses[i].ok() ? values[i] : "NOT_FOUND");
+    }
+    db_->ReleaseSnapshot(snapshot);
+
+    db_->MultiGet(ReadOptions(), std::vector<Slice>(), &values, &statuses);
+    ASSERT_TRUE(values.empty());
+    ASSERT_TRUE(statuses.empty());
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, ParallelCompaction) {
+  // Background threads and subcompactions per configuration
+  const int kConfigs[][2] = { { 4, 1 }, { 1, 4 }, { 4, 4 } };
+  for (int config = 0; config < 3; config++) {
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    options.write_buffer_size = 100000;  // Small write buffer
+    options.max_background_compactions = kConfigs[config][0];
+    options.max_subcompactions = kConfigs[config][1];
+    DestroyAndReopen(&options);
+
+    // Overwrite and delete keys across several memtables so that every
+    // level sees compactions, some of them split into subcompactions.
+    std::map<std::string, std::string> model;
+    Random rnd(301);
+    for (int i = 0; i < 20000; i++) {
+      const std::string k = Key(rnd.Uniform(4000));
+      if (rnd.OneIn(5)) {
+        ASSERT_OK(Delete(k));
+        model.erase(k);
+      } else {
+        const std::string v = RandomString(&rnd, 100);
+        ASSERT_OK(Put(k, v));
+        model[k] = v;
+      }
+    }
+    db_->CompactRange(NULL, NULL);
+
+    for (int reopen = 0; reopen < 2; reopen++) {
+      Iterator* iter = db_->NewIterator(ReadOptions());
+      std::map<std::string, std::string>::const_iterator m = model.begin();
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++m) {
+        ASSERT_TRUE(m != model.end());
+        ASSERT_EQ(m->first, iter->key().ToString());
+        ASSERT_EQ(m->second, iter->value().ToString());
+      }
+      ASSERT_TRUE(m == model.end());
+      delete iter;
+      for (int i = 0; i < 4000; i += 97) {
+        m = model.find(Key(i));
+        ASSERT_EQ(m == model.end() ? "NOT_FOUND" : m->second, Get(Key(i)));
+      }
+      Reopen(&options);
+    }
+  }
+}
+
 TEST(DBTest, DBOpen_Options) {
   std::string dbname = test::TmpDir() + "/db_options_test";
   DestroyDB(dbname, Options());
@@ -1690,6 +1828,257 @@ TEST(DBTest, BloomFilter) {
   delete options.filter_policy;
 }
 
+TEST(DBTest, FullFileFilter) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  options.filter_policy = NewBlockedBloomFilterPolicy(10);
+  options.full_file_filter = true;
+  Reopen(&options);
+
+  // Populate multiple layers
+  const int N = 10000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_OK(Put(Key(i), Key(i)));
+  }
+  Compact("a", "z");
+  for (int i = 0; i < N; i += 100) {
+    ASSERT_OK(Put(Key(i), Key(i)));
+  }
+  dbfull()->TEST_CompactMemTable();
+
+  // Prevent auto compactions triggered by seeks
+  env_->delay_sstable_sync_.Release_Store(env_);
+
+  // Lookup present keys.  Should rarely read from small sstable.
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(Key(i), Get(Key(i)));
+  }
+  int reads = env_->random_read_counter_.Read();
+  fprintf(stderr, "%d present => %d reads\n", N, reads);
+  ASSERT_GE(reads, N);
+  ASSERT_LE(reads, N + 2*N/100);
+
+  // The filter format is chosen per table, so the existing tables keep
+  // their full-file filters after switching back to per-block filters.
+  env_->delay_sstable_sync_.Release_Store(NULL);
+  options.full_file_filter = false;
+  Reopen(&options);
+  env_->delay_sstable_sync_.Release_Store(env_);
+  env_->random_read_counter_.Reset();
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ("NOT_FOUND", Get(Key(i) + ".missing"));
+  }
+  reads = env_->random_read_counter_.Read();
+  fprintf(stderr, "%d missing => %d reads\n", N, reads);
+  ASSERT_LE(reads, 3*N/100);
+
+  env_->delay_sstable_sync_.Release_Store(NULL);
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+}
+
+TEST(DBTest, CacheIndexAndFilterBlocks) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.filter_policy = NewBloomFilterPolicy(10);
+  Reopen(&options);
+
+  // Three overlapping flushes leave the last and widest file in level-0
+  for (int i = 100; i < 200; i++) {
+    ASSERT_OK(Put(Key(i), Key(i)));
+  }
+  dbfull()->TEST_CompactMemTable();
+  for (int i = 100; i < 200; i++) {
+    ASSERT_OK(Put(Key(i), Key(i)));
+  }
+  dbfull()->TEST_CompactMemTable();
+  for (int i = 0; i < 300; i++) {
+    ASSERT_OK(Put(Key(i), Key(i)));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(1, NumTableFilesAtLevel(0));
+
+  std::string value;
+  ASSERT_EQ(Key(0), Get(Key(0)));
+  ASSERT_TRUE(db_->GetProperty("leveldb.table-meta-memory", &value));
+  ASSERT_NE("0", value);
+
+  // An empty block cache keeps only entries that are in use or pinned
+  env_->count_random_reads_ = true;
+  options.block_cache = NewLRUCache(0);
+  options.cache_index_and_filter_blocks = true;
+  for (int pin = 0; pin < 2; pin++) {
+    options.pin_l0_index_and_filter_blocks = (pin == 1);
+    Reopen(&options);
+    ASSERT_EQ(Key(0), Get(Key(0)));
+    ASSERT_TRUE(db_->GetProperty("leveldb.table-meta-memory", &value));
+    ASSERT_EQ("0", value);
+
+    // Keys below Key(100) are only covered by the level-0 file
+    env_->random_read_counter_.Reset();
+    for (int i = 0; i < 100; i++) {
+      ASSERT_EQ("NOT_FOUND", Get(Key(i) + ".missing"));
+    }
+    const int reads = env_->random_read_counter_.Read();
+    fprintf(stderr, "%s: 100 missing => %d reads\n",
+            pin ? "pinned" : "not pinned", reads);
+    if (pin) {
+      ASSERT_EQ(0, reads);
+      ASSERT_TRUE(db_->GetProperty("leveldb.block-cache-usage", &value));
+      ASSERT_NE("0", value);
+    } else {
+      // Each read fetches the index block and the filter again
+      ASSERT_EQ(200, reads);
+    }
+  }
+
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+}
+
+static std::string PrefixKey(int prefix, int i) {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "%04d.%02d", prefix, i);
+  return std::string(buf);
+}
+
+TEST(DBTest, PrefixFilter) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  options.filter_policy = NewBloomFilterPolicy(10);
+  options.prefix_extractor = NewFixedPrefixExtractor(4);
+  Reopen(&options);
+
+  // Populate two layers with keys for the even prefixes only
+  const int kPrefixes = 400;
+  const int kPerPrefix = 10;
+  for (int p = 0; p < kPrefixes; p += 2) {
+    for (int i = 0; i < kPerPrefix; i++) {
+      ASSERT_OK(Put(PrefixKey(p, i), "v"));
+    }
+  }
+  Compact("0", "9");
+  for (int p = 0; p < kPrefixes; p += 20) {
+    ASSERT_OK(Put(PrefixKey(p, 0), "w"));
+  }
+  dbfull()->TEST_CompactMemTable();
+
+  // Prevent auto compactions triggered by seeks
+  env_->delay_sstable_sync_.Release_Store(env_);
+
+  ReadOptions prefix_options;
+  prefix_options.prefix_same_as_start = true;
+  Iterator* iter = db_->NewIterator(prefix_options);
+
+  // Present prefixes yield exactly their own keys
+  for (int p = 0; p < kPrefixes; p += 2) {
+    const std::string prefix = PrefixKey(p, 0).substr(0, 4);
+    int count = 0;
+    for (iter->Seek(prefix); iter->Valid(); iter->Next()) {
+      ASSERT_EQ(PrefixKey(p, count), iter->key().ToString());
+      count++;
+    }
+    ASSERT_OK(iter->status());
+    ASSERT_EQ(kPerPrefix, count);
+  }
+
+  // Going backwards is not supported
+  iter->Seek("0002");
+  ASSERT_TRUE(iter->Valid());
+  iter->Prev();
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_TRUE(!iter->status().ok());
+  delete iter;
+
+  // Missing prefixes should rarely read a data block.  Use a fresh
+  // iterator per seek so that no block is reused from a previous seek.
+  env_->random_read_counter_.Reset();
+  for (int p = 1; p < kPrefixes; p += 2) {
+    iter = db_->NewIterator(prefix_options);
+    iter->Seek(PrefixKey(p, 0).substr(0, 4));
+    ASSERT_TRUE(!iter->Valid());
+    ASSERT_OK(iter->status());
+    delete iter;
+  }
+  int reads = env_->random_read_counter_.Read();
+  fprintf(stderr, "%d missing prefixes => %d reads\n", kPrefixes / 2, reads);
+  ASSERT_LE(reads, 3 * kPrefixes / 100);
+
+  // Without prefix_same_as_start the same seeks read the tables
+  env_->random_read_counter_.Reset();
+  for (int p = 1; p + 1 < kPrefixes; p += 2) {
+    iter = db_->NewIterator(ReadOptions());
+    iter->Seek(PrefixKey(p, 0).substr(0, 4));
+    ASSERT_EQ(PrefixKey(p + 1, 0), IterStatus(iter).substr(0, 7));
+    delete iter;
+  }
+  reads = env_->random_read_counter_.Read();
+  ASSERT_GE(reads, kPrefixes / 2 - 1);
+
+  // A different extractor must not use the prefixes in existing tables
+  delete options.prefix_extractor;
+  options.prefix_extractor = NewFixedPrefixExtractor(2);
+  Reopen(&options);
+  iter = db_->NewIterator(prefix_options);
+  int count = 0;
+  for (iter->Seek("00"); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  ASSERT_EQ(50 * kPerPrefix, count);
+  delete iter;
+
+  env_->delay_sstable_sync_.Release_Store(NULL);
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+  delete options.prefix_extractor;
+}
+
+TEST(DBTest, IterateUpperBound) {
+  do {
+    ASSERT_OK(Put("a", "va"));
+    ASSERT_OK(Put("b", "vb"));
+    ASSERT_OK(Put("c", "vc"));
+    ASSERT_OK(Put("d", "vd"));
+    for (int pass = 0; pass < 2; pass++) {
+      Slice bound("c");
+      ReadOptions options;
+      options.iterate_upper_bound = &bound;
+      Iterator* iter = db_->NewIterator(options);
+
+      iter->SeekToFirst();
+      ASSERT_EQ(IterStatus(iter), "a->va");
+      iter->Next();
+      ASSERT_EQ(IterStatus(iter), "b->vb");
+      iter->Next();
+      ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+      iter->Seek("bb");
+      ASSERT_EQ(IterStatus(iter), "(invalid)");
+
+      iter->SeekToLast();
+      ASSERT_EQ(IterStatus(iter), "b->vb");
+      iter->Prev();
+      ASSERT_EQ(IterStatus(iter), "a->va");
+      iter->Next();
+      ASSERT_EQ(IterStatus(iter), "b->vb");
+      iter->Next();
+      ASSERT_EQ(IterStatus(iter), "(invalid)");
+      delete iter;
+
+      // Same again with the keys in a table instead of the memtable
+      dbfull()->TEST_CompactMemTable();
+    }
+  } while (ChangeOptions());
+}
+
 // Multi-threaded test:
 namespace {
 
@@ -1788,6 +2177,97 @@ TEST(DBTest, MultiThreaded) {
   } while (ChangeOptions());
 }
 
+namespace {
+
+static const int kWritesPerThread = 3000;
+
+struct GroupWriteState {
+  DB* db;
+  port::Mutex mu;
+  port::CondVar cv;
+  int next_id;
+  int running;
+
+  GroupWriteState() : cv(&mu), next_id(0), running(0) { }
+};
+
+static void GroupWriteBody(void* arg) {
+  GroupWriteState* state = reinterpret_cast<GroupWriteState*>(arg);
+  state->mu.Lock();
+  const int id = state->next_id++;
+  state->mu.Unlock();
+
+  char keybuf[20];
+  char valbuf[200];
+  for (int i = 0; i < kWritesPerThread; i++) {
+    snprintf(keybuf, sizeof(keybuf), "%d.%06d", id, i);
+    snprintf(valbuf, sizeof(valbuf), "%d.%-100d", id, i);
+    if ((i % 3) == 0) {
+      // Batches of several entries, some of them deletions
+      WriteBatch batch;
+      batch.Put(keybuf, valbuf);
+      batch.Put(std::string(keybuf) + "x", valbuf);
+      batch.Delete(std::string(keybuf) + "x");
+      ASSERT_OK(state->db->Write(WriteOptions(), &batch));
+    } else {
+      ASSERT_OK(state->db->Put(WriteOptions(), keybuf, valbuf));
+    }
+  }
+
+  state->mu.Lock();
+  state->running--;
+  state->cv.SignalAll();
+  state->mu.Unlock();
+}
+
+}  // namespace
+
+TEST(DBTest, GroupWriteModes) {
+  // allow_concurrent_memtable_write and enable_pipelined_write
+  const bool kModes[][2] = { { true, false }, { false, true }, { true, true } };
+  for (int mode = 0; mode < 3; mode++) {
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    options.write_buffer_size = 100000;  // Switch memtables while writing
+    options.allow_concurrent_memtable_write = kModes[mode][0];
+    options.enable_pipelined_write = kModes[mode][1];
+    DestroyAndReopen(&options);
+
+    GroupWriteState state;
+    state.db = db_;
+    state.running = kNumThreads;
+    for (int id = 0; id < kNumThreads; id++) {
+      env_->StartThread(GroupWriteBody, &state);
+    }
+    state.mu.Lock();
+    while (state.running > 0) {
+      state.cv.Wait();
+    }
+    state.mu.Unlock();
+
+    // Everything is there, both from the memtables and from the log
+    for (int reopen = 0; reopen < 2; reopen++) {
+      Iterator* iter = db_->NewIterator(ReadOptions());
+      iter->SeekToFirst();
+      for (int id = 0; id < kNumThreads; id++) {
+        for (int i = 0; i < kWritesPerThread; i++) {
+          char keybuf[20];
+          char valbuf[200];
+          snprintf(keybuf, sizeof(keybuf), "%d.%06d", id, i);
+          snprintf(valbuf, sizeof(valbuf), "%d.%-100d", id, i);
+          ASSERT_TRUE(iter->Valid());
+          ASSERT_EQ(keybuf, iter->key().ToString());
+          ASSERT_EQ(valbuf, iter->value().ToString());
+          iter->Next();
+        }
+      }
+      ASSERT_TRUE(!iter->Valid());
+      delete iter;
+      Reopen(&options);
+    }
+  }
+}
+
 namespace {
 typedef std::map<std::string, std::string> KVMap;
 }
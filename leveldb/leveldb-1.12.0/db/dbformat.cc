@@ -106,18 +106,37 @@ void InternalFilterPolicy::CreateFilter(const Slice* keys, int n,
                                         std::string* dst) const {
   // We rely on the fact that the code in table.cc does not mind us
   // adjusting keys[].
+  // Versions of one user key are adjacent, as are the prefixes the
+  // table builder appends after the keys, so suppressing adjacent
+  // duplicates keeps each of them from taking more than one slot.
   Slice* mkey = const_cast<Slice*>(keys);
+  int num_keys = 0;
   for (int i = 0; i < n; i++) {
-    mkey[i] = ExtractUserKey(keys[i]);
-    // TODO(sanjay): Suppress dups?
+    Slice user_key = ExtractUserKey(keys[i]);
+    if (num_keys == 0 || user_key != mkey[num_keys - 1]) {
+      mkey[num_keys++] = user_key;
+    }
   }
-  user_policy_->CreateFilter(keys, n, dst);
+  user_policy_->CreateFilter(keys, num_keys, dst);
 }
 
 bool InternalFilterPolicy::KeyMayMatch(const Slice& key, const Slice& f) const {
   return user_policy_->KeyMayMatch(ExtractUserKey(key), f);
 }
 
+const char* InternalPrefixExtractor::Name() const {
+  return user_extractor_->Name();
+}
+
+bool InternalPrefixExtractor::InDomain(const Slice& key) const {
+  return user_extractor_->InDomain(ExtractUserKey(key));
+}
+
+Slice InternalPrefixExtractor::Transform(const Slice& key) const {
+  Slice prefix = user_extractor_->Transform(ExtractUserKey(key));
+  return Slice(key.data(), prefix.size() + 8);
+}
+
 LookupKey::LookupKey(const Slice& user_key, SequenceNumber s) {
   size_t usize = user_key.size();
   size_t needed = usize + 13;  // A conservative estimate
@@ -9,6 +9,7 @@
 #include "leveldb/comparator.h"
 #include "leveldb/db.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/prefix_extractor.h"
 #include "leveldb/slice.h"
 #include "leveldb/table_builder.h"
 #include "util/coding.h"
@@ -135,6 +136,23 @@ class InternalFilterPolicy : public FilterPolicy {
   virtual bool KeyMayMatch(const Slice& key, const Slice& filter) const;
 };
 
+// Prefix extractor wrapper that converts from internal keys to user keys.
+// Table filters see prefixes through InternalFilterPolicy, which strips
+// the last eight bytes of everything it is given, so the "prefix" of an
+// internal key is the user key prefix followed by the eight bytes after
+// it.  Those bytes vary, but only the user key prefix reaches the filter.
+class InternalPrefixExtractor : public PrefixExtractor {
+ private:
+  const PrefixExtractor* const user_extractor_;
+ public:
+  explicit InternalPrefixExtractor(const PrefixExtractor* e)
+      : user_extractor_(e) { }
+  const PrefixExtractor* user_extractor() const { return user_extractor_; }
+  virtual const char* Name() const;
+  virtual bool InDomain(const Slice& key) const;
+  virtual Slice Transform(const Slice& key) const;
+};
+
 // Modules in this directory should keep internal keys wrapped inside
 // the following class instead of plain strings so that we do not
 // incorrectly use string comparisons instead of an InternalKeyComparator.
@@ -38,6 +38,10 @@ int MemTable::KeyComparator::operator()(const char* aptr, const char* bptr)
   return comparator.Compare(a, b);
 }
 
+Slice MemTable::KeyComparator::DecodeKey(const char* key) const {
+  return GetLengthPrefixedSlice(key);
+}
+
 // Encode a suitable internal key target for "target" and return it.
 // Uses *scratch as scratch space, and the returned pointer will point
 // into this scratch space.
@@ -79,9 +83,14 @@ Iterator* MemTable::NewIterator() {
   return new MemTableIterator(&table_);
 }
 
-void MemTable::Add(SequenceNumber s, ValueType type,
-                   const Slice& key,
-                   const Slice& value) {
+static size_t EncodedEntryLength(const Slice& key, const Slice& value) {
+  size_t internal_key_size = key.size() + 8;
+  return VarintLength(internal_key_size) + internal_key_size +
+      VarintLength(value.size()) + value.size();
+}
+
+static void EncodeEntry(char* buf, SequenceNumber s, ValueType type,
+                        const Slice& key, const Slice& value) {
   // Format of an entry is concatenation of:
   //  key_size     : varint32 of internal_key.size()
   //  key bytes    : char[internal_key.size()]
@@ -90,10 +99,6 @@ void MemTable::Add(SequenceNumber s, ValueType type,
   size_t key_size = key.size();
   size_t val_size = value.size();
   size_t internal_key_size = key_size + 8;
-  const size_t encoded_len =
-      VarintLength(internal_key_size) + internal_key_size +
-      VarintLength(val_size) + val_size;
-  char* buf = arena_.Allocate(encoded_len);
   char* p = EncodeVarint32(buf, internal_key_size);
   memcpy(p, key.data(), key_size);
   p += key_size;
@@ -101,10 +106,25 @@ void MemTable::Add(SequenceNumber s, ValueType type,
   p += 8;
   p = EncodeVarint32(p, val_size);
   memcpy(p, value.data(), val_size);
-  assert((p + val_size) - buf == encoded_len);
+  assert((p + val_size) - buf == EncodedEntryLength(key, value));
+}
+
+void MemTable::Add(SequenceNumber s, ValueType type,
+                   const Slice& key,
+                   const Slice& value) {
+  char* buf = arena_.Allocate(EncodedEntryLength(key, value));
+  EncodeEntry(buf, s, type, key, value);
   table_.Insert(buf);
 }
 
+void MemTable::AddConcurrently(SequenceNumber s, ValueType type,
+                               const Slice& key,
+                               const Slice& value) {
+  char* buf = arena_.AllocateConcurrently(EncodedEntryLength(key, value));
+  EncodeEntry(buf, s, type, key, value);
+  table_.InsertConcurrently(buf);
+}
+
 bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
   Slice memkey = key.memtable_key();
   Table::Iterator iter(&table_);
@@ -38,8 +38,7 @@ class MemTable {
   // Returns an estimate of the number of bytes of data in use by this
   // data structure.
   //
-  // REQUIRES: external synchronization to prevent simultaneous
-  // operations on the same MemTable.
+  // This is safe to call while other threads add entries.
   size_t ApproximateMemoryUsage();
 
   // Return an iterator that yields the contents of the memtable.
@@ -57,6 +56,12 @@ class MemTable {
            const Slice& key,
            const Slice& value);
 
+  // Same as Add(), but may be called by several threads at once.
+  // REQUIRES: Add() is not called at the same time.
+  void AddConcurrently(SequenceNumber seq, ValueType type,
+                       const Slice& key,
+                       const Slice& value);
+
   // If memtable contains a value for key, store it in *value and return true.
   // If memtable contains a deletion for key, store a NotFound() error
   // in *status and return true.
@@ -70,6 +75,7 @@ class MemTable {
     const InternalKeyComparator comparator;
     explicit KeyComparator(const InternalKeyComparator& c) : comparator(c) { }
     int operator()(const char* a, const char* b) const;
+    Slice DecodeKey(const char* key) const;
   };
   friend class MemTableIterator;
   friend class MemTableBackwardIterator;
@@ -49,7 +49,9 @@ class Repairer {
         env_(options.env),
         icmp_(options.comparator),
         ipolicy_(options.filter_policy),
-        options_(SanitizeOptions(dbname, &icmp_, &ipolicy_, options)),
+        iprefix_(options.prefix_extractor),
+        options_(SanitizeOptions(dbname, &icmp_, &ipolicy_, &iprefix_,
+                                 options)),
         owns_info_log_(options_.info_log != options.info_log),
         owns_cache_(options_.block_cache != options.block_cache),
         next_file_number_(1) {
@@ -101,6 +103,7 @@ class Repairer {
   Env* const env_;
   InternalKeyComparator const icmp_;
   InternalFilterPolicy const ipolicy_;
+  InternalPrefixExtractor const iprefix_;
   Options const options_;
   bool owns_info_log_;
   bool owns_cache_;
@@ -265,7 +268,7 @@ class Repairer {
     Status status = env_->GetFileSize(fname, &t->meta.file_size);
     if (status.ok()) {
       Iterator* iter = table_cache_->NewIterator(
-          ReadOptions(), t->meta.number, t->meta.file_size);
+          ReadOptions(), t->meta.number, t->meta.file_size, -1);
       bool empty = true;
       ParsedInternalKey parsed;
       t->max_sequence = 0;
@@ -5,7 +5,9 @@
 // Thread safety
 // -------------
 //
-// Writes require external synchronization, most likely a mutex.
+// Writes require external synchronization, most likely a mutex.  The
+// exception is InsertConcurrently(), which may be called from several
+// threads at once as long as no thread calls Insert() at the same time.
 // Reads require a guarantee that the SkipList will not be destroyed
 // while the read is in progress.  Apart from that, reads progress
 // without any internal locking or synchronization.
@@ -18,16 +20,18 @@
 //
 // (2) The contents of a Node except for the next/prev pointers are
 // immutable after the Node has been linked into the SkipList.
-// Only Insert() modifies the list, and it is careful to initialize
-// a node and use release-stores to publish the nodes in one or
-// more lists.
+// Only Insert() and InsertConcurrently() modify the list, and they
+// are careful to initialize a node and use release-stores (or
+// compare-and-swaps) to publish the nodes in one or more lists.
 //
 // ... prev vs. next pointer ordering ...
 
 #include <assert.h>
 #include <stdlib.h>
+#include "leveldb/slice.h"
 #include "port/port.h"
 #include "util/arena.h"
+#include "util/hash.h"
 #include "util/random.h"
 
 namespace leveldb {
@@ -49,6 +53,16 @@ class SkipList {
   // REQUIRES: nothing that compares equal to key is currently in the list.
   void Insert(const Key& key);
 
+  // Like Insert(), but may be called by several threads at once.  Each
+  // level is linked with a compare-and-swap, from the bottom up, so a
+  // node that is visible at some level is also visible at every level
+  // below it.
+  // REQUIRES: nothing that compares equal to key is in the list, or is
+  // being inserted by another thread.
+  // REQUIRES: Comparator has a "Slice DecodeKey(const Key&) const" method
+  // that returns the contents of a key.
+  void InsertConcurrently(const Key& key);
+
   // Returns true iff an entry that compares equal to key is in the list.
   bool Contains(const Key& key) const;
 
@@ -100,8 +114,8 @@ class SkipList {
 
   Node* const head_;
 
-  // Modified only by Insert().  Read racily by readers, but stale
-  // values are ok.
+  // Modified only by Insert() and InsertConcurrently().  Read racily by
+  // readers, but stale values are ok.
   port::AtomicPointer max_height_;   // Height of the entire list
 
   inline int GetMaxHeight() const {
@@ -113,7 +127,9 @@ class SkipList {
   Random rnd_;
 
   Node* NewNode(const Key& key, int height);
+  Node* NewNodeConcurrently(const Key& key, int height);
   int RandomHeight();
+  int RandomHeightConcurrently(const Key& key) const;
   bool Equal(const Key& a, const Key& b) const { return (compare_(a, b) == 0); }
 
   // Return true if key is greater than the data stored in "n"
@@ -126,6 +142,11 @@ class SkipList {
   // node at "level" for every level in [0..max_height_-1].
   Node* FindGreaterOrEqual(const Key& key, Node** prev) const;
 
+  // Starting at "before", find the nodes that "key" goes between at
+  // "level", and store them in *prev and *next.
+  void FindSpliceForLevel(const Key& key, Node* before, int level,
+                          Node** prev, Node** next) const;
+
   // Return the latest node with a key < key.
   // Return head_ if there is no such node.
   Node* FindLessThan(const Key& key) const;
@@ -171,6 +192,13 @@ struct SkipList<Key,Comparator>::Node {
     next_[n].NoBarrier_Store(x);
   }
 
+  // Link x in at level n if the current successor is still "expected".
+  // Acts as a full barrier, like SetNext().
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return next_[n].CompareAndSwap(expected, x);
+  }
+
  private:
   // Array of length equal to the node height.  next_[0] is lowest level link.
   port::AtomicPointer next_[1];
@@ -184,6 +212,14 @@ SkipList<Key,Comparator>::NewNode(const Key& key, int height) {
   return new (mem) Node(key);
 }
 
+template<typename Key, class Comparator>
+typename SkipList<Key,Comparator>::Node*
+SkipList<Key,Comparator>::NewNodeConcurrently(const Key& key, int height) {
+  char* mem = arena_->AllocateConcurrently(
+      sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
+  return new (mem) Node(key);
+}
+
 template<typename Key, class Comparator>
 inline SkipList<Key,Comparator>::Iterator::Iterator(const SkipList* list) {
   list_ = list;
@@ -249,6 +285,27 @@ int SkipList<Key,Comparator>::RandomHeight() {
   return height;
 }
 
+template<typename Key, class Comparator>
+int SkipList<Key,Comparator>::RandomHeightConcurrently(const Key& key) const {
+  // rnd_ cannot be shared between threads without a lock, so the height
+  // is drawn from a hash of the key's contents instead.  The contents of
+  // the keys in a list are distinct, so their hashes are spread like
+  // random numbers.  Key itself may be a pointer (as in MemTable), so it
+  // is decoded by the comparator first.  Each level uses two of the 32
+  // bits, enough for kMaxHeight.
+  static const unsigned int kBranching = 4;
+  const Slice contents = compare_.DecodeKey(key);
+  uint32_t bits = Hash(contents.data(), contents.size(), 0xdeadbeef);
+  int height = 1;
+  while (height < kMaxHeight && ((bits % kBranching) == 0)) {
+    height++;
+    bits /= kBranching;
+  }
+  assert(height > 0);
+  assert(height <= kMaxHeight);
+  return height;
+}
+
 template<typename Key, class Comparator>
 bool SkipList<Key,Comparator>::KeyIsAfterNode(const Key& key, Node* n) const {
   // NULL n is considered infinite
@@ -277,6 +334,22 @@ typename SkipList<Key,Comparator>::Node* SkipList<Key,Comparator>::FindGreaterOr
   }
 }
 
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::FindSpliceForLevel(const Key& key, Node* before,
+                                                  int level, Node** prev,
+                                                  Node** next) const {
+  Node* x = before;
+  while (true) {
+    Node* n = x->Next(level);
+    if (!KeyIsAfterNode(key, n)) {
+      *prev = x;
+      *next = n;
+      return;
+    }
+    x = n;
+  }
+}
+
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node*
 SkipList<Key,Comparator>::FindLessThan(const Key& key) const {
@@ -366,6 +439,47 @@ void SkipList<Key,Comparator>::Insert(const Key& key) {
   }
 }
 
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::InsertConcurrently(const Key& key) {
+  const int height = RandomHeightConcurrently(key);
+
+  // Raise max_height_ first.  As in Insert(), readers that see the new
+  // height before the node is linked just find NULL at the new levels.
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    if (max_height_.CompareAndSwap(reinterpret_cast<void*>(max_height),
+                                   reinterpret_cast<void*>(height))) {
+      max_height = height;
+      break;
+    }
+    max_height = GetMaxHeight();
+  }
+
+  Node* prev[kMaxHeight + 1];
+  Node* next[kMaxHeight + 1];
+  prev[max_height] = head_;
+  next[max_height] = NULL;
+  for (int i = max_height - 1; i >= 0; i--) {
+    FindSpliceForLevel(key, prev[i + 1], i, &prev[i], &next[i]);
+  }
+
+  // Our data structure does not allow duplicate insertion
+  assert(next[0] == NULL || !Equal(key, next[0]->key));
+
+  Node* x = NewNodeConcurrently(key, height);
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CASNext(i, next[i], x)) {
+        break;
+      }
+      // Another thread linked a node in between; the splice can only
+      // have moved forward from prev[i].
+      FindSpliceForLevel(key, prev[i], i, &prev[i], &next[i]);
+    }
+  }
+}
+
 template<typename Key, class Comparator>
 bool SkipList<Key,Comparator>::Contains(const Key& key) const {
   Node* x = FindGreaterOrEqual(key, NULL);
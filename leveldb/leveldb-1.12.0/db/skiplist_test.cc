@@ -24,6 +24,9 @@ struct Comparator {
       return 0;
     }
   }
+  Slice DecodeKey(const Key& key) const {
+    return Slice(reinterpret_cast<const char*>(&key), sizeof(key));
+  }
 };
 
 class SkipTest { };
@@ -371,6 +374,98 @@ TEST(SkipTest, Concurrent3) { RunConcurrent(3); }
 TEST(SkipTest, Concurrent4) { RunConcurrent(4); }
 TEST(SkipTest, Concurrent5) { RunConcurrent(5); }
 
+// Several threads call InsertConcurrently() on disjoint sets of keys
+// while another thread checks that iteration stays sorted.
+class ConcurrentInsertState {
+ public:
+  static const int kThreads = 4;
+  static const int kPerThread = 20000;
+
+  Arena arena_;
+  SkipList<Key, Comparator> list_;
+  port::AtomicPointer quit_flag_;
+  port::Mutex mu_;
+  port::CondVar cv_;
+  int next_thread_;
+  int running_;
+
+  ConcurrentInsertState()
+      : list_(Comparator(), &arena_),
+        quit_flag_(NULL),
+        cv_(&mu_),
+        next_thread_(0),
+        running_(0) { }
+};
+
+static void ConcurrentInserter(void* arg) {
+  ConcurrentInsertState* state = reinterpret_cast<ConcurrentInsertState*>(arg);
+  state->mu_.Lock();
+  const int id = state->next_thread_++;
+  state->mu_.Unlock();
+
+  // Interleave the keys of all threads so that they race for the
+  // same splices.
+  Random rnd(1000 + id);
+  for (int i = 0; i < ConcurrentInsertState::kPerThread; i++) {
+    const Key k = static_cast<Key>(i) * ConcurrentInsertState::kThreads + id;
+    state->list_.InsertConcurrently((k << 8) | (rnd.Next() & 0xff));
+  }
+
+  state->mu_.Lock();
+  state->running_--;
+  state->cv_.SignalAll();
+  state->mu_.Unlock();
+}
+
+static void SortedReader(void* arg) {
+  ConcurrentInsertState* state = reinterpret_cast<ConcurrentInsertState*>(arg);
+  while (!state->quit_flag_.Acquire_Load()) {
+    SkipList<Key, Comparator>::Iterator iter(&state->list_);
+    Key last = 0;
+    bool first = true;
+    for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+      ASSERT_TRUE(first || last < iter.key());
+      last = iter.key();
+      first = false;
+    }
+  }
+  state->mu_.Lock();
+  state->running_--;
+  state->cv_.SignalAll();
+  state->mu_.Unlock();
+}
+
+TEST(SkipTest, ConcurrentInserts) {
+  ConcurrentInsertState state;
+  state.running_ = ConcurrentInsertState::kThreads + 1;
+  Env::Default()->StartThread(SortedReader, &state);
+  for (int i = 0; i < ConcurrentInsertState::kThreads; i++) {
+    Env::Default()->StartThread(ConcurrentInserter, &state);
+  }
+  state.mu_.Lock();
+  while (state.running_ > 1) {
+    state.cv_.Wait();
+  }
+  state.mu_.Unlock();
+  state.quit_flag_.Release_Store(&state);  // Any non-NULL arg will do
+  state.mu_.Lock();
+  while (state.running_ > 0) {
+    state.cv_.Wait();
+  }
+  state.mu_.Unlock();
+
+  // Every key is present, in order, at every level the search uses
+  int count = 0;
+  SkipList<Key, Comparator>::Iterator iter(&state.list_);
+  for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+    ASSERT_EQ(count, static_cast<int>(iter.key() >> 8));
+    ASSERT_TRUE(state.list_.Contains(iter.key()));
+    count++;
+  }
+  ASSERT_EQ(ConcurrentInsertState::kThreads * ConcurrentInsertState::kPerThread,
+            count);
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -8,16 +8,22 @@
 #include "leveldb/env.h"
 #include "leveldb/table.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
 struct TableAndFile {
   RandomAccessFile* file;
   Table* table;
+  TableCache* owner;
 };
 
-static void DeleteEntry(const Slice& key, void* value) {
+void TableCache::DeleteEntry(const Slice& key, void* value) {
   TableAndFile* tf = reinterpret_cast<TableAndFile*>(value);
+  {
+    MutexLock l(&tf->owner->mutex_);
+    tf->owner->meta_memory_ -= tf->table->MetaMemoryUsage();
+  }
   delete tf->table;
   delete tf->file;
   delete tf;
@@ -35,7 +41,8 @@ TableCache::TableCache(const std::string& dbname,
     : env_(options->env),
       dbname_(dbname),
       options_(options),
-      cache_(NewLRUCache(entries)) {
+      cache_(NewLRUCache(entries)),
+      meta_memory_(0) {
 }
 
 TableCache::~TableCache() {
@@ -43,7 +50,7 @@ TableCache::~TableCache() {
 }
 
 Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
-                             Cache::Handle** handle) {
+                             int level, Cache::Handle** handle) {
   Status s;
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
@@ -67,22 +74,34 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
       TableAndFile* tf = new TableAndFile;
       tf->file = file;
       tf->table = table;
+      tf->owner = this;
+      {
+        MutexLock l(&mutex_);
+        meta_memory_ += table->MetaMemoryUsage();
+      }
       *handle = cache_->Insert(key, tf, 1, &DeleteEntry);
     }
   }
+  if (s.ok() && level == 0 && options_->pin_l0_index_and_filter_blocks) {
+    // Also done for tables that were opened before they were known to
+    // be in level-0; a no-op once pinned.
+    reinterpret_cast<TableAndFile*>(
+        cache_->Value(*handle))->table->PinIndexAndFilter();
+  }
   return s;
 }
 
 Iterator* TableCache::NewIterator(const ReadOptions& options,
                                   uint64_t file_number,
                                   uint64_t file_size,
+                                  int level,
                                   Table** tableptr) {
   if (tableptr != NULL) {
     *tableptr = NULL;
   }
 
   Cache::Handle* handle = NULL;
-  Status s = FindTable(file_number, file_size, &handle);
+  Status s = FindTable(file_number, file_size, level, &handle);
   if (!s.ok()) {
     return NewErrorIterator(s);
   }
@@ -99,11 +118,12 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
 Status TableCache::Get(const ReadOptions& options,
                        uint64_t file_number,
                        uint64_t file_size,
+                       int level,
                        const Slice& k,
                        void* arg,
                        void (*saver)(void*, const Slice&, const Slice&)) {
   Cache::Handle* handle = NULL;
-  Status s = FindTable(file_number, file_size, &handle);
+  Status s = FindTable(file_number, file_size, level, &handle);
   if (s.ok()) {
     Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
     s = t->InternalGet(options, k, arg, saver);
@@ -112,10 +132,46 @@ Status TableCache::Get(const ReadOptions& options,
   return s;
 }
 
+Status TableCache::MultiGet(const ReadOptions& options,
+                            uint64_t file_number,
+                            uint64_t file_size,
+                            int level,
+                            int n,
+                            const Slice* keys,
+                            void* const* args,
+                            void (*saver)(void*, const Slice&, const Slice&)) {
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, level, &handle);
+  if (s.ok()) {
+    Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+    s = t->InternalMultiGet(options, n, keys, args, saver);
+    cache_->Release(handle);
+  }
+  return s;
+}
+
+bool TableCache::PrefixMayMatch(uint64_t file_number,
+                                uint64_t file_size,
+                                const Slice& k) {
+  Cache::Handle* handle = NULL;
+  bool may_match = true;
+  if (FindTable(file_number, file_size, -1, &handle).ok()) {
+    Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+    may_match = Table::PrefixMayMatch(t, k);
+    cache_->Release(handle);
+  }
+  return may_match;
+}
+
 void TableCache::Evict(uint64_t file_number) {
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
   cache_->Erase(Slice(buf, sizeof(buf)));
 }
 
+uint64_t TableCache::MetaMemoryUsage() {
+  MutexLock l(&mutex_);
+  return meta_memory_;
+}
+
 }  // namespace leveldb
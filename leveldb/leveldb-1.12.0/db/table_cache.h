@@ -24,7 +24,10 @@ class TableCache {
   ~TableCache();
 
   // Return an iterator for the specified file number (the corresponding
-  // file length must be exactly "file_size" bytes).  If "tableptr" is
+  // file length must be exactly "file_size" bytes).  "level" is the level
+  // of the file, or -1 if it is not known; with
+  // Options::pin_l0_index_and_filter_blocks, the index block and filter
+  // of level-0 files are pinned in the block cache.  If "tableptr" is
   // non-NULL, also sets "*tableptr" to point to the Table object
   // underlying the returned iterator, or NULL if no Table object underlies
   // the returned iterator.  The returned "*tableptr" object is owned by
@@ -33,27 +36,59 @@ class TableCache {
   Iterator* NewIterator(const ReadOptions& options,
                         uint64_t file_number,
                         uint64_t file_size,
+                        int level,
                         Table** tableptr = NULL);
 
   // If a seek to internal key "k" in specified file finds an entry,
-  // call (*handle_result)(arg, found_key, found_value).
+  // call (*handle_result)(arg, found_key, found_value).  "level" is as
+  // for NewIterator().
   Status Get(const ReadOptions& options,
              uint64_t file_number,
              uint64_t file_size,
+             int level,
              const Slice& k,
              void* arg,
              void (*handle_result)(void*, const Slice&, const Slice&));
 
+  // Same as Get() for each of the "n" internal keys in keys[], which
+  // must be sorted, passing args[i] along with the entry found for
+  // keys[i].  The file is looked up in the cache only once.
+  Status MultiGet(const ReadOptions& options,
+                  uint64_t file_number,
+                  uint64_t file_size,
+                  int level,
+                  int n,
+                  const Slice* keys,
+                  void* const* args,
+                  void (*handle_result)(void*, const Slice&, const Slice&));
+
+  // Return false if the filters of the specified file show that no
+  // entry at or after internal key "k" shares k's prefix (see
+  // Options::prefix_extractor).  Errors opening the file yield true so
+  // that they surface through the regular read path.
+  bool PrefixMayMatch(uint64_t file_number,
+                      uint64_t file_size,
+                      const Slice& k);
+
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
+  // Return the memory held by the open tables for index blocks and
+  // filters, not counting those kept in Options::block_cache.
+  uint64_t MetaMemoryUsage();
+
  private:
   Env* const env_;
   const std::string dbname_;
   const Options* options_;
   Cache* cache_;
 
-  Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
+  port::Mutex mutex_;
+  uint64_t meta_memory_;  // Sum of MetaMemoryUsage() of the open tables
+
+  Status FindTable(uint64_t file_number, uint64_t file_size, int level,
+                   Cache::Handle**);
+  static void DeleteEntry(const Slice& key, void* value);
 };
 
 }  // namespace leveldb
@@ -14,6 +14,7 @@
 #include "leveldb/env.h"
 #include "leveldb/table_builder.h"
 #include "table/merger.h"
+#include "table/prefix_filter_iterator.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
 #include "util/logging.h"
@@ -225,24 +226,70 @@ static Iterator* GetFileIterator(void* arg,
   } else {
     return cache->NewIterator(options,
                               DecodeFixed64(file_value.data()),
-                              DecodeFixed64(file_value.data() + 8));
+                              DecodeFixed64(file_value.data() + 8),
+                              -1);
   }
 }
 
+namespace {
+// The files of one level, for LevelPrefixMayMatch()
+struct LevelPrefixFilter {
+  const InternalKeyComparator* icmp;
+  const std::vector<FileMetaData*>* files;
+  TableCache* table_cache;
+};
+}
+static bool LevelPrefixMayMatch(void* arg, const Slice& ikey) {
+  const LevelPrefixFilter* filter = reinterpret_cast<LevelPrefixFilter*>(arg);
+  const std::vector<FileMetaData*>& files = *filter->files;
+  // Files in a level are disjoint, so the first entry >= ikey is in the
+  // first file whose largest key is >= ikey.
+  const uint32_t index = FindFile(*filter->icmp, files, ikey);
+  if (index >= files.size()) {
+    return true;  // Past the end of the level; seeking reads nothing
+  }
+  return filter->table_cache->PrefixMayMatch(files[index]->number,
+                                             files[index]->file_size, ikey);
+}
+static void DeleteLevelPrefixFilter(void* arg, void* ignored) {
+  delete reinterpret_cast<LevelPrefixFilter*>(arg);
+}
+
 Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
                                             int level) const {
-  return NewTwoLevelIterator(
+  Iterator* iter = NewTwoLevelIterator(
       new LevelFileNumIterator(vset_->icmp_, &files_[level]),
       &GetFileIterator, vset_->table_cache_, options);
+  if (options.prefix_same_as_start &&
+      vset_->options_->prefix_extractor != NULL) {
+    // Check the prefix against the one file a seek lands in before
+    // opening it, so that the concatenating iterator does not move on
+    // to the next file when the table-level filter rejects the seek.
+    LevelPrefixFilter* filter = new LevelPrefixFilter;
+    filter->icmp = &vset_->icmp_;
+    filter->files = &files_[level];
+    filter->table_cache = vset_->table_cache_;
+    iter = NewPrefixFilterIterator(iter, &LevelPrefixMayMatch, filter);
+    iter->RegisterCleanup(&DeleteLevelPrefixFilter, filter, NULL);
+  }
+  return iter;
 }
 
 void Version::AddIterators(const ReadOptions& options,
                            std::vector<Iterator*>* iters) {
+  // Files that start at or after the upper bound cannot contribute
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  const Slice* upper_bound = options.iterate_upper_bound;
+
   // Merge all level zero files together since they may overlap
   for (size_t i = 0; i < files_[0].size(); i++) {
+    if (upper_bound != NULL &&
+        ucmp->Compare(files_[0][i]->smallest.user_key(), *upper_bound) >= 0) {
+      continue;
+    }
     iters->push_back(
         vset_->table_cache_->NewIterator(
-            options, files_[0][i]->number, files_[0][i]->file_size));
+            options, files_[0][i]->number, files_[0][i]->file_size, 0));
   }
 
   // For levels > 0, we can use a concatenating iterator that sequentially
@@ -250,6 +297,11 @@ void Version::AddIterators(const ReadOptions& options,
   // lazily.
   for (int level = 1; level < config::kNumLevels; level++) {
     if (!files_[level].empty()) {
+      if (upper_bound != NULL &&
+          ucmp->Compare(files_[level][0]->smallest.user_key(),
+                        *upper_bound) >= 0) {
+        continue;
+      }
       iters->push_back(NewConcatenatingIterator(options, level));
     }
   }
@@ -365,7 +417,7 @@ Status Version::Get(const ReadOptions& options,
       saver.ucmp = ucmp;
       saver.user_key = user_key;
       saver.value = value;
-      s = vset_->table_cache_->Get(options, f->number, f->file_size,
+      s = vset_->table_cache_->Get(options, f->number, f->file_size, level,
                                    ikey, &saver, SaveValue);
       if (!s.ok()) {
         return s;
@@ -388,6 +440,148 @@ Status Version::Get(const ReadOptions& options,
   return Status::NotFound(Slice());  // Use an empty error message for speed
 }
 
+void Version::MultiGet(const ReadOptions& options, int n,
+                       const LookupKey* const* keys,
+                       std::string* const* values, Status* statuses,
+                       GetStats* stats) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+
+  // Keys that are still being looked up, in order
+  std::vector<int> pending;
+  std::vector<FileMetaData*> last_file_read(n, NULL);
+  std::vector<int> last_file_read_level(n, -1);
+  std::vector<Saver> savers(n);
+  for (int i = 0; i < n; i++) {
+    stats[i].seek_file = NULL;
+    stats[i].seek_file_level = -1;
+    savers[i].ucmp = ucmp;
+    savers[i].user_key = keys[i]->user_key();
+    savers[i].value = values[i];
+    pending.push_back(i);
+  }
+
+  // Keys to look up in one file
+  std::vector<int> batch;
+  std::vector<Slice> batch_keys;
+  std::vector<void*> batch_args;
+
+  std::vector<FileMetaData*> tmp;
+  for (int level = 0; level < config::kNumLevels && !pending.empty();
+       level++) {
+    const std::vector<FileMetaData*>& files = files_[level];
+    if (files.empty()) continue;
+
+    // Files of this level, and for each of them, the first key in
+    // pending and the number of keys that may be in it.  Level-0 files
+    // may overlap each other, so they are searched from newest to
+    // oldest, each for every key in its range.  Other levels are
+    // disjoint, so the keys are simply split between the files.
+    std::vector<FileMetaData*> level_files;
+    std::vector<std::pair<size_t, size_t> > ranges;
+    if (level == 0) {
+      tmp = files;
+      std::sort(tmp.begin(), tmp.end(), NewestFirst);
+      for (size_t f = 0; f < tmp.size(); f++) {
+        level_files.push_back(tmp[f]);
+        ranges.push_back(std::make_pair(size_t(0), pending.size()));
+      }
+    } else {
+      size_t k = 0;
+      while (k < pending.size()) {
+        uint32_t index = FindFile(vset_->icmp_, files,
+                                  keys[pending[k]]->internal_key());
+        if (index >= files.size()) {
+          break;  // This key and all later ones are past the last file
+        }
+        // All the keys share one sequence number, so they are sorted as
+        // internal keys too, and the ones in files[index] are adjacent.
+        FileMetaData* f = files[index];
+        size_t start = k;
+        do {
+          k++;
+        } while (k < pending.size() &&
+                 vset_->icmp_.Compare(keys[pending[k]]->internal_key(),
+                                      f->largest.Encode()) <= 0);
+        level_files.push_back(f);
+        ranges.push_back(std::make_pair(start, k - start));
+      }
+    }
+
+    // Keys that have been found, deleted or failed in this level
+    std::vector<bool> done(n, false);
+    for (size_t f = 0; f < level_files.size(); f++) {
+      FileMetaData* file = level_files[f];
+      batch.clear();
+      batch_keys.clear();
+      batch_args.clear();
+      const size_t end = ranges[f].first + ranges[f].second;
+      for (size_t k = ranges[f].first; k < end; k++) {
+        const int i = pending[k];
+        Slice user_key = keys[i]->user_key();
+        if (done[i] ||
+            ucmp->Compare(user_key, file->smallest.user_key()) < 0 ||
+            ucmp->Compare(user_key, file->largest.user_key()) > 0) {
+          continue;
+        }
+        if (last_file_read[i] != NULL && stats[i].seek_file == NULL) {
+          // We have had more than one seek for this read.  Charge the 1st
+          // file.
+          stats[i].seek_file = last_file_read[i];
+          stats[i].seek_file_level = last_file_read_level[i];
+        }
+        last_file_read[i] = file;
+        last_file_read_level[i] = level;
+        savers[i].state = kNotFound;
+        batch.push_back(i);
+        batch_keys.push_back(keys[i]->internal_key());
+        batch_args.push_back(&savers[i]);
+      }
+      if (batch.empty()) continue;
+
+      Status s = vset_->table_cache_->MultiGet(
+          options, file->number, file->file_size, level, batch.size(),
+          &batch_keys[0], &batch_args[0], SaveValue);
+      for (size_t b = 0; b < batch.size(); b++) {
+        const int i = batch[b];
+        if (!s.ok()) {
+          statuses[i] = s;
+          done[i] = true;
+          continue;
+        }
+        switch (savers[i].state) {
+          case kNotFound:
+            break;      // Keep searching in other files
+          case kFound:
+            statuses[i] = Status::OK();
+            done[i] = true;
+            break;
+          case kDeleted:
+            statuses[i] = Status::NotFound(Slice());
+            done[i] = true;
+            break;
+          case kCorrupt:
+            statuses[i] = Status::Corruption("corrupted key for ",
+                                             savers[i].user_key);
+            done[i] = true;
+            break;
+        }
+      }
+    }
+
+    size_t remaining = 0;
+    for (size_t k = 0; k < pending.size(); k++) {
+      if (!done[pending[k]]) {
+        pending[remaining++] = pending[k];
+      }
+    }
+    pending.resize(remaining);
+  }
+
+  for (size_t k = 0; k < pending.size(); k++) {
+    statuses[pending[k]] = Status::NotFound(Slice());
+  }
+}
+
 bool Version::UpdateStats(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
   if (f != NULL) {
@@ -975,6 +1169,7 @@ void VersionSet::Finalize(Version* v) {
       score = static_cast<double>(level_bytes) / MaxBytesForLevel(level);
     }
 
+    v->level_scores_[level] = score;
     if (score > best_score) {
       best_level = level;
       best_score = score;
@@ -1082,7 +1277,8 @@ uint64_t VersionSet::ApproximateOffsetOf(Version* v, const InternalKey& ikey) {
         // approximate offset of "ikey" within the table.
         Table* tableptr;
         Iterator* iter = table_cache_->NewIterator(
-            ReadOptions(), files[i]->number, files[i]->file_size, &tableptr);
+            ReadOptions(), files[i]->number, files[i]->file_size, level,
+            &tableptr);
         if (tableptr != NULL) {
           result += tableptr->ApproximateOffsetOf(ikey.Encode());
         }
@@ -1183,7 +1379,7 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
         const std::vector<FileMetaData*>& files = c->inputs_[which];
         for (size_t i = 0; i < files.size(); i++) {
           list[num++] = table_cache_->NewIterator(
-              options, files[i]->number, files[i]->file_size);
+              options, files[i]->number, files[i]->file_size, 0);
         }
       } else {
         // Create concatenating iterator for the files from this level
@@ -1199,16 +1395,34 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   return result;
 }
 
-Compaction* VersionSet::PickCompaction() {
+Compaction* VersionSet::PickCompaction(const bool* busy_levels) {
   Compaction* c;
   int level;
 
+  // Pick the level with the highest score that no ongoing compaction
+  // is using.  Without busy levels this is compaction_level_.
+  int size_level = -1;
+  for (level = 0; level + 1 < config::kNumLevels; level++) {
+    if (busy_levels != NULL && (busy_levels[level] || busy_levels[level+1])) {
+      continue;
+    }
+    const double score = current_->level_scores_[level];
+    if (score >= 1 &&
+        (size_level < 0 || score > current_->level_scores_[size_level])) {
+      size_level = level;
+    }
+  }
+
   // We prefer compactions triggered by too much data in a level over
   // the compactions triggered by seeks.
-  const bool size_compaction = (current_->compaction_score_ >= 1);
-  const bool seek_compaction = (current_->file_to_compact_ != NULL);
+  const bool size_compaction = (size_level >= 0);
+  const bool seek_compaction =
+      (current_->file_to_compact_ != NULL &&
+       (busy_levels == NULL ||
+        (!busy_levels[current_->file_to_compact_level_] &&
+         !busy_levels[current_->file_to_compact_level_ + 1])));
   if (size_compaction) {
-    level = current_->compaction_level_;
+    level = size_level;
     assert(level >= 0);
     assert(level+1 < config::kNumLevels);
     c = new Compaction(level);
@@ -1358,12 +1572,15 @@ Compaction* VersionSet::CompactRange(
 Compaction::Compaction(int level)
     : level_(level),
       max_output_file_size_(MaxFileSizeForLevel(level)),
-      input_version_(NULL),
-      grandparent_index_(0),
-      seen_key_(false),
-      overlapped_bytes_(0) {
+      input_version_(NULL) {
+}
+
+Compaction::KeyState::KeyState()
+    : grandparent_index(0),
+      seen_key(false),
+      overlapped_bytes(0) {
   for (int i = 0; i < config::kNumLevels; i++) {
-    level_ptrs_[i] = 0;
+    level_ptrs[i] = 0;
   }
 }
 
@@ -1390,13 +1607,13 @@ void Compaction::AddInputDeletions(VersionEdit* edit) {
   }
 }
 
-bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
+bool Compaction::IsBaseLevelForKey(const Slice& user_key, KeyState* state) {
   // Maybe use binary search to find right entry instead of linear search?
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
   for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
     const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    for (; level_ptrs_[lvl] < files.size(); ) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
+    for (; state->level_ptrs[lvl] < files.size(); ) {
+      FileMetaData* f = files[state->level_ptrs[lvl]];
       if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
         // We've advanced far enough
         if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
@@ -1405,28 +1622,30 @@ bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
         }
         break;
       }
-      level_ptrs_[lvl]++;
+      state->level_ptrs[lvl]++;
     }
   }
   return true;
 }
 
-bool Compaction::ShouldStopBefore(const Slice& internal_key) {
+bool Compaction::ShouldStopBefore(const Slice& internal_key, KeyState* state) {
   // Scan to find earliest grandparent file that contains key.
   const InternalKeyComparator* icmp = &input_version_->vset_->icmp_;
-  while (grandparent_index_ < grandparents_.size() &&
-      icmp->Compare(internal_key,
-                    grandparents_[grandparent_index_]->largest.Encode()) > 0) {
-    if (seen_key_) {
-      overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
+  while (state->grandparent_index < grandparents_.size()) {
+    const FileMetaData* f = grandparents_[state->grandparent_index];
+    if (icmp->Compare(internal_key, f->largest.Encode()) <= 0) {
+      break;
+    }
+    if (state->seen_key) {
+      state->overlapped_bytes += f->file_size;
     }
-    grandparent_index_++;
+    state->grandparent_index++;
   }
-  seen_key_ = true;
+  state->seen_key = true;
 
-  if (overlapped_bytes_ > kMaxGrandParentOverlapBytes) {
+  if (state->overlapped_bytes > kMaxGrandParentOverlapBytes) {
     // Too much overlap for current output; start new output
-    overlapped_bytes_ = 0;
+    state->overlapped_bytes = 0;
     return true;
   } else {
     return false;
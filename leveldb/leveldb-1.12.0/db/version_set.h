@@ -73,6 +73,16 @@ class Version {
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
              GetStats* stats);
 
+  // Same as calling Get(options, *keys[i], values[i], &stats[i]) for
+  // each i in [0,n-1] and storing the result in statuses[i], but each
+  // file is searched once for all the keys that may be in it.
+  // REQUIRES: keys[] are sorted by user key and have the same sequence
+  // number
+  // REQUIRES: lock is not held
+  void MultiGet(const ReadOptions&, int n, const LookupKey* const* keys,
+                std::string* const* values, Status* statuses,
+                GetStats* stats);
+
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
   // REQUIRES: lock is held
@@ -132,12 +142,19 @@ class Version {
   double compaction_score_;
   int compaction_level_;
 
+  // Compaction score of every level, so that a level can still be
+  // picked while a better one is busy with another compaction.
+  double level_scores_[config::kNumLevels];
+
   explicit Version(VersionSet* vset)
       : vset_(vset), next_(this), prev_(this), refs_(0),
         file_to_compact_(NULL),
         file_to_compact_level_(-1),
         compaction_score_(-1),
         compaction_level_(-1) {
+    for (int level = 0; level < config::kNumLevels; level++) {
+      level_scores_[level] = -1;
+    }
   }
 
   ~Version();
@@ -213,7 +230,11 @@ class VersionSet {
   // Returns NULL if there is no compaction to be done.
   // Otherwise returns a pointer to a heap-allocated object that
   // describes the compaction.  Caller should delete the result.
-  Compaction* PickCompaction();
+  //
+  // If "busy_levels" is non-NULL, busy_levels[L] is true for every
+  // level L that an ongoing compaction reads or writes, and only
+  // compactions that touch neither of their two levels are picked.
+  Compaction* PickCompaction(const bool* busy_levels);
 
   // Return a compaction object for compacting the range [begin,end] in
   // the specified level.  Returns NULL if there is nothing in that
@@ -334,14 +355,32 @@ class Compaction {
   // Add all inputs to this compaction as delete operations to *edit.
   void AddInputDeletions(VersionEdit* edit);
 
+  // Position of a stream of keys, in increasing order, within the
+  // grandparent files and the levels below the compaction.  Every
+  // subcompaction walks its own key range and keeps its own state.
+  struct KeyState {
+    size_t grandparent_index;  // Index in grandparents_
+    bool seen_key;             // Some output key has been seen
+    int64_t overlapped_bytes;  // Bytes of overlap between current output
+                               // and grandparent files
+
+    // level_ptrs holds indices into input_version_->levels_: our state
+    // is that we are positioned at one of the file ranges for each
+    // higher level than the ones involved in this compaction (i.e. for
+    // all L >= level_ + 2).
+    size_t level_ptrs[config::kNumLevels];
+
+    KeyState();
+  };
+
   // Returns true if the information we have available guarantees that
   // the compaction is producing data in "level+1" for which no data exists
   // in levels greater than "level+1".
-  bool IsBaseLevelForKey(const Slice& user_key);
+  bool IsBaseLevelForKey(const Slice& user_key, KeyState* state);
 
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
-  bool ShouldStopBefore(const Slice& internal_key);
+  bool ShouldStopBefore(const Slice& internal_key, KeyState* state);
 
   // Release the input version for the compaction, once the compaction
   // is successful.
@@ -361,21 +400,9 @@ class Compaction {
   // Each compaction reads inputs from "level_" and "level_+1"
   std::vector<FileMetaData*> inputs_[2];      // The two sets of inputs
 
-  // State used to check for number of of overlapping grandparent files
+  // Files used to check for number of of overlapping grandparent files
   // (parent == level_ + 1, grandparent == level_ + 2)
   std::vector<FileMetaData*> grandparents_;
-  size_t grandparent_index_;  // Index in grandparent_starts_
-  bool seen_key_;             // Some output key has been seen
-  int64_t overlapped_bytes_;  // Bytes of overlap between current output
-                              // and grandparent files
-
-  // State for implementing IsBaseLevelForKey
-
-  // level_ptrs_ holds indices into input_version_->levels_: our state
-  // is that we are positioned at one of the file ranges for each
-  // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
-  size_t level_ptrs_[config::kNumLevels];
 };
 
 }  // namespace leveldb
@@ -105,6 +105,21 @@ extern char* leveldb_get(
     size_t* vallen,
     char** errptr);
 
+/* Looks up num_keys keys from a single snapshot.  For each i,
+   values_list[i] is set to NULL if keys_list[i] is not found, and to a
+   malloc()ed array otherwise, whose length is stored in
+   values_list_sizes[i].  If some lookup fails, its value is NULL and
+   the error is stored in *errptr. */
+extern void leveldb_multiget(
+    leveldb_t* db,
+    const leveldb_readoptions_t* options,
+    size_t num_keys,
+    const char* const* keys_list,
+    const size_t* keys_list_sizes,
+    char** values_list,
+    size_t* values_list_sizes,
+    char** errptr);
+
 extern leveldb_iterator_t* leveldb_create_iterator(
     leveldb_t* db,
     const leveldb_readoptions_t* options);
@@ -10,8 +10,8 @@
 // length strings, may use the length of the string as the charge for
 // the string.
 //
-// A builtin cache implementation with a least-recently-used eviction
-// policy is provided.  Clients may use their own implementations if
+// Builtin cache implementations with a least-recently-used and a CLOCK
+// eviction policy are provided.  Clients may use their own implementations if
 // they want something more sophisticated (like scan-resistance, a
 // custom eviction policy, variable cache sizing, etc.)
 
@@ -29,6 +29,19 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// Create a new cache with a fixed size capacity.  This implementation
+// of Cache uses the CLOCK eviction policy, an approximation of
+// least-recently-used in which Lookup() and Release() never block,
+// and it is split into more shards on machines with more cores.  It
+// scales better than NewLRUCache() when many threads share the cache.
+//
+// Entries are kept in hash tables that cannot grow.  They are sized
+// for "capacity" worth of entries whose charge is
+// "estimated_entry_charge" (for a block cache, Options::block_size is
+// a good estimate); if the typical charge is smaller than that, entries
+// are evicted before the capacity is reached.
+extern Cache* NewClockCache(size_t capacity, size_t estimated_entry_charge);
+
 class Cache {
  public:
   Cache() { }
@@ -52,6 +65,21 @@ class Cache {
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) = 0;
 
+  enum Priority {
+    kLow,
+    kHigh
+  };
+
+  // Like the Insert() above, but entries inserted with kHigh priority
+  // are retained in preference to kLow ones.  The builtin caches keep
+  // up to half of their capacity for high priority entries (LRU) or
+  // give them a head start in the eviction order (CLOCK).
+  //
+  // The default implementation ignores "priority".
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority);
+
   // If the cache has no mapping for "key", returns NULL.
   //
   // Else return a handle that corresponds to the mapping.  The caller
@@ -81,6 +109,12 @@ class Cache {
   // its cache keys.
   virtual uint64_t NewId() = 0;
 
+  // Return an estimate of the combined charges of all elements stored in
+  // the cache, including those that are only kept alive by outstanding
+  // handles.  The default implementation returns 0, for caches that
+  // don't keep track of charges.
+  virtual size_t TotalCharge() const;
+
  private:
   void LRU_Remove(Handle* e);
   void LRU_Append(Handle* e);
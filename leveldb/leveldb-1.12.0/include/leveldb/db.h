@@ -7,6 +7,8 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string>
+#include <vector>
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
 
@@ -83,6 +85,18 @@ class DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // Look up all of "keys" at once, from a single snapshot of the
+  // database.  On return, values->size() and statuses->size() equal
+  // keys.size(), and (*values)[i] and (*statuses)[i] hold what Get()
+  // would have returned for keys[i].  Cheaper than that many Get()
+  // calls when the keys share tables or blocks.
+  //
+  // The default implementation calls Get() for each key.
+  virtual void MultiGet(const ReadOptions& options,
+                        const std::vector<Slice>& keys,
+                        std::vector<std::string>* values,
+                        std::vector<Status>* statuses);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -115,6 +129,11 @@ class DB {
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
+  //  "leveldb.block-cache-usage" - returns the combined charge of the
+  //     entries in options.block_cache, which may be shared with other DBs.
+  //  "leveldb.table-meta-memory" - returns the approximate number of bytes
+  //     held by open tables for index blocks and filters that are not
+  //     kept in the block cache (see cache_index_and_filter_blocks).
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -125,6 +125,22 @@ class Env {
       void (*function)(void* arg),
       void* arg) = 0;
 
+  // Background work is queued in one of two pools.  Work in the HIGH
+  // pool (e.g. memtable flushes) never waits behind work queued in the
+  // LOW pool (e.g. compactions).  Schedule() queues in the LOW pool.
+  enum Priority { LOW, HIGH };
+
+  // Like Schedule(), but queues the work in the pool for "pri".
+  // The default implementation ignores "pri" and calls Schedule().
+  virtual void ScheduleWithPriority(void (*function)(void* arg),
+                                    void* arg,
+                                    Priority pri);
+
+  // Make sure the pool for "pri" may run at least "number" work items
+  // at the same time.  Pools never shrink.  The default implementation
+  // does nothing.
+  virtual void SetBackgroundThreads(int number, Priority pri);
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
@@ -309,6 +325,12 @@ class EnvWrapper : public Env {
   void Schedule(void (*f)(void*), void* a) {
     return target_->Schedule(f, a);
   }
+  void ScheduleWithPriority(void (*f)(void*), void* a, Priority pri) {
+    return target_->ScheduleWithPriority(f, a, pri);
+  }
+  void SetBackgroundThreads(int number, Priority pri) {
+    return target_->SetBackgroundThreads(number, pri);
+  }
   void StartThread(void (*f)(void*), void* a) {
     return target_->StartThread(f, a);
   }
@@ -14,6 +14,8 @@ class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class PrefixExtractor;
+class Slice;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -97,6 +99,35 @@ struct Options {
   // Default: NULL
   Cache* block_cache;
 
+  // If non-NULL, data blocks are also cached here in the form in which
+  // they are stored in the file, i.e. compressed if compression is
+  // enabled.  A block that misses in block_cache is then uncompressed
+  // from this cache instead of being read from the file.  Compressed
+  // blocks are typically several times smaller than uncompressed ones,
+  // so this cache can hold a much larger part of the database in the
+  // same amount of memory, at the cost of uncompressing on every hit.
+  // Blocks of files that serve reads from memory (e.g. mmap) are not
+  // cached here.
+  // Default: NULL
+  Cache* compressed_block_cache;
+
+  // If true, the index block and filter of each table are kept in
+  // block_cache with Cache::kHigh priority instead of in memory owned by
+  // the open table.  They are then charged against the capacity of
+  // block_cache and evicted when they are not used, so the memory held
+  // by open tables stays bounded even with a large max_open_files.
+  //
+  // Default: false
+  bool cache_index_and_filter_blocks;
+
+  // If true, and cache_index_and_filter_blocks is set, the index block
+  // and filter of each level-0 table are pinned in block_cache while the
+  // table is open.  Reads may have to consult every level-0 table, so
+  // this keeps them from paying for a cache miss on the index.
+  //
+  // Default: false
+  bool pin_l0_index_and_filter_blocks;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -135,6 +166,57 @@ struct Options {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // If non-NULL and filter_policy is also non-NULL, the prefix of each
+  // key (as defined by this extractor) is added to the filters as well,
+  // which lets iterators opened with ReadOptions::prefix_same_as_start
+  // skip tables and blocks that contain no key with the sought prefix.
+  // See leveldb/prefix_extractor.h.
+  //
+  // Default: NULL
+  const PrefixExtractor* prefix_extractor;
+
+  // If true, each table gets a single filter covering all of its keys
+  // instead of one filter per 2KB of data blocks.  A lookup can then
+  // consult the filter before searching the index block.  Pair this
+  // with NewBlockedBloomFilterPolicy() so that a probe touches a single
+  // cache line of the larger filter.  The choice is recorded in each
+  // table, so it may differ between tables of one database.
+  //
+  // Default: false
+  bool full_file_filter;
+
+  // Maximum number of compactions that may run at the same time.  With
+  // more than one, memtable flushes get their own HIGH priority thread
+  // (see Env::ScheduleWithPriority) and compactions that touch disjoint
+  // levels run in parallel on the LOW priority pool, which is grown to
+  // this many threads.  With one, all background work is done by a
+  // single thread, as before.
+  //
+  // Default: 1
+  int max_background_compactions;
+
+  // Maximum number of threads a single compaction may be split into.
+  // A large compaction is cut into key ranges at the boundaries of its
+  // input files, and the ranges are merged in parallel.
+  //
+  // Default: 1
+  int max_subcompactions;
+
+  // If true, the writers in a group (see DB::Write) insert their own
+  // batches into the memtable at the same time, once the group leader
+  // has appended the group to the log.  If false, the leader inserts
+  // the whole group by itself.
+  //
+  // Default: false
+  bool allow_concurrent_memtable_write;
+
+  // If true, the log append for one write group overlaps the memtable
+  // insertion of the group before it.  Writes become visible in the
+  // same order as without pipelining.
+  //
+  // Default: false
+  bool enable_pipelined_write;
+
   // Create an Options object with default values for all fields.
   Options();
 };
@@ -158,10 +240,29 @@ struct ReadOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // If non-NULL, iterators treat "*iterate_upper_bound" as the end of
+  // the key space: forward iteration stops at the first key that is
+  // >= the bound, and SeekToLast() positions at the last key before
+  // it.  The pointed-to Slice must stay live while iterators created
+  // with these options are in use.
+  // Default: NULL
+  const Slice* iterate_upper_bound;
+
+  // If true and Options::prefix_extractor is set, an iterator positioned
+  // by Seek(target) only returns keys that share target's prefix, and
+  // tables whose filters rule out that prefix are not read at all.
+  // SeekToFirst() is not restricted to a prefix.  Prev() and
+  // SeekToLast() are not supported and leave the iterator invalid
+  // with a NotSupported status.
+  // Default: false
+  bool prefix_same_as_start;
+
   ReadOptions()
       : verify_checksums(false),
         fill_cache(true),
-        snapshot(NULL) {
+        snapshot(NULL),
+        iterate_upper_bound(NULL),
+        prefix_same_as_start(false) {
   }
 };
 
@@ -0,0 +1,51 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A PrefixExtractor maps a key to a prefix of that key.  When one is
+// supplied in Options::prefix_extractor, the prefix of every key is
+// added to the table filters next to the key itself, so that an
+// iterator opened with ReadOptions::prefix_same_as_start can skip
+// tables and blocks that hold no key with the prefix it is scanning.
+//
+// Keys that share a prefix must be adjacent in the order defined by
+// Options::comparator (true of the bytewise comparator for any
+// extractor that returns a leading substring of the key).
+
+#ifndef STORAGE_LEVELDB_INCLUDE_PREFIX_EXTRACTOR_H_
+#define STORAGE_LEVELDB_INCLUDE_PREFIX_EXTRACTOR_H_
+
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class PrefixExtractor {
+ public:
+  virtual ~PrefixExtractor();
+
+  // The name of the extractor.  It is recorded in every table built
+  // with the extractor, and prefix filters are only consulted when the
+  // name matches the one in the options used to read the table, so the
+  // name must change whenever the mapping from keys to prefixes does.
+  virtual const char* Name() const = 0;
+
+  // Return true iff "key" has a prefix.  Keys outside the domain are
+  // stored normally but contribute nothing to the prefix filters.
+  virtual bool InDomain(const Slice& key) const = 0;
+
+  // Return the prefix of "key", which must be a leading substring of
+  // "key" (i.e. the result points into key.data()).
+  // REQUIRES: InDomain(key)
+  virtual Slice Transform(const Slice& key) const = 0;
+};
+
+// Return a new extractor whose prefix is the first "prefix_len" bytes of
+// the key.  Keys shorter than "prefix_len" are outside its domain.
+//
+// Callers must delete the result after any database that is using the
+// result has been closed.
+extern const PrefixExtractor* NewFixedPrefixExtractor(size_t prefix_len);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_PREFIX_EXTRACTOR_H_
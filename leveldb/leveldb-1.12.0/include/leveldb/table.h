@@ -6,12 +6,15 @@
 #define STORAGE_LEVELDB_INCLUDE_TABLE_H_
 
 #include <stdint.h>
+#include "leveldb/cache.h"
 #include "leveldb/iterator.h"
 
 namespace leveldb {
 
 class Block;
+struct BlockContents;
 class BlockHandle;
+class FilterBlockReader;
 class Footer;
 struct Options;
 class RandomAccessFile;
@@ -62,6 +65,15 @@ class Table {
   explicit Table(Rep* rep) { rep_ = rep; }
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
 
+  // Read the data block at "handle", consulting and filling
+  // Options::compressed_block_cache when it is set.
+  Status ReadDataBlock(const ReadOptions& options, const BlockHandle& handle,
+                       BlockContents* contents) const;
+
+  // Returns false if the filters show that no key >= "key" in the table
+  // shares key's Options::prefix_extractor prefix.
+  static bool PrefixMayMatch(void* table, const Slice& key);
+
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
   // that key is not present.
@@ -71,9 +83,40 @@ class Table {
       void* arg,
       void (*handle_result)(void* arg, const Slice& k, const Slice& v));
 
+  // Same as calling InternalGet(options, keys[i], args[i], handle_result)
+  // for each i in [0,n-1], but keys[] must be sorted, and each index
+  // and data block is read only once for all the keys that fall in it.
+  Status InternalMultiGet(
+      const ReadOptions&, int n, const Slice* keys,
+      void* const* args,
+      void (*handle_result)(void* arg, const Slice& k, const Slice& v));
+
 
   void ReadMeta(const Footer& footer);
-  void ReadFilter(const Slice& filter_handle_value);
+  void ReadFilter(const Slice& filter_handle_value, bool full_file);
+  Status LoadFilter(FilterBlockReader** filter,
+                    const char** filter_data) const;
+
+  // Find the index block or filter in Options::block_cache, reading it
+  // from the file on a miss.  Only used with
+  // Options::cache_index_and_filter_blocks.
+  Status LookupIndexBlock(Cache::Handle** handle) const;
+  Status LookupFilter(Cache::Handle** handle) const;
+
+  // Return the index block (NULL on error, with *s set) or the filter
+  // (NULL if there is none).  *handle is set to a handle that must be
+  // passed to ReleaseMeta() once the result is no longer used, or NULL.
+  Block* GetIndexBlock(Cache::Handle** handle, Status* s) const;
+  FilterBlockReader* GetFilter(Cache::Handle** handle) const;
+  void ReleaseMeta(Cache::Handle* handle) const;
+
+  // If the index block and filter are kept in Options::block_cache, hold
+  // them there until the table is deleted.  Used by TableCache.
+  void PinIndexAndFilter();
+
+  // Memory held by the table for its index block and filter, i.e. not
+  // counting anything kept in Options::block_cache.  Used by TableCache.
+  size_t MetaMemoryUsage() const;
 
   // No copying allowed
   Table(const Table&);
@@ -123,6 +123,16 @@ class AtomicPointer {
     MemoryBarrier();
     rep_ = v;
   }
+  inline bool CompareAndSwap(void* old_value, void* new_value) {
+#if defined(OS_WIN)
+    return InterlockedCompareExchangePointer(&rep_, new_value, old_value) ==
+        old_value;
+#elif defined(OS_MACOSX)
+    return OSAtomicCompareAndSwapPtrBarrier(old_value, new_value, &rep_);
+#else
+    return __sync_bool_compare_and_swap(&rep_, old_value, new_value);
+#endif
+  }
 };
 
 // AtomicPointer based on <cstdatomic>
@@ -145,6 +155,9 @@ class AtomicPointer {
   inline void NoBarrier_Store(void* v) {
     rep_.store(v, std::memory_order_relaxed);
   }
+  inline bool CompareAndSwap(void* old_value, void* new_value) {
+    return rep_.compare_exchange_strong(old_value, new_value);
+  }
 };
 
 // Atomic pointer based on sparc memory barriers
@@ -175,6 +188,9 @@ class AtomicPointer {
   }
   inline void* NoBarrier_Load() const { return rep_; }
   inline void NoBarrier_Store(void* v) { rep_ = v; }
+  inline bool CompareAndSwap(void* old_value, void* new_value) {
+    return __sync_bool_compare_and_swap(&rep_, old_value, new_value);
+  }
 };
 
 // Atomic pointer based on ia64 acq/rel
@@ -205,6 +221,9 @@ class AtomicPointer {
   }
   inline void* NoBarrier_Load() const { return rep_; }
   inline void NoBarrier_Store(void* v) { rep_ = v; }
+  inline bool CompareAndSwap(void* old_value, void* new_value) {
+    return __sync_bool_compare_and_swap(&rep_, old_value, new_value);
+  }
 };
 
 // We have neither MemoryBarrier(), nor <cstdatomic>
@@ -70,6 +70,11 @@ typedef intptr_t OnceType;
 #define LEVELDB_ONCE_INIT 0
 extern void InitOnce(port::OnceType*, void (*initializer)());
 
+// Returns the number of processors that are online, or 1 if it cannot
+// be determined.  Used to pick a degree of sharding for shared
+// structures.
+extern int NumberOfCPUs();
+
 // A type that holds a pointer that can be read or written atomically
 // (i.e., without word-tearing.)
 class AtomicPointer {
@@ -97,6 +102,10 @@ class AtomicPointer {
 
   // Set va as the stored pointer with no ordering guarantees.
   void NoBarrier_Store(void* v);
+
+  // If the stored pointer is old_value, replace it with new_value and
+  // return true; else return false.  Acts as a full memory barrier.
+  bool CompareAndSwap(void* old_value, void* new_value);
 };
 
 // ------------------ Compression -------------------
@@ -5,6 +5,7 @@
 #include "table/filter_block.h"
 
 #include "leveldb/filter_policy.h"
+#include "leveldb/prefix_extractor.h"
 #include "util/coding.h"
 
 namespace leveldb {
@@ -15,11 +16,18 @@ namespace leveldb {
 static const size_t kFilterBaseLg = 11;
 static const size_t kFilterBase = 1 << kFilterBaseLg;
 
-FilterBlockBuilder::FilterBlockBuilder(const FilterPolicy* policy)
-    : policy_(policy) {
+FilterBlockBuilder::FilterBlockBuilder(const FilterPolicy* policy,
+                                       const PrefixExtractor* prefix_extractor,
+                                       bool full_file)
+    : policy_(policy),
+      prefix_extractor_(prefix_extractor),
+      full_file_(full_file) {
 }
 
 void FilterBlockBuilder::StartBlock(uint64_t block_offset) {
+  if (full_file_) {
+    return;  // All keys go into the filter made by Finish()
+  }
   uint64_t filter_index = (block_offset / kFilterBase);
   assert(filter_index >= filter_offsets_.size());
   while (filter_index > filter_offsets_.size()) {
@@ -31,12 +39,27 @@ void FilterBlockBuilder::AddKey(const Slice& key) {
   Slice k = key;
   start_.push_back(keys_.size());
   keys_.append(k.data(), k.size());
+
+  if (prefix_extractor_ != NULL && prefix_extractor_->InDomain(k)) {
+    // Keys sharing a prefix are adjacent, so comparing against the last
+    // prefix is enough to add each prefix only once per filter.
+    Slice prefix = prefix_extractor_->Transform(k);
+    if (prefix_start_.empty() ||
+        prefix != Slice(prefixes_.data() + prefix_start_.back(),
+                        prefixes_.size() - prefix_start_.back())) {
+      prefix_start_.push_back(prefixes_.size());
+      prefixes_.append(prefix.data(), prefix.size());
+    }
+  }
 }
 
 Slice FilterBlockBuilder::Finish() {
   if (!start_.empty()) {
     GenerateFilter();
   }
+  if (full_file_) {
+    return Slice(result_);  // Just the one filter, if any
+  }
 
   // Append array of per-filter offsets
   const uint32_t array_offset = result_.size();
@@ -57,32 +80,50 @@ void FilterBlockBuilder::GenerateFilter() {
     return;
   }
 
-  // Make list of keys from flattened key structure
+  // Make list of keys from flattened key structure, followed by the
+  // prefixes of those keys.
+  const size_t num_prefixes = prefix_start_.size();
   start_.push_back(keys_.size());  // Simplify length computation
-  tmp_keys_.resize(num_keys);
+  prefix_start_.push_back(prefixes_.size());
+  tmp_keys_.resize(num_keys + num_prefixes);
   for (size_t i = 0; i < num_keys; i++) {
     const char* base = keys_.data() + start_[i];
     size_t length = start_[i+1] - start_[i];
     tmp_keys_[i] = Slice(base, length);
   }
+  for (size_t i = 0; i < num_prefixes; i++) {
+    const char* base = prefixes_.data() + prefix_start_[i];
+    size_t length = prefix_start_[i+1] - prefix_start_[i];
+    tmp_keys_[num_keys + i] = Slice(base, length);
+  }
 
   // Generate filter for current set of keys and append to result_.
   filter_offsets_.push_back(result_.size());
-  policy_->CreateFilter(&tmp_keys_[0], num_keys, &result_);
+  policy_->CreateFilter(&tmp_keys_[0], tmp_keys_.size(), &result_);
 
   tmp_keys_.clear();
   keys_.clear();
   start_.clear();
+  prefixes_.clear();
+  prefix_start_.clear();
 }
 
 FilterBlockReader::FilterBlockReader(const FilterPolicy* policy,
-                                     const Slice& contents)
+                                     const Slice& contents,
+                                     bool full_file)
     : policy_(policy),
+      full_file_(full_file),
       data_(NULL),
       offset_(NULL),
       num_(0),
       base_lg_(0) {
   size_t n = contents.size();
+  if (full_file_) {
+    // The whole block is the filter: make offset_ point at its end
+    data_ = contents.data();
+    offset_ = data_ + n;
+    return;
+  }
   if (n < 5) return;  // 1 byte for base_lg_ and 4 for start of offset array
   base_lg_ = contents[n-1];
   uint32_t last_word = DecodeFixed32(contents.data() + n - 5);
@@ -93,6 +134,13 @@ FilterBlockReader::FilterBlockReader(const FilterPolicy* policy,
 }
 
 bool FilterBlockReader::KeyMayMatch(uint64_t block_offset, const Slice& key) {
+  if (full_file_) {
+    if (offset_ == data_) {
+      // Empty filters do not match any keys
+      return false;
+    }
+    return policy_->KeyMayMatch(key, Slice(data_, offset_ - data_));
+  }
   uint64_t index = block_offset >> base_lg_;
   if (index < num_) {
     uint32_t start = DecodeFixed32(offset_ + index*4);
@@ -19,16 +19,23 @@
 namespace leveldb {
 
 class FilterPolicy;
+class PrefixExtractor;
 
 // A FilterBlockBuilder is used to construct all of the filters for a
 // particular Table.  It generates a single string which is stored as
-// a special block in the Table.
+// a special block in the Table.  If a PrefixExtractor is supplied, the
+// prefix of every key is added to the filters along with the key.  A
+// "full_file" builder makes a single filter for all keys of the Table
+// instead of one per 2KB of data blocks.
 //
 // The sequence of calls to FilterBlockBuilder must match the regexp:
 //      (StartBlock AddKey*)* Finish
 class FilterBlockBuilder {
  public:
-  explicit FilterBlockBuilder(const FilterPolicy*);
+  // "prefix_extractor" may be NULL.
+  FilterBlockBuilder(const FilterPolicy* policy,
+                     const PrefixExtractor* prefix_extractor,
+                     bool full_file);
 
   void StartBlock(uint64_t block_offset);
   void AddKey(const Slice& key);
@@ -38,8 +45,12 @@ class FilterBlockBuilder {
   void GenerateFilter();
 
   const FilterPolicy* policy_;
+  const PrefixExtractor* prefix_extractor_;
+  const bool full_file_;
   std::string keys_;              // Flattened key contents
   std::vector<size_t> start_;     // Starting index in keys_ of each key
+  std::string prefixes_;          // Flattened distinct key prefixes
+  std::vector<size_t> prefix_start_;  // Starting index in prefixes_
   std::string result_;            // Filter data computed so far
   std::vector<Slice> tmp_keys_;   // policy_->CreateFilter() argument
   std::vector<uint32_t> filter_offsets_;
@@ -52,11 +63,18 @@ class FilterBlockBuilder {
 class FilterBlockReader {
  public:
  // REQUIRES: "contents" and *policy must stay live while *this is live.
-  FilterBlockReader(const FilterPolicy* policy, const Slice& contents);
+ // "full_file" must match the setting of the builder of "contents".
+  FilterBlockReader(const FilterPolicy* policy, const Slice& contents,
+                    bool full_file);
   bool KeyMayMatch(uint64_t block_offset, const Slice& key);
 
+  // If true, the block offset passed to KeyMayMatch() is ignored, and
+  // a miss means that the key is nowhere in the Table.
+  bool full_file() const { return full_file_; }
+
  private:
   const FilterPolicy* policy_;
+  const bool full_file_;
   const char* data_;    // Pointer to filter data (at block-start)
   const char* offset_;  // Pointer to beginning of offset array (at block-end)
   size_t num_;          // Number of entries in offset array
@@ -5,6 +5,7 @@
 #include "table/filter_block.h"
 
 #include "leveldb/filter_policy.h"
+#include "leveldb/prefix_extractor.h"
 #include "util/coding.h"
 #include "util/hash.h"
 #include "util/logging.h"
@@ -44,16 +45,16 @@ class FilterBlockTest {
 };
 
 TEST(FilterBlockTest, EmptyBuilder) {
-  FilterBlockBuilder builder(&policy_);
+  FilterBlockBuilder builder(&policy_, NULL, false);
   Slice block = builder.Finish();
   ASSERT_EQ("\\x00\\x00\\x00\\x00\\x0b", EscapeString(block));
-  FilterBlockReader reader(&policy_, block);
+  FilterBlockReader reader(&policy_, block, false);
   ASSERT_TRUE(reader.KeyMayMatch(0, "foo"));
   ASSERT_TRUE(reader.KeyMayMatch(100000, "foo"));
 }
 
 TEST(FilterBlockTest, SingleChunk) {
-  FilterBlockBuilder builder(&policy_);
+  FilterBlockBuilder builder(&policy_, NULL, false);
   builder.StartBlock(100);
   builder.AddKey("foo");
   builder.AddKey("bar");
@@ -63,7 +64,7 @@ TEST(FilterBlockTest, SingleChunk) {
   builder.StartBlock(300);
   builder.AddKey("hello");
   Slice block = builder.Finish();
-  FilterBlockReader reader(&policy_, block);
+  FilterBlockReader reader(&policy_, block, false);
   ASSERT_TRUE(reader.KeyMayMatch(100, "foo"));
   ASSERT_TRUE(reader.KeyMayMatch(100, "bar"));
   ASSERT_TRUE(reader.KeyMayMatch(100, "box"));
@@ -74,7 +75,7 @@ TEST(FilterBlockTest, SingleChunk) {
 }
 
 TEST(FilterBlockTest, MultiChunk) {
-  FilterBlockBuilder builder(&policy_);
+  FilterBlockBuilder builder(&policy_, NULL, false);
 
   // First filter
   builder.StartBlock(0);
@@ -94,7 +95,7 @@ TEST(FilterBlockTest, MultiChunk) {
   builder.AddKey("hello");
 
   Slice block = builder.Finish();
-  FilterBlockReader reader(&policy_, block);
+  FilterBlockReader reader(&policy_, block, false);
 
   // Check first filter
   ASSERT_TRUE(reader.KeyMayMatch(0, "foo"));
@@ -121,6 +122,59 @@ TEST(FilterBlockTest, MultiChunk) {
   ASSERT_TRUE(! reader.KeyMayMatch(9000, "bar"));
 }
 
+TEST(FilterBlockTest, Prefixes) {
+  const PrefixExtractor* prefix_extractor = NewFixedPrefixExtractor(2);
+  FilterBlockBuilder builder(&policy_, prefix_extractor, false);
+  builder.StartBlock(100);
+  builder.AddKey("aa1");
+  builder.AddKey("aa2");
+  builder.AddKey("ab1");
+  builder.AddKey("c");  // Outside the domain of the extractor
+  Slice block = builder.Finish();
+
+  // Four keys and two distinct prefixes, one hash each
+  ASSERT_EQ(6 * 4 + 4 + 4 + 1, block.size());
+
+  FilterBlockReader reader(&policy_, block, false);
+  ASSERT_TRUE(reader.KeyMayMatch(100, "aa1"));
+  ASSERT_TRUE(reader.KeyMayMatch(100, "c"));
+  ASSERT_TRUE(reader.KeyMayMatch(100, "aa"));
+  ASSERT_TRUE(reader.KeyMayMatch(100, "ab"));
+  ASSERT_TRUE(! reader.KeyMayMatch(100, "ac"));
+  ASSERT_TRUE(! reader.KeyMayMatch(100, "c1"));
+  delete prefix_extractor;
+}
+
+TEST(FilterBlockTest, FullFile) {
+  FilterBlockBuilder builder(&policy_, NULL, true);
+  builder.StartBlock(0);
+  builder.AddKey("foo");
+  builder.StartBlock(3100);
+  builder.AddKey("bar");
+  builder.StartBlock(9000);
+  builder.AddKey("box");
+  Slice block = builder.Finish();
+
+  // One hash per key and no per-block offsets
+  ASSERT_EQ(3 * 4, block.size());
+
+  FilterBlockReader reader(&policy_, block, true);
+  ASSERT_TRUE(reader.full_file());
+  ASSERT_TRUE(reader.KeyMayMatch(0, "foo"));
+  ASSERT_TRUE(reader.KeyMayMatch(0, "box"));
+  ASSERT_TRUE(reader.KeyMayMatch(100000, "bar"));
+  ASSERT_TRUE(! reader.KeyMayMatch(0, "hello"));
+  ASSERT_TRUE(! reader.KeyMayMatch(9000, "other"));
+}
+
+TEST(FilterBlockTest, EmptyFullFile) {
+  FilterBlockBuilder builder(&policy_, NULL, true);
+  Slice block = builder.Finish();
+  ASSERT_EQ("", EscapeString(block));
+  FilterBlockReader reader(&policy_, block, true);
+  ASSERT_TRUE(! reader.KeyMayMatch(0, "foo"));
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
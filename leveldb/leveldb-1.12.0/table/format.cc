@@ -4,6 +4,7 @@
 
 #include "table/format.h"
 
+#include <string.h>
 #include "leveldb/env.h"
 #include "port/port.h"
 #include "table/block.h"
@@ -63,10 +64,43 @@ Status Footer::DecodeFrom(Slice* input) {
   return result;
 }
 
+// Return true iff the checksum in the trailer of the block in
+// data[0,n+kBlockTrailerSize-1] matches its contents.
+static bool BlockChecksumMatches(const char* data, size_t n) {
+  const uint32_t crc = crc32c::Unmask(DecodeFixed32(data + n + 1));
+  const uint32_t actual = crc32c::Value(data, n + 1);
+  return actual == crc;
+}
+
+static Status UncompressSnappyBlock(const char* data, size_t n,
+                                    BlockContents* result) {
+  size_t ulength = 0;
+  if (!port::Snappy_GetUncompressedLength(data, n, &ulength)) {
+    return Status::Corruption("corrupted compressed block contents");
+  }
+  char* ubuf = new char[ulength];
+  if (!port::Snappy_Uncompress(data, n, ubuf)) {
+    delete[] ubuf;
+    return Status::Corruption("corrupted compressed block contents");
+  }
+  result->data = Slice(ubuf, ulength);
+  result->heap_allocated = true;
+  result->cachable = true;
+  return Status::OK();
+}
+
 Status ReadBlock(RandomAccessFile* file,
                  const ReadOptions& options,
                  const BlockHandle& handle,
                  BlockContents* result) {
+  return ReadBlock(file, options, handle, result, NULL);
+}
+
+Status ReadBlock(RandomAccessFile* file,
+                 const ReadOptions& options,
+                 const BlockHandle& handle,
+                 BlockContents* result,
+                 std::string* raw) {
   result->data = Slice();
   result->cachable = false;
   result->heap_allocated = false;
@@ -88,14 +122,15 @@ Status ReadBlock(RandomAccessFile* file,
 
   // Check the crc of the type and the block contents
   const char* data = contents.data();    // Pointer to where Read put the data
-  if (options.verify_checksums) {
-    const uint32_t crc = crc32c::Unmask(DecodeFixed32(data + n + 1));
-    const uint32_t actual = crc32c::Value(data, n + 1);
-    if (actual != crc) {
-      delete[] buf;
-      s = Status::Corruption("block checksum mismatch");
-      return s;
-    }
+  if (options.verify_checksums && !BlockChecksumMatches(data, n)) {
+    delete[] buf;
+    s = Status::Corruption("block checksum mismatch");
+    return s;
+  }
+
+  if (raw != NULL && data == buf) {
+    // Blocks that the file keeps in memory (e.g. mmap) are not copied.
+    raw->assign(data, n + kBlockTrailerSize);
   }
 
   switch (data[n]) {
@@ -116,24 +151,10 @@ Status ReadBlock(RandomAccessFile* file,
 
       // Ok
       break;
-    case kSnappyCompression: {
-      size_t ulength = 0;
-      if (!port::Snappy_GetUncompressedLength(data, n, &ulength)) {
-        delete[] buf;
-        return Status::Corruption("corrupted compressed block contents");
-      }
-      char* ubuf = new char[ulength];
-      if (!port::Snappy_Uncompress(data, n, ubuf)) {
-        delete[] buf;
-        delete[] ubuf;
-        return Status::Corruption("corrupted compressed block contents");
-      }
+    case kSnappyCompression:
+      s = UncompressSnappyBlock(data, n, result);
       delete[] buf;
-      result->data = Slice(ubuf, ulength);
-      result->heap_allocated = true;
-      result->cachable = true;
-      break;
-    }
+      return s;
     default:
       delete[] buf;
       return Status::Corruption("bad block type");
@@ -142,4 +163,36 @@ Status ReadBlock(RandomAccessFile* file,
   return Status::OK();
 }
 
+Status UncompressBlock(const ReadOptions& options,
+                       const Slice& raw,
+                       BlockContents* result) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+
+  if (raw.size() < kBlockTrailerSize) {
+    return Status::Corruption("truncated block read");
+  }
+  const char* data = raw.data();
+  const size_t n = raw.size() - kBlockTrailerSize;
+  if (options.verify_checksums && !BlockChecksumMatches(data, n)) {
+    return Status::Corruption("block checksum mismatch");
+  }
+
+  switch (data[n]) {
+    case kNoCompression: {
+      char* buf = new char[n];
+      memcpy(buf, data, n);
+      result->data = Slice(buf, n);
+      result->heap_allocated = true;
+      result->cachable = true;
+      return Status::OK();
+    }
+    case kSnappyCompression:
+      return UncompressSnappyBlock(data, n, result);
+    default:
+      return Status::Corruption("bad block type");
+  }
+}
+
 }  // namespace leveldb
@@ -96,6 +96,23 @@ extern Status ReadBlock(RandomAccessFile* file,
                         const BlockHandle& handle,
                         BlockContents* result);
 
+// Like ReadBlock(), but if the block was read into memory owned by the
+// caller, also store a copy of the block as it appears in the file (its
+// possibly compressed contents followed by the type/crc trailer) in
+// *raw.  Blocks that the file serves from its own memory leave *raw
+// untouched.
+extern Status ReadBlock(RandomAccessFile* file,
+                        const ReadOptions& options,
+                        const BlockHandle& handle,
+                        BlockContents* result,
+                        std::string* raw);
+
+// Fill *result with the contents of "raw", a block as stored by
+// ReadBlock().  result->data is always heap allocated.
+extern Status UncompressBlock(const ReadOptions& options,
+                              const Slice& raw,
+                              BlockContents* result);
+
 // Implementation details follow.  Clients should ignore,
 
 inline BlockHandle::BlockHandle()
@@ -0,0 +1,80 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "table/prefix_filter_iterator.h"
+
+namespace leveldb {
+
+namespace {
+
+typedef bool (*MatchFunction)(void*, const Slice&);
+
+class PrefixFilterIterator : public Iterator {
+ public:
+  PrefixFilterIterator(Iterator* iter, MatchFunction match_function,
+                       void* arg)
+      : iter_(iter),
+        match_function_(match_function),
+        arg_(arg),
+        filtered_(false) {
+  }
+
+  virtual ~PrefixFilterIterator() {
+    delete iter_;
+  }
+
+  virtual bool Valid() const {
+    return !filtered_ && iter_->Valid();
+  }
+  virtual void Seek(const Slice& target) {
+    filtered_ = !(*match_function_)(arg_, target);
+    if (!filtered_) {
+      iter_->Seek(target);
+    }
+  }
+  virtual void SeekToFirst() {
+    filtered_ = false;
+    iter_->SeekToFirst();
+  }
+  virtual void SeekToLast() {
+    filtered_ = false;
+    iter_->SeekToLast();
+  }
+  virtual void Next() {
+    assert(Valid());
+    iter_->Next();
+  }
+  virtual void Prev() {
+    assert(Valid());
+    iter_->Prev();
+  }
+  virtual Slice key() const {
+    assert(Valid());
+    return iter_->key();
+  }
+  virtual Slice value() const {
+    assert(Valid());
+    return iter_->value();
+  }
+  virtual Status status() const {
+    return iter_->status();
+  }
+
+ private:
+  Iterator* const iter_;
+  MatchFunction const match_function_;
+  void* const arg_;
+  bool filtered_;   // Did the last Seek() skip iter_?
+};
+
+}  // namespace
+
+Iterator* NewPrefixFilterIterator(
+    Iterator* iter,
+    bool (*prefix_may_match)(void* arg, const Slice& target),
+    void* arg) {
+  return new PrefixFilterIterator(iter, prefix_may_match, arg);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,26 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_PREFIX_FILTER_ITERATOR_H_
+#define STORAGE_LEVELDB_TABLE_PREFIX_FILTER_ITERATOR_H_
+
+#include "leveldb/iterator.h"
+
+namespace leveldb {
+
+// Return an iterator over the same entries as "iter", for use with
+// ReadOptions::prefix_same_as_start.  Seek(target) first calls
+// (*prefix_may_match)(arg, target), which returns false only if no entry
+// at or after target shares target's prefix.  In that case the result
+// becomes invalid without "iter" being touched, so the blocks target
+// falls in are never read.  All other calls are passed through.
+// Takes ownership of "iter" and will delete it when no longer needed.
+extern Iterator* NewPrefixFilterIterator(
+    Iterator* iter,
+    bool (*prefix_may_match)(void* arg, const Slice& target),
+    void* arg);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_PREFIX_FILTER_ITERATOR_H_
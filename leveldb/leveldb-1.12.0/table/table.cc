@@ -9,9 +9,11 @@
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/prefix_extractor.h"
 #include "table/block.h"
 #include "table/filter_block.h"
 #include "table/format.h"
+#include "table/prefix_filter_iterator.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
 
@@ -22,19 +24,67 @@ struct Table::Rep {
     delete filter;
     delete [] filter_data;
     delete index_block;
+    void* pinned[2] = { pinned_index.NoBarrier_Load(),
+                        pinned_filter.NoBarrier_Load() };
+    for (int i = 0; i < 2; i++) {
+      if (pinned[i] != NULL) {
+        options.block_cache->Release(
+            reinterpret_cast<Cache::Handle*>(pinned[i]));
+      }
+    }
   }
 
   Options options;
   Status status;
   RandomAccessFile* file;
   uint64_t cache_id;
+  uint64_t compressed_cache_id;
   FilterBlockReader* filter;
   const char* filter_data;
+  bool prefix_filtered;  // Does filter hold options.prefix_extractor prefixes?
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
+
+  // With options.cache_index_and_filter_blocks, index_block and filter
+  // stay NULL and the index block and filter are kept in
+  // options.block_cache under the offsets of these handles instead.
+  bool meta_in_cache;
+  BlockHandle index_handle;
+  bool has_filter;           // Does filter_handle point at a filter?
+  BlockHandle filter_handle;
+  bool full_file_filter;
+
+  // Cache handles held by PinIndexAndFilter() until the table is deleted
+  port::AtomicPointer pinned_index;
+  port::AtomicPointer pinned_filter;
+};
+
+// A filter kept in the block cache, along with the memory holding its
+// data (NULL if the filter points into memory owned by the file).
+struct CachedFilter {
+  FilterBlockReader* reader;
+  const char* data;
 };
 
+static Slice CacheKey(uint64_t cache_id, uint64_t offset, char* buf) {
+  EncodeFixed64(buf, cache_id);
+  EncodeFixed64(buf+8, offset);
+  return Slice(buf, 16);
+}
+
+static void DeleteCachedBlock(const Slice& key, void* value) {
+  Block* block = reinterpret_cast<Block*>(value);
+  delete block;
+}
+
+static void DeleteCachedFilter(const Slice& key, void* value) {
+  CachedFilter* filter = reinterpret_cast<CachedFilter*>(value);
+  delete filter->reader;
+  delete[] filter->data;
+  delete filter;
+}
+
 Status Table::Open(const Options& options,
                    RandomAccessFile* file,
                    uint64_t size,
@@ -71,10 +121,31 @@ Status Table::Open(const Options& options,
     rep->options = options;
     rep->file = file;
     rep->metaindex_handle = footer.metaindex_handle();
-    rep->index_block = index_block;
+    rep->index_block = NULL;
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
+    rep->compressed_cache_id = (options.compressed_block_cache
+                                ? options.compressed_block_cache->NewId()
+                                : 0);
     rep->filter_data = NULL;
     rep->filter = NULL;
+    rep->prefix_filtered = false;
+    rep->meta_in_cache = (options.cache_index_and_filter_blocks &&
+                          options.block_cache != NULL);
+    rep->index_handle = footer.index_handle();
+    rep->has_filter = false;
+    rep->full_file_filter = false;
+    rep->pinned_index.NoBarrier_Store(NULL);
+    rep->pinned_filter.NoBarrier_Store(NULL);
+    if (rep->meta_in_cache) {
+      char cache_key_buffer[16];
+      options.block_cache->Release(options.block_cache->Insert(
+          CacheKey(rep->cache_id, rep->index_handle.offset(),
+                   cache_key_buffer),
+          index_block, index_block->size(), &DeleteCachedBlock,
+          Cache::kHigh));
+    } else {
+      rep->index_block = index_block;
+    }
     *table = new Table(rep);
     (*table)->ReadMeta(footer);
   } else {
@@ -100,34 +171,194 @@ void Table::ReadMeta(const Footer& footer) {
   Block* meta = new Block(contents);
 
   Iterator* iter = meta->NewIterator(BytewiseComparator());
-  std::string key = "filter.";
+  std::string key = "fullfilter.";
   key.append(rep_->options.filter_policy->Name());
   iter->Seek(key);
   if (iter->Valid() && iter->key() == Slice(key)) {
-    ReadFilter(iter->value());
+    ReadFilter(iter->value(), true);
+  } else {
+    key = "filter.";
+    key.append(rep_->options.filter_policy->Name());
+    iter->Seek(key);
+    if (iter->Valid() && iter->key() == Slice(key)) {
+      ReadFilter(iter->value(), false);
+    }
+  }
+  if (rep_->has_filter && rep_->options.prefix_extractor != NULL) {
+    key = "prefix.";
+    key.append(rep_->options.prefix_extractor->Name());
+    iter->Seek(key);
+    rep_->prefix_filtered = (iter->Valid() && iter->key() == Slice(key));
   }
   delete iter;
   delete meta;
 }
 
-void Table::ReadFilter(const Slice& filter_handle_value) {
+void Table::ReadFilter(const Slice& filter_handle_value, bool full_file) {
   Slice v = filter_handle_value;
-  BlockHandle filter_handle;
-  if (!filter_handle.DecodeFrom(&v).ok()) {
+  if (!rep_->filter_handle.DecodeFrom(&v).ok()) {
     return;
   }
+  rep_->full_file_filter = full_file;
+  if (rep_->meta_in_cache) {
+    // Load the filter into the cache now, as the index block already is
+    Cache::Handle* handle;
+    rep_->has_filter = LookupFilter(&handle).ok();
+    if (rep_->has_filter) {
+      rep_->options.block_cache->Release(handle);
+    }
+  } else {
+    rep_->has_filter = LoadFilter(&rep_->filter, &rep_->filter_data).ok();
+  }
+}
 
+Status Table::LoadFilter(FilterBlockReader** filter,
+                         const char** filter_data) const {
   // We might want to unify with ReadBlock() if we start
   // requiring checksum verification in Table::Open.
   ReadOptions opt;
   BlockContents block;
-  if (!ReadBlock(rep_->file, opt, filter_handle, &block).ok()) {
+  Status s = ReadBlock(rep_->file, opt, rep_->filter_handle, &block);
+  if (!s.ok()) {
+    return s;
+  }
+  Slice contents = block.data;
+  *filter_data = NULL;
+  if (rep_->full_file_filter) {
+    // Keep the filter cache line aligned, so that a policy that confines
+    // the probes for a key to one 64-byte line of the filter (such as
+    // NewBlockedBloomFilterPolicy) touches one cache line in memory.
+    static const uintptr_t kCacheLineSize = 64;
+    char* buf = new char[contents.size() + kCacheLineSize - 1];
+    char* aligned = buf + (kCacheLineSize -
+                           reinterpret_cast<uintptr_t>(buf) % kCacheLineSize)
+                          % kCacheLineSize;
+    memcpy(aligned, contents.data(), contents.size());
+    if (block.heap_allocated) {
+      delete[] block.data.data();
+    }
+    *filter_data = buf;                   // Will need to delete later
+    contents = Slice(aligned, contents.size());
+  } else if (block.heap_allocated) {
+    *filter_data = block.data.data();     // Will need to delete later
+  }
+  *filter = new FilterBlockReader(rep_->options.filter_policy, contents,
+                                  rep_->full_file_filter);
+  return s;
+}
+
+Status Table::LookupIndexBlock(Cache::Handle** handle) const {
+  Cache* block_cache = rep_->options.block_cache;
+  char cache_key_buffer[16];
+  Slice key = CacheKey(rep_->cache_id, rep_->index_handle.offset(),
+                       cache_key_buffer);
+  *handle = block_cache->Lookup(key);
+  if (*handle == NULL) {
+    BlockContents contents;
+    Status s = ReadBlock(rep_->file, ReadOptions(), rep_->index_handle,
+                         &contents);
+    if (!s.ok()) {
+      return s;
+    }
+    Block* block = new Block(contents);
+    *handle = block_cache->Insert(key, block, block->size(),
+                                  &DeleteCachedBlock, Cache::kHigh);
+  }
+  return Status::OK();
+}
+
+Status Table::LookupFilter(Cache::Handle** handle) const {
+  Cache* block_cache = rep_->options.block_cache;
+  char cache_key_buffer[16];
+  Slice key = CacheKey(rep_->cache_id, rep_->filter_handle.offset(),
+                       cache_key_buffer);
+  *handle = block_cache->Lookup(key);
+  if (*handle == NULL) {
+    CachedFilter* filter = new CachedFilter;
+    Status s = LoadFilter(&filter->reader, &filter->data);
+    if (!s.ok()) {
+      delete filter;
+      return s;
+    }
+    *handle = block_cache->Insert(key, filter, rep_->filter_handle.size(),
+                                  &DeleteCachedFilter, Cache::kHigh);
+  }
+  return Status::OK();
+}
+
+Block* Table::GetIndexBlock(Cache::Handle** handle, Status* s) const {
+  *handle = NULL;
+  if (!rep_->meta_in_cache) {
+    return rep_->index_block;
+  }
+  Cache* block_cache = rep_->options.block_cache;
+  void* pinned = rep_->pinned_index.Acquire_Load();
+  if (pinned != NULL) {
+    return reinterpret_cast<Block*>(
+        block_cache->Value(reinterpret_cast<Cache::Handle*>(pinned)));
+  }
+  *s = LookupIndexBlock(handle);
+  if (!s->ok()) {
+    return NULL;
+  }
+  return reinterpret_cast<Block*>(block_cache->Value(*handle));
+}
+
+FilterBlockReader* Table::GetFilter(Cache::Handle** handle) const {
+  *handle = NULL;
+  if (!rep_->meta_in_cache) {
+    return rep_->filter;
+  }
+  if (!rep_->has_filter) {
+    return NULL;
+  }
+  Cache* block_cache = rep_->options.block_cache;
+  void* pinned = rep_->pinned_filter.Acquire_Load();
+  if (pinned != NULL) {
+    return reinterpret_cast<CachedFilter*>(block_cache->Value(
+        reinterpret_cast<Cache::Handle*>(pinned)))->reader;
+  }
+  if (!LookupFilter(handle).ok()) {
+    // Do not propagate errors since the filter is not needed for operation
+    return NULL;
+  }
+  return reinterpret_cast<CachedFilter*>(block_cache->Value(*handle))->reader;
+}
+
+void Table::ReleaseMeta(Cache::Handle* handle) const {
+  if (handle != NULL) {
+    rep_->options.block_cache->Release(handle);
+  }
+}
+
+void Table::PinIndexAndFilter() {
+  if (!rep_->meta_in_cache) {
     return;
   }
-  if (block.heap_allocated) {
-    rep_->filter_data = block.data.data();     // Will need to delete later
+  Cache* block_cache = rep_->options.block_cache;
+  Cache::Handle* handle;
+  if (rep_->pinned_index.Acquire_Load() == NULL &&
+      LookupIndexBlock(&handle).ok() &&
+      !rep_->pinned_index.CompareAndSwap(NULL, handle)) {
+    block_cache->Release(handle);  // Another thread pinned it first
+  }
+  if (rep_->has_filter &&
+      rep_->pinned_filter.Acquire_Load() == NULL &&
+      LookupFilter(&handle).ok() &&
+      !rep_->pinned_filter.CompareAndSwap(NULL, handle)) {
+    block_cache->Release(handle);
   }
-  rep_->filter = new FilterBlockReader(rep_->options.filter_policy, block.data);
+}
+
+size_t Table::MetaMemoryUsage() const {
+  size_t usage = 0;
+  if (rep_->index_block != NULL) {
+    usage += rep_->index_block->size();
+  }
+  if (rep_->filter != NULL) {
+    usage += rep_->filter_handle.size();
+  }
+  return usage;
 }
 
 Table::~Table() {
@@ -138,9 +369,8 @@ static void DeleteBlock(void* arg, void* ignored) {
   delete reinterpret_cast<Block*>(arg);
 }
 
-static void DeleteCachedBlock(const Slice& key, void* value) {
-  Block* block = reinterpret_cast<Block*>(value);
-  delete block;
+static void DeleteCachedRawBlock(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
 }
 
 static void ReleaseBlock(void* arg, void* h) {
@@ -149,6 +379,38 @@ static void ReleaseBlock(void* arg, void* h) {
   cache->Release(handle);
 }
 
+Status Table::ReadDataBlock(const ReadOptions& options,
+                           const BlockHandle& handle,
+                           BlockContents* contents) const {
+  Cache* raw_cache = rep_->options.compressed_block_cache;
+  if (raw_cache == NULL) {
+    return ReadBlock(rep_->file, options, handle, contents);
+  }
+
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, rep_->compressed_cache_id);
+  EncodeFixed64(cache_key_buffer+8, handle.offset());
+  Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+  Cache::Handle* cache_handle = raw_cache->Lookup(key);
+  if (cache_handle != NULL) {
+    const std::string* raw =
+        reinterpret_cast<std::string*>(raw_cache->Value(cache_handle));
+    Status s = UncompressBlock(options, *raw, contents);
+    raw_cache->Release(cache_handle);
+    return s;
+  }
+
+  std::string* raw = new std::string;
+  Status s = ReadBlock(rep_->file, options, handle, contents, raw);
+  if (s.ok() && !raw->empty() && options.fill_cache) {
+    raw_cache->Release(raw_cache->Insert(key, raw, raw->size(),
+                                         &DeleteCachedRawBlock));
+  } else {
+    delete raw;
+  }
+  return s;
+}
+
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg,
@@ -176,7 +438,7 @@ Iterator* Table::BlockReader(void* arg,
       if (cache_handle != NULL) {
         block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
       } else {
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
+        s = table->ReadDataBlock(options, handle, &contents);
         if (s.ok()) {
           block = new Block(contents);
           if (contents.cachable && options.fill_cache) {
@@ -186,7 +448,7 @@ Iterator* Table::BlockReader(void* arg,
         }
       }
     } else {
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
+      s = table->ReadDataBlock(options, handle, &contents);
       if (s.ok()) {
         block = new Block(contents);
       }
@@ -208,22 +470,92 @@ Iterator* Table::BlockReader(void* arg,
 }
 
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+  Cache::Handle* index_handle;
+  Status s;
+  Block* index_block = GetIndexBlock(&index_handle, &s);
+  if (index_block == NULL) {
+    return NewErrorIterator(s);
+  }
+  Iterator* index_iter = index_block->NewIterator(rep_->options.comparator);
+  if (index_handle != NULL) {
+    index_iter->RegisterCleanup(&ReleaseBlock, rep_->options.block_cache,
+                                index_handle);
+  }
+  Iterator* iter = NewTwoLevelIterator(
+      index_iter, &Table::BlockReader, const_cast<Table*>(this), options);
+  if (options.prefix_same_as_start && rep_->prefix_filtered) {
+    iter = NewPrefixFilterIterator(iter, &Table::PrefixMayMatch,
+                                   const_cast<Table*>(this));
+  }
+  return iter;
+}
+
+// The first key >= "key" lives in the block found by seeking the index.
+// Keys sharing a prefix are adjacent, so if that block's filter does not
+// know key's prefix, no key at or after "key" in the table has it.
+bool Table::PrefixMayMatch(void* arg, const Slice& key) {
+  Table* table = reinterpret_cast<Table*>(arg);
+  const PrefixExtractor* prefix_extractor =
+      table->rep_->options.prefix_extractor;
+  if (!table->rep_->prefix_filtered || !prefix_extractor->InDomain(key)) {
+    return true;
+  }
+  Cache::Handle* filter_handle;
+  FilterBlockReader* filter = table->GetFilter(&filter_handle);
+  if (filter == NULL) {
+    return true;
+  }
+
+  bool may_match = true;
+  if (filter->full_file()) {
+    // Covers the whole table, so there is no block to find
+    may_match = filter->KeyMayMatch(0, prefix_extractor->Transform(key));
+  } else {
+    Cache::Handle* index_handle;
+    Status s;
+    Block* index_block = table->GetIndexBlock(&index_handle, &s);
+    if (index_block != NULL) {
+      Iterator* iiter =
+          index_block->NewIterator(table->rep_->options.comparator);
+      iiter->Seek(key);
+      if (iiter->Valid()) {
+        Slice handle_value = iiter->value();
+        BlockHandle handle;
+        if (handle.DecodeFrom(&handle_value).ok()) {
+          may_match = filter->KeyMayMatch(
+              handle.offset(), prefix_extractor->Transform(key));
+        }
+      }
+      delete iiter;
+      table->ReleaseMeta(index_handle);
+    }
+  }
+  table->ReleaseMeta(filter_handle);
+  return may_match;
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k,
                           void* arg,
                           void (*saver)(void*, const Slice&, const Slice&)) {
   Status s;
-  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  Cache::Handle* filter_handle;
+  FilterBlockReader* filter = GetFilter(&filter_handle);
+  if (filter != NULL && filter->full_file() && !filter->KeyMayMatch(0, k)) {
+    ReleaseMeta(filter_handle);
+    return s;  // Not found, and no need to search the index
+  }
+  Cache::Handle* index_handle;
+  Block* index_block = GetIndexBlock(&index_handle, &s);
+  if (index_block == NULL) {
+    ReleaseMeta(filter_handle);
+    return s;
+  }
+  Iterator* iiter = index_block->NewIterator(rep_->options.comparator);
   iiter->Seek(k);
   if (iiter->Valid()) {
     Slice handle_value = iiter->value();
-    FilterBlockReader* filter = rep_->filter;
     BlockHandle handle;
-    if (filter != NULL &&
+    if (filter != NULL && !filter->full_file() &&
         handle.DecodeFrom(&handle_value).ok() &&
         !filter->KeyMayMatch(handle.offset(), k)) {
       // Not found
@@ -241,19 +573,92 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
     s = iiter->status();
   }
   delete iiter;
+  ReleaseMeta(index_handle);
+  ReleaseMeta(filter_handle);
   return s;
 }
 
+Status Table::InternalMultiGet(const ReadOptions& options, int n,
+                               const Slice* keys, void* const* args,
+                               void (*saver)(void*, const Slice&,
+                                             const Slice&)) {
+  const Comparator* cmp = rep_->options.comparator;
+  Status s;
+  Cache::Handle* index_handle;
+  Block* index_block = GetIndexBlock(&index_handle, &s);
+  if (index_block == NULL) {
+    return s;
+  }
+  Cache::Handle* filter_handle;
+  FilterBlockReader* filter = GetFilter(&filter_handle);
+  Iterator* iiter = index_block->NewIterator(cmp);
+  Iterator* block_iter = NULL;
+  std::string block_handle;  // Index entry of the block in block_iter
+  bool seeked = false;       // Has iiter been positioned yet?
+  for (int i = 0; i < n && s.ok(); i++) {
+    const Slice& k = keys[i];
+    if (filter != NULL && filter->full_file() && !filter->KeyMayMatch(0, k)) {
+      continue;  // Not found, and no need to search the index
+    }
+    if (!seeked) {
+      seeked = true;
+      iiter->Seek(k);
+    } else if (!iiter->Valid()) {
+      // The previous key was past the last block, so this one is too
+      break;
+    } else if (cmp->Compare(k, iiter->key()) > 0) {
+      // The keys are sorted, so the block found for the previous key is
+      // also the first candidate for this one unless k is past it.
+      iiter->Seek(k);
+    }
+    if (!iiter->Valid()) {
+      break;
+    }
+
+    Slice handle_value = iiter->value();
+    BlockHandle handle;
+    if (filter != NULL && !filter->full_file() &&
+        handle.DecodeFrom(&handle_value).ok() &&
+        !filter->KeyMayMatch(handle.offset(), k)) {
+      // Not found
+      continue;
+    }
+    if (block_iter == NULL || iiter->value() != Slice(block_handle)) {
+      delete block_iter;
+      block_iter = BlockReader(this, options, iiter->value());
+      block_handle = iiter->value().ToString();
+    }
+    block_iter->Seek(k);
+    if (block_iter->Valid()) {
+      (*saver)(args[i], block_iter->key(), block_iter->value());
+    }
+    s = block_iter->status();
+  }
+  delete block_iter;
+  if (s.ok()) {
+    s = iiter->status();
+  }
+  delete iiter;
+  ReleaseMeta(index_handle);
+  ReleaseMeta(filter_handle);
+  return s;
+}
 
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
-  Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+  Cache::Handle* index_handle;
+  Status s;
+  Block* index_block = GetIndexBlock(&index_handle, &s);
+  if (index_block == NULL) {
+    // Like an undecodable index entry below
+    return rep_->metaindex_handle.offset();
+  }
+  Iterator* index_iter = index_block->NewIterator(rep_->options.comparator);
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
     BlockHandle handle;
     Slice input = index_iter->value();
-    Status s = handle.DecodeFrom(&input);
+    s = handle.DecodeFrom(&input);
     if (s.ok()) {
       result = handle.offset();
     } else {
@@ -269,6 +674,7 @@ uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
     result = rep_->metaindex_handle.offset();
   }
   delete index_iter;
+  ReleaseMeta(index_handle);
   return result;
 }
 
@@ -8,6 +8,7 @@
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/prefix_extractor.h"
 #include "leveldb/options.h"
 #include "table/block_builder.h"
 #include "table/filter_block.h"
@@ -54,7 +55,9 @@ struct TableBuilder::Rep {
         num_entries(0),
         closed(false),
         filter_block(opt.filter_policy == NULL ? NULL
-                     : new FilterBlockBuilder(opt.filter_policy)),
+                     : new FilterBlockBuilder(opt.filter_policy,
+                                              opt.prefix_extractor,
+                                              opt.full_file_filter)),
         pending_index_entry(false) {
     index_block_options.block_restart_interval = 1;
   }
@@ -80,6 +83,11 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if (options.filter_policy != rep_->options.filter_policy ||
+      options.prefix_extractor != rep_->options.prefix_extractor ||
+      options.full_file_filter != rep_->options.full_file_filter) {
+    return Status::InvalidArgument("changing filter while building table");
+  }
 
   // Note that any live BlockBuilders point to rep_->options and therefore
   // will automatically pick up the updated options.
@@ -214,12 +222,21 @@ Status TableBuilder::Finish() {
   if (ok()) {
     BlockBuilder meta_index_block(&r->options);
     if (r->filter_block != NULL) {
-      // Add mapping from "filter.Name" to location of filter data
-      std::string key = "filter.";
+      // Add mapping from "filter.Name" (or "fullfilter.Name") to
+      // location of filter data
+      std::string key = r->options.full_file_filter ? "fullfilter." : "filter.";
       key.append(r->options.filter_policy->Name());
       std::string handle_encoding;
       filter_block_handle.EncodeTo(&handle_encoding);
       meta_index_block.Add(key, handle_encoding);
+
+      if (r->options.prefix_extractor != NULL) {
+        // Record which extractor produced the prefixes in the filters
+        // so that readers using a different one ignore them.
+        key = "prefix.";
+        key.append(r->options.prefix_extractor->Name());
+        meta_index_block.Add(key, handle_encoding);
+      }
     }
 
     // TODO(postrelease): Add stats and other meta blocks
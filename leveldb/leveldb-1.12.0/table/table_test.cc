@@ -6,9 +6,11 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include "db/dbformat.h"
 #include "db/memtable.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
@@ -861,6 +863,79 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"),    4000,   6000));
 }
 
+// A StringSource that counts the reads made through it.
+class CountingStringSource : public StringSource {
+ public:
+  explicit CountingStringSource(const Slice& contents)
+      : StringSource(contents), reads_(0) { }
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    reads_++;
+    return StringSource::Read(offset, n, result, scratch);
+  }
+
+  int reads() const { return reads_; }
+
+ private:
+  mutable int reads_;
+};
+
+TEST(TableTest, CompressedBlockCache) {
+  Options options;
+  options.block_size = 256;
+  if (!SnappyCompressionSupported()) {
+    options.compression = kNoCompression;
+  }
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  Random rnd(301);
+  const int kNum = 1000;
+  std::vector<std::string> values;
+  for (int i = 0; i < kNum; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "k%06d", i);
+    std::string value;
+    test::CompressibleString(&rnd, 0.25, 100, &value);
+    builder.Add(key, value);
+    values.push_back(value);
+  }
+  ASSERT_OK(builder.Finish());
+
+  // The block cache keeps nothing once a block is released, so every
+  // block is either read from the file or found in the second cache.
+  CountingStringSource source(sink.contents());
+  Options table_options;
+  table_options.block_cache = NewLRUCache(0);
+  table_options.compressed_block_cache = NewLRUCache(1 << 20);
+  Table* table = NULL;
+  ASSERT_OK(Table::Open(table_options, &source, sink.contents().size(),
+                        &table));
+
+  ReadOptions read_options;
+  read_options.verify_checksums = true;
+  for (int pass = 0; pass < 2; pass++) {
+    const int reads_before = source.reads();
+    Iterator* iter = table->NewIterator(read_options);
+    int i = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), i++) {
+      ASSERT_EQ(values[i], iter->value().ToString());
+    }
+    ASSERT_OK(iter->status());
+    ASSERT_EQ(kNum, i);
+    delete iter;
+    if (pass == 0) {
+      ASSERT_GT(source.reads(), reads_before + 10);
+    } else {
+      ASSERT_EQ(reads_before, source.reads());
+    }
+  }
+
+  delete table;
+  delete table_options.block_cache;
+  delete table_options.compressed_block_cache;
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
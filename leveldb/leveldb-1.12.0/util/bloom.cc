@@ -86,10 +86,101 @@ class BloomFilterPolicy : public FilterPolicy {
     return true;
   }
 };
+
+// A bloom filter split into 64-byte lines.  A key's hash picks one line
+// and all of its probes go to bits within that line, so testing a key
+// touches a single cache line however large the filter is.  The probe
+// positions depend only on the hash and not on earlier loads.
+class BlockedBloomFilterPolicy : public FilterPolicy {
+ private:
+  static const size_t kLineBytes = 64;
+  static const size_t kLineBitsLg = 9;  // log2(kLineBytes * 8)
+
+  size_t bits_per_key_;
+  size_t k_;
+
+  // Returns the first byte of the line for hash "h" out of "lines".
+  static size_t LineOffset(uint32_t h, size_t lines) {
+    return static_cast<size_t>(
+        (static_cast<uint64_t>(h) * lines) >> 32) * kLineBytes;
+  }
+
+  // Returns the position within its line of the next probe for a key,
+  // updating *h for the probe after it.
+  static uint32_t NextProbe(uint32_t* h) {
+    *h *= 0x9e3779b9;  // Golden ratio; keeps the high bits well mixed
+    return *h >> (32 - kLineBitsLg);
+  }
+
+ public:
+  explicit BlockedBloomFilterPolicy(int bits_per_key)
+      : bits_per_key_(bits_per_key) {
+    // We intentionally round down to reduce probing cost a little bit
+    k_ = static_cast<size_t>(bits_per_key * 0.69);  // 0.69 =~ ln(2)
+    if (k_ < 1) k_ = 1;
+    if (k_ > 30) k_ = 30;
+  }
+
+  virtual const char* Name() const {
+    return "leveldb.BlockedBloomFilter";
+  }
+
+  virtual void CreateFilter(const Slice* keys, int n, std::string* dst) const {
+    // Compute the number of lines, which is at least one
+    const size_t bits = n * bits_per_key_;
+    size_t lines = (bits + kLineBytes * 8 - 1) / (kLineBytes * 8);
+    if (lines < 1) lines = 1;
+
+    const size_t init_size = dst->size();
+    dst->resize(init_size + lines * kLineBytes, 0);
+    dst->push_back(static_cast<char>(k_));  // Remember # of probes in filter
+    char* array = &(*dst)[init_size];
+    for (int i = 0; i < n; i++) {
+      uint32_t h = BloomHash(keys[i]);
+      char* line = array + LineOffset(h, lines);
+      for (size_t j = 0; j < k_; j++) {
+        const uint32_t bitpos = NextProbe(&h);
+        line[bitpos/8] |= (1 << (bitpos % 8));
+      }
+    }
+  }
+
+  virtual bool KeyMayMatch(const Slice& key, const Slice& bloom_filter) const {
+    const size_t len = bloom_filter.size();
+    if (len < 2) return false;
+    if ((len - 1) % kLineBytes != 0) {
+      // Not produced by CreateFilter().  Consider it a match.
+      return true;
+    }
+
+    const char* array = bloom_filter.data();
+    const size_t lines = (len - 1) / kLineBytes;
+
+    // Use the encoded k so that we can read filters generated by
+    // policies created using different parameters.
+    const size_t k = array[len-1];
+    if (k > 30) {
+      // Reserved for potentially new encodings.  Consider it a match.
+      return true;
+    }
+
+    uint32_t h = BloomHash(key);
+    const char* line = array + LineOffset(h, lines);
+    for (size_t j = 0; j < k; j++) {
+      const uint32_t bitpos = NextProbe(&h);
+      if ((line[bitpos/8] & (1 << (bitpos % 8))) == 0) return false;
+    }
+    return true;
+  }
+};
 }
 
 const FilterPolicy* NewBloomFilterPolicy(int bits_per_key) {
   return new BloomFilterPolicy(bits_per_key);
 }
 
+const FilterPolicy* NewBlockedBloomFilterPolicy(int bits_per_key) {
+  return new BlockedBloomFilterPolicy(bits_per_key);
+}
+
 }  // namespace leveldb
@@ -27,6 +27,12 @@ class BloomTest {
  public:
   BloomTest() : policy_(NewBloomFilterPolicy(10)) { }
 
+  void UsePolicy(const FilterPolicy* policy) {
+    delete policy_;
+    policy_ = policy;
+    Reset();
+  }
+
   ~BloomTest() {
     delete policy_;
   }
@@ -151,6 +157,55 @@ TEST(BloomTest, VaryingLengths) {
   ASSERT_LE(mediocre_filters, good_filters/5);
 }
 
+TEST(BloomTest, BlockedSmall) {
+  UsePolicy(NewBlockedBloomFilterPolicy(10));
+  ASSERT_TRUE(! Matches("hello"));
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(! Matches("x"));
+  ASSERT_TRUE(! Matches("foo"));
+  ASSERT_EQ(64 + 1, FilterSize());  // One line and the probe count
+}
+
+TEST(BloomTest, BlockedVaryingLengths) {
+  UsePolicy(NewBlockedBloomFilterPolicy(10));
+  char buffer[sizeof(int)];
+  int mediocre_filters = 0;
+  int good_filters = 0;
+
+  for (int length = 1; length <= 10000; length = NextLength(length)) {
+    Reset();
+    for (int i = 0; i < length; i++) {
+      Add(Key(i, buffer));
+    }
+    Build();
+
+    ASSERT_LE(FilterSize(), (length * 10 / 8) + 65) << length;
+    ASSERT_EQ(1, FilterSize() % 64) << length;
+
+    for (int i = 0; i < length; i++) {
+      ASSERT_TRUE(Matches(Key(i, buffer)))
+          << "Length " << length << "; key " << i;
+    }
+
+    double rate = FalsePositiveRate();
+    if (kVerbose >= 1) {
+      fprintf(stderr, "False positives: %5.2f%% @ length = %6d ; bytes = %6d\n",
+              rate*100.0, length, static_cast<int>(FilterSize()));
+    }
+    ASSERT_LE(rate, 0.02);   // Must not be over 2%
+    if (rate > 0.0125) mediocre_filters++;  // Allowed, but not too often
+    else good_filters++;
+  }
+  if (kVerbose >= 1) {
+    fprintf(stderr, "Filters: %d good, %d mediocre\n",
+            good_filters, mediocre_filters);
+  }
+  ASSERT_LE(mediocre_filters, good_filters/5);
+}
+
 // Different bits-per-byte
 
 }  // namespace leveldb
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "leveldb/cache.h"
 #include "port/port.h"
@@ -16,12 +17,24 @@ namespace leveldb {
 Cache::~Cache() {
 }
 
+Cache::Handle* Cache::Insert(const Slice& key, void* value, size_t charge,
+                             void (*deleter)(const Slice& key, void* value),
+                             Priority priority) {
+  return Insert(key, value, charge, deleter);
+}
+
+size_t Cache::TotalCharge() const {
+  return 0;
+}
+
 namespace {
 
 // LRU cache implementation
 
 // An entry is a variable length heap-allocated structure.  Entries
-// are kept in a circular doubly linked list ordered by access time.
+// are kept in one of two circular doubly linked lists ordered by access
+// time: high priority entries are kept apart from the others, which are
+// all evicted first, as long as they use at most half of the capacity.
 struct LRUHandle {
   void* value;
   void (*deleter)(const Slice&, void* value);
@@ -32,6 +45,8 @@ struct LRUHandle {
   size_t key_length;
   uint32_t refs;
   uint32_t hash;      // Hash of key(); used for fast sharding and comparisons
+  bool high_priority;  // Inserted with Cache::kHigh
+  bool in_high_pool;   // Kept in the list of high priority entries
   char key_data[1];   // Beginning of key
 
   Slice key() const {
@@ -143,43 +158,54 @@ class LRUCache {
   // Like Cache methods, but with an extra "hash" parameter.
   Cache::Handle* Insert(const Slice& key, uint32_t hash,
                         void* value, size_t charge,
-                        void (*deleter)(const Slice& key, void* value));
+                        void (*deleter)(const Slice& key, void* value),
+                        Cache::Priority priority);
   Cache::Handle* Lookup(const Slice& key, uint32_t hash);
   void Release(Cache::Handle* handle);
   void Erase(const Slice& key, uint32_t hash);
+  size_t TotalCharge() const;
 
  private:
   void LRU_Remove(LRUHandle* e);
   void LRU_Append(LRUHandle* e);
+  void MaintainHighPool();
   void Unref(LRUHandle* e);
 
   // Initialized before use.
   size_t capacity_;
 
   // mutex_ protects the following state.
-  port::Mutex mutex_;
+  mutable port::Mutex mutex_;
   size_t usage_;
 
-  // Dummy head of LRU list.
+  // Dummy heads of the LRU lists of low and high priority entries.
   // lru.prev is newest entry, lru.next is oldest entry.
   LRUHandle lru_;
+  LRUHandle high_lru_;
+  size_t high_usage_;  // Combined charge of the entries on high_lru_
 
   HandleTable table_;
 };
 
 LRUCache::LRUCache()
-    : usage_(0) {
-  // Make empty circular linked list
+    : usage_(0),
+      high_usage_(0) {
+  // Make empty circular linked lists
   lru_.next = &lru_;
   lru_.prev = &lru_;
+  high_lru_.next = &high_lru_;
+  high_lru_.prev = &high_lru_;
 }
 
 LRUCache::~LRUCache() {
-  for (LRUHandle* e = lru_.next; e != &lru_; ) {
-    LRUHandle* next = e->next;
-    assert(e->refs == 1);  // Error if caller has an unreleased handle
-    Unref(e);
-    e = next;
+  LRUHandle* lists[2] = { &lru_, &high_lru_ };
+  for (int i = 0; i < 2; i++) {
+    for (LRUHandle* e = lists[i]->next; e != lists[i]; ) {
+      LRUHandle* next = e->next;
+      assert(e->refs == 1);  // Error if caller has an unreleased handle
+      Unref(e);
+      e = next;
+    }
   }
 }
 
@@ -196,23 +222,44 @@ void LRUCache::Unref(LRUHandle* e) {
 void LRUCache::LRU_Remove(LRUHandle* e) {
   e->next->prev = e->prev;
   e->prev->next = e->next;
+  if (e->in_high_pool) {
+    high_usage_ -= e->charge;
+  }
 }
 
 void LRUCache::LRU_Append(LRUHandle* e) {
-  // Make "e" newest entry by inserting just before lru_
-  e->next = &lru_;
-  e->prev = lru_.prev;
+  // Make "e" newest entry of its list by inserting just before the head
+  LRUHandle* list = &lru_;
+  if (e->in_high_pool) {
+    list = &high_lru_;
+    high_usage_ += e->charge;
+  }
+  e->next = list;
+  e->prev = list->prev;
   e->prev->next = e;
   e->next->prev = e;
 }
 
+// Move the oldest high priority entries to the newest end of the low
+// priority list until the high priority ones fit in half the capacity.
+void LRUCache::MaintainHighPool() {
+  while (high_usage_ > capacity_ / 2 && high_lru_.next != &high_lru_) {
+    LRUHandle* e = high_lru_.next;
+    LRU_Remove(e);
+    e->in_high_pool = false;
+    LRU_Append(e);
+  }
+}
+
 Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
   MutexLock l(&mutex_);
   LRUHandle* e = table_.Lookup(key, hash);
   if (e != NULL) {
     e->refs++;
     LRU_Remove(e);
+    e->in_high_pool = e->high_priority;
     LRU_Append(e);
+    MaintainHighPool();
   }
   return reinterpret_cast<Cache::Handle*>(e);
 }
@@ -224,7 +271,8 @@ void LRUCache::Release(Cache::Handle* handle) {
 
 Cache::Handle* LRUCache::Insert(
     const Slice& key, uint32_t hash, void* value, size_t charge,
-    void (*deleter)(const Slice& key, void* value)) {
+    void (*deleter)(const Slice& key, void* value),
+    Cache::Priority priority) {
   MutexLock l(&mutex_);
 
   LRUHandle* e = reinterpret_cast<LRUHandle*>(
@@ -235,8 +283,11 @@ Cache::Handle* LRUCache::Insert(
   e->key_length = key.size();
   e->hash = hash;
   e->refs = 2;  // One from LRUCache, one for the returned handle
+  e->high_priority = (priority == Cache::kHigh);
+  e->in_high_pool = e->high_priority;
   memcpy(e->key_data, key.data(), key.size());
   LRU_Append(e);
+  MaintainHighPool();
   usage_ += charge;
 
   LRUHandle* old = table_.Insert(e);
@@ -245,8 +296,9 @@ Cache::Handle* LRUCache::Insert(
     Unref(old);
   }
 
-  while (usage_ > capacity_ && lru_.next != &lru_) {
-    LRUHandle* old = lru_.next;
+  while (usage_ > capacity_ &&
+         (lru_.next != &lru_ || high_lru_.next != &high_lru_)) {
+    LRUHandle* old = (lru_.next != &lru_) ? lru_.next : high_lru_.next;
     LRU_Remove(old);
     table_.Remove(old->key(), old->hash);
     Unref(old);
@@ -264,6 +316,11 @@ void LRUCache::Erase(const Slice& key, uint32_t hash) {
   }
 }
 
+size_t LRUCache::TotalCharge() const {
+  MutexLock l(&mutex_);
+  return usage_;
+}
+
 static const int kNumShardBits = 4;
 static const int kNumShards = 1 << kNumShardBits;
 
@@ -292,8 +349,14 @@ class ShardedLRUCache : public Cache {
   virtual ~ShardedLRUCache() { }
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) {
+    return Insert(key, value, charge, deleter, kLow);
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority) {
     const uint32_t hash = HashSlice(key);
-    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter,
+                                      priority);
   }
   virtual Handle* Lookup(const Slice& key) {
     const uint32_t hash = HashSlice(key);
@@ -314,6 +377,448 @@ class ShardedLRUCache : public Cache {
     MutexLock l(&id_mutex_);
     return ++(last_id_);
   }
+  virtual size_t TotalCharge() const {
+    size_t total = 0;
+    for (int s = 0; s < kNumShards; s++) {
+      total += shard_[s].TotalCharge();
+    }
+    return total;
+  }
+};
+
+// CLOCK cache implementation
+//
+// Each shard keeps its entries in a fixed-size open-addressed table of
+// slots, so that Lookup() and Release() never take a lock: a reader
+// claims a reference on a slot with a single compare-and-swap of the
+// slot's "meta" word and only then examines the key.  Slots are never
+// freed while the cache exists, which is what makes it safe to touch a
+// slot that another thread is concurrently evicting.
+//
+// Eviction uses the CLOCK algorithm: a hit sets the clock value of an
+// entry to kMaxClock, and a hand that sweeps around the table
+// decrements it and evicts unreferenced entries whose clock is zero.
+struct ClockHandle {
+  // Bits [0,2) hold the state, bits [2,4) the clock value, and the
+  // rest the number of outstanding handles.
+  port::AtomicPointer meta;
+
+  // Number of entries whose probe sequence passed over this slot when
+  // they were inserted.  A probe for a key stops at the first slot that
+  // does not hold the key and has no displacements.
+  port::AtomicPointer displacements;
+
+  // Hash of the key.  Probes compare it before taking a reference, while
+  // an Insert() may be writing it, so it is loaded and stored atomically.
+  port::AtomicPointer hash;
+
+  // Only written by the thread that owns the slot in kConstruction.
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  char* key_data;
+  size_t key_length;
+  size_t charge;
+  bool detached;      // Allocated outside the table; freed on Release()
+
+  Slice key() const { return Slice(key_data, key_length); }
+};
+
+typedef uintptr_t ClockMeta;
+
+static const ClockMeta kStateMask = 3;
+static const ClockMeta kEmpty = 0;         // Free slot
+static const ClockMeta kConstruction = 1;  // Owned by a single thread
+static const ClockMeta kVisible = 2;       // Can be found by Lookup()
+static const ClockMeta kInvisible = 3;     // Erased; freed on last Release()
+static const int kClockShift = 2;
+static const ClockMeta kClockMask = 3 << kClockShift;
+static const ClockMeta kMaxClock = 3;
+static const ClockMeta kInitialClock = 1;  // kMaxClock for Cache::kHigh
+static const ClockMeta kOneRef = 1 << 4;
+
+static inline ClockMeta LoadMeta(const ClockHandle* h) {
+  return reinterpret_cast<ClockMeta>(h->meta.Acquire_Load());
+}
+
+static inline bool CasMeta(ClockHandle* h, ClockMeta old_meta,
+                           ClockMeta new_meta) {
+  return h->meta.CompareAndSwap(reinterpret_cast<void*>(old_meta),
+                                reinterpret_cast<void*>(new_meta));
+}
+
+static inline uint32_t LoadHash(const ClockHandle* h) {
+  return static_cast<uint32_t>(
+      reinterpret_cast<uintptr_t>(h->hash.Acquire_Load()));
+}
+
+static inline uintptr_t LoadCounter(const port::AtomicPointer* p) {
+  return reinterpret_cast<uintptr_t>(p->Acquire_Load());
+}
+
+// Add "delta" (which may be the two's complement of a decrement) to the
+// counter stored in *p and return its previous value.
+static uintptr_t FetchAdd(port::AtomicPointer* p, uintptr_t delta) {
+  while (true) {
+    void* old_value = p->Acquire_Load();
+    void* new_value = reinterpret_cast<void*>(
+        reinterpret_cast<uintptr_t>(old_value) + delta);
+    if (p->CompareAndSwap(old_value, new_value)) {
+      return reinterpret_cast<uintptr_t>(old_value);
+    }
+  }
+}
+
+// A single shard of a sharded CLOCK cache.
+class ClockCache {
+ public:
+  ClockCache();
+  ~ClockCache();
+
+  // Separate from constructor so caller can easily make an array of
+  // ClockCache.  The table holds enough slots for "capacity" worth of
+  // entries whose charge is "estimated_entry_charge".
+  void Init(size_t capacity, size_t estimated_entry_charge);
+
+  // Like Cache methods, but with an extra "hash" parameter.
+  Cache::Handle* Insert(const Slice& key, uint32_t hash,
+                        void* value, size_t charge,
+                        void (*deleter)(const Slice& key, void* value),
+                        Cache::Priority priority);
+  Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+  void Release(Cache::Handle* handle);
+  void Erase(const Slice& key, uint32_t hash);
+  size_t TotalCharge() const { return LoadCounter(&usage_); }
+
+ private:
+  // Index of the i'th slot probed for "hash".  The step is odd, so the
+  // first length_ probes visit every slot exactly once.
+  size_t Probe(uint32_t hash, size_t i) const {
+    const uint32_t step = ((hash >> 11) | (hash << 21)) | 1;
+    return (hash + i * step) & (length_ - 1);
+  }
+
+  bool Ref(ClockHandle* h, bool touch);
+  void Unref(ClockHandle* h);
+  void Evict(size_t charge);
+  ClockHandle* Claim(uint32_t hash);
+  void Reclaim(ClockHandle* h);
+  void FreeEntry(ClockHandle* h);
+
+  // Initialized before use.
+  size_t capacity_;
+  size_t length_;           // Number of slots; a power of two
+  size_t occupancy_limit_;  // Evict once this many slots are in use
+  ClockHandle* slots_;
+
+  port::AtomicPointer usage_;         // Sum of charges of live entries
+  port::AtomicPointer occupancy_;     // Number of slots not kEmpty
+  port::AtomicPointer clock_hand_;    // Next slot examined by Evict()
+};
+
+ClockCache::ClockCache()
+    : capacity_(0),
+      length_(0),
+      occupancy_limit_(0),
+      slots_(NULL),
+      usage_(NULL),
+      occupancy_(NULL),
+      clock_hand_(NULL) {
+}
+
+ClockCache::~ClockCache() {
+  for (size_t i = 0; i < length_; i++) {
+    ClockHandle* h = &slots_[i];
+    const ClockMeta meta = LoadMeta(h);
+    if ((meta & kStateMask) != kEmpty) {
+      // Error if caller has an unreleased handle
+      assert((meta & kStateMask) == kVisible && meta < kOneRef);
+      FreeEntry(h);
+    }
+  }
+  delete[] slots_;
+}
+
+void ClockCache::Init(size_t capacity, size_t estimated_entry_charge) {
+  capacity_ = capacity;
+  if (estimated_entry_charge == 0) {
+    estimated_entry_charge = 1;
+  }
+  // Keep the table at most 70% full so that probe sequences stay short.
+  const size_t entries = capacity / estimated_entry_charge;
+  length_ = 16;
+  while (length_ * 7 / 10 < entries) {
+    length_ *= 2;
+  }
+  occupancy_limit_ = length_ * 7 / 10;
+  slots_ = new ClockHandle[length_];
+  for (size_t i = 0; i < length_; i++) {
+    slots_[i].meta.NoBarrier_Store(reinterpret_cast<void*>(kEmpty));
+    slots_[i].displacements.NoBarrier_Store(NULL);
+    slots_[i].hash.NoBarrier_Store(NULL);
+    slots_[i].detached = false;
+  }
+}
+
+// Acquire a reference to "h" if it is visible.  If "touch" is set, the
+// entry is also marked as recently used.
+bool ClockCache::Ref(ClockHandle* h, bool touch) {
+  while (true) {
+    const ClockMeta meta = LoadMeta(h);
+    if ((meta & kStateMask) != kVisible) {
+      return false;
+    }
+    ClockMeta new_meta = meta + kOneRef;
+    if (touch) {
+      new_meta |= kMaxClock << kClockShift;
+    }
+    if (CasMeta(h, meta, new_meta)) {
+      return true;
+    }
+  }
+}
+
+void ClockCache::Unref(ClockHandle* h) {
+  while (true) {
+    const ClockMeta meta = LoadMeta(h);
+    assert(meta >= kOneRef);
+    if (meta < 2 * kOneRef && (meta & kStateMask) == kInvisible) {
+      // Last reference to an erased entry: take ownership and free it.
+      if (CasMeta(h, meta, kConstruction)) {
+        Reclaim(h);
+        return;
+      }
+    } else if (CasMeta(h, meta, meta - kOneRef)) {
+      return;
+    }
+  }
+}
+
+void ClockCache::FreeEntry(ClockHandle* h) {
+  (*h->deleter)(h->key(), h->value);
+  free(h->key_data);
+  FetchAdd(&usage_, -h->charge);
+}
+
+// REQUIRES: h is in kConstruction and owned by the calling thread.
+void ClockCache::Reclaim(ClockHandle* h) {
+  FreeEntry(h);
+  const size_t index = h - slots_;
+  for (size_t i = 0; ; i++) {
+    const size_t p = Probe(LoadHash(h), i);
+    if (p == index) {
+      break;
+    }
+    FetchAdd(&slots_[p].displacements, -1);
+  }
+  h->meta.Release_Store(reinterpret_cast<void*>(kEmpty));
+  FetchAdd(&occupancy_, -1);
+}
+
+// Sweep the clock hand until there is room for an entry of "charge", or
+// until every entry has been given the chance to age out.  Referenced
+// entries are never evicted, so the cache may stay over capacity.
+void ClockCache::Evict(size_t charge) {
+  const size_t max_steps = (kMaxClock + 1) * length_;
+  for (size_t step = 0; step < max_steps; step++) {
+    if (LoadCounter(&usage_) + charge <= capacity_ &&
+        LoadCounter(&occupancy_) < occupancy_limit_) {
+      return;
+    }
+    ClockHandle* h = &slots_[FetchAdd(&clock_hand_, 1) & (length_ - 1)];
+    const ClockMeta meta = LoadMeta(h);
+    if ((meta & kStateMask) != kVisible || meta >= kOneRef) {
+      continue;
+    }
+    if ((meta & kClockMask) != 0) {
+      // Losing this race only means the entry ages more slowly.
+      CasMeta(h, meta, meta - (1 << kClockShift));
+    } else if (CasMeta(h, meta, kConstruction)) {
+      Reclaim(h);
+    }
+  }
+}
+
+// Find an empty slot for "hash" and return it in kConstruction, or
+// return NULL if the table is full.
+ClockHandle* ClockCache::Claim(uint32_t hash) {
+  if (FetchAdd(&occupancy_, 1) >= length_) {
+    FetchAdd(&occupancy_, -1);
+    return NULL;
+  }
+  for (size_t i = 0; i < length_; i++) {
+    ClockHandle* h = &slots_[Probe(hash, i)];
+    if (LoadMeta(h) == kEmpty && CasMeta(h, kEmpty, kConstruction)) {
+      return h;
+    }
+    FetchAdd(&h->displacements, 1);
+  }
+  // Concurrent inserts took every slot we looked at.
+  for (size_t i = 0; i < length_; i++) {
+    FetchAdd(&slots_[Probe(hash, i)].displacements, -1);
+  }
+  FetchAdd(&occupancy_, -1);
+  return NULL;
+}
+
+Cache::Handle* ClockCache::Lookup(const Slice& key, uint32_t hash) {
+  for (size_t i = 0; i < length_; i++) {
+    ClockHandle* h = &slots_[Probe(hash, i)];
+    // The hash read before the reference only filters out slots that
+    // are unlikely to match; it is checked again once h is referenced.
+    if (LoadHash(h) == hash && Ref(h, true)) {
+      if (LoadHash(h) == hash && h->key() == key) {
+        return reinterpret_cast<Cache::Handle*>(h);
+      }
+      Unref(h);
+    }
+    if (h->displacements.Acquire_Load() == NULL) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+void ClockCache::Release(Cache::Handle* handle) {
+  ClockHandle* h = reinterpret_cast<ClockHandle*>(handle);
+  if (h->detached) {
+    FreeEntry(h);
+    delete h;
+  } else {
+    Unref(h);
+  }
+}
+
+Cache::Handle* ClockCache::Insert(
+    const Slice& key, uint32_t hash, void* value, size_t charge,
+    void (*deleter)(const Slice& key, void* value),
+    Cache::Priority priority) {
+  Erase(key, hash);
+  Evict(charge);
+
+  ClockHandle* h = Claim(hash);
+  const bool detached = (h == NULL);
+  if (detached) {
+    // No free slot: hand out an entry that lives only as long as the
+    // returned handle.
+    h = new ClockHandle;
+  }
+  h->value = value;
+  h->deleter = deleter;
+  h->key_data = reinterpret_cast<char*>(malloc(key.size()));
+  memcpy(h->key_data, key.data(), key.size());
+  h->key_length = key.size();
+  h->charge = charge;
+  h->hash.Release_Store(reinterpret_cast<void*>(static_cast<uintptr_t>(hash)));
+  h->detached = detached;
+  FetchAdd(&usage_, charge);
+  if (!detached) {
+    const ClockMeta clock =
+        (priority == Cache::kHigh) ? kMaxClock : kInitialClock;
+    h->meta.Release_Store(reinterpret_cast<void*>(
+        kVisible | (clock << kClockShift) | kOneRef));
+  }
+  return reinterpret_cast<Cache::Handle*>(h);
+}
+
+void ClockCache::Erase(const Slice& key, uint32_t hash) {
+  for (size_t i = 0; i < length_; i++) {
+    ClockHandle* h = &slots_[Probe(hash, i)];
+    if (LoadHash(h) == hash && Ref(h, false)) {
+      if (LoadHash(h) == hash && h->key() == key) {
+        while (true) {
+          const ClockMeta meta = LoadMeta(h);
+          if ((meta & kStateMask) != kVisible ||
+              CasMeta(h, meta, (meta & ~kStateMask) | kInvisible)) {
+            break;
+          }
+        }
+      }
+      Unref(h);  // Frees the entry if that was the last reference
+    }
+    if (h->displacements.Acquire_Load() == NULL) {
+      break;
+    }
+  }
+}
+
+// Use at least two shards per core to keep the shared counters of each
+// shard from being contended, but keep shards large enough that CLOCK
+// still has a useful number of entries to choose from.
+static const int kMaxClockShardBits = 6;
+static const size_t kMinClockShardCapacity = 512 << 10;
+
+class ShardedClockCache : public Cache {
+ private:
+  ClockCache* shard_;
+  int num_shard_bits_;
+  port::Mutex id_mutex_;
+  uint64_t last_id_;
+
+  static inline uint32_t HashSlice(const Slice& s) {
+    return Hash(s.data(), s.size(), 0);
+  }
+
+  uint32_t Shard(uint32_t hash) const {
+    return (num_shard_bits_ == 0) ? 0 : hash >> (32 - num_shard_bits_);
+  }
+
+ public:
+  ShardedClockCache(size_t capacity, size_t estimated_entry_charge)
+      : num_shard_bits_(0),
+        last_id_(0) {
+    const int cpus = port::NumberOfCPUs();
+    while (num_shard_bits_ < kMaxClockShardBits &&
+           (1 << num_shard_bits_) < 2 * cpus &&
+           (capacity >> (num_shard_bits_ + 1)) >= kMinClockShardCapacity) {
+      num_shard_bits_++;
+    }
+    const int num_shards = 1 << num_shard_bits_;
+    const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
+    shard_ = new ClockCache[num_shards];
+    for (int s = 0; s < num_shards; s++) {
+      shard_[s].Init(per_shard, estimated_entry_charge);
+    }
+  }
+  virtual ~ShardedClockCache() {
+    delete[] shard_;
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    return Insert(key, value, charge, deleter, kLow);
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority) {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter,
+                                      priority);
+  }
+  virtual Handle* Lookup(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Lookup(key, hash);
+  }
+  virtual void Release(Handle* handle) {
+    ClockHandle* h = reinterpret_cast<ClockHandle*>(handle);
+    shard_[Shard(LoadHash(h))].Release(handle);
+  }
+  virtual void Erase(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    shard_[Shard(hash)].Erase(key, hash);
+  }
+  virtual void* Value(Handle* handle) {
+    return reinterpret_cast<ClockHandle*>(handle)->value;
+  }
+  virtual uint64_t NewId() {
+    MutexLock l(&id_mutex_);
+    return ++(last_id_);
+  }
+  virtual size_t TotalCharge() const {
+    size_t total = 0;
+    for (int s = 0; s < (1 << num_shard_bits_); s++) {
+      total += shard_[s].TotalCharge();
+    }
+    return total;
+  }
 };
 
 }  // end anonymous namespace
@@ -322,4 +827,8 @@ Cache* NewLRUCache(size_t capacity) {
   return new ShardedLRUCache(capacity);
 }
 
+Cache* NewClockCache(size_t capacity, size_t estimated_entry_charge) {
+  return new ShardedClockCache(capacity, estimated_entry_charge);
+}
+
 }  // namespace leveldb
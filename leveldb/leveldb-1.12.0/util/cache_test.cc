@@ -5,7 +5,11 @@
 #include "leveldb/cache.h"
 
 #include <vector>
+#include "leveldb/env.h"
+#include "port/port.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
 #include "util/testharness.h"
 
 namespace leveldb {
@@ -37,7 +41,8 @@ class CacheTest {
   std::vector<int> deleted_values_;
   Cache* cache_;
 
-  CacheTest() : cache_(NewLRUCache(kCacheSize)) {
+  explicit CacheTest(Cache* cache = NewLRUCache(kCacheSize))
+      : cache_(cache) {
     current_ = this;
   }
 
@@ -173,12 +178,268 @@ TEST(CacheTest, HeavyEntries) {
   ASSERT_LE(cached_weight, kCacheSize + kCacheSize/10);
 }
 
+TEST(CacheTest, HighPriority) {
+  cache_->Release(cache_->Insert(EncodeKey(100), EncodeValue(101), 1,
+                                 &CacheTest::Deleter, Cache::kHigh));
+
+  // High priority entry outlives any number of low priority ones
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(1000+i, 2000+i);
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(1000));
+}
+
+TEST(CacheTest, HighPriorityPoolIsBounded) {
+  // Only half of the capacity is reserved for high priority entries;
+  // the oldest ones beyond that are evicted like low priority entries.
+  for (int i = 0; i < kCacheSize; i++) {
+    cache_->Release(cache_->Insert(EncodeKey(i), EncodeValue(1000+i), 1,
+                                   &CacheTest::Deleter, Cache::kHigh));
+  }
+  for (int i = 0; i < kCacheSize; i++) {
+    Insert(2000+i, 3000+i);
+  }
+  ASSERT_EQ(-1, Lookup(0));
+  ASSERT_EQ(1000 + kCacheSize - 1, Lookup(kCacheSize - 1));
+  ASSERT_EQ(3000 + kCacheSize - 1, Lookup(2000 + kCacheSize - 1));
+}
+
+TEST(CacheTest, TotalCharge) {
+  Insert(100, 101, 10);
+  Insert(200, 201, 20);
+  ASSERT_EQ(30, cache_->TotalCharge());
+
+  Cache::Handle* h = cache_->Lookup(EncodeKey(100));
+  Erase(100);
+  ASSERT_EQ(30, cache_->TotalCharge());  // Still referenced
+  cache_->Release(h);
+  ASSERT_EQ(20, cache_->TotalCharge());
+}
+
 TEST(CacheTest, NewId) {
   uint64_t a = cache_->NewId();
   uint64_t b = cache_->NewId();
   ASSERT_NE(a, b);
 }
 
+// Runs the same checks against the CLOCK cache.  kCacheSize is far
+// below the capacity at which it starts sharding, so eviction order is
+// decided by a single clock hand.
+class ClockCacheTest : public CacheTest {
+ public:
+  ClockCacheTest() : CacheTest(NewClockCache(kCacheSize, 1)) { }
+};
+
+TEST(ClockCacheTest, ClockHitAndMiss) {
+  ASSERT_EQ(-1, Lookup(100));
+
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1,  Lookup(200));
+
+  Insert(200, 201);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+}
+
+TEST(ClockCacheTest, ClockEntriesArePinned) {
+  Insert(100, 101);
+  Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(101, DecodeValue(cache_->Value(h1)));
+
+  Insert(100, 102);
+  Cache::Handle* h2 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(102, DecodeValue(cache_->Value(h2)));
+  ASSERT_EQ(0, deleted_keys_.size());
+
+  cache_->Release(h1);
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(1, deleted_keys_.size());
+
+  cache_->Release(h2);
+  ASSERT_EQ(2, deleted_keys_.size());
+  ASSERT_EQ(102, deleted_values_[1]);
+}
+
+TEST(ClockCacheTest, ClockEvictionPolicy) {
+  Insert(100, 101);
+  Insert(200, 201);
+
+  // Frequently used entry must be kept around
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(1000+i, 2000+i);
+    ASSERT_EQ(2000+i, Lookup(1000+i));
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+}
+
+TEST(ClockCacheTest, ClockPinnedEntriesAreNotEvicted) {
+  Cache::Handle* h = cache_->Insert(EncodeKey(100), EncodeValue(101), 1,
+                                    &CacheTest::Deleter);
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(1000+i, 2000+i);
+  }
+  ASSERT_EQ(101, DecodeValue(cache_->Value(h)));
+  ASSERT_EQ(101, Lookup(100));
+  cache_->Release(h);
+}
+
+TEST(ClockCacheTest, ClockHighPriority) {
+  cache_->Release(cache_->Insert(EncodeKey(100), EncodeValue(101), 1,
+                                 &CacheTest::Deleter, Cache::kHigh));
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(1000+i, 2000+i);
+  }
+  ASSERT_EQ(101, Lookup(100));
+}
+
+TEST(ClockCacheTest, ClockTotalCharge) {
+  Insert(100, 101, 10);
+  Insert(200, 201, 20);
+  ASSERT_EQ(30, cache_->TotalCharge());
+  Erase(100);
+  ASSERT_EQ(20, cache_->TotalCharge());
+}
+
+TEST(ClockCacheTest, ClockHeavyEntries) {
+  const int kLight = 1;
+  const int kHeavy = 10;
+  int added = 0;
+  int index = 0;
+  while (added < 2*kCacheSize) {
+    const int weight = (index & 1) ? kLight : kHeavy;
+    Insert(index, 1000+index, weight);
+    added += weight;
+    index++;
+  }
+
+  int cached_weight = 0;
+  for (int i = 0; i < index; i++) {
+    const int weight = (i & 1 ? kLight : kHeavy);
+    int r = Lookup(i);
+    if (r >= 0) {
+      cached_weight += weight;
+      ASSERT_EQ(1000+i, r);
+    }
+  }
+  ASSERT_LE(cached_weight, kCacheSize + kCacheSize/10);
+}
+
+TEST(ClockCacheTest, ClockTableFull) {
+  // The table is sized for a handful of entries, so most inserts have to
+  // evict to find a slot, and inserts made while every slot is pinned
+  // get a handle that is not kept in the cache.
+  delete cache_;
+  cache_ = NewClockCache(kCacheSize, kCacheSize / 4);
+  std::vector<Cache::Handle*> handles;
+  for (int i = 0; i < 100; i++) {
+    handles.push_back(cache_->Insert(EncodeKey(i), EncodeValue(1000+i), 1,
+                                     &CacheTest::Deleter));
+  }
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(1000+i, DecodeValue(cache_->Value(handles[i])));
+    cache_->Release(handles[i]);
+  }
+  ASSERT_LE(100 - 16, deleted_keys_.size());
+  Insert(200, 201);
+  ASSERT_EQ(201, Lookup(200));
+}
+
+namespace {
+struct ConcurrentState {
+  Cache* cache;
+  port::Mutex mu;
+  int inserted;
+  int deleted;
+  int done;
+  uint32_t seed;
+};
+
+static ConcurrentState* concurrent_state;
+
+static void ConcurrentDeleter(const Slice& key, void* v) {
+  ASSERT_EQ(DecodeKey(key), DecodeValue(v) / 1000);
+  MutexLock l(&concurrent_state->mu);
+  concurrent_state->deleted++;
+}
+
+static void ConcurrentWorker(void* arg) {
+  ConcurrentState* state = reinterpret_cast<ConcurrentState*>(arg);
+  uint32_t seed;
+  {
+    MutexLock l(&state->mu);
+    seed = ++state->seed;
+  }
+  Random rnd(seed);
+  int inserted = 0;
+  for (int i = 0; i < 20000; i++) {
+    const int k = rnd.Uniform(500);
+    const std::string key = EncodeKey(k);
+    Cache::Handle* h = NULL;
+    switch (rnd.Uniform(4)) {
+      case 0:
+        h = state->cache->Insert(key, EncodeValue(k * 1000 + rnd.Uniform(1000)),
+                                 1, &ConcurrentDeleter);
+        inserted++;
+        break;
+      case 1:
+        state->cache->Erase(key);
+        break;
+      default:
+        h = state->cache->Lookup(key);
+        break;
+    }
+    if (h != NULL) {
+      ASSERT_EQ(k, DecodeValue(state->cache->Value(h)) / 1000);
+      state->cache->Release(h);
+    }
+  }
+  MutexLock l(&state->mu);
+  state->inserted += inserted;
+  state->done++;
+}
+}  // namespace
+
+TEST(ClockCacheTest, ClockConcurrent) {
+  const int kThreads = 4;
+  ConcurrentState state;
+  state.cache = NewClockCache(200, 1);
+  state.inserted = 0;
+  state.deleted = 0;
+  state.done = 0;
+  state.seed = 301;
+  concurrent_state = &state;
+  for (int i = 0; i < kThreads; i++) {
+    Env::Default()->StartThread(&ConcurrentWorker, &state);
+  }
+  while (true) {
+    {
+      MutexLock l(&state.mu);
+      if (state.done == kThreads) {
+        break;
+      }
+    }
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  delete state.cache;
+  ASSERT_EQ(state.inserted, state.deleted);
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -9,6 +9,14 @@ namespace leveldb {
 Env::~Env() {
 }
 
+void Env::ScheduleWithPriority(void (*function)(void* arg), void* arg,
+                               Priority pri) {
+  Schedule(function, arg);
+}
+
+void Env::SetBackgroundThreads(int number, Priority pri) {
+}
+
 SequentialFile::~SequentialFile() {
 }
 
@@ -540,6 +540,11 @@ class PosixEnv : public Env {
 
   virtual void Schedule(void (*function)(void*), void* arg);
 
+  virtual void ScheduleWithPriority(void (*function)(void*), void* arg,
+                                    Priority pri);
+
+  virtual void SetBackgroundThreads(int number, Priority pri);
+
   virtual void StartThread(void (*function)(void* arg), void* arg);
 
   virtual Status GetTestDirectory(std::string* result) {
@@ -592,70 +597,103 @@ class PosixEnv : public Env {
     }
   }
 
-  // BGThread() is the body of the background thread
-  void BGThread();
+  // BGThread() is the body of the background threads
+  void BGThread(Priority pri);
+  struct BGThreadArg { PosixEnv* env; Priority pri; };
   static void* BGThreadWrapper(void* arg) {
-    reinterpret_cast<PosixEnv*>(arg)->BGThread();
+    BGThreadArg* bg = reinterpret_cast<BGThreadArg*>(arg);
+    bg->env->BGThread(bg->pri);
+    delete bg;
     return NULL;
   }
 
   size_t page_size_;
   pthread_mutex_t mu_;
-  pthread_cond_t bgsignal_;
-  pthread_t bgthread_;
-  bool started_bgthread_;
 
   // Entry per Schedule() call
   struct BGItem { void* arg; void (*function)(void*); };
   typedef std::deque<BGItem> BGQueue;
-  BGQueue queue_;
+
+  // One pool of threads per Priority.  Threads are started lazily, when
+  // work is queued and no started thread is idle.
+  struct BGPool {
+    pthread_cond_t signal;
+    BGQueue queue;
+    int max_threads;
+    int started_threads;
+    int idle_threads;
+  };
+  BGPool pools_[2];
 
   PosixLockTable locks_;
   MmapLimiter mmap_limit_;
 };
 
-PosixEnv::PosixEnv() : page_size_(getpagesize()),
-                       started_bgthread_(false) {
+PosixEnv::PosixEnv() : page_size_(getpagesize()) {
   PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
-  PthreadCall("cvar_init", pthread_cond_init(&bgsignal_, NULL));
+  for (int i = 0; i < 2; i++) {
+    PthreadCall("cvar_init", pthread_cond_init(&pools_[i].signal, NULL));
+    pools_[i].max_threads = 1;
+    pools_[i].started_threads = 0;
+    pools_[i].idle_threads = 0;
+  }
 }
 
 void PosixEnv::Schedule(void (*function)(void*), void* arg) {
-  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  ScheduleWithPriority(function, arg, LOW);
+}
 
-  // Start background thread if necessary
-  if (!started_bgthread_) {
-    started_bgthread_ = true;
+void PosixEnv::ScheduleWithPriority(void (*function)(void*), void* arg,
+                                    Priority pri) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  BGPool* pool = &pools_[pri];
+
+  // Start another background thread if every idle one already has
+  // queued work waiting for it
+  if (pool->started_threads < pool->max_threads &&
+      static_cast<int>(pool->queue.size()) >= pool->idle_threads) {
+    pool->started_threads++;
+    BGThreadArg* bg = new BGThreadArg;
+    bg->env = this;
+    bg->pri = pri;
+    pthread_t t;
     PthreadCall(
         "create thread",
-        pthread_create(&bgthread_, NULL,  &PosixEnv::BGThreadWrapper, this));
-  }
-
-  // If the queue is currently empty, the background thread may currently be
-  // waiting.
-  if (queue_.empty()) {
-    PthreadCall("signal", pthread_cond_signal(&bgsignal_));
+        pthread_create(&t, NULL,  &PosixEnv::BGThreadWrapper, bg));
+    PthreadCall("detach thread", pthread_detach(t));
   }
 
   // Add to priority queue
-  queue_.push_back(BGItem());
-  queue_.back().function = function;
-  queue_.back().arg = arg;
+  pool->queue.push_back(BGItem());
+  pool->queue.back().function = function;
+  pool->queue.back().arg = arg;
 
+  PthreadCall("signal", pthread_cond_signal(&pool->signal));
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+void PosixEnv::SetBackgroundThreads(int number, Priority pri) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  if (pools_[pri].max_threads < number) {
+    pools_[pri].max_threads = number;
+  }
   PthreadCall("unlock", pthread_mutex_unlock(&mu_));
 }
 
-void PosixEnv::BGThread() {
+void PosixEnv::BGThread(Priority pri) {
+  BGPool* pool = &pools_[pri];
   while (true) {
     // Wait until there is an item that is ready to run
     PthreadCall("lock", pthread_mutex_lock(&mu_));
-    while (queue_.empty()) {
-      PthreadCall("wait", pthread_cond_wait(&bgsignal_, &mu_));
+    pool->idle_threads++;
+    while (pool->queue.empty()) {
+      PthreadCall("wait", pthread_cond_wait(&pool->signal, &mu_));
     }
+    pool->idle_threads--;
 
-    void (*function)(void*) = queue_.front().function;
-    void* arg = queue_.front().arg;
-    queue_.pop_front();
+    void (*function)(void*) = pool->queue.front().function;
+    void* arg = pool->queue.front().arg;
+    pool->queue.pop_front();
 
     PthreadCall("unlock", pthread_mutex_unlock(&mu_));
     (*function)(arg);
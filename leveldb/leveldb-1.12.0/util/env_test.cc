@@ -97,6 +97,43 @@ TEST(EnvPosixTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+struct Gate {
+  port::Mutex mu;
+  port::CondVar cv;
+  int arrived;
+  int needed;
+  explicit Gate(int n) : cv(&mu), arrived(0), needed(n) { }
+};
+
+// Blocks until "needed" callers have arrived at the gate
+static void MeetAtGate(void* arg) {
+  Gate* g = reinterpret_cast<Gate*>(arg);
+  g->mu.Lock();
+  g->arrived++;
+  g->cv.SignalAll();
+  while (g->arrived < g->needed) {
+    g->cv.Wait();
+  }
+  g->mu.Unlock();
+}
+
+TEST(EnvPosixTest, ScheduleWithPriority) {
+  // The LOW pool's only thread waits for work queued on the HIGH pool
+  Gate gate(3);
+  env_->Schedule(&MeetAtGate, &gate);
+  env_->ScheduleWithPriority(&MeetAtGate, &gate, Env::HIGH);
+  MeetAtGate(&gate);
+}
+
+TEST(EnvPosixTest, SetBackgroundThreads) {
+  // Two LOW work items can only meet if they run at the same time
+  env_->SetBackgroundThreads(2, Env::LOW);
+  Gate gate(3);
+  env_->Schedule(&MeetAtGate, &gate);
+  env_->Schedule(&MeetAtGate, &gate);
+  MeetAtGate(&gate);
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
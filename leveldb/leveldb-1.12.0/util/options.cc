@@ -19,10 +19,19 @@ Options::Options()
       write_buffer_size(4<<20),
       max_open_files(1000),
       block_cache(NULL),
+      compressed_block_cache(NULL),
+      cache_index_and_filter_blocks(false),
+      pin_l0_index_and_filter_blocks(false),
       block_size(4096),
       block_restart_interval(16),
       compression(kSnappyCompression),
-      filter_policy(NULL) {
+      filter_policy(NULL),
+      prefix_extractor(NULL),
+      full_file_filter(false),
+      max_background_compactions(1),
+      max_subcompactions(1),
+      allow_concurrent_memtable_write(false),
+      enable_pipelined_write(false) {
 }
 
 
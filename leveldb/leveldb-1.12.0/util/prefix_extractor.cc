@@ -0,0 +1,47 @@
+// Copyright (c) 2012 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/prefix_extractor.h"
+
+#include <stdio.h>
+#include <string>
+
+namespace leveldb {
+
+PrefixExtractor::~PrefixExtractor() { }
+
+namespace {
+class FixedPrefixExtractor : public PrefixExtractor {
+ private:
+  size_t prefix_len_;
+  std::string name_;
+
+ public:
+  explicit FixedPrefixExtractor(size_t prefix_len)
+      : prefix_len_(prefix_len) {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "leveldb.FixedPrefix.%llu",
+             static_cast<unsigned long long>(prefix_len));
+    name_ = buf;
+  }
+
+  virtual const char* Name() const {
+    return name_.c_str();
+  }
+
+  virtual bool InDomain(const Slice& key) const {
+    return key.size() >= prefix_len_;
+  }
+
+  virtual Slice Transform(const Slice& key) const {
+    return Slice(key.data(), prefix_len_);
+  }
+};
+}  // namespace
+
+const PrefixExtractor* NewFixedPrefixExtractor(size_t prefix_len) {
+  return new FixedPrefixExtractor(prefix_len);
+}
+
+}  // namespace leveldb